@@ -0,0 +1,361 @@
+// Performance benchmark over the committed corpus in bench/corpus.
+//
+//   tinta_bench [--corpus DIR] [--iterations N] [--out FILE]
+//
+// Every corpus file goes through the stages the viewer runs when it opens
+// a document: Markdown parsing, Mermaid parsing and graph layout, code
+// tokenizing, the full document layout, drawing it page by page into an
+// offscreen WIC render target, and search. Each stage is timed over N
+// iterations after one warm-up, and the p50/p99 per stage are written as
+// JSON (stdout, or --out) for comparing two builds.
+
+#include "app.h"
+#include "d2d_init.h"
+#include "document.h"
+#include "mermaid.h"
+#include "perf_trace.h"
+#include "render.h"
+#include "search.h"
+#include "syntax.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifndef TINTA_BENCH_CORPUS
+#define TINTA_BENCH_CORPUS "bench/corpus"
+#endif
+
+namespace {
+
+constexpr UINT kTargetWidth = 1024;
+constexpr UINT kTargetHeight = 768;
+
+struct Stage {
+    std::string name;
+    std::vector<int64_t> samples;  // microseconds
+};
+
+struct CorpusResult {
+    std::string file;
+    size_t bytes = 0;
+    size_t blocks = 0;
+    std::vector<Stage> stages;
+};
+
+struct CodeSample {
+    std::wstring code;
+    int language = 0;
+};
+
+// What the stages below work on, gathered once from the parsed tree
+struct CorpusParts {
+    std::vector<std::string> diagrams;
+    std::vector<CodeSample> code;
+};
+
+void collectParts(const Element* elem, CorpusParts& parts) {
+    if (elem->type == ElementType::MermaidDiagram) {
+        parts.diagrams.push_back(narrowText(elem->wtext));
+        return;
+    }
+    if (elem->type == ElementType::CodeBlock) {
+        std::wstring code;
+        for (const Element* child : elem->children) {
+            if (child->type == ElementType::Text) code += child->wtext;
+        }
+        std::string language(elem->language);
+        std::transform(language.begin(), language.end(), language.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (language == "mermaid") {
+            parts.diagrams.push_back(narrowText(code));
+        } else {
+            parts.code.push_back({std::move(code), detectLanguage(toWide(language))});
+        }
+        return;
+    }
+    for (const Element* child : elem->children) collectParts(child, parts);
+}
+
+void measure(Stage& stage, int iterations, const std::function<void()>& run) {
+    run();  // warm-up: caches, page faults, first-use font loading
+    for (int i = 0; i < iterations; i++) {
+        auto t0 = Clock::now();
+        run();
+        stage.samples.push_back(usElapsed(t0));
+    }
+}
+
+std::string jsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
+void writeJson(FILE* out, const std::vector<CorpusResult>& results, int iterations) {
+    fprintf(out, "{\n  \"version\": \"%d.%d.%d\",\n  \"iterations\": %d,\n  \"corpus\": [\n",
+            TINTA_VERSION_MAJOR, TINTA_VERSION_MINOR, TINTA_VERSION_PATCH, iterations);
+    for (size_t r = 0; r < results.size(); r++) {
+        const auto& result = results[r];
+        fprintf(out, "    {\n      \"file\": \"%s\",\n      \"bytes\": %zu,\n      \"blocks\": %zu,\n"
+                     "      \"stages\": {\n",
+                jsonEscape(result.file).c_str(), result.bytes, result.blocks);
+        for (size_t s = 0; s < result.stages.size(); s++) {
+            std::vector<int64_t> sorted = result.stages[s].samples;
+            std::sort(sorted.begin(), sorted.end());
+            fprintf(out, "        \"%s\": {\"p50_us\": %lld, \"p99_us\": %lld, \"min_us\": %lld, "
+                         "\"max_us\": %lld}%s\n",
+                    result.stages[s].name.c_str(),
+                    (long long)percentile(sorted.data(), sorted.size(), 0.50),
+                    (long long)percentile(sorted.data(), sorted.size(), 0.99),
+                    (long long)(sorted.empty() ? 0 : sorted.front()),
+                    (long long)(sorted.empty() ? 0 : sorted.back()),
+                    s + 1 < result.stages.size() ? "," : "");
+        }
+        fprintf(out, "      }\n    }%s\n", r + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+// An App with the viewer's factories and text formats, drawing into a WIC
+// bitmap instead of a window
+struct OffscreenApp {
+    App app;
+    IWICBitmap* bitmap = nullptr;
+    ID2D1RenderTarget* target = nullptr;
+    ID2D1DeviceContext* dc = nullptr;
+
+    bool init() {
+        if (!initD2D(app) || !app.wicFactory) return false;
+        app.width = (int)kTargetWidth;
+        app.height = (int)kTargetHeight;
+        updateTextFormats(app);
+        createTypography(app);
+
+        if (FAILED(app.wicFactory->CreateBitmap(kTargetWidth, kTargetHeight,
+                GUID_WICPixelFormat32bppPBGRA, WICBitmapCacheOnLoad, &bitmap))) {
+            return false;
+        }
+        D2D1_RENDER_TARGET_PROPERTIES props = D2D1::RenderTargetProperties(
+            D2D1_RENDER_TARGET_TYPE_DEFAULT,
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+            96.0f, 96.0f);
+        if (FAILED(app.d2dFactory->CreateWicBitmapRenderTarget(bitmap, props, &target))) {
+            return false;
+        }
+        target->QueryInterface(__uuidof(ID2D1DeviceContext), reinterpret_cast<void**>(&dc));
+        target->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+        return SUCCEEDED(target->CreateSolidColorBrush(D2D1::ColorF(1, 1, 1), &app.brush));
+    }
+
+    ~OffscreenApp() {
+        app.shutdown();  // the brush goes before the target it came from
+        if (dc) dc->Release();
+        if (target) target->Release();
+        if (bitmap) bitmap->Release();
+    }
+};
+
+bool readFile(const std::filesystem::path& path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+CorpusResult benchFile(OffscreenApp& offscreen, const std::filesystem::path& path,
+                       const std::string& text, int iterations) {
+    App& app = offscreen.app;
+    CorpusResult result;
+    result.file = path.filename().string();
+    result.bytes = text.size();
+    std::string name = path.string();
+
+    qmd::MarkdownParser parser;
+    Stage parse{"markdown_parse", {}};
+    measure(parse, iterations, [&] { parseDocument(parser, text, name); });
+    result.stages.push_back(std::move(parse));
+
+    auto parsed = parseDocument(parser, text, name);
+    if (!parsed.success || !parsed.root) return result;
+    result.blocks = parsed.root->children.size();
+    CorpusParts parts;
+    collectParts(parsed.root.get(), parts);
+
+    if (!parts.diagrams.empty()) {
+        Stage mermaidParse{"mermaid_parse", {}};
+        measure(mermaidParse, iterations, [&] {
+            for (const auto& source : parts.diagrams) mermaid::parse(source);
+        });
+        result.stages.push_back(std::move(mermaidParse));
+
+        // Node sizes as a label-length estimate: this stage times the graph
+        // layout alone, text measuring is part of document_layout
+        std::vector<mermaid::Diagram> diagrams;
+        std::vector<std::vector<mermaid::Size>> sizes;
+        for (const auto& source : parts.diagrams) {
+            auto diagram = mermaid::parse(source);
+            if (!diagram.success) continue;
+            std::vector<mermaid::Size> nodeSizes;
+            for (const auto& node : diagram.diagram.nodes) {
+                nodeSizes.push_back({24.0f + 8.0f * (float)node.label.size(), 42.0f});
+            }
+            diagrams.push_back(std::move(diagram.diagram));
+            sizes.push_back(std::move(nodeSizes));
+        }
+        Stage mermaidLayout{"mermaid_layout", {}};
+        measure(mermaidLayout, iterations, [&] {
+            for (size_t i = 0; i < diagrams.size(); i++) {
+                mermaid::layout(diagrams[i], sizes[i], 32.0f, 78.0f);
+            }
+        });
+        result.stages.push_back(std::move(mermaidLayout));
+    }
+
+    if (!parts.code.empty()) {
+        Stage tokenize{"tokenize_lines", {}};
+        measure(tokenize, iterations, [&] {
+            for (const auto& sample : parts.code) {
+                bool inBlockComment = false;
+                std::wstring_view code = sample.code;
+                size_t start = 0;
+                while (start <= code.size()) {
+                    size_t end = code.find(L'\n', start);
+                    if (end == std::wstring_view::npos) end = code.size();
+                    tokenizeLine(code.substr(start, end - start), sample.language, inBlockComment);
+                    start = end + 1;
+                }
+            }
+        });
+        result.stages.push_back(std::move(tokenize));
+    }
+
+    app.root = std::move(parsed.root);
+
+    // Cold: nothing cached from an earlier layout, as on first open
+    Stage layoutCold{"document_layout", {}};
+    measure(layoutCold, iterations, [&] {
+        app.clearLayoutCache();
+        app.mermaidLayoutCache.clear();
+        app.codeTokenCache.clear();
+        app.layoutDirty = true;
+        layoutDocument(app);
+    });
+    result.stages.push_back(std::move(layoutCold));
+
+    // Warm: diagram layouts and code tokens cached, as on a resize
+    Stage layoutWarm{"document_relayout", {}};
+    measure(layoutWarm, iterations, [&] {
+        app.clearLayoutCache();
+        app.layoutDirty = true;
+        layoutDocument(app);
+    });
+    result.stages.push_back(std::move(layoutWarm));
+
+    // Every viewport of the document, drawn as a frame would draw it
+    Stage draw{"draw_pages", {}};
+    measure(draw, iterations, [&] {
+        float page = (float)kTargetHeight;
+        for (float y = 0.0f; y < app.contentHeight; y += page) {
+            offscreen.target->BeginDraw();
+            offscreen.target->Clear(app.theme.background);
+            drawDocumentLayer(app, offscreen.target, offscreen.dc, 0.0f, y,
+                              D2D1::RectF(0.0f, y, (float)kTargetWidth, y + page));
+            offscreen.target->EndDraw();
+        }
+    });
+    result.stages.push_back(std::move(draw));
+
+    app.showSearch = true;
+    app.searchRegex = false;
+    app.searchWholeWord = false;
+    app.searchQuery = L"cache";
+    Stage search{"search_plain", {}};
+    measure(search, iterations, [&] { performSearch(app); });
+    result.stages.push_back(std::move(search));
+
+    app.searchRegex = true;
+    app.searchQuery = L"\\b[a-z]+e(d|s)\\b";
+    Stage searchRegex{"search_regex", {}};
+    measure(searchRegex, iterations, [&] { performSearch(app); });
+    result.stages.push_back(std::move(searchRegex));
+
+    app.searchRegex = false;
+    app.searchQuery.clear();
+    performSearch(app);
+    app.clearLayoutCache();
+    app.root.reset();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::filesystem::path corpus = TINTA_BENCH_CORPUS;
+    int iterations = 20;
+    const char* outPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--corpus" && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            fprintf(stderr, "usage: tinta_bench [--corpus DIR] [--iterations N] [--out FILE]\n");
+            return 2;
+        }
+    }
+
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(corpus, ec)) {
+        if (entry.is_regular_file() && isSupportedDocumentPath(entry.path().wstring())) {
+            files.push_back(entry.path());
+        }
+    }
+    if (files.empty()) {
+        fprintf(stderr, "tinta_bench: no documents in %s\n", corpus.string().c_str());
+        return 1;
+    }
+    std::sort(files.begin(), files.end());
+
+    OffscreenApp offscreen;
+    if (!offscreen.init()) {
+        fprintf(stderr, "tinta_bench: could not create the offscreen render target\n");
+        return 1;
+    }
+
+    std::vector<CorpusResult> results;
+    for (const auto& path : files) {
+        std::string text;
+        if (!readFile(path, text)) {
+            fprintf(stderr, "tinta_bench: cannot read %s\n", path.string().c_str());
+            return 1;
+        }
+        fprintf(stderr, "%s...\n", path.filename().string().c_str());
+        results.push_back(benchFile(offscreen, path, text, iterations));
+    }
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "tinta_bench: cannot write %s\n", outPath);
+        return 1;
+    }
+    writeJson(out, results, iterations);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -12,12 +12,19 @@
 #include <dwrite_2.h>
 #include <wincodec.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <chrono>
 
 #include "markdown.h"
+#include "text_buffer.h"
+#include "text_search.h"
+#include "undo_log.h"
 
 using namespace qmd;
 
@@ -27,7 +34,7 @@ inline int64_t usElapsed(Clock::time_point start) {
     return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
 }
 
-// Timer IDs (TIMER_FILE_WATCH=1 lives in file_utils.h, TIMER_EDITOR_REPARSE=2 in editor.cpp)
+// Timer IDs (TIMER_EDITOR_REPARSE=2 lives in editor.cpp; 1 was the old file-watch poll)
 #define TIMER_CURSOR_BLINK 3
 #define TIMER_NOTIFICATION 4
 #define TIMER_ZOOM_APPLY 5
@@ -35,18 +42,56 @@ inline int64_t usElapsed(Clock::time_point start) {
 // Posted to continue an incomplete document layout in time-budgeted chunks
 #define WM_APP_LAYOUT_CHUNK (WM_APP + 1)
 
+// Posted by the parse worker when a background parse finished (parse_worker.cpp)
+#define WM_APP_PARSE_DONE (WM_APP + 2)
+
+// Posted by image loader workers when a size or decoded image is ready (image_loader.cpp)
+#define WM_APP_IMAGE_READY (WM_APP + 3)
+
+// Posted by the file watcher when the open file's contents changed (file_watcher.cpp)
+#define WM_APP_FILE_CHANGED (WM_APP + 4)
+
+// Posted by the folder indexer when a listing or indexing progress is ready (folder_index.cpp)
+#define WM_APP_FOLDER_INDEX (WM_APP + 5)
+
 // Startup metrics
 struct StartupMetrics {
     int64_t windowInitUs = 0;
     int64_t d2dInitUs = 0;
     int64_t dwriteInitUs = 0;
     int64_t renderTargetUs = 0;
-    int64_t fileLoadUs = 0;
+    int64_t fileLoadUs = 0;      // open + wait for the parse worker
+    int64_t fileOpenUs = 0;      // open and read or map the file, queue the parse
+    int64_t fileParseUs = 0;     // md4c on the worker (overlaps D2D init)
+    int64_t fileLayoutUs = 0;    // first viewport layout, inside showWindowUs
     int64_t showWindowUs = 0;
     int64_t consoleInitUs = 0;
     int64_t totalStartupUs = 0;
 };
 
+// Where the time between two frames went (see perf_trace.h). Layout
+// includes the tokenizing and Mermaid layout it triggered.
+enum class FramePhase {
+    Layout,
+    Tokenize,
+    Mermaid,
+    Images,
+    DrawDocument,
+    DrawHighlights,
+    DrawOverlays,
+    Present,
+    Count
+};
+
+struct FrameStats {
+    static constexpr size_t kPhases = (size_t)FramePhase::Count;
+    static constexpr size_t kHistory = 120;  // frames in the overlay histogram
+    int64_t phaseUs[kPhases] = {};           // accumulating toward the next frame
+    int64_t lastPhaseUs[kPhases] = {};       // the last frame's breakdown
+    int64_t frameUs[kHistory] = {};          // ring of recent render() times
+    size_t frames = 0;                       // frames recorded so far
+};
+
 // Syntax highlighting token types
 enum class SyntaxTokenType { Plain, Keyword, String, Comment, Number, Function, TypeName, Operator, ControlFlow };
 
@@ -107,6 +152,16 @@ struct Settings {
     bool hasAskedFileAssociation = false;
     bool editorShowPreview = true;
     bool editorWordWrap = false;
+    int imageCacheMB = 256;      // GPU memory budget for decoded images
+    bool documentTiles = true;   // Scroll by blitting rasterized layout tiles
+    bool documentCache = true;   // Reopen unchanged files from the on-disk cache
+};
+
+// Size and last-write time of an opened file (see document_cache.h)
+struct DocumentStamp {
+    uint64_t size = 0;
+    uint64_t writeTime = 0;  // FILETIME of the last write
+    bool valid() const { return writeTime != 0; }
 };
 
 // Application state
@@ -123,17 +178,39 @@ struct App {
     ID2D1SolidColorBrush* brush = nullptr;
     ID2D1DeviceContext* deviceContext = nullptr;  // For color emoji rendering
 
+    // Brushes set as DirectWrite drawing effects on highlighted code lines,
+    // one per syntax color. Tied to the render target like bitmaps, so the
+    // layouts that hold them are dropped when it is recreated.
+    struct CodeBrush {
+        D2D1_COLOR_F color{};
+        ID2D1SolidColorBrush* brush = nullptr;
+    };
+    std::vector<CodeBrush> codeBrushes;
+
     // WIC (Windows Imaging Component) for image loading
     IWICImagingFactory* wicFactory = nullptr;
 
     // Image cache
     struct ImageEntry {
         ID2D1Bitmap* bitmap = nullptr;
-        int width = 0;
+        int width = 0;          // natural size of the image
         int height = 0;
+        int pixelWidth = 0;     // size of `bitmap`: at most the largest box it is drawn in
+        int pixelHeight = 0;
+        size_t bytes = 0;       // of `bitmap`, counted in imageCacheBytes
+        uint64_t lastUse = 0;   // imageUseClock when layout last placed it
         bool failed = false;
+        bool pending = false;   // queued on the image loader; size may be known already
+        uint32_t loadId = 0;    // matches loader results to the latest request
+        bool isUrl = false;
+        std::wstring path;      // resolved file path or URL
     };
     std::unordered_map<std::string, ImageEntry> imageCache;
+    size_t imageCacheBudget = size_t(256) << 20;  // Settings::imageCacheMB
+    size_t imageCacheBytes = 0;
+    uint64_t imageUseClock = 0;
+    struct ImageLoaderState;  // worker pool and result queue (image_loader.cpp)
+    std::shared_ptr<ImageLoaderState> imageLoader;
 
     // Layout bitmaps (document coordinates)
     struct LayoutBitmap {
@@ -180,8 +257,28 @@ struct App {
     MarkdownParser parser;
     ElementPtr root;
     std::string currentFile;
+    DocumentStamp currentFileStamp;  // invalid unless read from disk unmodified
+    bool documentCacheEnabled = true;  // Settings::documentCache
     bool focusMermaidOnNextLayout = false;
+
+    // Parsed + measured + laid out Mermaid diagrams by source/scale/theme,
+    // LRU-bounded (see mermaidLayoutFor in render.cpp)
+    struct MermaidLayoutEntry;
+    std::unordered_map<uint64_t, std::shared_ptr<MermaidLayoutEntry>> mermaidLayoutCache;
+    uint64_t mermaidLayoutUse = 0;
+
+    // Syntax tokens of fenced code blocks by source and language, kept
+    // across relayouts and LRU-bounded (see codeTokensFor in render.cpp)
+    struct CodeTokenEntry;
+    std::unordered_map<uint64_t, std::shared_ptr<CodeTokenEntry>> codeTokenCache;
+    uint64_t codeTokenUse = 0;
     size_t parseTimeUs = 0;
+
+    // Background parsing (see parse_worker.cpp). Every request bumps
+    // parseGeneration; a finished tree from an older generation is dropped.
+    struct ParseWorkerState;
+    std::shared_ptr<ParseWorkerState> parseWorker;
+    uint64_t parseGeneration = 0;
     float contentHeight = 0;
     float contentWidth = 0;
 
@@ -209,12 +306,25 @@ struct App {
     float folderBrowserAnimation = 0.0f;  // 0 to 1 for slide-in from left
     std::wstring folderBrowserPath;       // Current directory being browsed
     struct FolderItem {
-        std::wstring name;
+        std::wstring name;     // search hits: path relative to folderBrowserPath
         bool isDirectory;
+        std::wstring heading;  // search hit on a heading inside the file
+        std::string headingId; // its anchor, as the TOC numbers it
     };
     std::vector<FolderItem> folderItems;
     int hoveredFolderIndex = -1;
     float folderBrowserScroll = 0.0f;     // Scroll offset for folder list
+    bool folderBrowserJustOpened = false; // Skip WM_CHAR after opening with B key
+    bool folderListingPending = false;    // folderBrowserPath not listed yet
+    std::wstring folderSearchQuery;       // typed into the open browser
+    bool folderIndexing = false;          // the tree is still being crawled or read
+    // Listing cache and content index of the browsed tree (folder_index.cpp)
+    struct FolderIndexState;
+    std::shared_ptr<FolderIndexState> folderIndex;
+    // Heading slug to scroll to once the document opened from a search hit
+    // (pendingHeadingFile, as currentFile) is in and laid out
+    std::string pendingHeadingId;
+    std::string pendingHeadingFile;
 
     // Help overlay
     bool showHelp = false;
@@ -275,20 +385,26 @@ struct App {
     int hoveredCodeBlock = -1;
 
     // Text bounds - tracked for cursor changes and selection (document coordinates)
+    // Offsets into docText are 32-bit, here and in LayoutTextRun: there is
+    // one of these per word, and no document reaches 4G characters
     struct TextRect {
         D2D1_RECT_F rect;
-        size_t docStart = 0;   // Start position in docText
-        size_t docLength = 0;  // Length in docText
+        uint32_t docStart = 0;   // Start position in docText
+        uint32_t docLength = 0;  // Length in docText
+        uint32_t textRun = UINT32_MAX;  // layoutTextRuns entry drawing this text
     };
     std::vector<TextRect> textRects;
 
-    // Line buckets for fast hit-testing/selection
+    // Line buckets for fast hit-testing/selection. Text rects are recorded
+    // line by line, so a line's rects are the consecutive range
+    // [firstTextRect, firstTextRect + textRectCount).
     struct LineBucket {
         float top = 0;
         float bottom = 0;
         float minX = 0;
         float maxX = 0;
-        std::vector<size_t> textRectIndices;
+        uint32_t firstTextRect = 0;
+        uint32_t textRectCount = 0;
     };
     std::vector<LineBucket> lineBuckets;
 
@@ -297,9 +413,22 @@ struct App {
         size_t textRectIndex;       // Index into textRects
         size_t startPos;            // Character offset in text
         size_t length;              // Match length
-        D2D1_RECT_F highlightRect;  // Computed highlight bounds
+        D2D1_RECT_F highlightRect;  // Estimated bounds (scrolling target)
+        // Glyph-accurate fragments in searchHighlightRects, hit-tested the
+        // first time the match is drawn
+        bool exact = false;
+        uint32_t exactFirst = 0;
+        uint32_t exactCount = 0;
     };
     std::vector<SearchMatch> searchMatches;
+    std::vector<D2D1_RECT_F> searchHighlightRects;
+    // Incremental search (see search.cpp): every occurrence, overlapping or
+    // not, of the folded query in the text scanned so far, and where the
+    // scan resumes once layout appends more docText
+    std::wstring searchQueryLower;
+    std::vector<size_t> searchCandidates;
+    size_t searchScanPos = 0;
+    bool searchScrollPending = false;  // scroll to the first match once one streams in
     bool overText = false;
 
     // Text selection
@@ -319,7 +448,7 @@ struct App {
 
     // Document text built during render (used for search/mapping)
     std::wstring docText;
-    std::wstring docTextLower;
+    std::wstring docTextLower;  // towlower of a prefix of docText, extended by search
 
     // Cached space widths for common formats
     float spaceWidthText = 0.0f;
@@ -332,11 +461,14 @@ struct App {
         IDWriteTextLayout* layout = nullptr;
         D2D1_POINT_2F pos{};
         D2D1_RECT_F bounds{};
-        D2D1_COLOR_F color{};
-        size_t docStart = 0;
-        size_t docLength = 0;
+        uint32_t docStart = 0;
+        uint32_t docLength = 0;
+        uint32_t color = 0;       // index into runColors
         bool selectable = false;
     };
+    // The few distinct text colors a document uses, shared by all runs
+    std::vector<D2D1_COLOR_F> runColors;
+    std::unordered_map<uint64_t, uint32_t> runColorIndex;  // by color bits
     struct LayoutRect {
         D2D1_RECT_F rect{};
         D2D1_COLOR_F color{};
@@ -377,8 +509,91 @@ struct App {
     std::vector<LayoutLine> layoutLines;
     std::vector<LayoutShape> layoutShapes;
     std::vector<LayoutConnector> layoutConnectors;
+    // Mermaid diagrams placed in the document. The shapes, connectors and
+    // their Direct2D geometries live in diagram space in the shared
+    // MermaidGeometry (built once per cached diagram layout, see
+    // render.cpp), so a frame draws a diagram with a few geometry draws
+    // under a translation instead of one call per segment and shape.
+    struct MermaidGeometry;
+    struct LayoutDiagram {
+        D2D1_RECT_F bounds{};        // document space
+        D2D1_POINT_2F origin{};      // where diagram space (0, 0) is placed
+        std::shared_ptr<MermaidGeometry> geometry;
+    };
+    std::vector<LayoutDiagram> layoutDiagrams;
     bool layoutDirty = true;
 
+    // Spatial index over one layout vector. The document is cut into
+    // fixed-height tiles; each tile keeps the [first, end) index range of the
+    // items overlapping it. Items are emitted in reading order, so the union
+    // of the visible tiles' ranges is a tight contiguous slice and the frame
+    // loop keeps drawing in emission order without visiting the rest.
+    struct LayoutTileIndex {
+        static constexpr float kTileHeight = 256.0f;
+        struct Range {
+            uint32_t first = UINT32_MAX;
+            uint32_t end = 0;
+        };
+        std::vector<Range> tiles;
+
+        void clear() { tiles.clear(); }
+
+        void add(size_t index, float top, float bottom) {
+            if (bottom < top) std::swap(top, bottom);
+            size_t t0 = top > 0.0f ? (size_t)(top / kTileHeight) : 0;
+            size_t t1 = bottom > 0.0f ? (size_t)(bottom / kTileHeight) : 0;
+            if (t1 >= tiles.size()) tiles.resize(t1 + 1);
+            for (size_t t = t0; t <= t1; t++) {
+                tiles[t].first = std::min(tiles[t].first, (uint32_t)index);
+                tiles[t].end = std::max(tiles[t].end, (uint32_t)index + 1);
+            }
+        }
+
+        // Index range of the items that may overlap [top, bottom]
+        std::pair<size_t, size_t> query(float top, float bottom) const {
+            if (tiles.empty() || bottom < 0.0f) return {0, 0};
+            size_t t0 = top > 0.0f ? (size_t)(top / kTileHeight) : 0;
+            size_t t1 = std::min((size_t)(bottom / kTileHeight), tiles.size() - 1);
+            uint32_t first = UINT32_MAX, end = 0;
+            for (size_t t = t0; t <= t1; t++) {
+                first = std::min(first, tiles[t].first);
+                end = std::max(end, tiles[t].end);
+            }
+            if (first >= end) return {0, 0};
+            return {first, end};
+        }
+    };
+    LayoutTileIndex textRunTiles;
+    LayoutTileIndex rectTiles;
+    LayoutTileIndex lineTiles;
+    LayoutTileIndex shapeTiles;
+    LayoutTileIndex connectorTiles;
+    LayoutTileIndex diagramTiles;
+    LayoutTileIndex bitmapTiles;
+    LayoutTileIndex textRectTiles;
+
+    // Rasterized document tiles: the static layout (everything but the
+    // selection, search highlights and hover chrome, which draw on top) in
+    // fixed-size bitmaps that a scrolling frame only blits. Tiles are made
+    // of fully laid out regions only and dropped when the blocks under them
+    // change (see drawDocumentTiles in main_d2d.cpp).
+    struct DocumentTile {
+        static constexpr float kWidth = 1024.0f;
+        static constexpr float kHeight = 512.0f;
+        size_t row = 0;
+        size_t column = 0;
+        ID2D1Bitmap* bitmap = nullptr;
+        uint64_t lastUse = 0;
+    };
+    std::vector<DocumentTile> documentTiles;
+    uint64_t documentTileFrame = 0;
+    bool documentTilesEnabled = true;  // Settings::documentTiles
+
+    // Diamond and hexagon path geometries at the origin by type and size.
+    // Factory resources, so they outlive the render target.
+    std::unordered_map<uint64_t, ID2D1PathGeometry*> shapeGeometries;
+    ID2D1StrokeStyle* dashedStrokeStyle = nullptr;  // dashed connectors, created on first use
+
     // Incremental layout: the first paint lays out ~2 viewports, the rest
     // continues in WM_APP_LAYOUT_CHUNK time slices (see render.cpp)
     bool layoutComplete = true;
@@ -396,6 +611,113 @@ struct App {
     std::vector<ScrollAnchor> scrollAnchors;
     std::vector<size_t> editorLineByteOffsets;  // UTF-8 byte offset per editor line
 
+    // Per top-level block record of where its items start in each layout
+    // vector. A reparse that only touches a few blocks (an edit, a file-watch
+    // reload) reuses the unchanged blocks instead of relaying out the whole
+    // document (see layoutBegin in render.cpp).
+    struct LayoutBlock {
+        uint64_t hash = 0;                // content hash of the block subtree
+        size_t sourceOffset = SIZE_MAX;
+        float top = 0.0f;
+        float bottom = 0.0f;
+        float contentRight = 0.0f;        // widest extent the block produced
+        size_t textRuns = 0, rects = 0, lines = 0, shapes = 0, connectors = 0;
+        size_t diagrams = 0, bitmaps = 0, links = 0, codeBlocks = 0, textRects = 0;
+        size_t lineBuckets = 0, headings = 0, anchors = 0, docText = 0;
+        bool provisional = false;         // holds a placeholder; never reused as is
+    };
+    std::vector<LayoutBlock> layoutBlocks;
+    bool layoutBlockProvisional = false;  // set while laying out a block that has one
+    uint64_t layoutBlocksKey = 0;  // viewport width/zoom/theme the records were built for
+    float layoutBlocksScale = 0.0f;  // contentScale * zoomFactor they were built at
+    // Block heights and scroll position of a document reopened from the
+    // on-disk cache, for the first layout to estimate from (dropped once it
+    // finishes). Heights are at `scale`, by block content hash.
+    struct LayoutSeed {
+        std::vector<std::pair<uint64_t, float>> blockHeights;
+        float scale = 0.0f;
+        float scrollY = 0.0f;
+        std::wstring fontFamily;      // theme fonts and viewport width the
+        std::wstring codeFontFamily;  // heights were measured with
+        float width = 0.0f;
+    };
+    LayoutSeed layoutSeed;
+
+    // Trailing unchanged blocks held aside while the edited middle is laid
+    // out, then spliced back shifted by the y/docText/source deltas
+    struct ReusedLayout {
+        size_t firstNewBlock = SIZE_MAX;  // new block index the tail resumes at
+        float bottom = 0.0f;
+        std::vector<LayoutBlock> blocks;
+        std::vector<LayoutTextRun> textRuns;
+        std::vector<LayoutRect> rects;
+        std::vector<LayoutLine> lines;
+        std::vector<LayoutShape> shapes;
+        std::vector<LayoutConnector> connectors;
+        std::vector<LayoutDiagram> diagrams;
+        std::vector<LayoutBitmap> bitmaps;
+        std::vector<LinkRect> links;
+        std::vector<CodeBlockInfo> codeBlocks;
+        std::vector<TextRect> textRects;
+        std::vector<LineBucket> lineBuckets;
+        std::vector<HeadingInfo> headings;
+        std::vector<ScrollAnchor> anchors;
+        std::wstring docText;
+    };
+    ReusedLayout layoutReuse;
+
+    // Viewport-first layout from deep in the document (a zoom or reload
+    // while scrolled far down, a jump to a heading): the blocks under the
+    // viewport are laid out first at an estimated y, the blocks above them
+    // are laid out here, swapped in with the live vectors for one time
+    // slice at a time, and once they reach it the viewport blocks are
+    // spliced in after them (see layoutAboveViewport in render.cpp)
+    struct LayoutAside {
+        bool pending = false;
+        size_t nextBlock = 0;   // next block above the viewport blocks
+        size_t endBlock = 0;    // first viewport block
+        float cursorY = 0.0f;
+        ReusedLayout layout;
+        LayoutTileIndex textRunTiles, rectTiles, lineTiles, shapeTiles;
+        LayoutTileIndex connectorTiles, diagramTiles, bitmapTiles, textRectTiles;
+        std::unordered_map<std::string, int> headingSlugCounts;
+    };
+    LayoutAside layoutAside;
+    // Estimated height of the blocks from each index to the end, from a
+    // viewport-first layout. The scrollbar range counts the blocks not yet
+    // laid out at these until layoutFinish drops them.
+    std::vector<float> layoutHeightsBelow;
+
+    // A top-level table laid out a slice of rows at a time: a data dump of
+    // thousands of rows stops below the fold for the first paint and the
+    // time slices continue from the next row (see layoutTableRows in
+    // render.cpp). Only top-down layout pauses a table; viewport-first
+    // layout lays them out whole.
+    struct TableLayout {
+        const Element* table = nullptr;  // null unless paused
+        std::vector<const Element*> rows;
+        std::vector<float> colWidths;
+        float indent = 0.0f;
+        float totalWidth = 0.0f;
+        float top = 0.0f;
+        size_t nextRow = 0;
+    };
+    TableLayout pendingTable;
+    LayoutBlock pendingTableBlock;  // record of the block, finished once the table is
+    // Where the current layout slice stops, for the top-level table being
+    // laid out (set by layoutBlocksUntil)
+    struct TableSlice {
+        const Element* pausable = nullptr;
+        float stopY = -1.0f;
+        int64_t budgetUs = 0;
+        Clock::time_point start;
+    };
+    TableSlice tableSlice;
+    // Natural (unwrapped) widths of table cells by content, header row,
+    // scale and theme. A resize only redistributes the columns; reparses
+    // and reopened tables measure just the cells that changed.
+    std::unordered_map<uint64_t, float> tableCellWidths;
+
     size_t searchMatchCursor = 0;
 
     // Copied notification (fades out over 2 seconds)
@@ -413,9 +735,13 @@ struct App {
     int searchCurrentIndex = 0;
     bool searchActive = false;
     bool searchJustOpened = false;  // Skip WM_CHAR after opening with F key
+    bool searchRegex = false;       // Alt+R: query is a regular expression
+    bool searchWholeWord = false;   // Alt+W: matches must be whole words
+    SearchPattern searchPattern;    // compiled query when either mode is on
 
-    // File watching (auto-reload)
-    FILETIME lastFileWriteTime = {};
+    // File watching (auto-reload, see file_watcher.cpp)
+    struct FileWatchState;
+    std::shared_ptr<FileWatchState> fileWatcher;
     bool fileWatchEnabled = true;
 
     // Edit mode
@@ -436,22 +762,94 @@ struct App {
     std::chrono::steady_clock::time_point editModeNotificationStart;
     std::wstring editorNotificationMsg;
 
-    // Editor document
-    std::wstring editorText;
+    // Editor document (piece table; also holds the line index)
+    TextBuffer editorText;
     bool editorDirty = false;
-    std::vector<size_t> editorLineStarts;
 
     // Editor view options (persisted)
     bool editorShowPreview = true;
     bool editorWordWrap = false;
 
-    // Soft-wrap metrics: cumulative visual rows before each logical line
-    // (editorRowStarts.size() == lines + 1). Only maintained while
-    // editorWordWrap is on; rebuilt when text or wrap width changes.
-    std::vector<size_t> editorRowStarts;
-    size_t editorTotalRows = 0;
+    // Soft-wrap metrics: visual rows per logical line, with prefix sums in
+    // a Fenwick tree so row <-> line mapping is O(log n). Only maintained
+    // while editorWordWrap is on; an edit re-measures just the lines it
+    // touched, a wrap width change rebuilds everything.
+    struct EditorRowIndex {
+        std::vector<uint32_t> rows;  // rows of each line
+        std::vector<size_t> tree;    // Fenwick tree over `rows`
+        size_t totalRows = 0;
+
+        size_t size() const { return rows.size(); }
+        void clear() { rows.clear(); tree.clear(); totalRows = 0; }
+
+        // Rebuild the tree from `rows` in O(n)
+        void build() {
+            tree.assign(rows.begin(), rows.end());
+            totalRows = 0;
+            for (size_t i = 0; i < tree.size(); i++) {
+                totalRows += rows[i];
+                size_t parent = i | (i + 1);
+                if (parent < tree.size()) tree[parent] += tree[i];
+            }
+        }
+
+        void set(size_t line, uint32_t count) {
+            size_t old = rows[line];
+            rows[line] = count;
+            totalRows = totalRows - old + count;
+            for (size_t i = line; i < tree.size(); i |= i + 1) tree[i] = tree[i] - old + count;
+        }
+
+        // Replace lines [first, first + oldCount) with `fresh`. Same line
+        // count: point updates; otherwise the shifted tail forces a rebuild.
+        void replace(size_t first, size_t oldCount, const std::vector<uint32_t>& fresh) {
+            if (fresh.size() == oldCount) {
+                for (size_t i = 0; i < oldCount; i++) set(first + i, fresh[i]);
+                return;
+            }
+            rows.erase(rows.begin() + first, rows.begin() + first + oldCount);
+            rows.insert(rows.begin() + first, fresh.begin(), fresh.end());
+            build();
+        }
+
+        // Visual rows before `line` (line <= size())
+        size_t rowsBefore(size_t line) const {
+            size_t sum = 0;
+            for (size_t i = line; i > 0; i &= i - 1) sum += tree[i - 1];
+            return sum;
+        }
+
+        // Line containing visual row `row`: the last line whose rowsBefore <= row
+        size_t lineFromRow(size_t row) const {
+            if (rows.empty()) return 0;
+            size_t pos = 0;
+            size_t step = 1;
+            while (step * 2 <= tree.size()) step *= 2;
+            for (; step > 0; step /= 2) {
+                if (pos + step <= tree.size() && tree[pos + step - 1] <= row) {
+                    pos += step;
+                    row -= tree[pos - 1];
+                }
+            }
+            return std::min(pos, rows.size() - 1);
+        }
+    };
+    EditorRowIndex editorRows;
     float editorRowMetricsWidth = -1.0f;  // wrap width the metrics were built for
 
+    // Editor line layouts, most recently used first, keyed by a hash of the
+    // line text, wrap width and font size. Rendering, caret placement and
+    // hit testing share them, so a caret blink or a scroll back over lines
+    // already seen creates no layouts; an edit drops just the lines it
+    // touched. Released with editorTextFormat (font or zoom change).
+    struct EditorLineLayout {
+        uint64_t key = 0;
+        size_t length = 0;
+        IDWriteTextLayout* layout = nullptr;
+    };
+    std::list<EditorLineLayout> editorLayoutLru;
+    std::unordered_map<uint64_t, std::list<EditorLineLayout>::iterator> editorLayoutIndex;
+
     // Editor cursor & selection
     size_t editorCursorPos = 0;
     int editorDesiredCol = -1;
@@ -473,16 +871,8 @@ struct App {
     std::vector<EditorSearchMatch> editorSearchMatches;
     int editorSearchCurrentIndex = 0;
 
-    // Undo/redo
-    struct EditAction {
-        enum Type { Insert, Delete };
-        Type type;
-        size_t position;
-        std::wstring text;
-        size_t cursorBefore, cursorAfter;
-    };
-    std::vector<EditAction> undoStack;
-    std::vector<EditAction> redoStack;
+    // Undo/redo: spans of editorText, grouped by typing burst
+    UndoLog undoLog;
 
     // Editor text format (monospace)
     IDWriteTextFormat* supSubFormat = nullptr;   // small size for ^sup^/~sub~
@@ -491,6 +881,7 @@ struct App {
 
     // Metrics
     StartupMetrics metrics;
+    FrameStats frameStats;
     size_t drawCalls = 0;
 
     ~App() { shutdown(); }
@@ -502,10 +893,13 @@ struct App {
             }
         }
         layoutTextRuns.clear();
+        runColors.clear();
+        runColorIndex.clear();
         layoutRects.clear();
         layoutLines.clear();
         layoutShapes.clear();
         layoutConnectors.clear();
+        layoutDiagrams.clear();
         layoutBitmaps.clear();
         linkRects.clear();
         codeBlocks.clear();
@@ -515,9 +909,75 @@ struct App {
         docTextLower.clear();
         headings.clear();
         headingSlugCounts.clear();
+        layoutBlocks.clear();
+        clearReusedLayout();
+        clearLayoutAside();
+        pendingTable = TableLayout{};
+        clearTileIndex();
+        releaseDocumentTiles();
+    }
+
+    // Drop the document tiles reaching below y: the layout changed from there
+    void invalidateDocumentTiles(float fromY) {
+        size_t kept = 0;
+        for (auto& tile : documentTiles) {
+            if ((tile.row + 1) * DocumentTile::kHeight > fromY) {
+                if (tile.bitmap) tile.bitmap->Release();
+                continue;
+            }
+            documentTiles[kept++] = tile;
+        }
+        documentTiles.resize(kept);
+    }
+
+    void releaseDocumentTiles() { invalidateDocumentTiles(0.0f); }
+
+    void releaseShapeGeometries() {
+        for (auto& [key, geometry] : shapeGeometries) {
+            if (geometry) geometry->Release();
+        }
+        shapeGeometries.clear();
+    }
+
+    void clearTileIndex() {
+        textRunTiles.clear();
+        rectTiles.clear();
+        lineTiles.clear();
+        shapeTiles.clear();
+        connectorTiles.clear();
+        diagramTiles.clear();
+        bitmapTiles.clear();
+        textRectTiles.clear();
+    }
+
+    void clearReusedLayout() {
+        for (auto& run : layoutReuse.textRuns) {
+            if (run.layout) {
+                run.layout->Release();
+            }
+        }
+        layoutReuse = ReusedLayout{};
+    }
+
+    void clearLayoutAside() {
+        for (auto& run : layoutAside.layout.textRuns) {
+            if (run.layout) {
+                run.layout->Release();
+            }
+        }
+        layoutAside = LayoutAside{};
+    }
+
+    void clearEditorLayoutCache() {
+        for (auto& entry : editorLayoutLru) {
+            if (entry.layout) entry.layout->Release();
+        }
+        editorLayoutLru.clear();
+        editorLayoutIndex.clear();
     }
 
     void releaseOverlayFormats() {
+        clearEditorLayoutCache();
         if (searchTextFormat) { searchTextFormat->Release(); searchTextFormat = nullptr; }
         if (themeTitleFormat) { themeTitleFormat->Release(); themeTitleFormat = nullptr; }
         if (themeHeaderFormat) { themeHeaderFormat->Release(); themeHeaderFormat = nullptr; }
@@ -539,12 +999,23 @@ struct App {
             if (entry.bitmap) { entry.bitmap->Release(); entry.bitmap = nullptr; }
         }
         imageCache.clear();
+        imageCacheBytes = 0;
+    }
+
+    void releaseCodeBrushes() {
+        for (auto& b : codeBrushes) {
+            if (b.brush) b.brush->Release();
+        }
+        codeBrushes.clear();
     }
 
     void shutdown() {
         clearLayoutCache();
         releaseOverlayFormats();
         releaseImageCache();
+        releaseCodeBrushes();
+        releaseShapeGeometries();
+        if (dashedStrokeStyle) { dashedStrokeStyle->Release(); dashedStrokeStyle = nullptr; }
         if (wicFactory) { wicFactory->Release(); wicFactory = nullptr; }
         if (brush) { brush->Release(); brush = nullptr; }
         if (deviceContext) { deviceContext->Release(); deviceContext = nullptr; }
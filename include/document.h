@@ -6,6 +6,7 @@
 #include <array>
 #include <string>
 #include <string_view>
+#include <vector>
 
 inline constexpr std::array<std::wstring_view, 3> DOCUMENT_FILE_EXTENSIONS = {
     L".md",
@@ -20,10 +21,28 @@ bool isSupportedDocumentPath(std::wstring_view path);
 bool isSupportedDropPath(std::wstring_view path);
 
 qmd::ParseResult parseDocument(qmd::MarkdownParser& parser,
-                               const std::string& content,
+                               std::string_view content,
                                std::string_view path);
 qmd::ParseResult parseDocument(qmd::MarkdownParser& parser,
-                               const std::string& content,
+                               std::string_view content,
                                std::wstring_view path);
 
+// Progressive parsing of very large Markdown files: the source is cut into
+// chunks that each hold whole top-level blocks and parse on their own
+struct DocumentChunks {
+    std::vector<size_t> starts;   // byte offset of each chunk; it ends where the next starts
+    std::string linkDefinitions;  // every "[label]: url" line, parsed with each chunk
+    std::string unclosedBlockEnd; // closes a fence or HTML block left open at the end
+};
+
+// Cut `content` after about firstBytes, then about every chunkBytes, at a
+// blank line outside fenced code and HTML comments that is followed by an
+// unindented line opening neither a list item nor a block quote
+DocumentChunks splitDocument(std::string_view content, size_t firstBytes, size_t chunkBytes);
+
+// Parse chunk `index` of `content`. Source offsets are relative to the
+// whole content, and links may use definitions from any chunk.
+qmd::ParseResult parseDocumentChunk(qmd::MarkdownParser& parser, std::string_view content,
+                                    const DocumentChunks& chunks, size_t index);
+
 #endif // TINTA_DOCUMENT_H
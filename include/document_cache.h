@@ -0,0 +1,34 @@
+#ifndef TINTA_DOCUMENT_CACHE_H
+#define TINTA_DOCUMENT_CACHE_H
+
+#include "app.h"
+
+#include <string>
+
+// On-disk cache of opened documents, one file each under
+// %APPDATA%\Tinta\cache. Reopening a file that has not changed since loads
+// its element tree instead of parsing it, and the block heights and scroll
+// position saved with it let the viewport-first layout size the scrollbar
+// and show the saved position before the blocks above it are laid out.
+// Entries are keyed by path, size and last-write time; the heights are
+// rescaled to the current zoom, so zoom and DPI do not invalidate them.
+// The fonts and viewport width they were measured with are saved too, and
+// a different font or width drops the heights and scroll position.
+
+// Size and last-write time of a file; false when it cannot be queried
+bool documentStamp(const std::wstring& path, DocumentStamp& stamp);
+
+// Worker thread: the tree and layout seed saved for `path` while it had
+// `stamp`. False when there is no such entry or it cannot be read.
+bool loadDocumentCache(const std::wstring& path, const DocumentStamp& stamp,
+                       qmd::ParseResult& result, App::LayoutSeed& seed);
+
+// UI thread: whether a loaded seed was measured in the current fonts at
+// the current viewport width
+bool layoutSeedApplies(const App& app, const App::LayoutSeed& seed);
+
+// UI thread: save the current document, its block heights and scroll
+// position, once fully laid out from an unmodified file
+void saveDocumentCache(App& app);
+
+#endif // TINTA_DOCUMENT_CACHE_H
@@ -33,8 +33,8 @@ void performEditorSearch(App& app);
 void scrollEditorToMatch(App& app);
 
 // Utility
-void rebuildLineStarts(App& app);
 size_t editorTopVisibleLine(App& app);
 std::string toUtf8(const std::wstring& wstr);
+std::string toUtf8(const TextBuffer& text);
 
 #endif // TINTA_EDITOR_H
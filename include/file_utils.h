@@ -4,12 +4,13 @@
 #include "app.h"
 #include <string>
 
-#define TIMER_FILE_WATCH 1
-
-void updateFileWriteTime(App& app);
 bool isRootPath(const std::wstring& path);
 std::wstring getParentPath(const std::wstring& path);
 std::wstring getDirectoryFromFile(const std::string& filePath);
+// Show folderBrowserPath from the top: its listing, or the search hits
+// below it while a query is typed
 void populateFolderItems(App& app);
+// Rebuild folderItems in place, keeping the scroll position
+void refreshFolderItems(App& app);
 
 #endif // TINTA_FILE_UTILS_H
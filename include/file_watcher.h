@@ -0,0 +1,24 @@
+#ifndef TINTA_FILE_WATCHER_H
+#define TINTA_FILE_WATCHER_H
+
+#include "app.h"
+#include <string>
+
+// The open document is watched from a background thread blocked in
+// ReadDirectoryChangesW on its directory, so an idle window never wakes.
+// Notifications for the file are coalesced until it has been quiet for a
+// short window (a build tool writing in several steps reloads once), then
+// the contents are hashed and WM_APP_FILE_CHANGED is posted only when the
+// hash differs from what was last seen.
+
+// Watch `path` (UTF-8, as app.currentFile) from now on, replacing any
+// previous file. The current contents become the baseline hash.
+void watchFile(App& app, const std::string& path);
+
+// WM_APP_FILE_CHANGED: reload the document unless the notification is for
+// a file no longer watched or edit mode owns the text
+void handleFileChanged(App& app, WPARAM generation);
+
+void stopFileWatcher(App& app);
+
+#endif // TINTA_FILE_WATCHER_H
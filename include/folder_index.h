@@ -0,0 +1,39 @@
+#ifndef TINTA_FOLDER_INDEX_H
+#define TINTA_FOLDER_INDEX_H
+
+#include "app.h"
+#include <string>
+#include <vector>
+
+// The folder browser never enumerates a directory on the UI thread. A
+// background crawler lists the tree below the folder the browser was
+// opened on, caching every listing as it goes, and a small pool of readers
+// feeds the supported documents into a TrigramIndex so typing in the
+// browser searches the whole tree. A ReadDirectoryChangesW watch on the
+// tree marks listings stale and re-reads the documents it reports; trees
+// that deliver no notifications (some network shares) re-list a directory
+// whenever it is shown and its listing has aged. WM_APP_FOLDER_INDEX tells
+// the UI that something it may be showing changed.
+
+// Crawl, watch and index `root` from now on, unless it lies inside the tree
+// already indexed. Starts the worker threads on first use.
+void indexFolder(App& app, const std::wstring& root);
+
+// Append the listing of `directory` to items: subfolders first, then
+// supported documents, each sorted case-insensitively. Returns false when
+// it has not been listed yet; it is then queued ahead of the crawl.
+bool cachedFolderListing(App& app, const std::wstring& directory,
+                         std::vector<App::FolderItem>& items);
+
+// Append the files and headings below app.folderBrowserPath that match
+// app.folderSearchQuery, named relative to that folder
+void searchFolderIndex(App& app, std::vector<App::FolderItem>& items);
+
+// WM_APP_FOLDER_INDEX: refresh the open browser from the cache and index
+void handleFolderIndexUpdate(App& app);
+
+// Drop queued work and let the workers exit. A listing stuck on a dead
+// network share is abandoned rather than waited for.
+void stopFolderIndex(App& app);
+
+#endif // TINTA_FOLDER_INDEX_H
@@ -0,0 +1,26 @@
+#ifndef TINTA_HASH_H
+#define TINTA_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a. Start from kFnvOffset and feed the result back in to hash
+// several fields into one key.
+constexpr uint64_t kFnvOffset = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+inline uint64_t hashBytes(uint64_t h, const void* data, size_t len) {
+    const auto* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= kFnvPrime;
+    }
+    return h;
+}
+
+template <typename T>
+inline uint64_t hashValue(uint64_t h, const T& v) {
+    return hashBytes(h, &v, sizeof(v));
+}
+
+#endif // TINTA_HASH_H
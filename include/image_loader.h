@@ -0,0 +1,35 @@
+#ifndef TINTA_IMAGE_LOADER_H
+#define TINTA_IMAGE_LOADER_H
+
+#include "app.h"
+#include <algorithm>
+#include <string>
+
+// Images are downloaded and decoded on a small pool of worker threads, each
+// with its own WIC factory. Layout reserves a placeholder for a pending
+// image and relays out its block once the size or the pixels arrive.
+
+// Scale that fits a width x height image into maxWidth x maxHeight without
+// upscaling. Layout sizes the drawn box with it; the loader uses the same
+// box to decode straight to the size that will be drawn.
+inline float imageFitScale(int width, int height, float maxWidth, float maxHeight) {
+    if (width <= 0 || height <= 0) return 1.0f;
+    return std::min({1.0f, maxWidth / (float)width, maxHeight / (float)height});
+}
+
+// Queue the cache entry for `src` (its path already resolved) for loading,
+// decoded no larger than the maxWidth x maxHeight box. Marks it pending; a
+// bitmap it already has stays drawable until the new one replaces it.
+void requestImage(App& app, const std::string& src, float maxWidth, float maxHeight);
+
+// WM_APP_IMAGE_READY: apply finished sizes and decodes to app.imageCache,
+// uploading pixels to D2D bitmaps on the UI thread, then evict least
+// recently used bitmaps the current layout does not draw until the cache
+// fits app.imageCacheBudget
+void applyImageResults(App& app);
+
+// Drop queued jobs and let the workers exit. A download already running is
+// abandoned rather than waited for, so it cannot hold up closing the window.
+void stopImageLoader(App& app);
+
+#endif // TINTA_IMAGE_LOADER_H
@@ -11,7 +11,7 @@ void handleMouseDown(App& app, HWND hwnd, WPARAM wParam, LPARAM lParam);
 void handleMouseUp(App& app, HWND hwnd, WPARAM wParam, LPARAM lParam);
 void handleKeyDown(App& app, HWND hwnd, WPARAM wParam);
 void handleCharInput(App& app, HWND hwnd, WPARAM wParam);
+bool handleSearchModeKey(App& app, HWND hwnd, WPARAM wParam);
 void handleDropFiles(App& app, HWND hwnd, WPARAM wParam);
-void handleFileWatchTimer(App& app, HWND hwnd);
 
 #endif // TINTA_INPUT_H
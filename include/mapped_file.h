@@ -0,0 +1,54 @@
+#ifndef TINTA_MAPPED_FILE_H
+#define TINTA_MAPPED_FILE_H
+
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole file. Files up to kCopyBytes are read into a
+// buffer and the handle is closed at once; larger ones are mapped through
+// CreateFileMapping/MapViewOfFile so the parser reads the bytes straight
+// out of the page cache instead of out of an ifstream -> stringstream ->
+// std::string chain of copies. Either way the file is opened with every
+// sharing mode: an editor saving in place is never refused. While a view
+// is mapped Windows refuses to truncate the file below it, so the parser
+// cannot fault on a shrinking file; a rewrite in place goes through, and
+// the file watcher reparses after it. The view stays valid until the
+// object is closed or destroyed; parsing copies what the tree keeps into
+// its arena, so the file can be dropped after.
+class MappedFile {
+public:
+    static constexpr size_t kCopyBytes = size_t(16) << 20;
+
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // False if the file cannot be opened, read or mapped. An empty file
+    // opens with an empty view (Windows cannot map zero bytes).
+    bool open(const std::wstring& path);
+    void close();
+
+    bool isOpen() const { return open_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string_view view() const { return data_ ? std::string_view(data_, size_) : std::string_view(); }
+
+private:
+    HANDLE mapping_ = nullptr;
+    std::string copy_;           // the contents, when small enough to read
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool open_ = false;
+};
+
+#endif // TINTA_MAPPED_FILE_H
@@ -2,7 +2,9 @@
 #define TINTA_MARKDOWN_H
 
 #include "types.h"
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <functional>
@@ -45,29 +47,101 @@ enum class ElementType {
 
 // Forward declaration
 struct Element;
+class ElementArena;
+
+// Only document roots are reference counted: the pointer shares ownership of
+// the ElementArena that holds every node of the tree (see newDocument)
 using ElementPtr = std::shared_ptr<Element>;
 
-// Base element structure
+// Children of an element: a contiguous pointer array in the tree's arena.
+// Grown by ElementArena::append; read through the usual container calls.
+struct ElementList {
+    Element** items = nullptr;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+
+    Element* const* begin() const { return items; }
+    Element* const* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Element* operator[](size_t i) const { return items[i]; }
+    Element* front() const { return items[0]; }
+    Element* back() const { return items[count - 1]; }
+    void clear() { items = nullptr; count = capacity = 0; }
+};
+
+// Base element structure. Trivially destructible: strings are views into
+// the arena's string pool, so dropping a document frees the arena's blocks
+// without visiting a single node.
 struct Element {
     ElementType type;
-    std::string text;
-    std::string url;          // for links/images
-    std::string title;        // for links/images
+    std::string_view text;         // UTF-8, only while the tree is built
+    std::wstring_view wtext;       // text as UTF-16 (see ElementArena::widenText)
+    std::string_view url;          // for links/images
+    std::string_view title;        // for links/images
     int level = 0;            // for headings (1-6)
     bool ordered = false;     // for lists
     int start = 1;            // for ordered lists
-    std::string language;     // for code blocks
+    std::string_view language;     // for code blocks
     int align = 0;            // for table cells (0=default, 1=left, 2=center, 3=right)
     int col_count = 0;        // for tables (number of columns)
 
     size_t sourceOffset = SIZE_MAX; // byte offset in original markdown source
 
-    std::vector<ElementPtr> children;
+    ElementList children;
     Element* parent = nullptr;
 
-    Element(ElementType t) : type(t) {}
+    explicit Element(ElementType t = ElementType::Document) : type(t) {}
 };
 
+// Bump allocator backing one element tree: nodes, child arrays and text
+// all come out of a few large blocks that are released together
+class ElementArena {
+public:
+    ElementArena() = default;
+    ElementArena(const ElementArena&) = delete;
+    ElementArena& operator=(const ElementArena&) = delete;
+
+    Element* make(ElementType type);
+    std::string_view store(std::string_view text);
+    // Element text (Element::text): staged apart from the tree until
+    // widenText replaces it
+    std::string_view storeText(std::string_view text);
+    // Append `child` to `parent`'s list (doubling it in the arena when full)
+    void append(Element* parent, Element* child);
+    // Convert the text of every element under `root` to UTF-16 in one
+    // pass, into one buffer, and point each element's wtext at its range.
+    // Run on a finished tree, so layout never converts a fragment itself.
+    // The staged UTF-8 is released and every Element::text left empty: a
+    // parsed document keeps one copy of its text, not two.
+    void widenText(Element* root);
+
+    size_t bytesUsed() const { return m_nodes.used; }
+
+private:
+    struct Pool {
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* cursor = nullptr;
+        char* end = nullptr;
+        size_t used = 0;
+    };
+
+    static void* allocate(Pool& pool, size_t size, size_t align);
+    void* allocate(size_t size, size_t align) { return allocate(m_nodes, size, align); }
+
+    Pool m_nodes;
+    Pool m_text;    // staged Element::text
+};
+
+// Create a Document root in a fresh arena and hand that arena back for
+// building the rest of the tree. The root keeps the arena alive.
+ElementPtr newDocument(ElementArena*& arena);
+
+// Move the top-level blocks of `more` to the end of `root`'s children.
+// `root` is replaced by a pointer to the same Document node that also
+// keeps `more`'s arena alive, so raw pointers into the tree stay valid.
+void appendDocument(ElementPtr& root, ElementPtr more);
+
 // Parse result
 struct ParseResult {
     ElementPtr root;
@@ -82,7 +156,8 @@ public:
     MarkdownParser();
     ~MarkdownParser();
 
-    ParseResult parse(const std::string& markdown);
+    // The tree copies what it keeps, so markdown only has to outlive the call
+    ParseResult parse(std::string_view markdown);
     ParseResult parseFile(const std::string& path);
 
     // Options
@@ -102,12 +177,16 @@ private:
     bool m_taskLists = true;
 };
 
+// UTF-8 of element text, for what still takes UTF-8 (the Mermaid parser,
+// the document cache)
+std::string narrowText(std::wstring_view text);
+
 // Utility functions
 std::string elementTypeToString(ElementType type);
-void debugPrintElement(const ElementPtr& elem, int indent = 0);
+void debugPrintElement(const Element* elem, int indent = 0);
 
-// Parse HTML content into markdown elements
-void parseHtmlIntoElements(const std::string& html, Element* parent);
+// Parse HTML content into markdown elements allocated from `arena`
+void parseHtmlIntoElements(std::string_view html, Element* parent, ElementArena& arena);
 
 } // namespace qmd
 
@@ -89,6 +89,7 @@ struct Rect {
 struct Layout {
     std::vector<Rect> nodes;
     std::vector<size_t> ranks;  // layer index per node, for edge routing
+    size_t crossings = 0;       // segment crossings left between adjacent ranks
     float width = 0.0f;
     float height = 0.0f;
 };
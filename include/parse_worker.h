@@ -0,0 +1,33 @@
+#ifndef TINTA_PARSE_WORKER_H
+#define TINTA_PARSE_WORKER_H
+
+#include "app.h"
+#include "mapped_file.h"
+#include <string>
+
+// What the swapped-in tree replaces: a different document resets the view,
+// an update (file-watch reload, editor preview) keeps scroll and block reuse
+enum class ParseReason { Open, Update };
+
+void startParseWorker(App& app);
+void stopParseWorker(App& app);
+
+// Queue a parse on the worker thread. Supersedes any job still waiting;
+// a job already running finishes but its result is dropped as stale.
+void requestParse(App& app, std::string content, std::string path, ParseReason reason);
+
+// requestParse for a file on disk: the worker parses a MappedFile of it,
+// so a large file is never copied into a std::string. Falls back to an
+// ifstream read when the file cannot be mapped; returns false if it cannot
+// be read at all.
+bool requestParseFile(App& app, const std::wstring& widePath, std::string path,
+                      ParseReason reason);
+
+// WM_APP_PARSE_DONE: swap in the finished tree if it is still the latest
+void applyParseResult(App& app);
+
+// Block until the latest requested parse finished, then swap it in.
+// Returns false if that parse failed.
+bool waitForParse(App& app);
+
+#endif // TINTA_PARSE_WORKER_H
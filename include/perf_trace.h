@@ -0,0 +1,49 @@
+#ifndef TINTA_PERF_TRACE_H
+#define TINTA_PERF_TRACE_H
+
+#include "app.h"
+
+// Phase timing for the stats overlay (S) and for ETW. Each phase a frame
+// can spend time in runs under a ScopedPhase: on the UI thread the time is
+// added to app.frameStats, and on every thread, image workers included, a
+// start/stop event pair goes to the "Tinta" TraceLogging provider, so a
+// WPA capture shows Tinta's phases next to everything else on the machine.
+// With no session listening an event costs a single enabled check.
+
+void registerTraceProvider();
+void unregisterTraceProvider();
+
+const char* framePhaseName(FramePhase phase);
+
+class ScopedPhase {
+public:
+    // app is null off the UI thread: the phase is traced but not counted
+    ScopedPhase(App* app, FramePhase phase);
+    ~ScopedPhase() { stop(); }
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+    // End this phase and start the next, for passes that run back to back
+    void switchTo(FramePhase phase);
+    void stop();
+
+private:
+    void begin(FramePhase phase);
+
+    App* app_;
+    FramePhase phase_ = FramePhase::Layout;
+    Clock::time_point start_;
+    bool running_ = false;
+};
+
+// End of render(): record the frame in the histogram, keep its phase
+// breakdown for the overlay and start counting toward the next one
+void endFrame(App& app, int64_t frameUs);
+
+// Nearest-rank percentile (0..1) of count ascending samples; 0 when empty
+int64_t percentile(const int64_t* sorted, size_t count, double p);
+
+// Nearest-rank percentile (0..1) of the frames in the histogram
+int64_t frameTimePercentileUs(const FrameStats& stats, double p);
+
+#endif // TINTA_PERF_TRACE_H
@@ -6,9 +6,11 @@
 // Full synchronous layout of the whole document
 void layoutDocument(App& app);
 
-// Lays out from the top through ~2 viewports past the current scroll, then
-// returns so the first frame can present. If blocks remain, layoutComplete is
-// false and the caller posts WM_APP_LAYOUT_CHUNK to continue.
+// Lays out through ~2 viewports past the current scroll, then returns so the
+// first frame can present. Scrolled far down, the blocks under the viewport
+// are laid out first at an estimated position and the ones above wait for
+// the background slices. If blocks remain, layoutComplete is false and the
+// caller posts WM_APP_LAYOUT_CHUNK to continue.
 void layoutDocumentViewportFirst(App& app);
 
 // Continues an incomplete layout for at most budgetUs. Returns true when done.
@@ -17,4 +19,16 @@ bool layoutDocumentContinue(App& app, int64_t budgetUs);
 // Synchronously finishes any incomplete/dirty layout (search, TOC, End key)
 void ensureLayoutComplete(App& app);
 
+// During an incomplete layout, restart it with the block holding heading `id`
+// laid out first, so a jump to it does not wait for everything above.
+// Returns false when there is no such heading or it is near the top.
+bool layoutFromHeading(App& app, const std::string& id);
+
+// Draw the static layout (rects, diagrams, images, text, rules) inside
+// `view` to `target`, offset by the scroll position. The window draws it
+// straight from here in a frame and document tiles once when rasterized;
+// dc is target's device context for color fonts, if it has one.
+void drawDocumentLayer(App& app, ID2D1RenderTarget* target, ID2D1DeviceContext* dc,
+                       float scrollX, float scrollY, const D2D1_RECT_F& view);
+
 #endif // TINTA_RENDER_H
@@ -3,8 +3,23 @@
 
 #include "app.h"
 
+// Search the text laid out so far for app.searchQuery. A plain query that
+// only grew narrows the previous occurrences instead of rescanning; regex
+// and whole-word queries are compiled into app.searchPattern.
 void performSearch(App& app);
+
+// Layout appended to docText: scan the new text for the current query and
+// stream any matches into app.searchMatches
+void advanceSearch(App& app);
+
+// Layout dropped docText past validChars: forget what was found there
+void truncateSearch(App& app, size_t validChars);
+
 void mapSearchMatchesToLayout(App& app);
+
+// Highlight rects for one mapped match, hit-tested against its text runs
+// the first time it is drawn and cached until the matches are remapped
+std::pair<const D2D1_RECT_F*, size_t> searchHighlightFragments(App& app, size_t matchIndex);
 void scrollToCurrentMatch(App& app);
 
 #endif // TINTA_SEARCH_H
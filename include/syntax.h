@@ -2,9 +2,10 @@
 #define TINTA_SYNTAX_H
 
 #include "app.h"
+#include <array>
+#include <cstdint>
 #include <vector>
 #include <string>
-#include <unordered_set>
 #include <string_view>
 
 // Token for syntax highlighting
@@ -13,21 +14,63 @@ struct SyntaxToken {
     SyntaxTokenType tokenType;
 };
 
+// FNV-1a over the UTF-16 code units of a word
+constexpr uint32_t keywordHash(std::wstring_view word) {
+    uint32_t h = 2166136261u;
+    for (wchar_t c : word) {
+        h ^= (uint32_t)c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// A language's keywords as an open-addressed hash table built at compile
+// time (see makeKeywordTable in syntax.cpp). Lookups hash the identifier's
+// view in place, so nothing is allocated per identifier.
+class KeywordSet {
+public:
+    template <size_t Slots>
+    constexpr KeywordSet(const std::array<std::wstring_view, Slots>& slots)
+        : slots_(slots.data()), mask_(Slots - 1) {
+        static_assert(Slots > 0 && (Slots & (Slots - 1)) == 0, "slot count must be a power of two");
+    }
+
+    bool contains(std::wstring_view word) const;
+
+private:
+    const std::wstring_view* slots_;
+    size_t mask_;
+};
+
 // Language keyword sets
-extern const std::unordered_set<std::wstring> CPP_KEYWORDS;
-extern const std::unordered_set<std::wstring> CPP_TYPES;
-extern const std::unordered_set<std::wstring> PYTHON_KEYWORDS;
-extern const std::unordered_set<std::wstring> JS_KEYWORDS;
-extern const std::unordered_set<std::wstring> RUST_KEYWORDS;
-extern const std::unordered_set<std::wstring> GO_KEYWORDS;
-extern const std::unordered_set<std::wstring> BASH_KEYWORDS;
-extern const std::unordered_set<std::wstring> CSHARP_CONTROL_FLOW;
-extern const std::unordered_set<std::wstring> CSHARP_KEYWORDS;
-extern const std::unordered_set<std::wstring> CSHARP_TYPES;
+extern const KeywordSet CPP_KEYWORDS;
+extern const KeywordSet CPP_TYPES;
+extern const KeywordSet PYTHON_KEYWORDS;
+extern const KeywordSet JS_KEYWORDS;
+extern const KeywordSet RUST_KEYWORDS;
+extern const KeywordSet GO_KEYWORDS;
+extern const KeywordSet BASH_KEYWORDS;
+extern const KeywordSet CSHARP_CONTROL_FLOW;
+extern const KeywordSet CSHARP_KEYWORDS;
+extern const KeywordSet CSHARP_TYPES;
+
+// Tokens of a whole code block, stored as offsets into its text so they can
+// be cached and reused for the same source. Lines are split on '\n' with a
+// trailing '\r' dropped; line k owns spans [lineSpans[k], lineSpans[k + 1]).
+struct CodeTokens {
+    struct Span {
+        uint32_t start;
+        uint32_t length;
+        SyntaxTokenType tokenType;
+    };
+    std::vector<Span> spans;
+    std::vector<uint32_t> lineSpans;
+};
 
 int detectLanguage(const std::wstring& lang);
-const std::unordered_set<std::wstring>* getKeywordsForLanguage(int lang);
-std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bool& inBlockComment);
+const KeywordSet* getKeywordsForLanguage(int lang);
+std::vector<SyntaxToken> tokenizeLine(std::wstring_view line, int language, bool& inBlockComment);
+CodeTokens tokenizeCode(std::wstring_view code, int language);
 D2D1_COLOR_F getTokenColor(const D2DTheme& theme, SyntaxTokenType ttype);
 
 #endif // TINTA_SYNTAX_H
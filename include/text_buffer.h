@@ -0,0 +1,129 @@
+#ifndef TINTA_TEXT_BUFFER_H
+#define TINTA_TEXT_BUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Editor text as a piece table. The loaded file stays in an immutable
+// original buffer and inserted text is appended to an add buffer; the
+// document is the in-order sequence of pieces (spans of either buffer) in
+// a treap keyed by position. Every node caches the length and newline count
+// of its subtree, so insert, erase, character access and the line index
+// (line -> start, position -> line) are all O(log n) with no rescans.
+class TextBuffer {
+public:
+    TextBuffer();
+
+    // A run of the original or add buffer. Both only ever grow, so a span
+    // keeps naming the same text until assign, clear or compactAdded
+    struct Span {
+        bool added = false;
+        size_t start = 0;
+        size_t length = 0;
+    };
+
+    void assign(std::wstring text);
+    void clear();
+
+    size_t size() const { return root_ == kNil ? 0 : nodes_[root_].subLength; }
+    bool empty() const { return size() == 0; }
+    wchar_t operator[](size_t pos) const;
+
+    // Returns the span of the add buffer the text now occupies
+    Span insert(size_t pos, std::wstring_view text);
+    void erase(size_t pos, size_t len);
+
+    // Append the spans making up [pos, pos + len), in document order. Put
+    // back with insertSpans, they restore erased text without copying it.
+    void spans(size_t pos, size_t len, std::vector<Span>& out) const;
+    void insertSpans(size_t pos, const Span* spans, size_t count);
+
+    std::wstring substr(size_t pos, size_t len) const;
+    std::wstring str() const { return substr(0, size()); }
+
+    // Lines are separated by '\n'; there is always at least one
+    size_t lineCount() const;
+    size_t lineStart(size_t line) const;
+    size_t lineFromPos(size_t pos) const;
+
+    // Call fn(const wchar_t* data, size_t len) for each contiguous run of
+    // [pos, pos + len) in document order
+    template <typename Fn>
+    void forEachChunk(size_t pos, size_t len, Fn&& fn) const {
+        if (len == 0 || pos >= size()) return;
+        visitChunks(root_, 0, pos, pos + std::min(len, size() - pos), fn);
+    }
+
+    size_t pieceCount() const { return nodes_.size() - freeNodes_.size(); }
+    size_t addedSize() const { return added_.size(); }
+
+    // Drop the add-buffer text that neither a piece nor one of `keep` names
+    // any more (undone pastes, history that was let go), moving the pieces
+    // and `keep` onto the shorter buffer
+    void compactAdded(Span* keep, size_t count);
+
+private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct Node {
+        uint32_t left = kNil;
+        uint32_t right = kNil;
+        uint32_t priority = 0;
+        bool added = false;         // span of added_ rather than original_
+        size_t start = 0;           // offset in its buffer
+        size_t length = 0;
+        size_t newlines = 0;        // '\n' count inside the piece
+        size_t subLength = 0;       // totals over the subtree
+        size_t subNewlines = 0;
+    };
+
+    const std::wstring& bufferOf(const Node& n) const { return n.added ? added_ : original_; }
+    const std::vector<size_t>& newlinesOf(const Node& n) const {
+        return n.added ? addedNewlines_ : originalNewlines_;
+    }
+    size_t countNewlines(bool added, size_t start, size_t end) const;
+
+    uint32_t makeNode(bool added, size_t start, size_t length);
+    void freeSubtree(uint32_t node);
+    void update(uint32_t node);
+    void split(uint32_t node, size_t pos, uint32_t& left, uint32_t& right);
+    uint32_t merge(uint32_t left, uint32_t right);
+    bool growLastInsert(size_t pos, std::wstring_view text);
+
+    void collectSpans(uint32_t node, size_t base, size_t from, size_t to,
+                      std::vector<Span>& out) const;
+
+    template <typename Fn>
+    void visitChunks(uint32_t node, size_t base, size_t from, size_t to, Fn& fn) const {
+        while (node != kNil && base < to) {
+            const Node& n = nodes_[node];
+            size_t leftLength = n.left == kNil ? 0 : nodes_[n.left].subLength;
+            if (from < base + leftLength) visitChunks(n.left, base, from, to, fn);
+            size_t pieceBegin = base + leftLength;
+            size_t pieceEnd = pieceBegin + n.length;
+            size_t lo = std::max(from, pieceBegin);
+            size_t hi = std::min(to, pieceEnd);
+            if (lo < hi) fn(bufferOf(n).data() + n.start + (lo - pieceBegin), hi - lo);
+            if (to <= pieceEnd) return;
+            base = pieceEnd;
+            node = n.right;
+        }
+    }
+
+    std::wstring original_;
+    std::wstring added_;
+    std::vector<size_t> originalNewlines_;  // offsets of '\n' in each buffer
+    std::vector<size_t> addedNewlines_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> freeNodes_;
+    uint32_t root_ = kNil;
+    uint32_t lastInsert_ = kNil;     // piece that ends at the end of added_
+    size_t lastInsertEnd_ = 0;       // document position right after it
+    uint32_t seed_ = 0x9E3779B9u;
+};
+
+#endif // TINTA_TEXT_BUFFER_H
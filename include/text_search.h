@@ -0,0 +1,95 @@
+#ifndef TINTA_TEXT_SEARCH_H
+#define TINTA_TEXT_SEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// First position in [from, end) holding c, or end
+size_t findChar(const wchar_t* text, size_t from, size_t end, wchar_t c);
+
+// Letters, digits and '_': what \w, \b and whole-word search treat as a word
+bool isSearchWordChar(wchar_t c);
+
+// A search query compiled once per keystroke into a Thompson NFA and run as
+// a Pike VM: every live thread steps through the text in lock step, so a
+// scan is O(text * pattern) with no backtracking, whatever the pattern.
+//
+// Both the text and the query are expected lowercased (the search bars are
+// case-insensitive); character classes also accept the uppercase form of a
+// folded character, so [A-Z] still matches. Regex syntax: literals, '.',
+// [...] with ranges and '^' negation, \w \d \s \W \D \S, \b \B, ^ $ (line
+// anchors), * + ? {n} {n,} {n,m}, '|' and (...) / (?:...) groups.
+class SearchPattern {
+public:
+    struct Match {
+        size_t start;
+        size_t length;
+    };
+
+    // Returns false (and sets error()) when a regex does not parse. A
+    // literal query is matched verbatim; wholeWord additionally requires
+    // no word character right before or after each match.
+    bool compile(std::wstring_view query, bool regex, bool wholeWord);
+    void clear();
+
+    bool valid() const { return !program_.empty(); }
+    const std::wstring& error() const { return error_; }
+
+    // Append the non-overlapping, leftmost-longest, non-empty matches that
+    // start in text[from, size). With final unset the text may still grow
+    // past size: a match that could extend is held back and the return
+    // value is where the next call has to resume. With final set every
+    // match is reported and size is returned.
+    size_t find(const wchar_t* text, size_t size, size_t from, bool final,
+                std::vector<Match>& out) const;
+
+private:
+    enum class Op : uint8_t { Char, Any, Class, Assert, Split, Jump, Match };
+    enum class Assertion : uint8_t {
+        LineStart, LineEnd, WordBoundary, NotWordBoundary, NotWordBefore, NotWordAfter
+    };
+
+    struct Inst {
+        Op op;
+        wchar_t c;    // Char
+        uint32_t x;   // Class index, Assertion, Split/Jump target
+        uint32_t y;   // second Split target
+    };
+
+    struct CharClass {
+        enum : uint8_t {
+            Word = 1, NotWord = 2, Digit = 4, NotDigit = 8, Space = 16, NotSpace = 32
+        };
+        std::vector<std::pair<wchar_t, wchar_t>> ranges;
+        uint8_t sets = 0;
+        bool negated = false;
+
+        bool contains(wchar_t c) const;
+        bool matches(wchar_t c) const;
+    };
+
+    struct Thread {
+        uint32_t pc;
+        size_t start;
+    };
+
+    // Scratch for one find(): thread lists plus a per-instruction stamp
+    // marking which list already holds a thread at that pc
+    struct Scan;
+
+    class Parser;
+
+    bool step(const Inst& inst, wchar_t c) const;
+    void addThread(Scan& scan, std::vector<Thread>& list, uint32_t pc, size_t start,
+                   size_t pos) const;
+
+    std::vector<Inst> program_;
+    std::vector<CharClass> classes_;
+    wchar_t firstChar_ = 0;  // every match starts with this character, if set
+    std::wstring error_;
+};
+
+#endif // TINTA_TEXT_SEARCH_H
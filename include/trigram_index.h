@@ -0,0 +1,109 @@
+#ifndef TINTA_TRIGRAM_INDEX_H
+#define TINTA_TRIGRAM_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Content index over the documents of a folder tree. Every document is
+// folded to lowercase and each run of three UTF-16 units in it is recorded
+// in a posting list of the documents that contain it. A query of three or
+// more characters intersects the lists of its own trigrams, shortest
+// first, and only the documents left are scanned for the query itself.
+// Shorter queries have no trigram to narrow by and match names and
+// headings only.
+//
+// The folded text of the documents is what a candidate is verified
+// against, and it is the bulk of the index. It is held to a byte budget:
+// past it the bodies added longest ago are dropped, and those documents
+// are found by name and headings only until they are read again.
+//
+// prepare() does the per-document work and may run on any thread; the
+// index itself is not synchronized, so callers serialize add, remove and
+// search.
+class TrigramIndex {
+public:
+    struct Heading {
+        std::wstring text;    // as shown: inline markup and closing #s stripped
+        std::wstring folded;
+        int level = 0;        // 1-6
+        std::string anchor;   // id to scroll to, when the caller assigns one
+    };
+
+    // A document ready to add
+    struct Entry {
+        std::wstring path;        // relative to the indexed root
+        std::wstring foldedPath;
+        std::wstring folded;      // lowercased contents
+        std::vector<Heading> headings;
+        std::vector<uint64_t> trigrams;  // sorted and unique; dropped once added
+    };
+
+    enum class HitKind { Name, Heading, Body };
+
+    struct Hit {
+        HitKind kind;
+        std::wstring path;
+        std::wstring heading;  // HitKind::Heading only
+        int level = 0;
+        std::string anchor;    // HitKind::Heading only
+    };
+
+    // Lowercase the way the search bars do, one UTF-16 unit at a time
+    static void fold(std::wstring& text);
+
+    // ATX and setext headings of Markdown source, skipping fenced code
+    static std::vector<Heading> scanHeadings(std::wstring_view text);
+
+    // Fold, scan and split `content` into trigrams for `path`. Without
+    // `withBody` only the headings are kept: the document is found by name
+    // and headings, not by its text.
+    static Entry prepare(std::wstring path, std::wstring_view content, bool withBody = true);
+
+    explicit TrigramIndex(size_t maxBodyBytes = size_t(256) << 20)
+        : maxBodyBytes_(maxBodyBytes) {}
+
+    // Add a document, replacing any with the same path
+    void add(Entry entry);
+    void remove(std::wstring_view path);
+    // Remove every document below `directory` (relative, no trailing separator)
+    void removeUnder(std::wstring_view directory);
+    void clear();
+
+    size_t size() const { return byPath_.size(); }
+    // Bytes of folded text held for verification
+    size_t bodyBytes() const { return bodyBytes_; }
+
+    // Up to `limit` hits for `query` among the documents under `scope`
+    // (relative; empty for all): files whose path matches, then matching
+    // headings, then files that match only in their text, each group in
+    // path order
+    std::vector<Hit> search(std::wstring_view query, std::wstring_view scope,
+                            size_t limit) const;
+
+private:
+    struct Doc {
+        Entry entry;
+        bool live = false;
+    };
+
+    static std::vector<uint64_t> trigramsOf(std::wstring_view folded);
+    static std::vector<uint64_t> trigramsOf(const Entry& entry);
+    void post(uint32_t id, const std::vector<uint64_t>& trigrams);
+    void compact();
+    void evictBodies();
+
+    std::vector<Doc> docs_;                                // by id; removed ones stay dead
+    std::unordered_map<std::wstring, uint32_t> byPath_;    // folded path -> id
+    std::unordered_map<uint64_t, std::vector<uint32_t>> postings_;  // ascending ids
+    size_t dead_ = 0;
+    std::deque<uint32_t> bodies_;    // ids that may hold a body, oldest first
+    size_t bodyBytes_ = 0;
+    size_t maxBodyBytes_;
+};
+
+#endif // TINTA_TRIGRAM_INDEX_H
@@ -0,0 +1,108 @@
+#ifndef TINTA_UNDO_LOG_H
+#define TINTA_UNDO_LOG_H
+
+#include "text_buffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Editor undo history. An edit does not copy its text: it records the
+// spans of the TextBuffer that hold it (the add-buffer span an insert
+// appended, or the pieces a delete cut out), so undoing or redoing one only
+// splices pieces in or out of the buffer. Edits and spans live in two flat
+// arrays; redo history is whatever lies past the applied count, and a new
+// edit truncates it.
+//
+// Keystrokes close together in time and position form one group, undone
+// and redone as a unit. A typed insert that continues the previous one
+// extends its span instead of adding an edit. The byte cap counts the
+// arrays and the add-buffer text the spans name; past it, the oldest
+// groups are dropped. Text nothing names any more stays in the add buffer
+// until releaseText compacts it.
+class UndoLog {
+public:
+    enum class Kind : uint8_t { Insert, Delete };
+
+    struct Edit {
+        Kind kind = Kind::Insert;
+        bool groupStart = true;   // first edit of its group
+        bool burst = false;       // a keystroke that may join the next one
+        size_t position = 0;
+        size_t length = 0;        // characters inserted or deleted
+        size_t firstSpan = 0;     // into the span array
+        size_t spanCount = 0;
+        size_t cursorBefore = 0;
+        size_t cursorAfter = 0;
+        uint64_t time = 0;        // ms, of the latest keystroke merged in
+    };
+
+    // Keystrokes further apart than this start a new group
+    static constexpr uint64_t kBurstMs = 1000;
+    // An add buffer shorter than this is never worth compacting
+    static constexpr size_t kMinReleaseChars = size_t(1) << 20;
+
+    explicit UndoLog(size_t maxBytes = 8u << 20) : maxBytes_(maxBytes) {}
+
+    // Record an edit already applied to the buffer, with the spans its text
+    // occupies. `burst` marks single keystrokes (typing, Backspace, Delete)
+    // that may group with the keystrokes around them.
+    void record(Kind kind, size_t position, const TextBuffer::Span* spans, size_t count,
+                size_t cursorBefore, size_t cursorAfter, uint64_t timeMs, bool burst);
+    void clear();
+
+    // Compact the buffer's add buffer once most of it is text that neither
+    // the document nor this history names, so paste/undo cycles and the
+    // groups trim drops do not hold memory forever. Call after recording
+    // an insert, the only edit that grows the add buffer.
+    void releaseText(TextBuffer& text);
+
+    bool canUndo() const { return applied_ > 0; }
+    bool canRedo() const { return applied_ < edits_.size(); }
+
+    // Step back over the newest applied group, calling fn(const Edit&,
+    // const Span*) for its edits newest first. Returns false with nothing
+    // to undo.
+    template <typename Fn>
+    bool undo(Fn&& fn) {
+        if (applied_ == 0) return false;
+        do {
+            applied_--;
+            fn(edits_[applied_], spans_.data() + edits_[applied_].firstSpan);
+        } while (applied_ > 0 && !edits_[applied_].groupStart);
+        return true;
+    }
+
+    // Reapply the next undone group, oldest edit first
+    template <typename Fn>
+    bool redo(Fn&& fn) {
+        if (applied_ == edits_.size()) return false;
+        do {
+            fn(edits_[applied_], spans_.data() + edits_[applied_].firstSpan);
+            applied_++;
+        } while (applied_ < edits_.size() && !edits_[applied_].groupStart);
+        return true;
+    }
+
+    size_t editCount() const { return edits_.size(); }
+    size_t spanCount() const { return spans_.size(); }
+    size_t bytes() const {
+        return edits_.size() * sizeof(Edit) + spans_.size() * sizeof(TextBuffer::Span) +
+               addedChars_ * sizeof(wchar_t);
+    }
+
+private:
+    bool joinsGroup(const Edit& last, Kind kind, size_t position, size_t length,
+                    uint64_t timeMs) const;
+    void trim();
+    // Add-buffer characters named by spans_[first, last)
+    size_t addedChars(size_t first, size_t last) const;
+
+    std::vector<Edit> edits_;
+    std::vector<TextBuffer::Span> spans_;
+    size_t applied_ = 0;
+    size_t addedChars_ = 0;  // add-buffer text the spans name, counted against the cap
+    size_t maxBytes_;
+};
+
+#endif // TINTA_UNDO_LOG_H
@@ -4,6 +4,7 @@
 #include "app.h"
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 // Simple inline element rendering
 struct InlineSpan {
@@ -14,7 +15,7 @@ struct InlineSpan {
     bool underline;
 };
 
-std::wstring toWide(const std::string& str);
+std::wstring toWide(std::string_view str);
 float measureText(App& app, const std::wstring& text, IDWriteTextFormat* format);
 std::wstring toLower(const std::wstring& str);
 std::wstring_view textViewForRect(const App& app, const App::TextRect& tr);
@@ -30,9 +31,12 @@ void findLineRects(const App& app, float y, float& lineLeft, float& lineRight,
 void updateWindowTitle(App& app);
 void openUrl(const std::string& url);
 void copyToClipboard(HWND hwnd, const std::wstring& text);
-void extractText(const ElementPtr& elem, std::wstring& out);
+void extractText(const Element* elem, std::wstring& out);
 
 std::string slugifyHeading(const std::wstring& text);
+// Anchor id of the next TOC heading with this text: its slug, numbered
+// from the second occurrence on
+std::string nextHeadingId(std::unordered_map<std::string, int>& counts, const std::wstring& text);
 void scrollToHeadingY(App& app, float headingY);
 bool scrollToHeadingId(App& app, const std::string& id);
 void handleLinkClick(App& app);
@@ -301,10 +301,16 @@ bool createRenderTarget(App& app) {
         app.brush = nullptr;
     }
 
-    // D2D bitmaps are tied to the render target, so invalidate cached images
-    for (auto& [key, entry] : app.imageCache) {
-        if (entry.bitmap) { entry.bitmap->Release(); entry.bitmap = nullptr; }
-        entry.failed = false;  // retry on next layout
+    // D2D bitmaps and brushes are tied to the render target: drop the cached
+    // images so the next layout queues them for decoding again, and the code
+    // color brushes, along with the layout that still points at either.
+    // The document tiles are bitmaps of the old target too.
+    app.releaseDocumentTiles();
+    if (!app.imageCache.empty() || !app.codeBrushes.empty()) {
+        app.releaseImageCache();
+        app.clearLayoutCache();
+        app.releaseCodeBrushes();
+        app.layoutDirty = true;
     }
 
     RECT rc;
@@ -63,16 +63,17 @@ bool isSupportedPath(std::basic_string_view<Character> path) {
         isMermaidPath(path);
 }
 
-qmd::ParseResult createMermaidDocument(const std::string& content) {
+qmd::ParseResult createMermaidDocument(std::string_view content) {
     auto start = std::chrono::high_resolution_clock::now();
 
     qmd::ParseResult result;
-    result.root = std::make_shared<qmd::Element>(qmd::ElementType::Document);
-    auto diagram = std::make_shared<qmd::Element>(qmd::ElementType::MermaidDiagram);
-    diagram->text = content;
+    qmd::ElementArena* arena = nullptr;
+    result.root = qmd::newDocument(arena);
+    qmd::Element* diagram = arena->make(qmd::ElementType::MermaidDiagram);
+    diagram->text = arena->storeText(content);
     diagram->sourceOffset = 0;
-    diagram->parent = result.root.get();
-    result.root->children.push_back(std::move(diagram));
+    arena->append(result.root.get(), diagram);
+    arena->widenText(result.root.get());
     result.success = true;
     result.parseTimeUs = static_cast<size_t>(
         std::chrono::duration_cast<std::chrono::microseconds>(
@@ -80,6 +81,83 @@ qmd::ParseResult createMermaidDocument(const std::string& content) {
     return result;
 }
 
+bool isBlankLine(std::string_view line) {
+    return line.find_first_not_of(" \t\r") == std::string_view::npos;
+}
+
+// Leading spaces of a line, or SIZE_MAX when it starts with a tab
+size_t lineIndent(std::string_view line) {
+    size_t i = 0;
+    while (i < line.size() && line[i] == ' ') i++;
+    return i < line.size() && line[i] == '\t' ? SIZE_MAX : i;
+}
+
+// A ``` or ~~~ fence of at least three characters: its character and
+// length, or 0 when the line is none
+size_t fenceLength(std::string_view line, char& fenceChar) {
+    size_t indent = lineIndent(line);
+    if (indent > 3) return 0;
+    char c = indent < line.size() ? line[indent] : 0;
+    if (c != '`' && c != '~') return 0;
+    size_t n = 0;
+    while (indent + n < line.size() && line[indent + n] == c) n++;
+    if (n < 3) return 0;
+    fenceChar = c;
+    return n;
+}
+
+// HTML blocks that run on past blank lines (CommonMark types 1 and 2):
+// the text that closes the one the line opens, or empty
+std::string_view htmlBlockEnd(std::string_view line) {
+    static const std::string_view kBlocks[][2] = {
+        {"<!--", "-->"},
+        {"<pre", "</pre>"},
+        {"<script", "</script>"},
+        {"<style", "</style>"},
+        {"<textarea", "</textarea>"},
+    };
+    size_t indent = lineIndent(line);
+    if (indent > 3) return {};
+    line.remove_prefix(indent);
+    for (const auto& block : kBlocks) {
+        if (line.substr(0, block[0].size()) != block[0]) continue;
+        bool closed = line.find(block[1], block[0].size()) != std::string_view::npos;
+        return closed ? std::string_view() : block[1];
+    }
+    return {};
+}
+
+bool isLinkDefinition(std::string_view line) {
+    size_t indent = lineIndent(line);
+    if (indent > 3 || indent >= line.size() || line[indent] != '[') return false;
+    size_t close = line.find("]:", indent + 1);
+    return close != std::string_view::npos && close > indent + 1 &&
+        line.find('[', indent + 1) > close;
+}
+
+// The line can start a chunk: it starts a new top-level block that no
+// block before the blank line above could continue
+bool startsTopLevelBlock(std::string_view line) {
+    if (line.empty()) return false;
+    char c = line[0];
+    if (c == ' ' || c == '\t' || c == '>') return false;
+    if ((c == '-' || c == '*' || c == '+') &&
+        (line.size() == 1 || line[1] == ' ' || line[1] == '\t')) {
+        return false;
+    }
+    size_t digits = 0;
+    while (digits < line.size() && digits < 10 && line[digits] >= '0' && line[digits] <= '9') digits++;
+    if (digits > 0 && digits < line.size() && (line[digits] == '.' || line[digits] == ')')) {
+        return false;
+    }
+    return true;
+}
+
+void shiftSourceOffsets(qmd::Element* elem, size_t offset) {
+    if (elem->sourceOffset != SIZE_MAX) elem->sourceOffset += offset;
+    for (qmd::Element* child : elem->children) shiftSourceOffsets(child, offset);
+}
+
 } // namespace
 
 bool isMermaidDocumentPath(std::string_view path) {
@@ -103,15 +181,95 @@ bool isSupportedDropPath(std::wstring_view path) {
 }
 
 qmd::ParseResult parseDocument(qmd::MarkdownParser& parser,
-                               const std::string& content,
+                               std::string_view content,
                                std::string_view path) {
     if (isMermaidDocumentPath(path)) return createMermaidDocument(content);
     return parser.parse(content);
 }
 
 qmd::ParseResult parseDocument(qmd::MarkdownParser& parser,
-                               const std::string& content,
+                               std::string_view content,
                                std::wstring_view path) {
     if (isMermaidDocumentPath(path)) return createMermaidDocument(content);
     return parser.parse(content);
 }
+
+DocumentChunks splitDocument(std::string_view content, size_t firstBytes, size_t chunkBytes) {
+    DocumentChunks chunks;
+    chunks.starts.push_back(0);
+    size_t nextCut = firstBytes;
+    size_t fence = 0;              // length of the open code fence, if any
+    char fenceChar = 0;
+    std::string_view htmlEnd;      // closes the open multi-paragraph HTML block
+    bool previousBlank = false;
+
+    size_t pos = 0;
+    while (pos < content.size()) {
+        size_t end = content.find('\n', pos);
+        if (end == std::string_view::npos) end = content.size();
+        std::string_view line = content.substr(pos, end - pos);
+        bool blank = isBlankLine(line);
+
+        if (fence) {
+            char c = 0;
+            size_t n = fenceLength(line, c);
+            if (n >= fence && c == fenceChar && isBlankLine(line.substr(lineIndent(line) + n))) {
+                fence = 0;
+            }
+        } else if (!htmlEnd.empty()) {
+            if (line.find(htmlEnd) != std::string_view::npos) htmlEnd = {};
+        } else {
+            if (pos >= nextCut && previousBlank && !blank && startsTopLevelBlock(line)) {
+                chunks.starts.push_back(pos);
+                nextCut = pos + chunkBytes;
+            }
+            if ((fence = fenceLength(line, fenceChar)) != 0) {
+                // Everything up to the closing fence is code
+            } else if (!(htmlEnd = htmlBlockEnd(line)).empty()) {
+                // Blank lines inside do not end it
+            } else if (isLinkDefinition(line)) {
+                chunks.linkDefinitions.append(line);
+                chunks.linkDefinitions += '\n';
+            }
+        }
+
+        previousBlank = blank;
+        pos = end + 1;
+    }
+    // A block left open runs to the end of the document; closing it keeps
+    // the definitions appended to the last chunk out of it
+    if (fence) {
+        chunks.unclosedBlockEnd.assign(fence, fenceChar);
+    } else if (!htmlEnd.empty()) {
+        chunks.unclosedBlockEnd = htmlEnd;
+    }
+    return chunks;
+}
+
+qmd::ParseResult parseDocumentChunk(qmd::MarkdownParser& parser, std::string_view content,
+                                    const DocumentChunks& chunks, size_t index) {
+    size_t start = chunks.starts[index];
+    size_t end = index + 1 < chunks.starts.size() ? chunks.starts[index + 1] : content.size();
+    std::string_view chunk = content.substr(start, end - start);
+
+    qmd::ParseResult result;
+    if (chunks.linkDefinitions.empty()) {
+        result = parser.parse(chunk);
+    } else {
+        // Definitions produce no elements, so after the chunk's own text
+        // they leave its offsets alone
+        std::string source;
+        source.reserve(chunk.size() + 2 + chunks.unclosedBlockEnd.size() + 2 +
+                       chunks.linkDefinitions.size());
+        source.append(chunk);
+        if (index + 1 == chunks.starts.size() && !chunks.unclosedBlockEnd.empty()) {
+            if (!chunk.empty() && chunk.back() != '\n') source += '\n';
+            source += chunks.unclosedBlockEnd;
+        }
+        source += "\n\n";
+        source += chunks.linkDefinitions;
+        result = parser.parse(source);
+    }
+    if (result.success && start > 0) shiftSourceOffsets(result.root.get(), start);
+    return result;
+}
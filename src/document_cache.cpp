@@ -0,0 +1,282 @@
+#include "document_cache.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "settings.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cwctype>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+constexpr char kMagic[4] = {'T', 'N', 'T', 'C'};
+constexpr uint32_t kVersion = 2;
+constexpr size_t kMaxCachedSourceBytes = 32 * 1024 * 1024;
+constexpr size_t kMaxCacheEntries = 64;
+
+std::wstring cacheDirectory() {
+    std::wstring settings = getSettingsPath();
+    size_t slash = settings.find_last_of(L'\\');
+    if (slash == std::wstring::npos) return L"";
+    std::wstring dir = settings.substr(0, slash) + L"\\cache";
+    CreateDirectoryW(dir.c_str(), nullptr);  // Create if not exists
+    return dir;
+}
+
+// One entry per path, case-insensitively as Windows compares them
+std::wstring cacheFilePath(const std::wstring& path) {
+    std::wstring dir = cacheDirectory();
+    if (dir.empty()) return L"";
+    std::wstring folded = path;
+    for (wchar_t& c : folded) c = towlower(c);
+    uint64_t h = hashBytes(kFnvOffset, folded.data(), folded.size() * sizeof(wchar_t));
+    wchar_t name[32];
+    swprintf(name, 32, L"\\%016llx.cache", (unsigned long long)h);
+    return dir + name;
+}
+
+// --- Serialization ---
+
+class Writer {
+public:
+    template <typename T>
+    void put(T value) {
+        out_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void putString(std::string_view s) {
+        put((uint32_t)s.size());
+        out_.append(s.data(), s.size());
+    }
+    std::string& bytes() { return out_; }
+
+private:
+    std::string out_;
+};
+
+class Reader {
+public:
+    explicit Reader(std::string_view in) : in_(in) {}
+
+    template <typename T>
+    bool get(T& value) {
+        if (in_.size() - pos_ < sizeof(value)) return false;
+        std::memcpy(&value, in_.data() + pos_, sizeof(value));
+        pos_ += sizeof(value);
+        return true;
+    }
+    bool getString(std::string_view& s) {
+        uint32_t size = 0;
+        if (!get(size) || in_.size() - pos_ < size) return false;
+        s = in_.substr(pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+private:
+    std::string_view in_;
+    size_t pos_ = 0;
+};
+
+// Elements in pre-order, each followed by its children
+void writeElement(Writer& w, const qmd::Element* elem) {
+    w.put((uint8_t)elem->type);
+    w.put((uint8_t)elem->ordered);
+    w.put((int32_t)elem->level);
+    w.put((int32_t)elem->start);
+    w.put((int32_t)elem->align);
+    w.put((int32_t)elem->col_count);
+    w.put((uint64_t)elem->sourceOffset);
+    w.putString(qmd::narrowText(elem->wtext));
+    w.putString(elem->url);
+    w.putString(elem->title);
+    w.putString(elem->language);
+    w.put((uint32_t)elem->children.size());
+    for (const qmd::Element* child : elem->children) writeElement(w, child);
+}
+
+// Iterative, so a deeply nested document cannot exhaust the stack
+bool readTree(Reader& r, qmd::ParseResult& result) {
+    qmd::ElementArena* arena = nullptr;
+    qmd::ElementPtr root = qmd::newDocument(arena);
+    struct Open {
+        qmd::Element* elem;
+        uint32_t childrenLeft;
+    };
+    std::vector<Open> stack;
+    bool first = true;
+    do {
+        uint8_t type = 0, ordered = 0;
+        int32_t level = 0, start = 0, align = 0, colCount = 0;
+        uint64_t sourceOffset = 0;
+        std::string_view text, url, title, language;
+        uint32_t children = 0;
+        if (!r.get(type) || !r.get(ordered) || !r.get(level) || !r.get(start) ||
+            !r.get(align) || !r.get(colCount) || !r.get(sourceOffset) ||
+            !r.getString(text) || !r.getString(url) || !r.getString(title) ||
+            !r.getString(language) || !r.get(children) ||
+            type > (uint8_t)qmd::ElementType::Strikethrough) {
+            return false;
+        }
+        qmd::Element* elem = first ? root.get() : arena->make((qmd::ElementType)type);
+        if (first && type != (uint8_t)qmd::ElementType::Document) return false;
+        elem->ordered = ordered != 0;
+        elem->level = level;
+        elem->start = start;
+        elem->align = align;
+        elem->col_count = colCount;
+        elem->sourceOffset = (size_t)sourceOffset;
+        elem->text = arena->storeText(text);
+        elem->url = arena->store(url);
+        elem->title = arena->store(title);
+        elem->language = arena->store(language);
+        if (!first) {
+            arena->append(stack.back().elem, elem);
+            stack.back().childrenLeft--;
+        }
+        first = false;
+        if (children > 0) stack.push_back({elem, children});
+        while (!stack.empty() && stack.back().childrenLeft == 0) stack.pop_back();
+    } while (!stack.empty());
+
+    arena->widenText(root.get());
+    result.root = std::move(root);
+    result.success = true;
+    return true;
+}
+
+// Keep the most recently written entries
+void pruneCache(const std::wstring& dir) {
+    struct Entry {
+        std::wstring path;
+        uint64_t writeTime;
+    };
+    std::vector<Entry> entries;
+    WIN32_FIND_DATAW findData;
+    HANDLE find = FindFirstFileW((dir + L"\\*.cache").c_str(), &findData);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        uint64_t t = ((uint64_t)findData.ftLastWriteTime.dwHighDateTime << 32) |
+                     findData.ftLastWriteTime.dwLowDateTime;
+        entries.push_back({dir + L"\\" + findData.cFileName, t});
+    } while (FindNextFileW(find, &findData));
+    FindClose(find);
+    if (entries.size() <= kMaxCacheEntries) return;
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a.writeTime > b.writeTime; });
+    for (size_t i = kMaxCacheEntries; i < entries.size(); i++) {
+        DeleteFileW(entries[i].path.c_str());
+    }
+}
+
+} // namespace
+
+bool documentStamp(const std::wstring& path, DocumentStamp& stamp) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) return false;
+    stamp.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    stamp.writeTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+                      data.ftLastWriteTime.dwLowDateTime;
+    return stamp.valid();
+}
+
+bool loadDocumentCache(const std::wstring& path, const DocumentStamp& stamp,
+                       qmd::ParseResult& result, App::LayoutSeed& seed) {
+    if (!stamp.valid() || stamp.size > kMaxCachedSourceBytes) return false;
+    auto start = Clock::now();
+    std::wstring cachePath = cacheFilePath(path);
+    MappedFile file;
+    if (cachePath.empty() || !file.open(cachePath)) return false;
+
+    Reader r(file.view());
+    char magic[4] = {};
+    uint32_t version = 0;
+    uint64_t size = 0, writeTime = 0;
+    std::string_view savedPath;
+    if (!r.get(magic) || std::memcmp(magic, kMagic, 4) != 0 || !r.get(version) ||
+        version != kVersion || !r.get(size) || !r.get(writeTime) || !r.getString(savedPath)) {
+        return false;
+    }
+    // Changed since, or another path with the same file name hash
+    if (size != stamp.size || writeTime != stamp.writeTime || toWide(savedPath) != path) {
+        return false;
+    }
+
+    App::LayoutSeed loaded;
+    std::string_view fontFamily, codeFontFamily;
+    uint32_t blocks = 0;
+    if (!r.get(loaded.scale) || !r.get(loaded.scrollY) || !r.getString(fontFamily) ||
+        !r.getString(codeFontFamily) || !r.get(loaded.width) || !r.get(blocks)) {
+        return false;
+    }
+    loaded.fontFamily = toWide(fontFamily);
+    loaded.codeFontFamily = toWide(codeFontFamily);
+    loaded.blockHeights.reserve(std::min<uint32_t>(blocks, 1u << 20));
+    for (uint32_t i = 0; i < blocks; i++) {
+        std::pair<uint64_t, float> block;
+        if (!r.get(block.first) || !r.get(block.second)) return false;
+        loaded.blockHeights.push_back(block);
+    }
+    qmd::ParseResult tree;
+    if (!readTree(r, tree)) return false;
+
+    tree.parseTimeUs = (size_t)usElapsed(start);
+    result = std::move(tree);
+    seed = std::move(loaded);
+    return true;
+}
+
+bool layoutSeedApplies(const App& app, const App::LayoutSeed& seed) {
+    // Wrapping moves with the width; half a pixel is rounding
+    return seed.fontFamily == app.theme.fontFamily &&
+           seed.codeFontFamily == app.theme.codeFontFamily &&
+           std::fabs(seed.width - documentViewportWidth(app)) < 0.5f;
+}
+
+void saveDocumentCache(App& app) {
+    if (!app.documentCacheEnabled || !app.root || app.editMode ||
+        !app.currentFileStamp.valid() || app.currentFileStamp.size > kMaxCachedSourceBytes ||
+        app.layoutDirty || !app.layoutComplete || app.currentFile.empty()) {
+        return;
+    }
+    std::wstring path = toWide(app.currentFile);
+    std::wstring cachePath = cacheFilePath(path);
+    if (cachePath.empty()) return;
+
+    Writer w;
+    w.put(kMagic);
+    w.put(kVersion);
+    w.put(app.currentFileStamp.size);
+    w.put(app.currentFileStamp.writeTime);
+    w.putString(app.currentFile);
+    w.put(app.layoutBlocksScale);
+    w.put(app.scrollY);
+    w.putString(qmd::narrowText(app.theme.fontFamily));
+    w.putString(qmd::narrowText(app.theme.codeFontFamily));
+    w.put(documentViewportWidth(app));
+    w.put((uint32_t)app.layoutBlocks.size());
+    for (const auto& block : app.layoutBlocks) {
+        w.put(block.hash);
+        w.put(block.bottom - block.top);
+    }
+    writeElement(w, app.root.get());
+
+    // Written aside and moved over, so a crash mid-write leaves no torn entry
+    std::wstring tempPath = cachePath + L".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out) return;
+        out.write(w.bytes().data(), (std::streamsize)w.bytes().size());
+        if (!out) return;
+    }
+    if (MoveFileExW(tempPath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        pruneCache(cachePath.substr(0, cachePath.find_last_of(L'\\')));
+    } else {
+        DeleteFileW(tempPath.c_str());
+    }
+}
@@ -2,9 +2,12 @@
 #include "document.h"
 #include "utils.h"
 #include "file_utils.h"
+#include "hash.h"
 #include "render.h"
 #include "d2d_init.h"
 #include "search.h"
+#include "parse_worker.h"
+#include "mapped_file.h"
 
 #include <fstream>
 #include <sstream>
@@ -24,11 +27,43 @@ std::string toUtf8(const std::wstring& wstr) {
     return out;
 }
 
-static std::wstring fromUtf8(const std::string& str) {
+// Piece by piece, without first flattening the buffer into one wstring.
+// A surrogate pair split across two pieces is carried into the next one.
+std::string toUtf8(const TextBuffer& text) {
+    std::string out;
+    wchar_t carry[2] = {};
+    size_t carried = 0;
+    auto convert = [&](const wchar_t* data, size_t len) {
+        if (len == 0) return;
+        int bytes = WideCharToMultiByte(CP_UTF8, 0, data, (int)len, nullptr, 0, nullptr, nullptr);
+        size_t at = out.size();
+        out.resize(at + bytes);
+        WideCharToMultiByte(CP_UTF8, 0, data, (int)len, &out[at], bytes, nullptr, nullptr);
+    };
+    text.forEachChunk(0, text.size(), [&](const wchar_t* data, size_t len) {
+        if (carried) {
+            carry[1] = data[0];
+            convert(carry, 2);
+            carried = 0;
+            data++;
+            len--;
+        }
+        if (len > 0 && data[len - 1] >= 0xD800 && data[len - 1] <= 0xDBFF) {
+            carry[0] = data[len - 1];
+            carried = 1;
+            len--;
+        }
+        convert(data, len);
+    });
+    if (carried) convert(carry, 1);
+    return out;
+}
+
+static std::wstring fromUtf8(std::string_view str) {
     if (str.empty()) return {};
-    int len = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), nullptr, 0);
+    int len = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), nullptr, 0);
     std::wstring out(len, L'\0');
-    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), &out[0], len);
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &out[0], len);
     return out;
 }
 
@@ -46,12 +81,17 @@ static float editorTextMaxWidth(const App& app) {
     return std::max(10.0f, editorPaneWidth(app) - gutterWidth - padding * 2.0f);
 }
 
+static float editorLayoutMaxWidth(const App& app) {
+    return app.editorWordWrap ? editorTextMaxWidth(app) : 1e7f;
+}
+
 static IDWriteTextLayout* createEditorLineLayout(const App& app, size_t lineStart, size_t lineLen) {
     if (!app.dwriteFactory || !app.editorTextFormat || lineLen == 0) return nullptr;
-    float maxWidth = app.editorWordWrap ? editorTextMaxWidth(app) : 1e7f;
+    float maxWidth = editorLayoutMaxWidth(app);
     IDWriteTextLayout* layout = nullptr;
+    std::wstring lineText = app.editorText.substr(lineStart, lineLen);
     app.dwriteFactory->CreateTextLayout(
-        app.editorText.data() + lineStart, (UINT32)lineLen,
+        lineText.data(), (UINT32)lineLen,
         app.editorTextFormat, maxWidth, 1e7f, &layout);
     // The shared editor format is NO_WRAP; the wrap toggle overrides per layout
     if (layout && app.editorWordWrap) {
@@ -60,6 +100,80 @@ static IDWriteTextLayout* createEditorLineLayout(const App& app, size_t lineStar
     return layout;
 }
 
+// --- Line layout cache ---
+
+constexpr size_t kEditorLayoutCacheSize = 1024;
+
+// Gutter numbers and line text share the cache; the tag keeps their keys apart
+static uint64_t editorLayoutKeySeed(const App& app, char tag, float maxWidth) {
+    uint64_t h = hashValue(kFnvOffset, tag);
+    h = hashValue(h, maxWidth);
+    return hashValue(h, app.editorTextFormat ? app.editorTextFormat->GetFontSize() : 0.0f);
+}
+
+static uint64_t editorLineLayoutKey(const App& app, size_t lineStart, size_t lineLen) {
+    uint64_t h = editorLayoutKeySeed(app, 'L', editorLayoutMaxWidth(app));
+    h = hashValue(h, lineLen);
+    app.editorText.forEachChunk(lineStart, lineLen, [&](const wchar_t* data, size_t count) {
+        h = hashBytes(h, data, count * sizeof(wchar_t));
+    });
+    return h;
+}
+
+// Look up `key`, creating the layout with `create` on a miss. The cache
+// owns the result: callers don't release it, and it stays valid until
+// kEditorLayoutCacheSize other layouts have been looked up.
+template <typename Create>
+static IDWriteTextLayout* cachedEditorLayout(App& app, uint64_t key, size_t length,
+                                             Create&& create) {
+    auto found = app.editorLayoutIndex.find(key);
+    if (found != app.editorLayoutIndex.end() && found->second->length == length) {
+        app.editorLayoutLru.splice(app.editorLayoutLru.begin(), app.editorLayoutLru, found->second);
+        return found->second->layout;
+    }
+    if (found != app.editorLayoutIndex.end()) {
+        // Hash collision with a different length: replace the old entry
+        if (found->second->layout) found->second->layout->Release();
+        app.editorLayoutLru.erase(found->second);
+        app.editorLayoutIndex.erase(found);
+    }
+
+    IDWriteTextLayout* layout = create();
+    if (!layout) return nullptr;
+    app.editorLayoutLru.push_front({key, length, layout});
+    app.editorLayoutIndex[key] = app.editorLayoutLru.begin();
+    while (app.editorLayoutLru.size() > kEditorLayoutCacheSize) {
+        auto& oldest = app.editorLayoutLru.back();
+        if (oldest.layout) oldest.layout->Release();
+        app.editorLayoutIndex.erase(oldest.key);
+        app.editorLayoutLru.pop_back();
+    }
+    return layout;
+}
+
+static IDWriteTextLayout* editorLineLayout(App& app, size_t lineStart, size_t lineLen) {
+    if (!app.dwriteFactory || !app.editorTextFormat || lineLen == 0) return nullptr;
+    return cachedEditorLayout(app, editorLineLayoutKey(app, lineStart, lineLen), lineLen,
+        [&] { return createEditorLineLayout(app, lineStart, lineLen); });
+}
+
+// Line number layout for the gutter, `width` x `height`
+static IDWriteTextLayout* editorGutterLayout(App& app, size_t lineNumber, float width,
+                                             float height) {
+    if (!app.dwriteFactory || !app.editorTextFormat) return nullptr;
+    wchar_t text[16];
+    int len = swprintf(text, 16, L"%d", (int)lineNumber);
+    if (len <= 0) return nullptr;
+    uint64_t key = hashValue(editorLayoutKeySeed(app, 'G', width), lineNumber);
+    key = hashValue(key, height);
+    return cachedEditorLayout(app, key, (size_t)len, [&] {
+        IDWriteTextLayout* layout = nullptr;
+        app.dwriteFactory->CreateTextLayout(text, (UINT32)len, app.editorTextFormat,
+                                            width, height, &layout);
+        return layout;
+    });
+}
+
 // Caret x,y within a (possibly wrapped) line layout for the caret placed
 // before column `col`
 static void editorCaretXY(IDWriteTextLayout* layout, size_t col, float& x, float& y) {
@@ -113,94 +227,169 @@ static size_t editorNextCharEnd(const App& app, size_t pos) {
     return p;
 }
 
-// --- Line starts ---
+// --- Line index ---
+//
+// Line starts come from the text buffer's piece tree, which keeps them up
+// to date through every insert and erase
 
-static void rebuildEditorRowMetrics(App& app);
+static size_t getLineCount(const App& app) {
+    return app.editorText.lineCount();
+}
 
-void rebuildLineStarts(App& app) {
-    app.editorLineStarts.clear();
-    app.editorLineStarts.push_back(0);
-    for (size_t i = 0; i < app.editorText.size(); i++) {
-        if (app.editorText[i] == L'\n') {
-            app.editorLineStarts.push_back(i + 1);
-        }
-    }
-    rebuildEditorRowMetrics(app);
+static size_t getLineStart(const App& app, size_t line) {
+    return app.editorText.lineStart(line);
 }
 
 static size_t getLineFromPos(const App& app, size_t pos) {
-    // Binary search for line containing pos
-    size_t lo = 0, hi = app.editorLineStarts.size();
-    while (lo + 1 < hi) {
-        size_t mid = (lo + hi) / 2;
-        if (app.editorLineStarts[mid] <= pos) lo = mid;
-        else hi = mid;
-    }
-    return lo;
+    return app.editorText.lineFromPos(pos);
 }
 
 static size_t getColFromPos(const App& app, size_t pos) {
     size_t line = getLineFromPos(app, pos);
-    return pos - app.editorLineStarts[line];
+    return pos - getLineStart(app, line);
 }
 
 static size_t getLineEnd(const App& app, size_t line) {
-    if (line + 1 < app.editorLineStarts.size())
-        return app.editorLineStarts[line + 1] - 1; // before '\n'
+    if (line + 1 < getLineCount(app))
+        return getLineStart(app, line + 1) - 1; // before '\n'
     return app.editorText.size();
 }
 
 static size_t getLineLength(const App& app, size_t line) {
-    return getLineEnd(app, line) - app.editorLineStarts[line];
+    return getLineEnd(app, line) - getLineStart(app, line);
 }
 
 // --- Soft-wrap row metrics ---
 //
 // In wrap mode each logical line occupies one or more visual rows.
-// editorRowStarts holds the cumulative row count before each line so
+// editorRows keeps the row count of each line and their prefix sums so
 // scroll, click, and caret math can map between rows and lines.
 
+static float editorCharCellWidth(const App& app) {
+    return app.editorCharWidth > 0 ? app.editorCharWidth
+        : (app.editorTextFormat ? app.editorTextFormat->GetFontSize() * 0.6f : 10.0f);
+}
+
+static uint32_t measureEditorLineRows(const App& app, size_t line, float maxTextWidth,
+                                      float charWidth) {
+    size_t lineLen = getLineLength(app, line);
+    uint32_t rows = 1;
+    // A line can't wrap unless it could exceed the pane width even at
+    // full-width glyph advances (2x the ASCII cell) — skip the layout
+    // for the common short line
+    if (lineLen > 0 && (float)lineLen * charWidth * 2.0f > maxTextWidth) {
+        IDWriteTextLayout* layout =
+            createEditorLineLayout(app, getLineStart(app, line), lineLen);
+        if (layout) {
+            DWRITE_TEXT_METRICS tm{};
+            if (SUCCEEDED(layout->GetMetrics(&tm)) && tm.lineCount > 0) {
+                rows = tm.lineCount;
+            }
+            layout->Release();
+        }
+    }
+    return rows;
+}
+
 static void rebuildEditorRowMetrics(App& app) {
-    app.editorRowStarts.clear();
-    app.editorTotalRows = 0;
+    app.editorRows.clear();
     app.editorRowMetricsWidth = -1.0f;
     if (!app.editorWordWrap || !app.editMode) return;
 
     float maxTextWidth = editorTextMaxWidth(app);
     app.editorRowMetricsWidth = maxTextWidth;
-    float charWidth = app.editorCharWidth > 0 ? app.editorCharWidth
-        : (app.editorTextFormat ? app.editorTextFormat->GetFontSize() * 0.6f : 10.0f);
+    float charWidth = editorCharCellWidth(app);
 
-    size_t lineCount = app.editorLineStarts.size();
-    app.editorRowStarts.reserve(lineCount + 1);
-    app.editorRowStarts.push_back(0);
+    size_t lineCount = getLineCount(app);
+    app.editorRows.rows.resize(lineCount);
     for (size_t i = 0; i < lineCount; i++) {
-        size_t lineLen = getLineLength(app, i);
-        size_t rows = 1;
-        // A line can't wrap unless it could exceed the pane width even at
-        // full-width glyph advances (2x the ASCII cell) — skip the layout
-        // for the common short line
-        if (lineLen > 0 && (float)lineLen * charWidth * 2.0f > maxTextWidth) {
-            IDWriteTextLayout* layout =
-                createEditorLineLayout(app, app.editorLineStarts[i], lineLen);
-            if (layout) {
-                DWRITE_TEXT_METRICS tm{};
-                if (SUCCEEDED(layout->GetMetrics(&tm)) && tm.lineCount > 0) {
-                    rows = tm.lineCount;
-                }
-                layout->Release();
-            }
-        }
-        app.editorRowStarts.push_back(app.editorRowStarts.back() + rows);
+        app.editorRows.rows[i] = measureEditorLineRows(app, i, maxTextWidth, charWidth);
     }
-    app.editorTotalRows = app.editorRowStarts.back();
+    app.editorRows.build();
+}
+
+// An edit at pos replaced text holding removedNewlines with text holding
+// insertedNewlines: re-measure only the lines it now spans and splice
+// them over the old ones
+static void updateEditorRowMetrics(App& app, size_t pos, size_t removedNewlines,
+                                   size_t insertedNewlines) {
+    if (!app.editorWordWrap || app.editorRowMetricsWidth < 0.0f) return;
+    size_t lineCount = getLineCount(app);
+    if (app.editorRows.size() + insertedNewlines != lineCount + removedNewlines) {
+        rebuildEditorRowMetrics(app);  // out of sync; start over
+        return;
+    }
+
+    float maxTextWidth = app.editorRowMetricsWidth;
+    float charWidth = editorCharCellWidth(app);
+    size_t first = getLineFromPos(app, pos);
+    std::vector<uint32_t> fresh(insertedNewlines + 1);
+    for (size_t i = 0; i < fresh.size(); i++) {
+        fresh[i] = measureEditorLineRows(app, first + i, maxTextWidth, charWidth);
+    }
+    app.editorRows.replace(first, removedNewlines + 1, fresh);
+}
+
+static size_t countNewlines(std::wstring_view text) {
+    return (size_t)std::count(text.begin(), text.end(), L'\n');
+}
+
+// Drop the cached layouts of lines [firstLine, lastLine] before they are
+// edited; their new text gets new keys, so nothing else needs touching
+static void forgetEditorLineLayouts(App& app, size_t firstLine, size_t lastLine) {
+    if (app.editorLayoutIndex.empty()) return;
+    for (size_t line = firstLine; line <= lastLine && line < getLineCount(app); line++) {
+        size_t lineLen = getLineLength(app, line);
+        if (lineLen == 0) continue;
+        auto found = app.editorLayoutIndex.find(
+            editorLineLayoutKey(app, getLineStart(app, line), lineLen));
+        if (found == app.editorLayoutIndex.end()) continue;
+        if (found->second->layout) found->second->layout->Release();
+        app.editorLayoutLru.erase(found->second);
+        app.editorLayoutIndex.erase(found);
+    }
+}
+
+// Every edit of the buffer goes through these two so the wrap metrics
+// and the layout cache follow along incrementally
+static TextBuffer::Span editorInsertText(App& app, size_t pos, const std::wstring& text) {
+    size_t line = getLineFromPos(app, pos);
+    forgetEditorLineLayouts(app, line, line);
+    TextBuffer::Span span = app.editorText.insert(pos, text);
+    updateEditorRowMetrics(app, pos, 0, countNewlines(text));
+    return span;
+}
+
+// Put back text an undo record points at; nothing is copied
+static void editorInsertSpans(App& app, size_t pos, const TextBuffer::Span* spans, size_t count) {
+    size_t line = getLineFromPos(app, pos);
+    forgetEditorLineLayouts(app, line, line);
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) length += spans[i].length;
+    app.editorText.insertSpans(pos, spans, count);
+    size_t addedNewlines = 0;
+    app.editorText.forEachChunk(pos, length, [&](const wchar_t* data, size_t n) {
+        addedNewlines += countNewlines(std::wstring_view(data, n));
+    });
+    updateEditorRowMetrics(app, pos, 0, addedNewlines);
+}
+
+static void editorEraseText(App& app, size_t pos, size_t len) {
+    size_t removedNewlines = 0;
+    app.editorText.forEachChunk(pos, len, [&](const wchar_t* data, size_t count) {
+        removedNewlines += countNewlines(std::wstring_view(data, count));
+    });
+    size_t firstLine = getLineFromPos(app, pos);
+    forgetEditorLineLayouts(app, firstLine, firstLine + removedNewlines);
+    app.editorText.erase(pos, len);
+    updateEditorRowMetrics(app, pos, removedNewlines, 0);
 }
 
 // Rebuild row metrics if the wrap width changed (resize, zoom, splitter,
 // preview toggle) or the line count is out of sync
 static void ensureEditorRowMetrics(App& app) {
     if (!app.editorWordWrap) return;
-    if (app.editorRowStarts.size() != app.editorLineStarts.size() + 1 ||
+    if (app.editorRows.size() != getLineCount(app) ||
         std::abs(editorTextMaxWidth(app) - app.editorRowMetricsWidth) > 0.5f) {
         rebuildEditorRowMetrics(app);
     }
@@ -208,14 +397,13 @@ static void ensureEditorRowMetrics(App& app) {
 
 // Logical line containing a global visual row
 static size_t editorLineFromRow(const App& app, size_t row) {
-    if (app.editorRowStarts.size() < 2) return 0;
-    size_t lo = 0, hi = app.editorRowStarts.size() - 1;
-    while (lo + 1 < hi) {
-        size_t mid = (lo + hi) / 2;
-        if (app.editorRowStarts[mid] <= row) lo = mid;
-        else hi = mid;
-    }
-    return lo;
+    return app.editorRows.lineFromRow(row);
+}
+
+// Visual rows before a logical line (the line itself in unwrapped terms
+// when the metrics are not available)
+static size_t editorRowOfLine(const App& app, size_t line) {
+    return line <= app.editorRows.size() ? app.editorRows.rowsBefore(line) : line;
 }
 
 // Top visible logical line for the current editor scroll position
@@ -235,10 +423,10 @@ static void editorMoveCursorVertical(App& app, bool down) {
     ensureEditorRowMetrics(app);
     float lineHeight = app.editorTextFormat ? app.editorTextFormat->GetFontSize() * 1.5f : 20.0f;
     size_t line = getLineFromPos(app, app.editorCursorPos);
-    size_t col = app.editorCursorPos - app.editorLineStarts[line];
+    size_t col = app.editorCursorPos - getLineStart(app, line);
 
-    IDWriteTextLayout* layout = createEditorLineLayout(
-        app, app.editorLineStarts[line], getLineLength(app, line));
+    IDWriteTextLayout* layout = editorLineLayout(
+        app, getLineStart(app, line), getLineLength(app, line));
     float cx = 0, cy = 0;
     editorCaretXY(layout, col, cx, cy);
     if (app.editorDesiredCol < 0) {
@@ -261,20 +449,19 @@ static void editorMoveCursorVertical(App& app, bool down) {
         float layoutHeight = SUCCEEDED(layout->GetMetrics(&tm)) ? tm.height : lineHeight;
         float targetY = cy + (down ? lineHeight : -lineHeight) + lineHeight * 0.5f;
         if (targetY >= 0.0f && targetY < layoutHeight) {
-            app.editorCursorPos = app.editorLineStarts[line] +
+            app.editorCursorPos = getLineStart(app, line) +
                 hitCol(layout, app.editorDesiredX, targetY, getLineLength(app, line));
             moved = true;
         }
-        layout->Release();
     }
 
     if (!moved) {
-        bool hasAdjacent = down ? (line + 1 < app.editorLineStarts.size()) : (line > 0);
+        bool hasAdjacent = down ? (line + 1 < getLineCount(app)) : (line > 0);
         if (!hasAdjacent) return;
         size_t adjacent = down ? line + 1 : line - 1;
         size_t adjacentLen = getLineLength(app, adjacent);
-        IDWriteTextLayout* adjacentLayout = createEditorLineLayout(
-            app, app.editorLineStarts[adjacent], adjacentLen);
+        IDWriteTextLayout* adjacentLayout = editorLineLayout(
+            app, getLineStart(app, adjacent), adjacentLen);
         float targetY = lineHeight * 0.5f;
         if (!down && adjacentLayout) {
             // entering from below: land on the LAST visual row
@@ -283,67 +470,53 @@ static void editorMoveCursorVertical(App& app, bool down) {
                 targetY = tm.height - lineHeight * 0.5f;
             }
         }
-        app.editorCursorPos = app.editorLineStarts[adjacent] +
+        app.editorCursorPos = getLineStart(app, adjacent) +
             hitCol(adjacentLayout, app.editorDesiredX, targetY, adjacentLen);
-        if (adjacentLayout) adjacentLayout->Release();
     }
 }
 
 // --- Undo/Redo ---
 
-static void pushUndo(App& app, App::EditAction::Type type, size_t pos,
-                      const std::wstring& text, size_t curBefore, size_t curAfter) {
-    // Coalesce consecutive single-char inserts
-    if (type == App::EditAction::Insert && text.size() == 1 && !app.undoStack.empty()) {
-        auto& last = app.undoStack.back();
-        if (last.type == App::EditAction::Insert &&
-            last.position + last.text.size() == pos &&
-            text[0] != L'\n' && text[0] != L' ') {
-            last.text += text;
-            last.cursorAfter = curAfter;
-            return;
-        }
-    }
-    app.undoStack.push_back({type, pos, text, curBefore, curAfter});
-    app.redoStack.clear();
+static void recordInsert(App& app, size_t pos, TextBuffer::Span span, size_t curBefore,
+                         size_t curAfter, bool burst) {
+    app.undoLog.record(UndoLog::Kind::Insert, pos, &span, 1, curBefore, curAfter,
+                       GetTickCount64(), burst);
+    app.undoLog.releaseText(app.editorText);
+}
+
+// Call before erasing: the spans name the text about to go
+static void recordDelete(App& app, size_t pos, size_t len, size_t curBefore, size_t curAfter,
+                         bool burst) {
+    std::vector<TextBuffer::Span> spans;
+    app.editorText.spans(pos, len, spans);
+    app.undoLog.record(UndoLog::Kind::Delete, pos, spans.data(), spans.size(), curBefore,
+                       curAfter, GetTickCount64(), burst);
 }
 
 static void editorUndo(App& app) {
-    if (app.undoStack.empty()) return;
-    auto action = app.undoStack.back();
-    app.undoStack.pop_back();
-
-    if (action.type == App::EditAction::Insert) {
-        // Reverse: delete the inserted text
-        app.editorText.erase(action.position, action.text.size());
-        app.editorCursorPos = action.cursorBefore;
-        app.redoStack.push_back(action);
-    } else {
-        // Reverse: re-insert the deleted text
-        app.editorText.insert(action.position, action.text);
-        app.editorCursorPos = action.cursorBefore;
-        app.redoStack.push_back(action);
-    }
-    rebuildLineStarts(app);
+    bool undone = app.undoLog.undo([&](const UndoLog::Edit& edit, const TextBuffer::Span* spans) {
+        if (edit.kind == UndoLog::Kind::Insert) {
+            editorEraseText(app, edit.position, edit.length);
+        } else {
+            editorInsertSpans(app, edit.position, spans, edit.spanCount);
+        }
+        app.editorCursorPos = edit.cursorBefore;
+    });
+    if (!undone) return;
     app.editorHasSelection = false;
     app.editorDesiredCol = -1;
 }
 
 static void editorRedo(App& app) {
-    if (app.redoStack.empty()) return;
-    auto action = app.redoStack.back();
-    app.redoStack.pop_back();
-
-    if (action.type == App::EditAction::Insert) {
-        app.editorText.insert(action.position, action.text);
-        app.editorCursorPos = action.cursorAfter;
-        app.undoStack.push_back(action);
-    } else {
-        app.editorText.erase(action.position, action.text.size());
-        app.editorCursorPos = action.cursorAfter;
-        app.undoStack.push_back(action);
-    }
-    rebuildLineStarts(app);
+    bool redone = app.undoLog.redo([&](const UndoLog::Edit& edit, const TextBuffer::Span* spans) {
+        if (edit.kind == UndoLog::Kind::Insert) {
+            editorInsertSpans(app, edit.position, spans, edit.spanCount);
+        } else {
+            editorEraseText(app, edit.position, edit.length);
+        }
+        app.editorCursorPos = edit.cursorAfter;
+    });
+    if (!redone) return;
     app.editorHasSelection = false;
     app.editorDesiredCol = -1;
 }
@@ -354,12 +527,10 @@ static void editorDeleteSelection(App& app) {
     if (!app.editorHasSelection) return;
     size_t selMin = std::min(app.editorSelStart, app.editorSelEnd);
     size_t selMax = std::max(app.editorSelStart, app.editorSelEnd);
-    std::wstring deleted = app.editorText.substr(selMin, selMax - selMin);
-    pushUndo(app, App::EditAction::Delete, selMin, deleted, app.editorCursorPos, selMin);
-    app.editorText.erase(selMin, selMax - selMin);
+    recordDelete(app, selMin, selMax - selMin, app.editorCursorPos, selMin, false);
+    editorEraseText(app, selMin, selMax - selMin);
     app.editorCursorPos = selMin;
     app.editorHasSelection = false;
-    rebuildLineStarts(app);
 }
 
 static size_t editorSelMin(const App& app) {
@@ -468,19 +639,18 @@ static std::wstring editorGetClipboard(HWND hwnd) {
 // --- Scroll helpers ---
 
 static void editorEnsureCursorVisible(App& app) {
-    if (app.editorLineStarts.empty()) return;
+    if (!app.editMode) return;
     size_t line = getLineFromPos(app, app.editorCursorPos);
     float lineHeight = app.editorTextFormat ? app.editorTextFormat->GetFontSize() * 1.5f : 20.0f;
     float padding = dpi(app, 8.0f);
     float cursorY;
     if (app.editorWordWrap) {
         ensureEditorRowMetrics(app);
-        IDWriteTextLayout* layout = createEditorLineLayout(
-            app, app.editorLineStarts[line], getLineLength(app, line));
+        IDWriteTextLayout* layout = editorLineLayout(
+            app, getLineStart(app, line), getLineLength(app, line));
         float cx = 0, cy = 0;
-        editorCaretXY(layout, app.editorCursorPos - app.editorLineStarts[line], cx, cy);
-        if (layout) layout->Release();
-        size_t rowStart = (line < app.editorRowStarts.size()) ? app.editorRowStarts[line] : line;
+        editorCaretXY(layout, app.editorCursorPos - getLineStart(app, line), cx, cy);
+        size_t rowStart = editorRowOfLine(app, line);
         cursorY = padding + rowStart * lineHeight + cy;
     } else {
         cursorY = padding + line * lineHeight;
@@ -505,10 +675,10 @@ void performEditorSearch(App& app) {
 
     // Build lowercase versions for case-insensitive search
     std::wstring textLower;
-    textLower.resize(app.editorText.size());
-    for (size_t i = 0; i < app.editorText.size(); i++) {
-        textLower[i] = towlower(app.editorText[i]);
-    }
+    textLower.reserve(app.editorText.size());
+    app.editorText.forEachChunk(0, app.editorText.size(), [&](const wchar_t* data, size_t len) {
+        for (size_t i = 0; i < len; i++) textLower += (wchar_t)towlower(data[i]);
+    });
 
     std::wstring queryLower;
     queryLower.resize(app.searchQuery.size());
@@ -518,6 +688,17 @@ void performEditorSearch(App& app) {
 
     app.editorSearchMatches.reserve(64);
 
+    if (app.searchRegex || app.searchWholeWord) {
+        if (!app.searchPattern.compile(queryLower, app.searchRegex, app.searchWholeWord)) return;
+        std::vector<SearchPattern::Match> found;
+        app.searchPattern.find(textLower.data(), textLower.size(), 0, true, found);
+        for (const auto& match : found) {
+            app.editorSearchMatches.push_back({match.start, match.length});
+        }
+        return;
+    }
+    app.searchPattern.clear();
+
     size_t pos = 0;
     while ((pos = textLower.find(queryLower, pos)) != std::wstring::npos) {
         app.editorSearchMatches.push_back({pos, app.searchQuery.length()});
@@ -585,13 +766,9 @@ void editorReparse(App& app) {
         }
     }
 
-    auto result = parseDocument(app.parser, utf8, app.currentFile);
-    if (result.success) {
-        app.root = result.root;
-        app.parseTimeUs = result.parseTimeUs;
-        app.layoutDirty = true;
-        InvalidateRect(app.hwnd, nullptr, FALSE);
-    }
+    // Parsed off the UI thread so typing never waits on md4c; the preview
+    // swaps in on WM_APP_PARSE_DONE unless a newer edit superseded it
+    requestParse(app, std::move(utf8), app.currentFile, ParseReason::Update);
 }
 
 // --- Mode transitions ---
@@ -609,44 +786,50 @@ void enterEditMode(App& app) {
     }
 
     // Load raw file content
+    // Converted straight from the mapped bytes; falls back to a stream read
+    // when the file cannot be mapped
     std::wstring widePath = toWide(app.currentFile);
-    std::ifstream file(widePath, std::ios::binary);
-    if (!file) return;
-
-    std::stringstream buf;
-    buf << file.rdbuf();
-    std::string content = buf.str();
+    std::wstring text;
+    MappedFile mapped;
+    if (mapped.open(widePath)) {
+        text = fromUtf8(mapped.view());
+    } else {
+        std::ifstream file(widePath, std::ios::binary);
+        if (!file) return;
+        std::stringstream buf;
+        buf << file.rdbuf();
+        text = fromUtf8(buf.str());
+    }
+    mapped.close();
 
-    app.editorText = fromUtf8(content);
-    // Normalize \r\n to \n
-    std::wstring normalized;
-    normalized.reserve(app.editorText.size());
-    for (size_t i = 0; i < app.editorText.size(); i++) {
-        if (app.editorText[i] == L'\r') {
-            normalized += L'\n';
-            if (i + 1 < app.editorText.size() && app.editorText[i + 1] == L'\n') i++;
+    // Normalize \r\n (and lone \r) to \n in place
+    size_t out = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == L'\r') {
+            text[out++] = L'\n';
+            if (i + 1 < text.size() && text[i + 1] == L'\n') i++;
         } else {
-            normalized += app.editorText[i];
+            text[out++] = text[i];
         }
     }
-    app.editorText = std::move(normalized);
+    text.resize(out);
+    app.editorText.assign(std::move(text));
 
-    rebuildLineStarts(app);
+    rebuildEditorRowMetrics(app);
     app.editorCursorPos = 0;
     app.editorDesiredCol = -1;
     app.editorScrollY = 0;
     app.editorHasSelection = false;
     app.editorDirty = false;
-    app.undoStack.clear();
-    app.redoStack.clear();
+    app.undoLog.clear();
     app.editorSearchMatches.clear();
     app.editorSearchCurrentIndex = 0;
     app.editMode = true;
     app.escPressedOnce = false;
     app.confirmExitPending = false;
 
-    // Disable file watch while editing
-    KillTimer(app.hwnd, 1); // TIMER_FILE_WATCH = 1
+    // External changes are not reloaded while editing (handleFileChanged);
+    // leaving edit mode rereads the file
 
     // Show notification
     app.editorNotificationMsg = L"Press ESC twice to exit edit mode";
@@ -677,9 +860,8 @@ void exitEditMode(App& app) {
 
     app.editMode = false;
     app.editorText.clear();
-    app.editorLineStarts.clear();
-    app.undoStack.clear();
-    app.redoStack.clear();
+    app.clearEditorLayoutCache();
+    app.undoLog.clear();
     app.editorSearchMatches.clear();
     app.editorSearchCurrentIndex = 0;
     // Close search if open
@@ -692,22 +874,8 @@ void exitEditMode(App& app) {
     KillTimer(app.hwnd, TIMER_EDITOR_REPARSE);
     updateBlinkTimer(app);
 
-    // Re-enable file watch
-    updateFileWriteTime(app);
-    SetTimer(app.hwnd, 1, 500, nullptr); // TIMER_FILE_WATCH = 1
-
     // Reload file to pick up saved changes
-    std::wstring widePath = toWide(app.currentFile);
-    std::ifstream file(widePath);
-    if (file) {
-        std::stringstream buf;
-        buf << file.rdbuf();
-        auto result = parseDocument(app.parser, buf.str(), app.currentFile);
-        if (result.success) {
-            app.root = result.root;
-            app.parseTimeUs = result.parseTimeUs;
-        }
-    }
+    requestParseFile(app, toWide(app.currentFile), app.currentFile, ParseReason::Update);
 
     // Update window title (remove dirty marker)
     updateWindowTitle(app);
@@ -759,7 +927,6 @@ void saveEditorFile(App& app, HWND hwnd) {
         out.write(utf8.data(), utf8.size());
         out.close();
         app.editorDirty = false;
-        updateFileWriteTime(app);
 
         // Reparse and update preview immediately
         editorReparse(app);
@@ -948,10 +1115,9 @@ void handleEditorKeyDown(App& app, HWND hwnd, WPARAM wParam) {
                 if (!paste.empty()) {
                     if (app.editorHasSelection) editorDeleteSelection(app);
                     size_t before = app.editorCursorPos;
-                    app.editorText.insert(app.editorCursorPos, paste);
+                    TextBuffer::Span span = editorInsertText(app, app.editorCursorPos, paste);
                     app.editorCursorPos += paste.size();
-                    pushUndo(app, App::EditAction::Insert, before, paste, before, app.editorCursorPos);
-                    rebuildLineStarts(app);
+                    recordInsert(app, before, span, before, app.editorCursorPos, false);
                     scheduleReparse(app);
                     editorEnsureCursorVisible(app);
                     InvalidateRect(hwnd, nullptr, FALSE);
@@ -1074,12 +1240,12 @@ void handleEditorKeyDown(App& app, HWND hwnd, WPARAM wParam) {
                 size_t col = (app.editorDesiredCol >= 0) ? (size_t)app.editorDesiredCol : getColFromPos(app, app.editorCursorPos);
                 if (app.editorDesiredCol < 0) app.editorDesiredCol = (int)col;
                 size_t prevLineLen = getLineLength(app, line - 1);
-                app.editorCursorPos = app.editorLineStarts[line - 1] + std::min(col, prevLineLen);
-            } else if (down && line + 1 < app.editorLineStarts.size()) {
+                app.editorCursorPos = getLineStart(app, line - 1) + std::min(col, prevLineLen);
+            } else if (down && line + 1 < getLineCount(app)) {
                 size_t col = (app.editorDesiredCol >= 0) ? (size_t)app.editorDesiredCol : getColFromPos(app, app.editorCursorPos);
                 if (app.editorDesiredCol < 0) app.editorDesiredCol = (int)col;
                 size_t nextLineLen = getLineLength(app, line + 1);
-                app.editorCursorPos = app.editorLineStarts[line + 1] + std::min(col, nextLineLen);
+                app.editorCursorPos = getLineStart(app, line + 1) + std::min(col, nextLineLen);
             }
             if (shift) editorUpdateSelEnd(app);
             else app.editorHasSelection = false;
@@ -1091,7 +1257,7 @@ void handleEditorKeyDown(App& app, HWND hwnd, WPARAM wParam) {
         case VK_HOME: {
             editorStartOrExtendSelection(app, shift);
             size_t line = getLineFromPos(app, app.editorCursorPos);
-            app.editorCursorPos = app.editorLineStarts[line];
+            app.editorCursorPos = getLineStart(app, line);
             app.editorDesiredCol = -1;
             if (shift) editorUpdateSelEnd(app);
             else app.editorHasSelection = false;
@@ -1121,7 +1287,7 @@ void handleEditorKeyDown(App& app, HWND hwnd, WPARAM wParam) {
             size_t col = getColFromPos(app, app.editorCursorPos);
             size_t targetLine = (line > (size_t)pageLines) ? line - pageLines : 0;
             size_t targetLineLen = getLineLength(app, targetLine);
-            app.editorCursorPos = app.editorLineStarts[targetLine] + std::min(col, targetLineLen);
+            app.editorCursorPos = getLineStart(app, targetLine) + std::min(col, targetLineLen);
             if (shift) editorUpdateSelEnd(app);
             else app.editorHasSelection = false;
             editorEnsureCursorVisible(app);
@@ -1136,9 +1302,9 @@ void handleEditorKeyDown(App& app, HWND hwnd, WPARAM wParam) {
             int pageLines = std::max(1, (int)(app.height / lineHeight) - 2);
             size_t line = getLineFromPos(app, app.editorCursorPos);
             size_t col = getColFromPos(app, app.editorCursorPos);
-            size_t targetLine = std::min(line + pageLines, app.editorLineStarts.size() - 1);
+            size_t targetLine = std::min(line + pageLines, getLineCount(app) - 1);
             size_t targetLineLen = getLineLength(app, targetLine);
-            app.editorCursorPos = app.editorLineStarts[targetLine] + std::min(col, targetLineLen);
+            app.editorCursorPos = getLineStart(app, targetLine) + std::min(col, targetLineLen);
             if (shift) editorUpdateSelEnd(app);
             else app.editorHasSelection = false;
             editorEnsureCursorVisible(app);
@@ -1151,11 +1317,9 @@ void handleEditorKeyDown(App& app, HWND hwnd, WPARAM wParam) {
                 editorDeleteSelection(app);
             } else if (app.editorCursorPos < app.editorText.size()) {
                 size_t delEnd = editorNextCharEnd(app, app.editorCursorPos);
-                std::wstring deleted = app.editorText.substr(app.editorCursorPos, delEnd - app.editorCursorPos);
-                pushUndo(app, App::EditAction::Delete, app.editorCursorPos, deleted,
-                         app.editorCursorPos, app.editorCursorPos);
-                app.editorText.erase(app.editorCursorPos, delEnd - app.editorCursorPos);
-                rebuildLineStarts(app);
+                recordDelete(app, app.editorCursorPos, delEnd - app.editorCursorPos,
+                             app.editorCursorPos, app.editorCursorPos, true);
+                editorEraseText(app, app.editorCursorPos, delEnd - app.editorCursorPos);
             }
             app.editorDesiredCol = -1;
             scheduleReparse(app);
@@ -1199,11 +1363,9 @@ void handleEditorCharInput(App& app, HWND hwnd, WPARAM wParam) {
         } else if (app.editorCursorPos > 0) {
             size_t before = app.editorCursorPos;
             size_t delStart = editorPrevCharStart(app, app.editorCursorPos);
-            std::wstring deleted = app.editorText.substr(delStart, before - delStart);
-            app.editorText.erase(delStart, before - delStart);
+            recordDelete(app, delStart, before - delStart, before, delStart, true);
+            editorEraseText(app, delStart, before - delStart);
             app.editorCursorPos = delStart;
-            pushUndo(app, App::EditAction::Delete, app.editorCursorPos, deleted, before, app.editorCursorPos);
-            rebuildLineStarts(app);
         }
         app.editorDesiredCol = -1;
         scheduleReparse(app);
@@ -1220,10 +1382,9 @@ void handleEditorCharInput(App& app, HWND hwnd, WPARAM wParam) {
         std::wstring spaces = L"    ";
         if (app.editorHasSelection) editorDeleteSelection(app);
         size_t before = app.editorCursorPos;
-        app.editorText.insert(app.editorCursorPos, spaces);
+        TextBuffer::Span span = editorInsertText(app, app.editorCursorPos, spaces);
         app.editorCursorPos += 4;
-        pushUndo(app, App::EditAction::Insert, before, spaces, before, app.editorCursorPos);
-        rebuildLineStarts(app);
+        recordInsert(app, before, span, before, app.editorCursorPos, true);
         app.editorDesiredCol = -1;
         scheduleReparse(app);
         editorEnsureCursorVisible(app);
@@ -1238,10 +1399,10 @@ void handleEditorCharInput(App& app, HWND hwnd, WPARAM wParam) {
     if (app.editorHasSelection) editorDeleteSelection(app);
     std::wstring ins(1, ch);
     size_t before = app.editorCursorPos;
-    app.editorText.insert(app.editorCursorPos, ins);
+    TextBuffer::Span span = editorInsertText(app, app.editorCursorPos, ins);
     app.editorCursorPos++;
-    pushUndo(app, App::EditAction::Insert, before, ins, before, app.editorCursorPos);
-    rebuildLineStarts(app);
+    // A new line ends the burst, so each line typed undoes on its own
+    recordInsert(app, before, span, before, app.editorCursorPos, ch != L'\n');
     app.editorDesiredCol = -1;
     scheduleReparse(app);
     editorEnsureCursorVisible(app);
@@ -1253,19 +1414,18 @@ void handleEditorCharInput(App& app, HWND hwnd, WPARAM wParam) {
 // Place the IME composition window at the caret so candidate lists for
 // CJK input appear where the user is typing instead of the window corner.
 void editorPositionImeWindow(App& app, HWND hwnd) {
-    if (!app.editMode || app.editorLineStarts.empty()) return;
+    if (!app.editMode) return;
     HIMC himc = ImmGetContext(hwnd);
     if (!himc) return;
 
     size_t line = getLineFromPos(app, app.editorCursorPos);
-    size_t lineStart = app.editorLineStarts[line];
+    size_t lineStart = getLineStart(app, line);
     size_t lineLen = getLineLength(app, line);
     size_t col = std::min(app.editorCursorPos - lineStart, lineLen);
 
-    IDWriteTextLayout* layout = createEditorLineLayout(app, lineStart, lineLen);
+    IDWriteTextLayout* layout = editorLineLayout(app, lineStart, lineLen);
     float xOff = 0, yOff = 0;
     editorCaretXY(layout, col, xOff, yOff);
-    if (layout) layout->Release();
 
     float lineHeight = app.editorTextFormat ? app.editorTextFormat->GetFontSize() * 1.5f : 20.0f;
     float padding = dpi(app, 8.0f);
@@ -1274,7 +1434,7 @@ void editorPositionImeWindow(App& app, HWND hwnd) {
     float lineTop;
     if (app.editorWordWrap) {
         ensureEditorRowMetrics(app);
-        size_t rowStart = (line < app.editorRowStarts.size()) ? app.editorRowStarts[line] : line;
+        size_t rowStart = editorRowOfLine(app, line);
         lineTop = padding + rowStart * lineHeight;
     } else {
         lineTop = padding + line * lineHeight;
@@ -1291,7 +1451,7 @@ void editorPositionImeWindow(App& app, HWND hwnd) {
 // --- Mouse handling ---
 
 static size_t editorPosFromClick(App& app, int x, int y) {
-    if (!app.editorTextFormat || app.editorLineStarts.empty()) return 0;
+    if (!app.editorTextFormat) return 0;
 
     float lineHeight = app.editorTextFormat->GetFontSize() * 1.5f;
     float padding = dpi(app, 8.0f);
@@ -1303,16 +1463,16 @@ static size_t editorPosFromClick(App& app, int x, int y) {
         ensureEditorRowMetrics(app);
         size_t row = (size_t)std::max(0, (int)(adjustedY / lineHeight));
         line = editorLineFromRow(app, row);
-        if (line < app.editorRowStarts.size()) {
-            localY = adjustedY - app.editorRowStarts[line] * lineHeight;
+        if (line < app.editorRows.size()) {
+            localY = adjustedY - app.editorRows.rowsBefore(line) * lineHeight;
             localY = std::max(0.0f, localY);
         }
     } else {
         line = (size_t)std::max(0, (int)(adjustedY / lineHeight));
     }
-    if (line >= app.editorLineStarts.size()) line = app.editorLineStarts.size() - 1;
+    if (line >= getLineCount(app)) line = getLineCount(app) - 1;
 
-    size_t lineStart = app.editorLineStarts[line];
+    size_t lineStart = getLineStart(app, line);
     size_t lineLen = getLineLength(app, line);
 
     float gutterWidth = dpi(app, 48.0f);
@@ -1322,12 +1482,11 @@ static size_t editorPosFromClick(App& app, int x, int y) {
     adjustedX = std::max(0.0f, adjustedX);
 
     size_t col;
-    IDWriteTextLayout* layout = createEditorLineLayout(app, lineStart, lineLen);
+    IDWriteTextLayout* layout = editorLineLayout(app, lineStart, lineLen);
     if (layout) {
         BOOL trailing = FALSE, inside = FALSE;
         DWRITE_HIT_TEST_METRICS m{};
         layout->HitTestPoint(adjustedX, localY, &trailing, &inside, &m);
-        layout->Release();
         // trailing hit means the click was past the glyph's midpoint: the
         // caret goes after the full character (m.length covers surrogate pairs)
         col = (size_t)m.textPosition + (trailing ? (size_t)m.length : 0);
@@ -1399,7 +1558,7 @@ void handleEditorMouseDown(App& app, HWND hwnd, int x, int y) {
     } else if (app.clickCount == 3) {
         // Triple-click: select line
         size_t line = getLineFromPos(app, clickPos);
-        app.editorSelStart = app.editorLineStarts[line];
+        app.editorSelStart = getLineStart(app, line);
         app.editorSelEnd = getLineEnd(app, line);
         if (app.editorSelEnd < app.editorText.size()) app.editorSelEnd++; // include \n
         app.editorCursorPos = app.editorSelEnd;
@@ -1515,12 +1674,12 @@ static void editorFillRangeRects(App& app, IDWriteTextLayout* layout,
     }
 }
 
-// Soft-wrap rendering: each logical line spans editorRowStarts-many visual
+// Soft-wrap rendering: each logical line spans editorRows-many visual
 // rows; highlights and the caret come from DirectWrite hit testing on the
 // wrapped per-line layouts
 static void renderEditorWrapped(App& app, float editorWidth) {
     ensureEditorRowMetrics(app);
-    if (app.editorRowStarts.size() != app.editorLineStarts.size() + 1) return;
+    if (app.editorRows.size() != getLineCount(app)) return;
 
     float lineHeight = app.editorTextFormat->GetFontSize() * 1.5f;
     float padding = dpi(app, 8.0f);
@@ -1550,24 +1709,26 @@ static void renderEditorWrapped(App& app, float editorWidth) {
 
     size_t firstRow = (size_t)std::max(0.0f, (app.editorScrollY - padding) / lineHeight);
     size_t firstLine = editorLineFromRow(app, firstRow);
+    size_t lineRow = app.editorRows.rowsBefore(firstLine);
 
-    for (size_t i = firstLine; i < app.editorLineStarts.size(); i++) {
-        float lineY = padding + app.editorRowStarts[i] * lineHeight - app.editorScrollY;
+    for (size_t i = firstLine; i < getLineCount(app); i++) {
+        float lineY = padding + lineRow * lineHeight - app.editorScrollY;
         if (lineY > app.height) break;
+        lineRow += app.editorRows.rows[i];
 
-        size_t lineStart = app.editorLineStarts[i];
+        size_t lineStart = getLineStart(app, i);
         size_t lineLen = getLineLength(app, i);
-        IDWriteTextLayout* lineLayout = createEditorLineLayout(app, lineStart, lineLen);
+        IDWriteTextLayout* lineLayout = editorLineLayout(app, lineStart, lineLen);
 
         // Line number on the first visual row of the line
-        wchar_t lineNum[16];
-        swprintf(lineNum, 16, L"%d", (int)i + 1);
+        IDWriteTextLayout* numLayout = editorGutterLayout(
+            app, i + 1, gutterWidth - dpi(app, 8.0f), lineHeight);
         D2D1_COLOR_F gutterColor = app.theme.text;
         gutterColor.a = 0.3f;
         app.brush->SetColor(gutterColor);
-        app.renderTarget->DrawText(lineNum, (UINT32)wcslen(lineNum), app.editorTextFormat,
-            D2D1::RectF(dpi(app, 4.0f), lineY, gutterWidth - dpi(app, 4.0f), lineY + lineHeight),
-            app.brush);
+        if (numLayout) {
+            app.renderTarget->DrawTextLayout(D2D1::Point2F(dpi(app, 4.0f), lineY), numLayout, app.brush);
+        }
 
         // Selection highlight
         if (app.editorHasSelection && selMax > lineStart && selMin < lineStart + lineLen + 1) {
@@ -1629,10 +1790,9 @@ static void renderEditorWrapped(App& app, float editorWidth) {
                 app.brush);
         }
 
-        if (lineLayout) lineLayout->Release();
     }
 
-    app.editorContentHeight = padding * 2 + app.editorTotalRows * lineHeight;
+    app.editorContentHeight = padding * 2 + app.editorRows.totalRows * lineHeight;
 
     // Editor scrollbar (same as unwrapped)
     if (app.editorContentHeight > app.height) {
@@ -1653,7 +1813,7 @@ static void renderEditorWrapped(App& app, float editorWidth) {
 }
 
 void renderEditor(App& app, float editorWidth) {
-    if (!app.editorTextFormat || app.editorLineStarts.empty()) return;
+    if (!app.editorTextFormat) return;
 
     if (app.editorWordWrap) {
         renderEditorWrapped(app, editorWidth);
@@ -1677,7 +1837,7 @@ void renderEditor(App& app, float editorWidth) {
     // Calculate visible line range
     int firstVisible = std::max(0, (int)((app.editorScrollY - padding) / lineHeight));
     int lastVisible = (int)((app.editorScrollY + app.height) / lineHeight) + 1;
-    lastVisible = std::min(lastVisible, (int)app.editorLineStarts.size() - 1);
+    lastVisible = std::min(lastVisible, (int)getLineCount(app) - 1);
 
     // Selection range
     size_t selMin = 0, selMax = 0;
@@ -1695,31 +1855,33 @@ void renderEditor(App& app, float editorWidth) {
 
     // Advance search scan index to first match that could overlap visible lines
     if (hasSearchMatches && firstVisible > 0) {
-        size_t firstVisiblePos = app.editorLineStarts[firstVisible];
+        size_t firstVisiblePos = getLineStart(app, firstVisible);
         while (searchScanIdx < app.editorSearchMatches.size() &&
                app.editorSearchMatches[searchScanIdx].startPos + app.editorSearchMatches[searchScanIdx].length <= firstVisiblePos) {
             searchScanIdx++;
         }
     }
 
-    for (int i = firstVisible; i <= lastVisible && i < (int)app.editorLineStarts.size(); i++) {
+    for (int i = firstVisible; i <= lastVisible && i < (int)getLineCount(app); i++) {
         float lineY = padding + i * lineHeight - app.editorScrollY;
-        size_t lineStart = app.editorLineStarts[i];
+        size_t lineStart = getLineStart(app, i);
         size_t lineLen = getLineLength(app, i);
 
-        // One DirectWrite layout per visible line: reused for highlight
-        // metrics and drawing so overlays always match the actual glyphs
-        // (CJK and other full-width characters are wider than charWidth)
-        IDWriteTextLayout* lineLayout = createEditorLineLayout(app, lineStart, lineLen);
+        // One DirectWrite layout per visible line, from the layout cache:
+        // reused for highlight metrics and drawing so overlays always match
+        // the actual glyphs (CJK and other full-width characters are wider
+        // than charWidth)
+        IDWriteTextLayout* lineLayout = editorLineLayout(app, lineStart, lineLen);
 
         // Line number
-        wchar_t lineNum[16];
-        swprintf(lineNum, 16, L"%d", i + 1);
+        IDWriteTextLayout* numLayout = editorGutterLayout(
+            app, (size_t)i + 1, gutterWidth - dpi(app, 8.0f), lineHeight);
         D2D1_COLOR_F gutterColor = app.theme.text;
         gutterColor.a = 0.3f;
         app.brush->SetColor(gutterColor);
-        app.renderTarget->DrawText(lineNum, (UINT32)wcslen(lineNum), app.editorTextFormat,
-            D2D1::RectF(dpi(app, 4.0f), lineY, gutterWidth - dpi(app, 4.0f), lineY + lineHeight), app.brush);
+        if (numLayout) {
+            app.renderTarget->DrawTextLayout(D2D1::Point2F(dpi(app, 4.0f), lineY), numLayout, app.brush);
+        }
 
         // Selection highlight on this line
         if (app.editorHasSelection && selMax > lineStart && selMin < lineStart + lineLen + 1) {
@@ -1780,18 +1942,16 @@ void renderEditor(App& app, float editorWidth) {
                 D2D1::Point2F(gutterWidth + padding, lineY), lineLayout, app.brush);
         }
 
-        if (lineLayout) lineLayout->Release();
     }
 
     // Cursor (blink state driven by TIMER_CURSOR_BLINK)
     if (app.cursorBlinkOn) {
         size_t curLine = getLineFromPos(app, app.editorCursorPos);
         size_t curCol = getColFromPos(app, app.editorCursorPos);
-        size_t curLineStart = app.editorLineStarts[curLine];
+        size_t curLineStart = getLineStart(app, curLine);
         size_t curLineLen = getLineLength(app, curLine);
-        IDWriteTextLayout* curLayout = createEditorLineLayout(app, curLineStart, curLineLen);
+        IDWriteTextLayout* curLayout = editorLineLayout(app, curLineStart, curLineLen);
         float curX = gutterWidth + padding + editorColToX(app, curLayout, std::min(curCol, curLineLen));
-        if (curLayout) curLayout->Release();
         float curY = padding + curLine * lineHeight - app.editorScrollY;
 
         app.brush->SetColor(app.theme.text);
@@ -1800,7 +1960,7 @@ void renderEditor(App& app, float editorWidth) {
     }
 
     // Update content height for scrolling
-    app.editorContentHeight = padding * 2 + app.editorLineStarts.size() * lineHeight;
+    app.editorContentHeight = padding * 2 + getLineCount(app) * lineHeight;
 
     // Editor scrollbar
     if (app.editorContentHeight > app.height) {
@@ -1,20 +1,7 @@
 #include "file_utils.h"
-#include "document.h"
+#include "folder_index.h"
 #include "utils.h"
 
-#include <algorithm>
-
-void updateFileWriteTime(App& app) {
-    if (app.currentFile.empty()) return;
-    std::wstring widePath = toWide(app.currentFile);
-    HANDLE h = CreateFileW(widePath.c_str(), GENERIC_READ,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
-    if (h != INVALID_HANDLE_VALUE) {
-        GetFileTime(h, nullptr, nullptr, &app.lastFileWriteTime);
-        CloseHandle(h);
-    }
-}
-
 bool isRootPath(const std::wstring& path) {
     if (path.length() == 3 && path[1] == L':' && (path[2] == L'\\' || path[2] == L'/')) {
         return true;
@@ -45,57 +32,28 @@ std::wstring getDirectoryFromFile(const std::string& filePath) {
 }
 
 void populateFolderItems(App& app) {
-    app.folderItems.clear();
     app.hoveredFolderIndex = -1;
     app.folderBrowserScroll = 0.0f;
+    if (!app.folderBrowserPath.empty()) indexFolder(app, app.folderBrowserPath);
+    refreshFolderItems(app);
+}
+
+void refreshFolderItems(App& app) {
+    app.folderItems.clear();
+    app.folderListingPending = false;
 
     if (app.folderBrowserPath.empty()) return;
 
+    if (!app.folderSearchQuery.empty()) {
+        searchFolderIndex(app, app.folderItems);
+        return;
+    }
+
     // Add ".." entry if not at root
     if (!isRootPath(app.folderBrowserPath)) {
         app.folderItems.push_back({L"..", true});
     }
 
-    // Build search pattern
-    std::wstring searchPath = app.folderBrowserPath;
-    if (searchPath.back() != L'\\' && searchPath.back() != L'/') {
-        searchPath += L'\\';
-    }
-    searchPath += L"*";
-
-    WIN32_FIND_DATAW findData;
-    HANDLE hFind = FindFirstFileW(searchPath.c_str(), &findData);
-    if (hFind == INVALID_HANDLE_VALUE) return;
-
-    std::vector<App::FolderItem> folders;
-    std::vector<App::FolderItem> files;
-
-    do {
-        std::wstring name = findData.cFileName;
-
-        // Skip . and ..
-        if (name == L"." || name == L"..") continue;
-
-        // Skip hidden files
-        if (findData.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN) continue;
-
-        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            folders.push_back({name, true});
-        } else if (isSupportedDocumentPath(name)) {
-            files.push_back({name, false});
-        }
-    } while (FindNextFileW(hFind, &findData));
-
-    FindClose(hFind);
-
-    // Sort alphabetically (case-insensitive)
-    auto cmpFunc = [](const App::FolderItem& a, const App::FolderItem& b) {
-        return _wcsicmp(a.name.c_str(), b.name.c_str()) < 0;
-    };
-    std::sort(folders.begin(), folders.end(), cmpFunc);
-    std::sort(files.begin(), files.end(), cmpFunc);
-
-    // Add folders first, then files
-    for (auto& f : folders) app.folderItems.push_back(std::move(f));
-    for (auto& f : files) app.folderItems.push_back(std::move(f));
+    // Listed in the background; WM_APP_FOLDER_INDEX refreshes when it lands
+    app.folderListingPending = !cachedFolderListing(app, app.folderBrowserPath, app.folderItems);
 }
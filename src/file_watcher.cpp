@@ -0,0 +1,293 @@
+#include "file_watcher.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "parse_worker.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Quiet time after the last notification before the file is read, and the
+// longest a steady stream of writes can hold the reload back
+constexpr DWORD kSettleMs = 150;
+constexpr ULONGLONG kMaxDelayMs = 2000;
+// Directories that do not deliver change notifications (some network
+// shares) fall back to comparing the write time at this interval
+constexpr DWORD kPollMs = 2000;
+
+enum class Wake { Change, Quiet, Control };
+
+DWORD remainingMs(ULONGLONG deadline) {
+    ULONGLONG now = GetTickCount64();
+    return now >= deadline ? 0 : (DWORD)(deadline - now);
+}
+
+// An overlapped ReadDirectoryChangesW kept pending on the directory holding
+// the file. Once the first read is issued the system buffers notifications
+// for the handle, so nothing is lost between completions.
+class DirectoryWatch {
+public:
+    DirectoryWatch() = default;
+    DirectoryWatch(const DirectoryWatch&) = delete;
+    DirectoryWatch& operator=(const DirectoryWatch&) = delete;
+    ~DirectoryWatch() { close(); }
+
+    bool open(const std::wstring& path) {
+        close();
+        size_t slash = path.find_last_of(L"\\/");
+        std::wstring directory = slash == std::wstring::npos ? L"." : path.substr(0, slash + 1);
+        name_ = slash == std::wstring::npos ? path : path.substr(slash + 1);
+        dir_ = CreateFileW(directory.c_str(), FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (dir_ == INVALID_HANDLE_VALUE) return false;
+        overlapped_.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!overlapped_.hEvent || !issue()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (dir_ != INVALID_HANDLE_VALUE) {
+            if (pending_) {
+                CancelIoEx(dir_, &overlapped_);
+                DWORD bytes = 0;
+                GetOverlappedResult(dir_, &overlapped_, &bytes, TRUE);
+            }
+            CloseHandle(dir_);
+            dir_ = INVALID_HANDLE_VALUE;
+        }
+        if (overlapped_.hEvent) CloseHandle(overlapped_.hEvent);
+        overlapped_ = {};
+        pending_ = false;
+    }
+
+    bool isOpen() const { return dir_ != INVALID_HANDLE_VALUE; }
+
+    // Block until a notification names the file, `control` is signaled or
+    // timeoutMs passes without either. Notifications for other files in
+    // the directory are consumed here without waking anyone.
+    Wake wait(HANDLE control, DWORD timeoutMs) {
+        ULONGLONG deadline = GetTickCount64() + timeoutMs;
+        for (;;) {
+            HANDLE handles[] = {control, overlapped_.hEvent};
+            DWORD wait = timeoutMs == INFINITE ? INFINITE : remainingMs(deadline);
+            DWORD r = WaitForMultipleObjects(2, handles, FALSE, wait);
+            if (r == WAIT_TIMEOUT) return Wake::Quiet;
+            if (r != WAIT_OBJECT_0 + 1) return Wake::Control;
+
+            DWORD bytes = 0;
+            bool ok = GetOverlappedResult(dir_, &overlapped_, &bytes, FALSE) != 0;
+            pending_ = false;
+            // Zero bytes means the buffer overflowed: anything may have changed
+            bool named = !ok || bytes == 0 || namesFile();
+            if (!issue()) {
+                // The directory went away; the caller polls from here on
+                close();
+                return Wake::Change;
+            }
+            if (named) return Wake::Change;
+        }
+    }
+
+private:
+    bool issue() {
+        ResetEvent(overlapped_.hEvent);
+        pending_ = ReadDirectoryChangesW(dir_, buffer_, sizeof(buffer_), FALSE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+            nullptr, &overlapped_, nullptr) != 0;
+        return pending_;
+    }
+
+    // Writes, and renames onto the name (editors that save through a
+    // temporary file), both show up as an entry with the file's name
+    bool namesFile() const {
+        const BYTE* p = buffer_;
+        for (;;) {
+            auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+            int length = (int)(info->FileNameLength / sizeof(wchar_t));
+            if (CompareStringOrdinal(info->FileName, length, name_.c_str(), (int)name_.size(),
+                                     TRUE) == CSTR_EQUAL) {
+                return true;
+            }
+            if (info->NextEntryOffset == 0) return false;
+            p += info->NextEntryOffset;
+        }
+    }
+
+    HANDLE dir_ = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped_ = {};
+    bool pending_ = false;
+    std::wstring name_;
+    alignas(DWORD) BYTE buffer_[16384];
+};
+
+struct FileStamp {
+    uint64_t writeTime = 0;
+    uint64_t size = 0;
+    bool operator!=(const FileStamp& o) const { return writeTime != o.writeTime || size != o.size; }
+};
+
+FileStamp fileStamp(const std::wstring& path) {
+    FileStamp stamp;
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        stamp.writeTime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+                          data.ftLastWriteTime.dwLowDateTime;
+        stamp.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    }
+    return stamp;
+}
+
+Wake pollForChange(const std::wstring& path, HANDLE control, DWORD timeoutMs, FileStamp& stamp) {
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    for (;;) {
+        DWORD wait = timeoutMs == INFINITE ? kPollMs : std::min(kPollMs, remainingMs(deadline));
+        if (WaitForSingleObject(control, wait) == WAIT_OBJECT_0) return Wake::Control;
+        FileStamp now = fileStamp(path);
+        if (now != stamp) {
+            stamp = now;
+            return Wake::Change;
+        }
+        if (timeoutMs != INFINITE && remainingMs(deadline) == 0) return Wake::Quiet;
+    }
+}
+
+// FNV-1a over the file's bytes. MappedFile opens with every sharing mode,
+// so this fails only while the file cannot be opened at all, e.g. it was
+// deleted or replaced mid-save.
+bool hashFile(const std::wstring& path, uint64_t& hash) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+    std::string_view bytes = file.view();
+    hash = hashBytes(kFnvOffset, bytes.data(), bytes.size());
+    return true;
+}
+
+} // namespace
+
+// path and generation are shared with the watcher thread and guarded by
+// `mutex`; `control` wakes the thread when either changes or on shutdown
+struct App::FileWatchState {
+    std::mutex mutex;
+    std::thread thread;
+    HANDLE control = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    HWND hwnd = nullptr;
+    bool stopping = false;
+    std::wstring path;
+    uint64_t generation = 0;  // bumped by every watchFile; only the UI thread writes it
+
+    ~FileWatchState() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        SetEvent(control);
+        if (thread.joinable()) thread.join();
+        CloseHandle(control);
+    }
+};
+
+namespace {
+
+void watchLoop(App::FileWatchState* state) {
+    DirectoryWatch watch;
+    std::wstring path;
+    uint64_t generation = 0;
+    uint64_t hash = 0;
+    bool hashed = false;
+    FileStamp stamp;
+
+    auto waitForChange = [&](DWORD timeoutMs) {
+        return watch.isOpen() ? watch.wait(state->control, timeoutMs)
+                              : pollForChange(path, state->control, timeoutMs, stamp);
+    };
+
+    for (;;) {
+        bool retarget = false;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->stopping) return;
+            if (state->generation != generation) {
+                generation = state->generation;
+                path = state->path;
+                retarget = true;
+            }
+        }
+        if (retarget) {
+            watch.close();
+            hashed = false;
+            if (!path.empty()) {
+                watch.open(path);
+                stamp = fileStamp(path);
+                hashed = hashFile(path, hash);
+            }
+        }
+        if (path.empty()) {
+            WaitForSingleObject(state->control, INFINITE);
+            continue;
+        }
+
+        if (waitForChange(INFINITE) == Wake::Control) continue;
+
+        // Coalesce: wait until the file has been quiet for kSettleMs, but no
+        // longer than kMaxDelayMs in total
+        ULONGLONG first = GetTickCount64();
+        bool interrupted = false;
+        bool readable = false;
+        uint64_t newHash = 0;
+        for (;;) {
+            Wake wake = waitForChange(kSettleMs);
+            if (wake == Wake::Control) {
+                interrupted = true;
+                break;
+            }
+            bool overdue = GetTickCount64() - first >= kMaxDelayMs;
+            if (wake == Wake::Change && !overdue) continue;
+            readable = hashFile(path, newHash);
+            // Still missing after the whole window: wait for it to reappear
+            if (readable || overdue) break;
+        }
+        if (interrupted || !readable) continue;
+
+        // Touched but not changed (a save without edits, a build step that
+        // rewrote the same output): nothing to reload
+        if (hashed && newHash == hash) continue;
+        hash = newHash;
+        hashed = true;
+        PostMessage(state->hwnd, WM_APP_FILE_CHANGED, (WPARAM)generation, 0);
+    }
+}
+
+} // namespace
+
+void watchFile(App& app, const std::string& path) {
+    if (!app.fileWatcher) {
+        app.fileWatcher = std::make_shared<App::FileWatchState>();
+        app.fileWatcher->hwnd = app.hwnd;
+        app.fileWatcher->thread = std::thread(watchLoop, app.fileWatcher.get());
+    }
+    auto& state = *app.fileWatcher;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.path = path.empty() ? std::wstring() : toWide(path);
+        state.generation++;
+    }
+    SetEvent(state.control);
+}
+
+void handleFileChanged(App& app, WPARAM generation) {
+    if (!app.fileWatcher || generation != (WPARAM)app.fileWatcher->generation) return;
+    if (app.currentFile.empty() || !app.fileWatchEnabled || app.editMode) return;
+    // Swapped in on WM_APP_PARSE_DONE, keeping the scroll position
+    requestParseFile(app, toWide(app.currentFile), app.currentFile, ParseReason::Update);
+}
+
+void stopFileWatcher(App& app) {
+    app.fileWatcher.reset();  // the destructor stops and joins the thread
+}
@@ -0,0 +1,668 @@
+#include "folder_index.h"
+#include "document.h"
+#include "file_utils.h"
+#include "trigram_index.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+constexpr unsigned kMaxReaders = 4;
+// Bounds on what one root costs: opening the browser on a drive root must
+// not walk the whole disk
+constexpr size_t kMaxCrawlDirectories = 20000;
+constexpr size_t kMaxIndexedDocuments = 20000;
+// Larger documents are found by name and headings only, and past the
+// second bound, by name only
+constexpr size_t kMaxIndexedBytes = size_t(8) << 20;
+constexpr size_t kMaxHeadingScanBytes = size_t(64) << 20;
+// Folded text kept across all documents; older bodies are dropped past it
+constexpr size_t kMaxIndexedTextBytes = size_t(256) << 20;
+constexpr size_t kMaxSearchHits = 200;
+// Progress while indexing refreshes the open browser at most this often
+constexpr ULONGLONG kNotifyIntervalMs = 150;
+// Without change notifications a shown listing older than this is re-listed
+constexpr ULONGLONG kUnwatchedMaxAgeMs = 2000;
+// A changed document is re-read once it has gone this long without another
+// change: a save reports several writes
+constexpr ULONGLONG kSettleMs = 500;
+
+bool isSeparator(wchar_t c) {
+    return c == L'\\' || c == L'/';
+}
+
+// Paths are kept without a trailing separator ("C:" for a drive root)
+std::wstring trimSeparators(std::wstring path) {
+    while (!path.empty() && isSeparator(path.back())) path.pop_back();
+    return path;
+}
+
+std::wstring joinPath(const std::wstring& directory, const std::wstring& name) {
+    return directory + L'\\' + name;
+}
+
+std::wstring listingKey(const std::wstring& path) {
+    std::wstring key = path;
+    TrigramIndex::fold(key);
+    std::replace(key.begin(), key.end(), L'/', L'\\');
+    return key;
+}
+
+bool isUnder(const std::wstring& root, const std::wstring& path) {
+    std::wstring r = listingKey(root);
+    std::wstring p = listingKey(path);
+    return p.size() >= r.size() && p.compare(0, r.size(), r) == 0 &&
+           (p.size() == r.size() || p[r.size()] == L'\\');
+}
+
+// `path` relative to `root`, which it must lie under
+std::wstring relativeTo(const std::wstring& root, const std::wstring& path) {
+    return path.size() > root.size() ? path.substr(root.size() + 1) : std::wstring();
+}
+
+std::wstring parentOf(const std::wstring& path) {
+    size_t slash = path.find_last_of(L"\\/");
+    return slash == std::wstring::npos ? std::wstring() : path.substr(0, slash);
+}
+
+// Read a document for indexing with every sharing mode, so an editor
+// saving it in place is never refused. Past `maxBytes` nothing is read and
+// only its name is indexed.
+bool readDocument(const std::wstring& path, size_t maxBytes, std::string& out) {
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size = {};
+    bool ok = GetFileSizeEx(file, &size) != 0;
+    if (ok && (ULONGLONG)size.QuadPart <= maxBytes) {
+        out.resize((size_t)size.QuadPart);
+        size_t done = 0;
+        while (done < out.size()) {
+            DWORD chunk = (DWORD)std::min<size_t>(out.size() - done, 1u << 30);
+            DWORD read = 0;
+            if (!ReadFile(file, out.data() + done, chunk, &read, nullptr)) {
+                ok = false;
+                break;
+            }
+            if (read == 0) break;  // truncated while reading
+            done += read;
+        }
+        out.resize(done);
+    }
+    CloseHandle(file);
+    return ok;
+}
+
+// Non-hidden subfolders and supported documents, folders first, each sorted
+// case-insensitively. FindExInfoBasic skips the 8.3 names and a large
+// fetch asks for bigger batches per round trip, which is most of the cost
+// of listing a directory on a network share.
+bool listDirectory(const std::wstring& directory, std::vector<App::FolderItem>& items) {
+    std::wstring pattern = joinPath(directory, L"*");
+    WIN32_FIND_DATAW findData;
+    HANDLE hFind = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &findData,
+                                    FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFind == INVALID_HANDLE_VALUE) return false;
+
+    std::vector<App::FolderItem> folders;
+    std::vector<App::FolderItem> files;
+    do {
+        std::wstring name = findData.cFileName;
+        if (name == L"." || name == L"..") continue;
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN) continue;
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            folders.push_back({name, true});
+        } else if (isSupportedDocumentPath(name)) {
+            files.push_back({name, false});
+        }
+    } while (FindNextFileW(hFind, &findData));
+    FindClose(hFind);
+
+    auto cmpFunc = [](const App::FolderItem& a, const App::FolderItem& b) {
+        return _wcsicmp(a.name.c_str(), b.name.c_str()) < 0;
+    };
+    std::sort(folders.begin(), folders.end(), cmpFunc);
+    std::sort(files.begin(), files.end(), cmpFunc);
+    items.reserve(items.size() + folders.size() + files.size());
+    for (auto& f : folders) items.push_back(std::move(f));
+    for (auto& f : files) items.push_back(std::move(f));
+    return true;
+}
+
+// An overlapped ReadDirectoryChangesW over a whole tree. The buffer is kept
+// at 64 KB, the most a network redirector will fill.
+class TreeWatch {
+public:
+    TreeWatch() = default;
+    TreeWatch(const TreeWatch&) = delete;
+    TreeWatch& operator=(const TreeWatch&) = delete;
+    ~TreeWatch() { close(); }
+
+    bool open(const std::wstring& root) {
+        close();
+        std::wstring path = root;
+        if (path.size() == 2 && path[1] == L':') path += L'\\';
+        dir_ = CreateFileW(path.c_str(), FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (dir_ == INVALID_HANDLE_VALUE) return false;
+        overlapped_.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!overlapped_.hEvent || !issue()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (dir_ != INVALID_HANDLE_VALUE) {
+            if (pending_) {
+                CancelIoEx(dir_, &overlapped_);
+                DWORD bytes = 0;
+                GetOverlappedResult(dir_, &overlapped_, &bytes, TRUE);
+            }
+            CloseHandle(dir_);
+            dir_ = INVALID_HANDLE_VALUE;
+        }
+        if (overlapped_.hEvent) CloseHandle(overlapped_.hEvent);
+        overlapped_ = {};
+        pending_ = false;
+    }
+
+    bool isOpen() const { return dir_ != INVALID_HANDLE_VALUE; }
+    HANDLE event() const { return overlapped_.hEvent; }
+    bool ready() const { return isOpen() && WaitForSingleObject(overlapped_.hEvent, 0) == WAIT_OBJECT_0; }
+
+    // Hand each (action, relative path) of a completed read to `visit` and
+    // issue the next read. `visit` sees action 0 when the buffer overflowed
+    // and anything may have changed. Returns false once the tree is gone.
+    template <typename Visit>
+    bool drain(Visit&& visit) {
+        DWORD bytes = 0;
+        bool ok = GetOverlappedResult(dir_, &overlapped_, &bytes, FALSE) != 0;
+        pending_ = false;
+        if (!ok || bytes == 0) {
+            visit(0, std::wstring());
+        } else {
+            const BYTE* p = buffer_;
+            for (;;) {
+                auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+                visit(info->Action,
+                      std::wstring(info->FileName, info->FileNameLength / sizeof(wchar_t)));
+                if (info->NextEntryOffset == 0) break;
+                p += info->NextEntryOffset;
+            }
+        }
+        if (!issue()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool issue() {
+        ResetEvent(overlapped_.hEvent);
+        pending_ = ReadDirectoryChangesW(dir_, buffer_, sizeof(buffer_), TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+            FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+            nullptr, &overlapped_, nullptr) != 0;
+        return pending_;
+    }
+
+    HANDLE dir_ = INVALID_HANDLE_VALUE;
+    OVERLAPPED overlapped_ = {};
+    bool pending_ = false;
+    alignas(DWORD) BYTE buffer_[65536];
+};
+
+struct Listing {
+    std::vector<App::FolderItem> items;
+    ULONGLONG listedAt = 0;
+    bool stale = false;  // a change was reported; a fresh listing is queued
+};
+
+struct FileJob {
+    std::wstring path;      // full path
+    std::wstring relative;  // to the root, as indexed
+    uint64_t generation = 0;
+};
+
+// Shared between the UI thread and the workers, guarded by `mutex`. The
+// workers are detached and each holds a reference, so a crawler blocked on
+// an unreachable share cannot hold up closing the window.
+struct FolderShared {
+    std::mutex mutex;
+    std::condition_variable wake;  // readers: files queued or stopping
+    HANDLE control = CreateEventW(nullptr, FALSE, FALSE, nullptr);  // crawler
+    HWND hwnd = nullptr;
+    bool stopping = false;
+
+    std::wstring root;
+    uint64_t generation = 0;          // bumped per root; older work is dropped
+    bool watched = false;             // the root delivers change notifications
+    bool crawling = false;
+    std::deque<std::wstring> requested;  // list these fresh, ahead of the crawl
+    std::unordered_map<std::wstring, Listing> listings;  // by listingKey
+    // Folded relative path of every document queued or being read. A change
+    // reported while it is read queues it once more when the read is done.
+    enum class FileState { Queued, Reading, Reread };
+    std::deque<FileJob> files;
+    std::unordered_map<std::wstring, FileState> queuedFiles;
+    unsigned reading = 0;
+    TrigramIndex index{kMaxIndexedTextBytes};
+
+    bool notifyPosted = false;
+    ULONGLONG lastNotify = 0;
+
+    ~FolderShared() { CloseHandle(control); }
+
+    // With the lock held: tell the UI, at most every kNotifyIntervalMs
+    // unless forced, and never with a notification still queued
+    void notify(bool force) {
+        ULONGLONG now = GetTickCount64();
+        if (notifyPosted || (!force && now - lastNotify < kNotifyIntervalMs)) return;
+        notifyPosted = true;
+        lastNotify = now;
+        PostMessage(hwnd, WM_APP_FOLDER_INDEX, 0, 0);
+    }
+
+    bool busy() const { return crawling || !files.empty() || reading > 0; }
+
+    // With the lock held
+    void request(const std::wstring& directory) {
+        if (std::find(requested.begin(), requested.end(), directory) == requested.end()) {
+            requested.push_back(directory);
+        }
+    }
+
+    // With the lock held
+    void queueFile(const std::wstring& relative) {
+        std::wstring key = relative;
+        TrigramIndex::fold(key);
+        auto it = queuedFiles.find(key);
+        if (it != queuedFiles.end()) {
+            if (it->second == FileState::Reading) it->second = FileState::Reread;
+            return;
+        }
+        if (index.size() + files.size() >= kMaxIndexedDocuments) return;
+        queuedFiles.emplace(std::move(key), FileState::Queued);
+        files.push_back({joinPath(root, relative), relative, generation});
+        wake.notify_one();
+    }
+
+    // With the lock held: forget `directory` and every listing below it
+    void dropListingsUnder(const std::wstring& directory) {
+        std::wstring key = listingKey(directory);
+        for (auto it = listings.begin(); it != listings.end();) {
+            bool under = it->first.compare(0, key.size(), key) == 0 &&
+                         (it->first.size() == key.size() || it->first[key.size()] == L'\\');
+            it = under ? listings.erase(it) : std::next(it);
+        }
+    }
+
+    // With the lock held: re-list a directory, keeping the old listing on
+    // show until the new one lands
+    void markStale(const std::wstring& directory) {
+        auto it = listings.find(listingKey(directory));
+        if (it == listings.end()) return;
+        it->second.stale = true;
+        request(directory);
+    }
+};
+
+// Apply one completed read of the tree watch. Only changes in directories
+// already listed count: a new folder inside an unlisted (hidden, or not yet
+// crawled) one is reached by the crawl, or never. Attributes are read
+// before taking the lock, which the UI thread waits on. Changed documents
+// are re-read once they settle. Returns true when the notifications
+// overflowed and the crawl starts over.
+// Documents reported changed wait in `settling` (folded relative path ->
+// relative path and due time) until kSettleMs pass without another change.
+struct Settling {
+    std::wstring relative;
+    ULONGLONG due = 0;
+};
+
+bool applyChanges(FolderShared& s, TreeWatch& watch, const std::wstring& root,
+                  std::deque<std::wstring>& crawl,
+                  std::unordered_map<std::wstring, Settling>& settling) {
+    struct Change {
+        DWORD action;
+        std::wstring relative;
+        DWORD attributes;
+    };
+    std::vector<Change> changes;
+    bool overflow = false;
+    bool alive = watch.drain([&](DWORD action, std::wstring relative) {
+        if (action == 0) {
+            overflow = true;
+            return;
+        }
+        DWORD attributes = INVALID_FILE_ATTRIBUTES;
+        if (action != FILE_ACTION_REMOVED && action != FILE_ACTION_RENAMED_OLD_NAME) {
+            attributes = GetFileAttributesW(joinPath(root, relative).c_str());
+        }
+        changes.push_back({action, std::move(relative), attributes});
+    });
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!alive) s.watched = false;
+    if (overflow) {
+        // Anything may have changed: start the tree over
+        s.listings.clear();
+        s.index.clear();
+        s.files.clear();
+        s.queuedFiles.clear();
+        crawl.assign(1, root);
+        settling.clear();
+        changes.clear();
+    }
+    ULONGLONG due = GetTickCount64() + kSettleMs;
+    for (const Change& change : changes) {
+        std::wstring full = joinPath(root, change.relative);
+        std::wstring parent = parentOf(full);
+        if (!s.listings.count(listingKey(parent))) continue;
+        // Rewriting a file leaves its folder's listing as it was
+        if (change.action != FILE_ACTION_MODIFIED) s.markStale(parent);
+        bool document = isSupportedDocumentPath(change.relative);
+        if (change.action == FILE_ACTION_REMOVED || change.action == FILE_ACTION_RENAMED_OLD_NAME) {
+            if (document) {
+                s.index.remove(change.relative);
+                std::wstring key = change.relative;
+                TrigramIndex::fold(key);
+                settling.erase(key);
+            } else {
+                s.index.removeUnder(change.relative);
+                s.dropListingsUnder(full);
+            }
+        } else if (change.attributes != INVALID_FILE_ATTRIBUTES &&
+                   !(change.attributes & FILE_ATTRIBUTE_HIDDEN)) {
+            if (change.attributes & FILE_ATTRIBUTE_DIRECTORY) {
+                if (change.action != FILE_ACTION_MODIFIED) crawl.push_back(full);
+            } else if (document) {
+                std::wstring key = change.relative;
+                TrigramIndex::fold(key);
+                settling[key] = {change.relative, due};
+            }
+        }
+    }
+    s.notify(true);
+    return overflow;
+}
+
+// Queue the settled documents; returns the ms until the next one settles
+DWORD queueSettled(FolderShared& s, std::unordered_map<std::wstring, Settling>& settling) {
+    if (settling.empty()) return INFINITE;
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG next = ULLONG_MAX;
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (auto it = settling.begin(); it != settling.end();) {
+        if (it->second.due <= now) {
+            s.queueFile(it->second.relative);
+            it = settling.erase(it);
+        } else {
+            next = std::min(next, it->second.due);
+            ++it;
+        }
+    }
+    return next == ULLONG_MAX ? INFINITE : (DWORD)(next - now);
+}
+
+void crawlLoop(std::shared_ptr<FolderShared> shared) {
+    FolderShared& s = *shared;
+    TreeWatch watch;
+    uint64_t generation = 0;
+    std::wstring root;
+    std::deque<std::wstring> crawl;  // directories left to walk, breadth first
+    size_t crawled = 0;
+    std::unordered_map<std::wstring, Settling> settling;
+
+    for (;;) {
+        std::wstring directory;
+        bool fresh = false;
+        bool retarget = false;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (s.stopping) return;
+            if (s.generation != generation) {
+                generation = s.generation;
+                root = s.root;
+                crawl.assign(1, root);
+                crawled = 0;
+                settling.clear();
+                retarget = true;
+            }
+        }
+        if (retarget) {
+            // Opening a watch on a share can take a round trip: not under the lock
+            bool watching = watch.open(root);
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (s.generation == generation) s.watched = watching;
+            continue;
+        }
+        if (watch.ready()) {
+            if (applyChanges(s, watch, root, crawl, settling)) crawled = 0;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (!s.requested.empty()) {
+                directory = std::move(s.requested.front());
+                s.requested.pop_front();
+                fresh = true;
+            } else if (!crawl.empty() && crawled < kMaxCrawlDirectories) {
+                directory = std::move(crawl.front());
+                crawl.pop_front();
+            }
+            // Finishing the crawl is news even with no query running
+            bool crawling = (!directory.empty() && !fresh) ||
+                            (!crawl.empty() && crawled < kMaxCrawlDirectories);
+            if (s.crawling && !crawling) s.notify(true);
+            s.crawling = crawling;
+        }
+
+        DWORD untilSettled = queueSettled(s, settling);
+        if (directory.empty()) {
+            // Idle until a request, a new root, a change in the tree or a
+            // changed document settling
+            HANDLE handles[] = {s.control, watch.event()};
+            WaitForMultipleObjects(watch.isOpen() ? 2 : 1, handles, FALSE, untilSettled);
+            continue;
+        }
+
+        // The crawl reuses what browsing already listed
+        std::vector<App::FolderItem> items;
+        bool cached = false;
+        if (!fresh) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.listings.find(listingKey(directory));
+            if (it != s.listings.end()) {
+                items = it->second.items;
+                cached = true;
+            }
+        }
+        if (!cached) listDirectory(directory, items);
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.generation != generation) continue;
+        if (!cached) s.listings[listingKey(directory)] = {items, GetTickCount64(), false};
+        if (fresh) {
+            s.notify(true);
+        } else {
+            crawled++;
+            std::wstring relative = relativeTo(root, directory);
+            for (const auto& item : items) {
+                if (item.isDirectory) {
+                    crawl.push_back(joinPath(directory, item.name));
+                } else {
+                    s.queueFile(relative.empty() ? item.name : joinPath(relative, item.name));
+                }
+            }
+        }
+    }
+}
+
+void readLoop(std::shared_ptr<FolderShared> shared) {
+    FolderShared& s = *shared;
+    for (;;) {
+        FileJob job;
+        {
+            std::unique_lock<std::mutex> lock(s.mutex);
+            s.wake.wait(lock, [&] { return s.stopping || !s.files.empty(); });
+            if (s.stopping) return;
+            job = std::move(s.files.front());
+            s.files.pop_front();
+            s.reading++;
+            std::wstring key = job.relative;
+            TrigramIndex::fold(key);
+            auto it = s.queuedFiles.find(key);
+            if (it != s.queuedFiles.end()) it->second = FolderShared::FileState::Reading;
+        }
+
+        // Read, decode, fold and split into trigrams off the lock
+        std::string bytes;
+        bool readable = readDocument(job.path, kMaxHeadingScanBytes, bytes);
+        TrigramIndex::Entry entry;
+        if (readable) {
+            std::string_view text = bytes;
+            if (text.size() >= 3 && text.compare(0, 3, "\xEF\xBB\xBF") == 0) text.remove_prefix(3);
+            entry = TrigramIndex::prepare(job.relative, toWide(text), text.size() <= kMaxIndexedBytes);
+            // Only the headings the TOC anchors can be jumped to: keep those,
+            // numbered the way the layout numbers duplicates
+            auto& headings = entry.headings;
+            headings.erase(std::remove_if(headings.begin(), headings.end(),
+                                          [](const auto& h) { return h.level > 3; }),
+                           headings.end());
+            std::unordered_map<std::string, int> counts;
+            for (auto& h : headings) h.anchor = nextHeadingId(counts, h.text);
+        }
+        std::string().swap(bytes);
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.reading--;
+        if (job.generation == s.generation) {
+            std::wstring key = job.relative;
+            TrigramIndex::fold(key);
+            auto it = s.queuedFiles.find(key);
+            bool reread = it != s.queuedFiles.end() && it->second == FolderShared::FileState::Reread;
+            if (it != s.queuedFiles.end()) s.queuedFiles.erase(it);
+            if (readable) s.index.add(std::move(entry));
+            else s.index.remove(job.relative);
+            if (reread) s.queueFile(job.relative);
+        }
+        s.notify(!s.busy());
+    }
+}
+
+} // namespace
+
+struct App::FolderIndexState {
+    std::shared_ptr<FolderShared> shared;
+
+    ~FolderIndexState() {
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            shared->stopping = true;
+            shared->files.clear();
+            shared->requested.clear();
+        }
+        shared->wake.notify_all();
+        SetEvent(shared->control);
+    }
+};
+
+void indexFolder(App& app, const std::wstring& root) {
+    if (!app.folderIndex) {
+        app.folderIndex = std::make_shared<App::FolderIndexState>();
+        auto shared = std::make_shared<FolderShared>();
+        shared->hwnd = app.hwnd;
+        app.folderIndex->shared = shared;
+        std::thread(crawlLoop, shared).detach();
+        unsigned readers = std::max(1u, std::min(kMaxReaders, std::thread::hardware_concurrency()));
+        for (unsigned i = 0; i < readers; i++) std::thread(readLoop, shared).detach();
+    }
+    FolderShared& s = *app.folderIndex->shared;
+    std::wstring path = trimSeparators(root);
+    if (path.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.root.empty() && isUnder(s.root, path)) return;
+        s.root = path;
+        s.generation++;
+        s.watched = false;
+        s.crawling = true;
+        s.requested.clear();
+        s.listings.clear();
+        s.files.clear();
+        s.queuedFiles.clear();
+        s.index.clear();
+    }
+    SetEvent(s.control);
+}
+
+bool cachedFolderListing(App& app, const std::wstring& directory,
+                         std::vector<App::FolderItem>& items) {
+    if (!app.folderIndex) return false;
+    FolderShared& s = *app.folderIndex->shared;
+    std::wstring path = trimSeparators(directory);
+    bool listed = false;
+    bool refresh = true;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.listings.find(listingKey(path));
+        if (it != s.listings.end()) {
+            const Listing& listing = it->second;
+            items.insert(items.end(), listing.items.begin(), listing.items.end());
+            listed = true;
+            refresh = listing.stale ||
+                      (!s.watched && GetTickCount64() - listing.listedAt > kUnwatchedMaxAgeMs);
+        }
+        if (refresh) s.request(path);
+    }
+    if (refresh) SetEvent(s.control);
+    return listed;
+}
+
+void searchFolderIndex(App& app, std::vector<App::FolderItem>& items) {
+    if (!app.folderIndex || app.folderSearchQuery.empty()) return;
+    FolderShared& s = *app.folderIndex->shared;
+    std::vector<TrigramIndex::Hit> hits;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::wstring scope = trimSeparators(app.folderBrowserPath);
+        if (!isUnder(s.root, scope)) return;
+        hits = s.index.search(app.folderSearchQuery, relativeTo(s.root, scope), kMaxSearchHits);
+        app.folderIndexing = s.busy();
+    }
+    items.reserve(items.size() + hits.size());
+    for (auto& hit : hits) {
+        items.push_back({std::move(hit.path), false, std::move(hit.heading), std::move(hit.anchor)});
+    }
+}
+
+void handleFolderIndexUpdate(App& app) {
+    if (!app.folderIndex) return;
+    FolderShared& s = *app.folderIndex->shared;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.notifyPosted = false;
+        app.folderIndexing = s.busy();
+    }
+    if (!app.showFolderBrowser) return;
+    refreshFolderItems(app);
+    InvalidateRect(app.hwnd, nullptr, FALSE);
+}
+
+void stopFolderIndex(App& app) {
+    app.folderIndex.reset();  // the destructor stops the workers
+}
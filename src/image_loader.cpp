@@ -0,0 +1,336 @@
+#include "image_loader.h"
+#include "perf_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <urlmon.h>
+#pragma comment(lib, "urlmon.lib")
+
+namespace {
+
+constexpr unsigned kMaxImageWorkers = 4;
+
+struct ImageJob {
+    std::string src;
+    std::wstring path;
+    bool isUrl = false;
+    uint32_t loadId = 0;
+    float maxWidth = 0.0f;   // box the image is drawn in; decode no larger
+    float maxHeight = 0.0f;
+};
+
+// A worker posts up to two results per job: the frame size as soon as the
+// header is read (so layout can reserve the right box), then the pixels
+struct ImageResult {
+    std::string src;
+    uint32_t loadId = 0;
+    int width = 0;           // natural size
+    int height = 0;
+    int pixelWidth = 0;      // size of `pixels`
+    int pixelHeight = 0;
+    bool sizeOnly = false;
+    bool failed = false;
+    IWICBitmap* pixels = nullptr;  // 32bpp PBGRA, owned until applied
+};
+
+// Shared between the UI thread and the workers, guarded by `mutex`. The
+// workers are detached and each holds a reference, so the queue outlives
+// App when a slow download is still running at exit.
+struct ImageQueue {
+    std::mutex mutex;
+    std::condition_variable wake;
+    HWND hwnd = nullptr;
+    bool stopping = false;
+    std::deque<ImageJob> jobs;
+    std::deque<ImageResult> results;
+
+    ~ImageQueue() {
+        for (auto& r : results) {
+            if (r.pixels) r.pixels->Release();
+        }
+    }
+
+    void publish(ImageResult result) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                if (result.pixels) result.pixels->Release();
+                return;
+            }
+            results.push_back(std::move(result));
+        }
+        PostMessage(hwnd, WM_APP_IMAGE_READY, 0, 0);
+    }
+};
+
+} // namespace
+
+struct App::ImageLoaderState {
+    std::shared_ptr<ImageQueue> queue;
+    uint32_t nextLoadId = 0;  // UI thread only
+
+    ~ImageLoaderState() {
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->stopping = true;
+            queue->jobs.clear();
+        }
+        queue->wake.notify_all();
+    }
+};
+
+namespace {
+
+// Download (for URLs) and decode one job. Every exit path publishes a
+// final result so the entry never stays pending.
+void decodeImage(ImageQueue& queue, IWICImagingFactory* wic, const ImageJob& job) {
+    ScopedPhase phase(nullptr, FramePhase::Images);
+    ImageResult result;
+    result.src = job.src;
+    result.loadId = job.loadId;
+    result.failed = true;
+
+    std::wstring file = job.path;
+    if (job.isUrl) {
+        wchar_t tempPath[MAX_PATH] = {};
+        HRESULT hr = URLDownloadToCacheFileW(nullptr, job.path.c_str(), tempPath, MAX_PATH, 0, nullptr);
+        if (FAILED(hr)) {
+            queue.publish(std::move(result));
+            return;
+        }
+        file = tempPath;
+    }
+
+    IWICBitmapDecoder* decoder = nullptr;
+    HRESULT hr = wic ? wic->CreateDecoderFromFilename(file.c_str(), nullptr,
+        GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder) : E_FAIL;
+    if (FAILED(hr) || !decoder) {
+        queue.publish(std::move(result));
+        return;
+    }
+
+    IWICBitmapFrameDecode* frame = nullptr;
+    hr = decoder->GetFrame(0, &frame);
+    if (FAILED(hr) || !frame) {
+        decoder->Release();
+        queue.publish(std::move(result));
+        return;
+    }
+
+    UINT width = 0, height = 0;
+    if (SUCCEEDED(frame->GetSize(&width, &height)) && width > 0 && height > 0) {
+        ImageResult size;
+        size.src = job.src;
+        size.loadId = job.loadId;
+        size.width = (int)width;
+        size.height = (int)height;
+        size.sizeOnly = true;
+        queue.publish(std::move(size));
+    }
+
+    // Decode straight to the drawn size: a 4000px screenshot shown at 800px
+    // keeps 2.5 MB resident instead of 64 MB
+    float fit = imageFitScale((int)width, (int)height, job.maxWidth, job.maxHeight);
+    UINT pixelWidth = std::max(1u, (UINT)std::ceil(width * fit));
+    UINT pixelHeight = std::max(1u, (UINT)std::ceil(height * fit));
+    IWICBitmapSource* source = frame;
+    IWICBitmapScaler* scaler = nullptr;
+    if (pixelWidth < width && SUCCEEDED(wic->CreateBitmapScaler(&scaler)) && scaler &&
+        SUCCEEDED(scaler->Initialize(frame, pixelWidth, pixelHeight,
+                                     WICBitmapInterpolationModeFant))) {
+        source = scaler;
+    } else {
+        pixelWidth = width;
+        pixelHeight = height;
+    }
+
+    IWICFormatConverter* converter = nullptr;
+    hr = wic->CreateFormatConverter(&converter);
+    if (SUCCEEDED(hr) && converter) {
+        hr = converter->Initialize(source, GUID_WICPixelFormat32bppPBGRA,
+            WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom);
+    }
+    // Force the decode here rather than on the UI thread during upload
+    IWICBitmap* pixels = nullptr;
+    if (SUCCEEDED(hr) && converter) {
+        hr = wic->CreateBitmapFromSource(converter, WICBitmapCacheOnLoad, &pixels);
+    }
+    if (converter) converter->Release();
+    if (scaler) scaler->Release();
+    frame->Release();
+    decoder->Release();
+
+    if (SUCCEEDED(hr) && pixels) {
+        result.pixels = pixels;
+        result.width = (int)width;
+        result.height = (int)height;
+        result.pixelWidth = (int)pixelWidth;
+        result.pixelHeight = (int)pixelHeight;
+        result.failed = false;
+    }
+    queue.publish(std::move(result));
+}
+
+void workerLoop(std::shared_ptr<ImageQueue> queue) {
+    CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    IWICImagingFactory* wic = nullptr;
+    CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
+        IID_PPV_ARGS(&wic));
+
+    for (;;) {
+        ImageJob job;
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->wake.wait(lock, [&] { return queue->stopping || !queue->jobs.empty(); });
+            if (queue->stopping) break;
+            job = std::move(queue->jobs.front());
+            queue->jobs.pop_front();
+        }
+        decodeImage(*queue, wic, job);
+    }
+
+    if (wic) wic->Release();
+    CoUninitialize();
+}
+
+void startImageLoader(App& app) {
+    app.imageLoader = std::make_shared<App::ImageLoaderState>();
+    auto queue = std::make_shared<ImageQueue>();
+    queue->hwnd = app.hwnd;
+    app.imageLoader->queue = queue;
+
+    unsigned workers = std::clamp(std::thread::hardware_concurrency() / 2, 1u, kMaxImageWorkers);
+    for (unsigned i = 0; i < workers; i++) {
+        std::thread(workerLoop, queue).detach();
+    }
+}
+
+// Layout may still point at a bitmap that is about to be released; the
+// renderer skips null entries until the next relayout replaces them. The
+// document tiles may show it as well.
+static void forgetLayoutBitmap(App& app, ID2D1Bitmap* bitmap) {
+    app.releaseDocumentTiles();
+    for (auto& b : app.layoutBitmaps) {
+        if (b.bitmap == bitmap) b.bitmap = nullptr;
+    }
+    for (auto& b : app.layoutReuse.bitmaps) {
+        if (b.bitmap == bitmap) b.bitmap = nullptr;
+    }
+}
+
+static void releaseEntryBitmap(App& app, App::ImageEntry& entry) {
+    if (!entry.bitmap) return;
+    forgetLayoutBitmap(app, entry.bitmap);
+    entry.bitmap->Release();
+    entry.bitmap = nullptr;
+    app.imageCacheBytes -= entry.bytes;
+    entry.bytes = 0;
+}
+
+// Evict least recently placed bitmaps until the cache fits its budget.
+// Bitmaps the current layout draws are kept even over budget; evicted
+// entries are dropped so a later layout queues them again.
+static void trimImageCache(App& app) {
+    if (app.imageCacheBytes <= app.imageCacheBudget) return;
+
+    std::unordered_set<ID2D1Bitmap*> drawn;
+    for (const auto& b : app.layoutBitmaps) drawn.insert(b.bitmap);
+    for (const auto& b : app.layoutReuse.bitmaps) drawn.insert(b.bitmap);
+
+    std::vector<std::pair<uint64_t, std::string>> candidates;
+    for (const auto& [src, entry] : app.imageCache) {
+        if (entry.bitmap && !entry.pending && !drawn.count(entry.bitmap)) {
+            candidates.push_back({entry.lastUse, src});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (const auto& [lastUse, src] : candidates) {
+        if (app.imageCacheBytes <= app.imageCacheBudget) break;
+        auto it = app.imageCache.find(src);
+        releaseEntryBitmap(app, it->second);
+        app.imageCache.erase(it);
+    }
+}
+
+} // namespace
+
+void requestImage(App& app, const std::string& src, float maxWidth, float maxHeight) {
+    if (!app.imageLoader) startImageLoader(app);
+    auto& state = *app.imageLoader;
+    auto& entry = app.imageCache[src];
+    entry.pending = true;
+    entry.failed = false;
+    entry.loadId = ++state.nextLoadId;
+    {
+        std::lock_guard<std::mutex> lock(state.queue->mutex);
+        state.queue->jobs.push_back(
+            {src, entry.path, entry.isUrl, entry.loadId, maxWidth, maxHeight});
+    }
+    state.queue->wake.notify_one();
+}
+
+void applyImageResults(App& app) {
+    if (!app.imageLoader) return;
+    ScopedPhase phase(&app, FramePhase::Images);
+    auto& queue = *app.imageLoader->queue;
+    std::deque<ImageResult> results;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        results.swap(queue.results);
+    }
+
+    bool changed = false;
+    for (auto& r : results) {
+        auto it = app.imageCache.find(r.src);
+        // Dropped or re-requested (render target recreated) since it was queued
+        if (it == app.imageCache.end() || it->second.loadId != r.loadId ||
+            !it->second.pending) {
+            if (r.pixels) r.pixels->Release();
+            continue;
+        }
+        auto& entry = it->second;
+        if (r.sizeOnly) {
+            entry.width = r.width;
+            entry.height = r.height;
+            changed = true;
+            continue;
+        }
+
+        entry.pending = false;
+        ID2D1Bitmap* bitmap = nullptr;
+        if (r.pixels && app.renderTarget) {
+            HRESULT hr = app.renderTarget->CreateBitmapFromWicBitmap(r.pixels, nullptr, &bitmap);
+            if (FAILED(hr)) bitmap = nullptr;
+        }
+        if (r.pixels) r.pixels->Release();
+        if (bitmap) {
+            // Replaces the smaller bitmap of an earlier, lower zoom
+            releaseEntryBitmap(app, entry);
+            entry.bitmap = bitmap;
+            entry.width = r.width;
+            entry.height = r.height;
+            entry.pixelWidth = r.pixelWidth;
+            entry.pixelHeight = r.pixelHeight;
+            entry.bytes = (size_t)r.pixelWidth * r.pixelHeight * 4;
+            app.imageCacheBytes += entry.bytes;
+        }
+        // A failed re-decode at a larger size keeps the bitmap it had
+        entry.failed = !entry.bitmap;
+        changed = true;
+    }
+
+    if (changed) {
+        trimImageCache(app);
+        app.layoutDirty = true;
+        InvalidateRect(app.hwnd, nullptr, FALSE);
+    }
+}
+
+void stopImageLoader(App& app) {
+    app.imageLoader.reset();  // the destructor tells the workers to exit
+}
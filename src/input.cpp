@@ -7,11 +7,10 @@
 #include "d2d_init.h"
 #include "settings.h"
 #include "render.h"
+#include "parse_worker.h"
 
 #include <windowsx.h>
 #include <shellapi.h>
-#include <fstream>
-#include <sstream>
 #include <algorithm>
 #include <chrono>
 
@@ -20,20 +19,22 @@ static HCURSOR cursorArrow = LoadCursor(nullptr, IDC_ARROW);
 static HCURSOR cursorHand  = LoadCursor(nullptr, IDC_HAND);
 static HCURSOR cursorIBeam = LoadCursor(nullptr, IDC_IBEAM);
 
-// Ctrl+wheel zoom. The scroll anchor scales immediately, but text format
-// recreation (~47 COM objects) + full relayout is applied on the leading
-// tick and then coalesced via TIMER_ZOOM_APPLY while the wheel keeps spinning.
+// Ctrl+wheel zoom. The scroll anchor scales immediately and the frames
+// draw the existing layout through a scale transform, so a tick costs no
+// layout at all. Text format recreation (~47 COM objects) and the relayout
+// at the new size wait until the wheel has rested for TIMER_ZOOM_APPLY,
+// and then run viewport-first like any other relayout.
 static void applyZoomDelta(App& app, float delta) {
     float oldZoom = app.zoomFactor;
     app.zoomFactor = std::max(0.5f, std::min(3.0f, app.zoomFactor + delta * 0.1f));
     float zoomRatio = app.zoomFactor / oldZoom;
     app.scrollY *= zoomRatio;
     app.targetScrollY *= zoomRatio;
-    if (!app.zoomApplyPending) {
-        updateTextFormats(app);
-        app.zoomApplyPending = true;
-        SetTimer(app.hwnd, TIMER_ZOOM_APPLY, 80, nullptr);
-    }
+    app.scrollX *= zoomRatio;
+    app.targetScrollX *= zoomRatio;
+    // Re-arming restarts the countdown: apply once the ticks stop
+    app.zoomApplyPending = true;
+    SetTimer(app.hwnd, TIMER_ZOOM_APPLY, 80, nullptr);
 }
 
 void handleMouseWheel(App& app, HWND hwnd, WPARAM wParam, LPARAM lParam) {
@@ -329,7 +330,7 @@ void handleMouseMove(App& app, HWND hwnd, LPARAM lParam) {
         const auto& cb = app.codeBlocks[app.hoveredCodeBlock];
         float btnW = dpi(app, 52.0f);
         float btnH = dpi(app, 26.0f);
-        float btnPad = 8.0f * app.contentScale * app.zoomFactor;
+        float btnPad = 8.0f * app.contentScale * app.appliedZoomFactor;
         float btnX = cb.bounds.right - btnW - btnPad;
         float btnY = cb.bounds.top + btnPad;
         if (docX >= btnX && docX <= btnX + btnW &&
@@ -356,6 +357,51 @@ void handleMouseMove(App& app, HWND hwnd, LPARAM lParam) {
     }
 }
 
+// Enter a folder or open a document (at the heading of a search hit) from
+// the folder browser's list
+static void openFolderItem(App& app, int index) {
+    if (index < 0 || index >= (int)app.folderItems.size()) return;
+    const auto& item = app.folderItems[index];
+
+    if (item.isDirectory) {
+        // Navigate into folder
+        if (item.name == L"..") {
+            // Go up to parent
+            app.folderBrowserPath = getParentPath(app.folderBrowserPath);
+        } else {
+            // Enter subdirectory
+            if (app.folderBrowserPath.back() != L'\\' && app.folderBrowserPath.back() != L'/') {
+                app.folderBrowserPath += L'\\';
+            }
+            app.folderBrowserPath += item.name;
+        }
+        populateFolderItems(app);
+        return;
+    }
+
+    // Open document (search hits name it relative to the browsed folder)
+    std::wstring fullPath = app.folderBrowserPath;
+    if (fullPath.back() != L'\\' && fullPath.back() != L'/') {
+        fullPath += L'\\';
+    }
+    fullPath += item.name;
+
+    // Convert wide path to UTF-8 for currentFile
+    int utf8Len = WideCharToMultiByte(CP_UTF8, 0, fullPath.c_str(), -1, nullptr, 0, nullptr, nullptr);
+    std::string filepath(utf8Len - 1, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, fullPath.c_str(), -1, &filepath[0], utf8Len, nullptr, nullptr);
+    std::string headingFile = item.headingId.empty() ? std::string() : filepath;
+    // Map the file; the parse runs on the worker and the
+    // document swaps in (view reset, title) when it is done
+    if (requestParseFile(app, fullPath, std::move(filepath), ParseReason::Open)) {
+        app.pendingHeadingId = item.headingId;
+        app.pendingHeadingFile = std::move(headingFile);
+        // Close folder browser after opening file
+        app.showFolderBrowser = false;
+        app.folderBrowserAnimation = 0;
+    }
+}
+
 void handleMouseDown(App& app, HWND hwnd, WPARAM wParam, LPARAM lParam) {
     // Edit mode: route to editor or preview
     if (app.editMode) {
@@ -607,63 +653,7 @@ void handleMouseUp(App& app, HWND hwnd, WPARAM wParam, LPARAM lParam) {
         // Check if click is inside panel
         if (clickX >= panelX && clickX <= panelX + panelWidth) {
             // Hit-test items
-            if (app.hoveredFolderIndex >= 0 && app.hoveredFolderIndex < (int)app.folderItems.size()) {
-                const auto& item = app.folderItems[app.hoveredFolderIndex];
-
-                if (item.isDirectory) {
-                    // Navigate into folder
-                    if (item.name == L"..") {
-                        // Go up to parent
-                        app.folderBrowserPath = getParentPath(app.folderBrowserPath);
-                    } else {
-                        // Enter subdirectory
-                        if (app.folderBrowserPath.back() != L'\\' && app.folderBrowserPath.back() != L'/') {
-                            app.folderBrowserPath += L'\\';
-                        }
-                        app.folderBrowserPath += item.name;
-                    }
-                    populateFolderItems(app);
-                } else {
-                    // Open document
-                    std::wstring fullPath = app.folderBrowserPath;
-                    if (fullPath.back() != L'\\' && fullPath.back() != L'/') {
-                        fullPath += L'\\';
-                    }
-                    fullPath += item.name;
-
-                    // Load the file
-                    std::ifstream file(fullPath);
-                    if (file) {
-                        std::stringstream buffer;
-                        buffer << file.rdbuf();
-                        auto result = parseDocument(app.parser, buffer.str(), fullPath);
-                        if (result.success) {
-                            app.root = result.root;
-                            app.parseTimeUs = result.parseTimeUs;
-                            // Convert wide path to UTF-8 for currentFile
-                            int utf8Len = WideCharToMultiByte(CP_UTF8, 0, fullPath.c_str(), -1, nullptr, 0, nullptr, nullptr);
-                            app.currentFile.resize(utf8Len - 1);
-                            WideCharToMultiByte(CP_UTF8, 0, fullPath.c_str(), -1, &app.currentFile[0], utf8Len, nullptr, nullptr);
-                            app.scrollY = 0;
-                            app.scrollX = 0;
-                            app.targetScrollY = 0;
-                            app.targetScrollX = 0;
-                            app.focusMermaidOnNextLayout = isMermaidDocumentPath(fullPath);
-                            app.contentHeight = 0;
-                            app.docText.clear();
-                            app.docTextLower.clear();
-                            app.searchMatches.clear();
-                            app.layoutDirty = true;
-                            updateFileWriteTime(app);
-                            updateWindowTitle(app);
-
-                            // Close folder browser after opening file
-                            app.showFolderBrowser = false;
-                            app.folderBrowserAnimation = 0;
-                        }
-                    }
-                }
-            }
+            openFolderItem(app, app.hoveredFolderIndex);
         } else {
             // Click outside panel = close browser
             app.showFolderBrowser = false;
@@ -737,7 +727,7 @@ void handleMouseUp(App& app, HWND hwnd, WPARAM wParam, LPARAM lParam) {
         float clickDocY = app.mouseY + app.scrollY;
         float btnW = dpi(app, 52.0f);
         float btnH = dpi(app, 26.0f);
-        float btnPad = 8.0f * app.contentScale * app.zoomFactor;
+        float btnPad = 8.0f * app.contentScale * app.appliedZoomFactor;
         float btnX = cb.bounds.right - btnW - btnPad;
         float btnY = cb.bounds.top + btnPad;
         if (clickDocX >= btnX && clickDocX <= btnX + btnW &&
@@ -845,13 +835,47 @@ void handleKeyDown(App& app, HWND hwnd, WPARAM wParam) {
         }
     }
 
+    // Typing in the open folder browser searches the tree below it. Keys
+    // that type a character arrive as WM_CHAR and are not shortcuts here;
+    // the rest (F-keys, arrows, paging, Ctrl chords) keep their meaning.
+    if (app.showFolderBrowser && !app.showSearch && !app.showHelp && !ctrl &&
+        (wParam == VK_ESCAPE || wParam == VK_BACK || wParam == VK_RETURN ||
+         MapVirtualKeyW((UINT)wParam, MAPVK_VK_TO_CHAR) != 0)) {
+        switch (wParam) {
+            case VK_ESCAPE:
+                // Clear the query first, close on the next press
+                if (!app.folderSearchQuery.empty()) {
+                    app.folderSearchQuery.clear();
+                    populateFolderItems(app);
+                } else {
+                    app.showFolderBrowser = false;
+                    app.folderBrowserAnimation = 0;
+                }
+                break;
+            case VK_BACK:
+                if (app.folderSearchQuery.empty()) return;
+                app.folderSearchQuery.pop_back();
+                populateFolderItems(app);
+                break;
+            case VK_RETURN:
+                // Open the best hit
+                if (app.folderSearchQuery.empty()) return;
+                openFolderItem(app, 0);
+                break;
+            default:
+                return;
+        }
+        InvalidateRect(hwnd, nullptr, FALSE);
+        return;
+    }
+
     if (ctrl) {
         switch (wParam) {
             case 'A': {
                 // Select All - extract all text from document
                 if (app.root) {
                     app.selectedText.clear();
-                    extractText(app.root, app.selectedText);
+                    extractText(app.root.get(), app.selectedText);
                     app.hasSelection = true;
                 }
                 break;
@@ -867,7 +891,7 @@ void handleKeyDown(App& app, HWND hwnd, WPARAM wParam) {
                 } else if (app.root) {
                     // If no selection, copy all
                     std::wstring allText;
-                    extractText(app.root, allText);
+                    extractText(app.root.get(), allText);
                     copyToClipboard(hwnd, allText);
                     copied = true;
                 }
@@ -934,6 +958,8 @@ void handleKeyDown(App& app, HWND hwnd, WPARAM wParam) {
                     app.showFolderBrowser = !app.showFolderBrowser;
                     if (app.showFolderBrowser) {
                         app.folderBrowserAnimation = 0;
+                        app.folderBrowserJustOpened = true;
+                        app.folderSearchQuery.clear();
                         // Initialize to directory of current file, or working directory
                         if (!app.currentFile.empty()) {
                             app.folderBrowserPath = getDirectoryFromFile(app.currentFile);
@@ -1050,6 +1076,21 @@ void handleCharInput(App& app, HWND hwnd, WPARAM wParam) {
         }
     }
 
+    if (app.showFolderBrowser && !app.showSearch && !app.showHelp) {
+        // Skip the character that opened the browser (B key)
+        if (app.folderBrowserJustOpened) {
+            app.folderBrowserJustOpened = false;
+            return;
+        }
+        wchar_t ch = (wchar_t)wParam;
+        if (ch >= 32 && ch != 127) {
+            app.folderSearchQuery += ch;
+            populateFolderItems(app);
+            InvalidateRect(hwnd, nullptr, FALSE);
+        }
+        return;
+    }
+
     if (app.showSearch && app.searchActive) {
         // Skip the character that opened search (F key)
         if (app.searchJustOpened) {
@@ -1071,6 +1112,31 @@ void handleCharInput(App& app, HWND hwnd, WPARAM wParam) {
     }
 }
 
+// Alt chords reach the window as WM_SYSKEYDOWN. In the search bar Alt+R and
+// Alt+W toggle regex and whole-word matching and rerun the query.
+bool handleSearchModeKey(App& app, HWND hwnd, WPARAM wParam) {
+    if (!app.showSearch || !app.searchActive) return false;
+    if (wParam == 'R') {
+        app.searchRegex = !app.searchRegex;
+    } else if (wParam == 'W') {
+        app.searchWholeWord = !app.searchWholeWord;
+    } else {
+        return false;
+    }
+
+    if (app.editMode) {
+        performEditorSearch(app);
+        app.searchCurrentIndex = app.editorSearchCurrentIndex;
+        if (!app.editorSearchMatches.empty()) scrollEditorToMatch(app);
+    } else {
+        performSearch(app);
+        if (!app.searchMatches.empty()) scrollToCurrentMatch(app);
+    }
+    resetCursorBlink(app);
+    InvalidateRect(hwnd, nullptr, FALSE);
+    return true;
+}
+
 void handleDropFiles(App& app, HWND hwnd, WPARAM wParam) {
     HDROP hDrop = (HDROP)wParam;
     wchar_t wpath[MAX_PATH];
@@ -1082,63 +1148,9 @@ void handleDropFiles(App& app, HWND hwnd, WPARAM wParam) {
         WideCharToMultiByte(CP_UTF8, 0, wpath, -1, &filepath[0], utf8Len, nullptr, nullptr);
 
         // Load file - use wide path for non-ASCII support
-        std::ifstream file(wpath);
-        if (file) {
-            std::stringstream buffer;
-            buffer << file.rdbuf();
-            auto result = parseDocument(app.parser, buffer.str(), wpath);
-            if (result.success) {
-                app.root = result.root;
-                app.parseTimeUs = result.parseTimeUs;
-                app.currentFile = filepath;
-                app.scrollY = 0;
-                app.scrollX = 0;
-                app.targetScrollY = 0;
-                app.targetScrollX = 0;
-                app.focusMermaidOnNextLayout = isMermaidDocumentPath(wpath);
-                app.contentHeight = 0;
-                app.docText.clear();
-                app.docTextLower.clear();
-                app.searchMatches.clear();
-                app.layoutDirty = true;
-                updateFileWriteTime(app);
-                updateWindowTitle(app);
-            }
-        }
+        requestParseFile(app, wpath, std::move(filepath), ParseReason::Open);
         InvalidateRect(hwnd, nullptr, FALSE);
     }
     DragFinish(hDrop);
 }
 
-void handleFileWatchTimer(App& app, HWND hwnd) {
-    if (app.currentFile.empty() || !app.fileWatchEnabled || app.editMode) return;
-
-    std::wstring widePath = toWide(app.currentFile);
-    HANDLE h = CreateFileW(widePath.c_str(), GENERIC_READ,
-        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
-    if (h != INVALID_HANDLE_VALUE) {
-        FILETIME ft;
-        GetFileTime(h, nullptr, nullptr, &ft);
-        CloseHandle(h);
-        if (CompareFileTime(&ft, &app.lastFileWriteTime) != 0) {
-            app.lastFileWriteTime = ft;
-            // Reload file
-            std::ifstream file(widePath);
-            if (file) {
-                std::stringstream buffer;
-                buffer << file.rdbuf();
-                auto result = parseDocument(app.parser, buffer.str(), app.currentFile);
-                if (result.success) {
-                    float savedScroll = app.scrollY;
-                    float savedTargetScroll = app.targetScrollY;
-                    app.root = result.root;
-                    app.parseTimeUs = result.parseTimeUs;
-                    app.layoutDirty = true;
-                    app.scrollY = savedScroll;
-                    app.targetScrollY = savedTargetScroll;
-                    InvalidateRect(hwnd, nullptr, FALSE);
-                }
-            }
-        }
-    }
-}
@@ -8,8 +8,6 @@
 #include <commdlg.h>
 #include <shlobj.h>
 
-#include <fstream>
-#include <sstream>
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
@@ -25,6 +23,12 @@
 #include "overlays.h"
 #include "input.h"
 #include "editor.h"
+#include "parse_worker.h"
+#include "image_loader.h"
+#include "file_watcher.h"
+#include "folder_index.h"
+#include "perf_trace.h"
+#include "document_cache.h"
 
 static App* g_app = nullptr;
 
@@ -32,13 +36,99 @@ static App* g_app = nullptr;
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 void render(App& app);
 
+// Rasterize one tile of the static layout; the bitmap is null on failure
+static ID2D1Bitmap* renderDocumentTile(App& app, size_t row, size_t column) {
+    using Tile = App::DocumentTile;
+    ID2D1BitmapRenderTarget* target = nullptr;
+    if (FAILED(app.renderTarget->CreateCompatibleRenderTarget(
+            D2D1::SizeF(Tile::kWidth, Tile::kHeight), &target)) || !target) {
+        return nullptr;
+    }
+    ID2D1DeviceContext* dc = nullptr;
+    target->QueryInterface(__uuidof(ID2D1DeviceContext), reinterpret_cast<void**>(&dc));
+    // Same text rendering as the window: tiles are opaque, so ClearType holds
+    target->SetTextAntialiasMode(app.renderTarget->GetTextAntialiasMode());
+    IDWriteRenderingParams* params = nullptr;
+    app.renderTarget->GetTextRenderingParams(&params);
+    if (params) {
+        target->SetTextRenderingParams(params);
+        params->Release();
+    }
+
+    float left = column * Tile::kWidth;
+    float top = row * Tile::kHeight;
+    target->BeginDraw();
+    target->Clear(app.theme.background);
+    drawDocumentLayer(app, target, dc, left, top,
+        D2D1::RectF(left, top, left + Tile::kWidth, top + Tile::kHeight));
+    ID2D1Bitmap* bitmap = nullptr;
+    if (SUCCEEDED(target->EndDraw())) target->GetBitmap(&bitmap);
+    if (dc) dc->Release();
+    target->Release();
+    return bitmap;
+}
+
+// Draw `view` from the document tiles, rasterizing the ones not cached
+// yet. Returns false, having drawn nothing that matters, while the layout
+// under the view is not final: the frame then draws the layer directly.
+static bool drawDocumentTiles(App& app, float scrollX, float scrollY, const D2D1_RECT_F& view) {
+    using Tile = App::DocumentTile;
+    if (app.layoutAside.pending) return false;
+    size_t row0 = (size_t)(std::max(0.0f, view.top) / Tile::kHeight);
+    size_t row1 = (size_t)(std::max(0.0f, view.bottom) / Tile::kHeight);
+    size_t column0 = (size_t)(std::max(0.0f, view.left) / Tile::kWidth);
+    size_t column1 = (size_t)(std::max(0.0f, view.right) / Tile::kWidth);
+    if (!app.layoutComplete && (row1 + 1) * Tile::kHeight > app.layoutCursorY) return false;
+
+    // Whole pixels (the target is at 96 DPI), so nearest-neighbor blits the
+    // tiles unfiltered; a pending zoom scales them and wants filtering
+    bool scaled = app.zoomFactor != app.appliedZoomFactor;
+    auto interpolation = scaled ? D2D1_BITMAP_INTERPOLATION_MODE_LINEAR
+                                : D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR;
+    uint64_t frame = ++app.documentTileFrame;
+    for (size_t row = row0; row <= row1; row++) {
+        for (size_t column = column0; column <= column1; column++) {
+            auto it = std::find_if(app.documentTiles.begin(), app.documentTiles.end(),
+                [&](const Tile& t) { return t.row == row && t.column == column; });
+            if (it == app.documentTiles.end()) {
+                ID2D1Bitmap* bitmap = renderDocumentTile(app, row, column);
+                if (!bitmap) return false;
+                Tile tile;
+                tile.row = row;
+                tile.column = column;
+                tile.bitmap = bitmap;
+                app.documentTiles.push_back(tile);
+                it = app.documentTiles.end() - 1;
+            }
+            it->lastUse = frame;
+            float x = std::round(column * Tile::kWidth - scrollX);
+            float y = std::round(row * Tile::kHeight - scrollY);
+            app.renderTarget->DrawBitmap(it->bitmap,
+                D2D1::RectF(x, y, x + Tile::kWidth, y + Tile::kHeight), 1.0f, interpolation);
+            app.drawCalls++;
+        }
+    }
+
+    // Keep about two screens' worth: enough to scroll back without redrawing
+    size_t budget = std::max<size_t>(24, (row1 - row0 + 1) * (column1 - column0 + 1) * 2);
+    while (app.documentTiles.size() > budget) {
+        auto oldest = std::min_element(app.documentTiles.begin(), app.documentTiles.end(),
+            [](const Tile& a, const Tile& b) { return a.lastUse < b.lastUse; });
+        oldest->bitmap->Release();
+        app.documentTiles.erase(oldest);
+    }
+    return true;
+}
+
 void render(App& app) {
     if (!app.renderTarget) return;
 
+    auto frameStart = Clock::now();
     app.renderTarget->BeginDraw();
     app.drawCalls = 0;
 
     if (app.layoutDirty) {
+        ScopedPhase layoutPhase(&app, FramePhase::Layout);
         if (app.editMode && !app.editorShowPreview) {
             // Preview hidden: defer document layout until it's shown again
             // (the viewport is zero-width, so laying out now would be wasted
@@ -56,6 +146,15 @@ void render(App& app) {
         }
     }
 
+    // Opened from a folder search hit on a heading: jump there once the
+    // document is in (scrollToHeadingId lays out further if it must)
+    if (!app.pendingHeadingId.empty() && app.currentFile == app.pendingHeadingFile &&
+        !app.layoutDirty && !app.editMode) {
+        std::string id = std::move(app.pendingHeadingId);
+        app.pendingHeadingId.clear();
+        scrollToHeadingId(app, id);
+    }
+
     // Sync preview scroll to editor scroll position using source-offset anchors
     if (app.editMode && app.editorShowPreview &&
         !app.scrollAnchors.empty() && !app.editorLineByteOffsets.empty()) {
@@ -138,278 +237,39 @@ void render(App& app) {
 
 render_document:
 
+    // While a zoom is pending the layout is still at appliedZoomFactor:
+    // draw it scaled up to zoomFactor, which is what scrollX/scrollY and
+    // the scrollbars already assume, until TIMER_ZOOM_APPLY relays it out
+    const float zoomScale = app.zoomFactor / app.appliedZoomFactor;
+    const float scaledContentWidth = app.contentWidth * zoomScale;
+    const float scaledContentHeight = app.contentHeight * zoomScale;
+    D2D1_MATRIX_3X2_F documentTransform;
+    app.renderTarget->GetTransform(&documentTransform);
+    if (zoomScale != 1.0f) {
+        app.renderTarget->SetTransform(
+            D2D1::Matrix3x2F::Scale(zoomScale, zoomScale) * documentTransform);
+    }
+
     // Clamp scroll values
     float documentWidth = documentViewportWidth(app);
-    float maxScrollX = std::max(0.0f, app.contentWidth - documentWidth);
-    float maxScrollY = std::max(0.0f, app.contentHeight - app.height);
+    float maxScrollX = std::max(0.0f, scaledContentWidth - documentWidth);
+    float maxScrollY = std::max(0.0f, scaledContentHeight - app.height);
     app.scrollX = std::max(0.0f, std::min(app.scrollX, maxScrollX));
     app.scrollY = std::max(0.0f, std::min(app.scrollY, maxScrollY));
 
-    // Render cached layout (document coordinates -> screen)
-    const float viewportTop = app.scrollY;
-    const float viewportBottom = app.scrollY + app.height;
-    const float viewportLeft = app.scrollX;
-    const float viewportRight = app.scrollX + documentWidth;
+    // Render cached layout (document coordinates -> screen); scrollX and
+    // scrollY below are in layout coordinates
+    const float scrollX = app.scrollX / zoomScale;
+    const float scrollY = app.scrollY / zoomScale;
+    const float viewportTop = scrollY;
+    const float viewportBottom = scrollY + app.height / zoomScale;
+    const D2D1_RECT_F view = D2D1::RectF(
+        scrollX, viewportTop, scrollX + documentWidth / zoomScale, viewportBottom);
     const float cullMargin = 100.0f;
 
-    for (const auto& rect : app.layoutRects) {
-        if (rect.rect.bottom < viewportTop - cullMargin ||
-            rect.rect.top > viewportBottom + cullMargin) {
-            continue;
-        }
-        if (rect.rect.right < viewportLeft - cullMargin ||
-            rect.rect.left > viewportRight + cullMargin) {
-            continue;
-        }
-        app.brush->SetColor(rect.color);
-        app.renderTarget->FillRectangle(
-            D2D1::RectF(rect.rect.left - app.scrollX, rect.rect.top - app.scrollY,
-                       rect.rect.right - app.scrollX, rect.rect.bottom - app.scrollY),
-            app.brush);
-        app.drawCalls++;
-    }
-
-    ID2D1StrokeStyle* dashedStrokeStyle = nullptr;
-    if (std::any_of(
-            app.layoutConnectors.begin(), app.layoutConnectors.end(),
-            [](const App::LayoutConnector& connector) { return connector.dashed; })) {
-        D2D1_STROKE_STYLE_PROPERTIES properties = {
-            D2D1_CAP_STYLE_FLAT,
-            D2D1_CAP_STYLE_FLAT,
-            D2D1_CAP_STYLE_FLAT,
-            D2D1_LINE_JOIN_MITER,
-            10.0f,
-            D2D1_DASH_STYLE_DASH,
-            0.0f,
-        };
-        app.d2dFactory->CreateStrokeStyle(
-            properties, nullptr, 0, &dashedStrokeStyle);
-    }
-
-    for (const auto& connector : app.layoutConnectors) {
-        if (connector.bounds.bottom < viewportTop - cullMargin ||
-            connector.bounds.top > viewportBottom + cullMargin ||
-            connector.bounds.right < viewportLeft - cullMargin ||
-            connector.bounds.left > viewportRight + cullMargin ||
-            connector.points.size() < 2) {
-            continue;
-        }
-
-        app.brush->SetColor(connector.color);
-        for (size_t i = 1; i < connector.points.size(); i++) {
-            const auto& from = connector.points[i - 1];
-            const auto& to = connector.points[i];
-            app.renderTarget->DrawLine(
-                D2D1::Point2F(from.x - app.scrollX, from.y - app.scrollY),
-                D2D1::Point2F(to.x - app.scrollX, to.y - app.scrollY),
-                app.brush, connector.stroke,
-                connector.dashed ? dashedStrokeStyle : nullptr);
-            app.drawCalls++;
-        }
-
-        if (connector.directed) {
-            const auto& tip = connector.points.back();
-            const auto& previous = connector.points[connector.points.size() - 2];
-            float dx = tip.x - previous.x;
-            float dy = tip.y - previous.y;
-            float length = std::sqrt(dx * dx + dy * dy);
-            if (length > 0.001f) {
-                dx /= length;
-                dy /= length;
-                float wing = connector.arrowSize * 0.5f;
-                D2D1_POINT_2F left = D2D1::Point2F(
-                    tip.x - dx * connector.arrowSize + dy * wing,
-                    tip.y - dy * connector.arrowSize - dx * wing);
-                D2D1_POINT_2F right = D2D1::Point2F(
-                    tip.x - dx * connector.arrowSize - dy * wing,
-                    tip.y - dy * connector.arrowSize + dx * wing);
-                D2D1_POINT_2F screenTip =
-                    D2D1::Point2F(tip.x - app.scrollX, tip.y - app.scrollY);
-                app.renderTarget->DrawLine(
-                    screenTip,
-                    D2D1::Point2F(left.x - app.scrollX, left.y - app.scrollY),
-                    app.brush, connector.stroke);
-                app.renderTarget->DrawLine(
-                    screenTip,
-                    D2D1::Point2F(right.x - app.scrollX, right.y - app.scrollY),
-                    app.brush, connector.stroke);
-                app.drawCalls += 2;
-            }
-        }
-    }
-    if (dashedStrokeStyle) dashedStrokeStyle->Release();
-
-    auto drawPolygon = [&](const D2D1_POINT_2F* points, size_t count,
-                           const App::LayoutShape& shape) {
-        if (count < 3) return;
-
-        ID2D1PathGeometry* geometry = nullptr;
-        if (FAILED(app.d2dFactory->CreatePathGeometry(&geometry)) || !geometry) return;
-
-        ID2D1GeometrySink* sink = nullptr;
-        if (SUCCEEDED(geometry->Open(&sink)) && sink) {
-            sink->BeginFigure(points[0], D2D1_FIGURE_BEGIN_FILLED);
-            sink->AddLines(points + 1, static_cast<UINT32>(count - 1));
-            sink->EndFigure(D2D1_FIGURE_END_CLOSED);
-            sink->Close();
-            sink->Release();
-
-            if (shape.fill.a > 0.0f) {
-                app.brush->SetColor(shape.fill);
-                app.renderTarget->FillGeometry(geometry, app.brush);
-                app.drawCalls++;
-            }
-            if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
-                app.brush->SetColor(shape.stroke);
-                app.renderTarget->DrawGeometry(
-                    geometry, app.brush, shape.strokeWidth);
-                app.drawCalls++;
-            }
-        }
-        geometry->Release();
-    };
-
-    for (const auto& shape : app.layoutShapes) {
-        if (shape.rect.bottom < viewportTop - cullMargin ||
-            shape.rect.top > viewportBottom + cullMargin ||
-            shape.rect.right < viewportLeft - cullMargin ||
-            shape.rect.left > viewportRight + cullMargin) {
-            continue;
-        }
-
-        D2D1_RECT_F rect = D2D1::RectF(
-            shape.rect.left - app.scrollX,
-            shape.rect.top - app.scrollY,
-            shape.rect.right - app.scrollX,
-            shape.rect.bottom - app.scrollY);
-
-        if (shape.type == App::LayoutShapeType::Diamond) {
-            float centerX = (rect.left + rect.right) * 0.5f;
-            float centerY = (rect.top + rect.bottom) * 0.5f;
-            D2D1_POINT_2F points[] = {
-                D2D1::Point2F(centerX, rect.top),
-                D2D1::Point2F(rect.right, centerY),
-                D2D1::Point2F(centerX, rect.bottom),
-                D2D1::Point2F(rect.left, centerY),
-            };
-            drawPolygon(points, 4, shape);
-            continue;
-        }
-
-        if (shape.type == App::LayoutShapeType::Hexagon) {
-            float inset = (rect.right - rect.left) * 0.18f;
-            float centerY = (rect.top + rect.bottom) * 0.5f;
-            D2D1_POINT_2F points[] = {
-                D2D1::Point2F(rect.left + inset, rect.top),
-                D2D1::Point2F(rect.right - inset, rect.top),
-                D2D1::Point2F(rect.right, centerY),
-                D2D1::Point2F(rect.right - inset, rect.bottom),
-                D2D1::Point2F(rect.left + inset, rect.bottom),
-                D2D1::Point2F(rect.left, centerY),
-            };
-            drawPolygon(points, 6, shape);
-            continue;
-        }
-
-        app.brush->SetColor(shape.fill);
-        if (shape.type == App::LayoutShapeType::Ellipse) {
-            D2D1_ELLIPSE ellipse = D2D1::Ellipse(
-                D2D1::Point2F(
-                    (rect.left + rect.right) * 0.5f,
-                    (rect.top + rect.bottom) * 0.5f),
-                (rect.right - rect.left) * 0.5f,
-                (rect.bottom - rect.top) * 0.5f);
-            if (shape.fill.a > 0.0f) {
-                app.renderTarget->FillEllipse(ellipse, app.brush);
-                app.drawCalls++;
-            }
-            if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
-                app.brush->SetColor(shape.stroke);
-                app.renderTarget->DrawEllipse(
-                    ellipse, app.brush, shape.strokeWidth);
-                app.drawCalls++;
-            }
-            continue;
-        }
-
-        if (shape.type == App::LayoutShapeType::RoundedRectangle ||
-            shape.type == App::LayoutShapeType::Stadium) {
-            float radius = shape.type == App::LayoutShapeType::Stadium
-                ? (rect.bottom - rect.top) * 0.5f
-                : shape.radius;
-            D2D1_ROUNDED_RECT rounded = D2D1::RoundedRect(rect, radius, radius);
-            if (shape.fill.a > 0.0f) {
-                app.renderTarget->FillRoundedRectangle(rounded, app.brush);
-                app.drawCalls++;
-            }
-            if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
-                app.brush->SetColor(shape.stroke);
-                app.renderTarget->DrawRoundedRectangle(
-                    rounded, app.brush, shape.strokeWidth);
-                app.drawCalls++;
-            }
-            continue;
-        }
-
-        if (shape.fill.a > 0.0f) {
-            app.renderTarget->FillRectangle(rect, app.brush);
-            app.drawCalls++;
-        }
-        if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
-            app.brush->SetColor(shape.stroke);
-            app.renderTarget->DrawRectangle(
-                rect, app.brush, shape.strokeWidth);
-            app.drawCalls++;
-        }
-    }
-
-    // Render images (bitmaps)
-    for (const auto& bmp : app.layoutBitmaps) {
-        if (!bmp.bitmap) continue;
-        if (bmp.destRect.bottom < viewportTop - cullMargin ||
-            bmp.destRect.top > viewportBottom + cullMargin) continue;
-        if (bmp.destRect.right < viewportLeft - cullMargin ||
-            bmp.destRect.left > viewportRight + cullMargin) continue;
-        app.renderTarget->DrawBitmap(bmp.bitmap,
-            D2D1::RectF(bmp.destRect.left - app.scrollX,
-                         bmp.destRect.top - app.scrollY,
-                         bmp.destRect.right - app.scrollX,
-                         bmp.destRect.bottom - app.scrollY));
-        app.drawCalls++;
-    }
-
-    for (const auto& run : app.layoutTextRuns) {
-        if (run.bounds.bottom < viewportTop - cullMargin ||
-            run.bounds.top > viewportBottom + cullMargin) {
-            continue;
-        }
-        if (run.bounds.right < viewportLeft - cullMargin ||
-            run.bounds.left > viewportRight + cullMargin) {
-            continue;
-        }
-        app.brush->SetColor(run.color);
-        D2D1_POINT_2F drawPos = D2D1::Point2F(run.pos.x - app.scrollX, run.pos.y - app.scrollY);
-        if (app.deviceContext) {
-            app.deviceContext->DrawTextLayout(drawPos, run.layout, app.brush,
-                D2D1_DRAW_TEXT_OPTIONS_ENABLE_COLOR_FONT);
-        } else {
-            app.renderTarget->DrawTextLayout(drawPos, run.layout, app.brush);
-        }
-        app.drawCalls++;
-    }
-
-    for (const auto& line : app.layoutLines) {
-        float minY = std::min(line.p1.y, line.p2.y);
-        float maxY = std::max(line.p1.y, line.p2.y);
-        if (maxY < viewportTop - cullMargin || minY > viewportBottom + cullMargin) {
-            continue;
-        }
-        app.brush->SetColor(line.color);
-        app.renderTarget->DrawLine(
-            D2D1::Point2F(line.p1.x - app.scrollX, line.p1.y - app.scrollY),
-            D2D1::Point2F(line.p2.x - app.scrollX, line.p2.y - app.scrollY),
-            app.brush, line.stroke);
-        app.drawCalls++;
+    ScopedPhase drawPhase(&app, FramePhase::DrawDocument);
+    if (!app.documentTilesEnabled || !drawDocumentTiles(app, scrollX, scrollY, view)) {
+        drawDocumentLayer(app, app.renderTarget, app.deviceContext, scrollX, scrollY, view);
     }
 
     // Render code block copy button on hover
@@ -419,9 +279,9 @@ render_document:
             cb.bounds.top <= viewportBottom + cullMargin) {
             float btnW = dpi(app, 52.0f);
             float btnH = dpi(app, 26.0f);
-            float btnPad = 8.0f * app.contentScale * app.zoomFactor;
-            float btnX = cb.bounds.right - btnW - btnPad - app.scrollX;
-            float btnY = cb.bounds.top + btnPad - app.scrollY;
+            float btnPad = 8.0f * app.contentScale * app.appliedZoomFactor;
+            float btnX = cb.bounds.right - btnW - btnPad - scrollX;
+            float btnY = cb.bounds.top + btnPad - scrollY;
 
             // Button background
             app.brush->SetColor(D2D1::ColorF(
@@ -453,53 +313,8 @@ render_document:
         }
     }
 
-    // Determine scrollbar visibility
-    bool needsVScroll = app.contentHeight > app.height;
-    bool needsHScroll = app.contentWidth > documentWidth;
-    float scrollbarSize = dpi(app, 14.0f);
-
-    // Scrollbar color: dark on light themes, light on dark themes
-    float sbColorValue = app.theme.isDark ? 1.0f : 0.0f;
-
-    // Draw vertical scrollbar
-    if (needsVScroll) {
-        float maxScrollY = std::max(0.0f, app.contentHeight - app.height);
-        float trackHeight = app.height - (needsHScroll ? scrollbarSize : 0);
-        float sbHeight = trackHeight / app.contentHeight * trackHeight;
-        sbHeight = std::max(sbHeight, dpi(app, 30.0f));
-        float sbY = (maxScrollY > 0) ? (app.scrollY / maxScrollY * (trackHeight - sbHeight)) : 0;
-
-        float sbWidth = (app.scrollbarHovered || app.scrollbarDragging) ? dpi(app, 10.0f) : dpi(app, 6.0f);
-        float sbAlpha = (app.scrollbarHovered || app.scrollbarDragging) ? 0.5f : 0.3f;
-
-        app.brush->SetColor(D2D1::ColorF(sbColorValue, sbColorValue, sbColorValue, sbAlpha));
-        app.renderTarget->FillRoundedRectangle(
-            D2D1::RoundedRect(D2D1::RectF(documentWidth - sbWidth - dpi(app, 4.0f), sbY,
-                                          documentWidth - dpi(app, 4.0f), sbY + sbHeight), 3, 3),
-            app.brush);
-        app.drawCalls++;
-    }
-
-    // Draw horizontal scrollbar
-    if (needsHScroll) {
-        float maxScrollX = std::max(0.0f, app.contentWidth - documentWidth);
-        float trackWidth = documentWidth - (needsVScroll ? scrollbarSize : 0);
-        float sbWidth = trackWidth / app.contentWidth * trackWidth;
-        sbWidth = std::max(sbWidth, dpi(app, 30.0f));
-        float sbX = (maxScrollX > 0) ? (app.scrollX / maxScrollX * (trackWidth - sbWidth)) : 0;
-
-        float sbHeight = (app.hScrollbarHovered || app.hScrollbarDragging) ? dpi(app, 10.0f) : dpi(app, 6.0f);
-        float sbAlpha = (app.hScrollbarHovered || app.hScrollbarDragging) ? 0.5f : 0.3f;
-
-        app.brush->SetColor(D2D1::ColorF(sbColorValue, sbColorValue, sbColorValue, sbAlpha));
-        app.renderTarget->FillRoundedRectangle(
-            D2D1::RoundedRect(D2D1::RectF(sbX, app.height - sbHeight - dpi(app, 4.0f),
-                                          sbX + sbWidth, app.height - dpi(app, 4.0f)), 3, 3),
-            app.brush);
-        app.drawCalls++;
-    }
-
     // Draw selection highlights
+    drawPhase.switchTo(FramePhase::DrawHighlights);
     if ((app.selecting || app.hasSelection) && !app.textRects.empty()) {
         // Calculate selection bounds (normalized so start is always before end)
         // Selection is stored in document coordinates
@@ -561,14 +376,15 @@ render_document:
             if (lineInSelection) {
                 // Draw continuous selection bar for this line
                 app.renderTarget->FillRectangle(
-                    D2D1::RectF(drawLeft - app.scrollX, line.top - app.scrollY,
-                                drawRight - app.scrollX, line.bottom - app.scrollY),
+                    D2D1::RectF(drawLeft - scrollX, line.top - scrollY,
+                                drawRight - scrollX, line.bottom - scrollY),
                     app.brush);
                 selectedCount++;
 
                 // Collect text from rects in this line that fall within selection
                 if (!collectedText.empty()) collectedText += L"\n";
-                for (size_t idx : line.textRectIndices) {
+                for (size_t idx = line.firstTextRect;
+                     idx < line.firstTextRect + line.textRectCount; idx++) {
                     const auto& tr = app.textRects[idx];
                     const D2D1_RECT_F& rect = tr.rect;
                     if (rect.left < drawRight && rect.right > drawLeft) {
@@ -589,88 +405,96 @@ render_document:
         }
     }
 
-    // Draw search match highlights (search live through visible textRects)
+    // Draw search match highlights: only the matches inside the visible
+    // text rects, each with the glyph-accurate rects cached on first draw
     if (app.showSearch && !app.searchQuery.empty() && !app.textRects.empty() && !app.searchMatches.empty()) {
-        // Collect visible match rects by intersecting search matches with text rects
-        struct VisibleMatch {
-            D2D1_RECT_F rect;
-            size_t matchIndex;
-        };
-        std::vector<VisibleMatch> visibleMatches;
-
-        size_t matchIndex = 0;
-        for (const auto& tr : app.textRects) {
-            size_t textLen = tr.docLength;
-            if (textLen == 0) continue;
-
-            size_t rectStart = tr.docStart;
-            size_t rectEnd = rectStart + textLen;
-
-            // Advance to first match that could overlap this rect
-            while (matchIndex < app.searchMatches.size()) {
-                const auto& m = app.searchMatches[matchIndex];
-                size_t mEnd = m.startPos + m.length;
-                if (mEnd <= rectStart) {
-                    matchIndex++;
-                    continue;
-                }
-                break;
-            }
-
-            size_t mi = matchIndex;
-            while (mi < app.searchMatches.size()) {
-                const auto& m = app.searchMatches[mi];
-                if (m.startPos >= rectEnd) break;
-
-                size_t mStart = m.startPos;
-                size_t mEnd = m.startPos + m.length;
-                size_t overlapStart = std::max(rectStart, mStart);
-                size_t overlapEnd = std::min(rectEnd, mEnd);
-
-                if (overlapStart < overlapEnd) {
-                    float totalWidth = tr.rect.right - tr.rect.left;
-                    float charWidth = totalWidth / (float)textLen;
-                    float startX = tr.rect.left + (overlapStart - rectStart) * charWidth;
-                    float matchWidth = (overlapEnd - overlapStart) * charWidth;
-
-                    // Extend highlight slightly for better visibility
-                    D2D1_RECT_F highlightRect = D2D1::RectF(
-                        startX - 1, tr.rect.top,
-                        startX + matchWidth + 1, tr.rect.bottom
-                    );
-
-                    visibleMatches.push_back({highlightRect, mi});
-                }
-
-                if (mEnd <= rectEnd) {
-                    mi++;
-                } else {
-                    break;  // Match spans beyond this rect; continue on next rect
-                }
-            }
-
-            matchIndex = mi;
+        const auto visibleRects = app.textRectTiles.query(
+            viewportTop - cullMargin, viewportBottom + cullMargin);
+        size_t docFrom = SIZE_MAX, docTo = 0;
+        for (size_t i = visibleRects.first; i < visibleRects.second; i++) {
+            const auto& tr = app.textRects[i];
+            docFrom = std::min(docFrom, (size_t)tr.docStart);
+            docTo = std::max(docTo, (size_t)tr.docStart + tr.docLength);
         }
 
-        // Draw all matches - orange if it's the current match, yellow otherwise
-        for (const auto& vm : visibleMatches) {
+        auto firstVisible = std::partition_point(app.searchMatches.begin(), app.searchMatches.end(),
+            [&](const App::SearchMatch& m) { return m.startPos + m.length <= docFrom; });
+        for (size_t mi = (size_t)(firstVisible - app.searchMatches.begin());
+             mi < app.searchMatches.size() && app.searchMatches[mi].startPos < docTo; mi++) {
             bool isCurrent = (app.searchCurrentIndex >= 0 &&
-                              vm.matchIndex == (size_t)app.searchCurrentIndex);
+                              mi == (size_t)app.searchCurrentIndex);
 
+            // Orange if it's the current match, yellow otherwise
             if (isCurrent) {
-                app.brush->SetColor(D2D1::ColorF(1.0f, 0.6f, 0.0f, 0.5f));  // Orange
+                app.brush->SetColor(D2D1::ColorF(1.0f, 0.6f, 0.0f, 0.5f));
             } else {
-                app.brush->SetColor(D2D1::ColorF(1.0f, 0.9f, 0.0f, 0.3f));  // Yellow
+                app.brush->SetColor(D2D1::ColorF(1.0f, 0.9f, 0.0f, 0.3f));
             }
 
-            app.renderTarget->FillRectangle(
-                D2D1::RectF(vm.rect.left - app.scrollX, vm.rect.top - app.scrollY,
-                            vm.rect.right - app.scrollX, vm.rect.bottom - app.scrollY),
-                app.brush);
-            app.drawCalls++;
+            auto fragments = searchHighlightFragments(app, mi);
+            for (size_t f = 0; f < fragments.second; f++) {
+                const D2D1_RECT_F& rect = fragments.first[f];
+                if (rect.bottom < viewportTop || rect.top > viewportBottom) continue;
+                // Extend highlight slightly for better visibility
+                app.renderTarget->FillRectangle(
+                    D2D1::RectF(rect.left - 1 - scrollX, rect.top - scrollY,
+                                rect.right + 1 - scrollX, rect.bottom - scrollY),
+                    app.brush);
+                app.drawCalls++;
+            }
         }
     }
 
+    // Chrome from here on is drawn unscaled
+    drawPhase.switchTo(FramePhase::DrawOverlays);
+    app.renderTarget->SetTransform(documentTransform);
+
+    // Determine scrollbar visibility
+    bool needsVScroll = scaledContentHeight > app.height;
+    bool needsHScroll = scaledContentWidth > documentWidth;
+    float scrollbarSize = dpi(app, 14.0f);
+
+    // Scrollbar color: dark on light themes, light on dark themes
+    float sbColorValue = app.theme.isDark ? 1.0f : 0.0f;
+
+    // Draw vertical scrollbar
+    if (needsVScroll) {
+        float maxScrollY = std::max(0.0f, scaledContentHeight - app.height);
+        float trackHeight = app.height - (needsHScroll ? scrollbarSize : 0);
+        float sbHeight = trackHeight / scaledContentHeight * trackHeight;
+        sbHeight = std::max(sbHeight, dpi(app, 30.0f));
+        float sbY = (maxScrollY > 0) ? (app.scrollY / maxScrollY * (trackHeight - sbHeight)) : 0;
+
+        float sbWidth = (app.scrollbarHovered || app.scrollbarDragging) ? dpi(app, 10.0f) : dpi(app, 6.0f);
+        float sbAlpha = (app.scrollbarHovered || app.scrollbarDragging) ? 0.5f : 0.3f;
+
+        app.brush->SetColor(D2D1::ColorF(sbColorValue, sbColorValue, sbColorValue, sbAlpha));
+        app.renderTarget->FillRoundedRectangle(
+            D2D1::RoundedRect(D2D1::RectF(documentWidth - sbWidth - dpi(app, 4.0f), sbY,
+                                          documentWidth - dpi(app, 4.0f), sbY + sbHeight), 3, 3),
+            app.brush);
+        app.drawCalls++;
+    }
+
+    // Draw horizontal scrollbar
+    if (needsHScroll) {
+        float maxScrollX = std::max(0.0f, scaledContentWidth - documentWidth);
+        float trackWidth = documentWidth - (needsVScroll ? scrollbarSize : 0);
+        float sbWidth = trackWidth / scaledContentWidth * trackWidth;
+        sbWidth = std::max(sbWidth, dpi(app, 30.0f));
+        float sbX = (maxScrollX > 0) ? (app.scrollX / maxScrollX * (trackWidth - sbWidth)) : 0;
+
+        float sbHeight = (app.hScrollbarHovered || app.hScrollbarDragging) ? dpi(app, 10.0f) : dpi(app, 6.0f);
+        float sbAlpha = (app.hScrollbarHovered || app.hScrollbarDragging) ? 0.5f : 0.3f;
+
+        app.brush->SetColor(D2D1::ColorF(sbColorValue, sbColorValue, sbColorValue, sbAlpha));
+        app.renderTarget->FillRoundedRectangle(
+            D2D1::RoundedRect(D2D1::RectF(sbX, app.height - sbHeight - dpi(app, 4.0f),
+                                          sbX + sbWidth, app.height - dpi(app, 4.0f)), 3, 3),
+            app.brush);
+        app.drawCalls++;
+    }
+
     // "Copied!" notification with fade out (cached layout)
     if (app.showCopiedNotification) {
         auto now = std::chrono::steady_clock::now();
@@ -720,10 +544,20 @@ render_document:
 
     // Draw stats
     if (app.showStats) {
-        wchar_t stats[512];
-        swprintf(stats, 512,
+        const auto& frames = app.frameStats;
+        auto phaseMs = [&](FramePhase phase) {
+            return frames.lastPhaseUs[(size_t)phase] / 1000.0;
+        };
+        // File time is the open plus however long the UI thread then waited
+        // for the worker; the parse itself mostly ran during D2D init
+        wchar_t stats[768];
+        swprintf(stats, 768,
             L"Parse: %zu us | Layout: %zu us | Draw calls: %zu\n"
-            L"Startup: %.1fms (Win: %.1f | D2D: %.1f | DWrite: %.1f | File: %.1f)",
+            L"Startup: %.1fms (Win: %.1f | D2D: %.1f | DWrite: %.1f | File: %.1f"
+            L" = open %.1f + wait %.1f, worker parse %.1f, layout %.1f)\n"
+            L"Frame: p50 %.1f | p95 %.1f | max %.1f ms; last: layout %.1f (tokenize %.1f,"
+            L" mermaid %.1f) | images %.1f | document %.1f | highlights %.1f | chrome %.1f"
+            L" | present %.1f",
             app.parseTimeUs,
             app.layoutTimeUs,
             app.drawCalls,
@@ -731,10 +565,26 @@ render_document:
             app.metrics.windowInitUs / 1000.0,
             app.metrics.d2dInitUs / 1000.0,
             app.metrics.dwriteInitUs / 1000.0,
-            app.metrics.fileLoadUs / 1000.0);
-
-        float statsWidth = dpi(app, 600.0f);
-        float statsHeight = dpi(app, 50.0f);
+            app.metrics.fileLoadUs / 1000.0,
+            app.metrics.fileOpenUs / 1000.0,
+            (app.metrics.fileLoadUs - app.metrics.fileOpenUs) / 1000.0,
+            app.metrics.fileParseUs / 1000.0,
+            app.metrics.fileLayoutUs / 1000.0,
+            frameTimePercentileUs(frames, 0.50) / 1000.0,
+            frameTimePercentileUs(frames, 0.95) / 1000.0,
+            frameTimePercentileUs(frames, 1.00) / 1000.0,
+            phaseMs(FramePhase::Layout),
+            phaseMs(FramePhase::Tokenize),
+            phaseMs(FramePhase::Mermaid),
+            phaseMs(FramePhase::Images),
+            phaseMs(FramePhase::DrawDocument),
+            phaseMs(FramePhase::DrawHighlights),
+            phaseMs(FramePhase::DrawOverlays),
+            phaseMs(FramePhase::Present));
+
+        float statsWidth = dpi(app, 760.0f);
+        float histogramHeight = dpi(app, 40.0f);
+        float statsHeight = dpi(app, 72.0f) + histogramHeight;
 
         app.brush->SetColor(D2D1::ColorF(0, 0, 0, 0.8f));
         app.renderTarget->FillRectangle(
@@ -742,9 +592,39 @@ render_document:
                        app.width - dpi(app, 10.0f), app.height - dpi(app, 10.0f)),
             app.brush);
 
+        // Frame-time histogram, oldest frame on the left. Bars are scaled
+        // so 33 ms fills the strip and colored against 60 and 30 fps.
+        float barsLeft = app.width - statsWidth - dpi(app, 5.0f);
+        float barsBottom = app.height - statsHeight - dpi(app, 5.0f) + histogramHeight;
+        float barWidth = (statsWidth - dpi(app, 10.0f)) / FrameStats::kHistory;
+        size_t recorded = std::min(frames.frames, FrameStats::kHistory);
+        for (size_t i = 0; i < recorded; i++) {
+            size_t frame = frames.frames - recorded + i;
+            int64_t us = frames.frameUs[frame % FrameStats::kHistory];
+            float h = std::min(1.0f, us / 33333.0f) * histogramHeight;
+            if (us > 33333) {
+                app.brush->SetColor(D2D1::ColorF(0.9f, 0.3f, 0.3f));
+            } else if (us > 16667) {
+                app.brush->SetColor(D2D1::ColorF(0.9f, 0.8f, 0.3f));
+            } else {
+                app.brush->SetColor(D2D1::ColorF(0.4f, 0.8f, 0.4f));
+            }
+            float x = barsLeft + (FrameStats::kHistory - recorded + i) * barWidth;
+            app.renderTarget->FillRectangle(
+                D2D1::RectF(x, barsBottom - std::max(h, 1.0f), x + barWidth - 1.0f, barsBottom),
+                app.brush);
+        }
+        app.brush->SetColor(D2D1::ColorF(1, 1, 1, 0.3f));
+        app.renderTarget->DrawLine(
+            D2D1::Point2F(barsLeft, barsBottom - histogramHeight / 2),
+            D2D1::Point2F(barsLeft + barWidth * FrameStats::kHistory, barsBottom - histogramHeight / 2),
+            app.brush, 1.0f);
+        app.drawCalls += recorded + 1;
+
         app.brush->SetColor(D2D1::ColorF(0.7f, 0.9f, 0.7f));
         app.renderTarget->DrawText(stats, (UINT32)wcslen(stats), app.codeFormat,
-            D2D1::RectF(app.width - statsWidth - dpi(app, 5.0f), app.height - statsHeight - dpi(app, 5.0f),
+            D2D1::RectF(app.width - statsWidth - dpi(app, 5.0f),
+                       app.height - statsHeight - dpi(app, 5.0f) + histogramHeight + dpi(app, 4.0f),
                        app.width - dpi(app, 15.0f), app.height - dpi(app, 15.0f)),
             app.brush);
     }
@@ -771,7 +651,10 @@ render_document:
 
     // "Saved!" notification (reuses "Copied!" infrastructure)
 
+    drawPhase.switchTo(FramePhase::Present);
     app.renderTarget->EndDraw();
+    drawPhase.stop();
+    endFrame(app, usElapsed(frameStart));
 }
 
 LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
@@ -851,6 +734,18 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             if (app) handleCharInput(*app, hwnd, wParam);
             return 0;
 
+        case WM_SYSKEYDOWN:
+            if (app && handleSearchModeKey(*app, hwnd, wParam)) return 0;
+            break;
+
+        case WM_SYSCHAR:
+            // Swallow the Alt+R / Alt+W characters so they do not beep
+            if (app && app->showSearch && app->searchActive &&
+                (wParam == 'r' || wParam == 'R' || wParam == 'w' || wParam == 'W')) {
+                return 0;
+            }
+            break;
+
         case WM_IME_STARTCOMPOSITION:
         case WM_IME_COMPOSITION:
             // Anchor the IME composition/candidate window at the caret in
@@ -863,7 +758,6 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             return 0;
 
         case WM_TIMER:
-            if (wParam == TIMER_FILE_WATCH && app) handleFileWatchTimer(*app, hwnd);
             if (wParam == 2 && app) editorReparse(*app); // TIMER_EDITOR_REPARSE
             if (wParam == TIMER_CURSOR_BLINK && app) {
                 app->cursorBlinkOn = !app->cursorBlinkOn;
@@ -881,13 +775,13 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                 }
             }
             if (wParam == TIMER_ZOOM_APPLY && app) {
+                // The wheel rested: lay out crisply at the zoom the scaled
+                // frames have been showing
+                KillTimer(hwnd, TIMER_ZOOM_APPLY);
+                app->zoomApplyPending = false;
                 if (app->zoomFactor != app->appliedZoomFactor) {
-                    // More zoom ticks arrived since the last apply
                     updateTextFormats(*app);
                     InvalidateRect(hwnd, nullptr, FALSE);
-                } else {
-                    KillTimer(hwnd, TIMER_ZOOM_APPLY);
-                    app->zoomApplyPending = false;
                 }
             }
             return 0;
@@ -896,14 +790,30 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             // Continue an incomplete document layout in ~10ms slices, yielding
             // to input between slices
             if (app && !app->layoutDirty && !app->layoutComplete) {
+                ScopedPhase layoutPhase(app, FramePhase::Layout);
                 bool done = layoutDocumentContinue(*app, 10000);
                 InvalidateRect(hwnd, nullptr, FALSE);  // scrollbar grows as layout fills in
                 if (!done) PostMessage(hwnd, WM_APP_LAYOUT_CHUNK, 0, 0);
             }
             return 0;
 
+        case WM_APP_PARSE_DONE:
+            if (app) applyParseResult(*app);
+            return 0;
+
+        case WM_APP_IMAGE_READY:
+            if (app) applyImageResults(*app);
+            return 0;
+
+        case WM_APP_FILE_CHANGED:
+            if (app) handleFileChanged(*app, wParam);
+            return 0;
+
+        case WM_APP_FOLDER_INDEX:
+            if (app) handleFolderIndexUpdate(*app);
+            return 0;
+
         case WM_DESTROY:
-            KillTimer(hwnd, TIMER_FILE_WATCH);
             KillTimer(hwnd, 2); // TIMER_EDITOR_REPARSE
             KillTimer(hwnd, TIMER_CURSOR_BLINK);
             KillTimer(hwnd, TIMER_NOTIFICATION);
@@ -930,6 +840,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
                 saveSettings(settings);
             }
+            saveDocumentCache(*app);
             PostQuitMessage(0);
             return 0;
     }
@@ -1007,6 +918,7 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
     SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
 
     auto startupStart = Clock::now();
+    registerTraceProvider();
 
     App app;
     auto t0 = startupStart;
@@ -1020,6 +932,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
     app.zoomFactor = savedSettings.zoomFactor;
     app.editorShowPreview = savedSettings.editorShowPreview;
     app.editorWordWrap = savedSettings.editorWordWrap;
+    app.imageCacheBudget = size_t(savedSettings.imageCacheMB) << 20;
+    app.documentTilesEnabled = savedSettings.documentTiles;
+    app.documentCacheEnabled = savedSettings.documentCache;
 
     // Parse command line
     std::string inputFile;
@@ -1125,6 +1040,24 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
 
     app.metrics.windowInitUs = usElapsed(t0);
 
+    // Load document. Only the read happens here: md4c runs on the parse
+    // worker while D2D and DirectWrite initialize, and we block on it just
+    // before the window is shown.
+    t0 = Clock::now();
+    startParseWorker(app);
+
+    // No argument: try syntax.md, then the built-in welcome page. MappedFile
+    // reads a file of up to 16 MB into a buffer here and maps a larger one,
+    // which md4c then pages in on the worker thread.
+    std::string startupFile = inputFile.empty() ? std::string("syntax.md") : inputFile;
+    bool startupFromFile = requestParseFile(app, toWide(startupFile), startupFile,
+                                            ParseReason::Open);
+    if (!startupFromFile) {
+        requestParse(app, sampleMarkdown, {}, ParseReason::Update);
+    }
+    int64_t fileReadUs = usElapsed(t0);
+    app.metrics.fileOpenUs = fileReadUs;
+
     // Get DPI using per-monitor aware API
     app.contentScale = GetDpiForWindow(app.hwnd) / 96.0f;
 
@@ -1152,53 +1085,19 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
     }
     app.metrics.renderTargetUs = usElapsed(t0);
 
-    // Load document
+    // Swap in the startup document, falling back to the welcome page if
+    // the file did not parse
     t0 = Clock::now();
-
-    auto loadDocumentContent = [&](const std::string& content, std::string_view path) {
-        auto result = parseDocument(app.parser, content, path);
-        if (result.success) {
-            app.root = result.root;
-            app.parseTimeUs = result.parseTimeUs;
-        }
-        return result.success;
-    };
-
-    auto loadFile = [&](const std::string& path) -> bool {
-        // Use wide string path for ifstream to support non-ASCII paths (MSVC extension)
-        std::wstring widePath = toWide(path);
-        std::ifstream file(widePath);
-        if (!file) return false;
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        return loadDocumentContent(buffer.str(), path);
-    };
-
-    if (!inputFile.empty()) {
-        if (loadFile(inputFile)) {
-            app.currentFile = inputFile;
-            app.focusMermaidOnNextLayout = isMermaidDocumentPath(inputFile);
-        } else {
-            loadDocumentContent(sampleMarkdown, {});
-        }
-    } else {
-        // Try syntax.md
-        if (loadFile("syntax.md")) {
-            app.currentFile = "syntax.md";
-        } else {
-            loadDocumentContent(sampleMarkdown, {});
-        }
+    if (!waitForParse(app) && startupFromFile) {
+        requestParse(app, sampleMarkdown, {}, ParseReason::Update);
+        waitForParse(app);
     }
-
-    app.metrics.fileLoadUs = usElapsed(t0);
+    app.metrics.fileLoadUs = fileReadUs + usElapsed(t0);
+    app.metrics.fileParseUs = (int64_t)app.parseTimeUs;
 
     // Set window title with filename
     updateWindowTitle(app);
 
-    // Start file watch timer and record initial write time
-    updateFileWriteTime(app);
-    SetTimer(app.hwnd, TIMER_FILE_WATCH, 500, nullptr);
-
     // Show window (respect saved maximized state)
     t0 = Clock::now();
     if (savedSettings.windowMaximized) {
@@ -1208,6 +1107,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
     }
     UpdateWindow(app.hwnd);
     app.metrics.showWindowUs = usElapsed(t0);
+    // The first paint laid out the visible part of the document
+    app.metrics.fileLayoutUs = (int64_t)app.layoutTimeUs;
 
     app.metrics.totalStartupUs = usElapsed(startupStart);
 
@@ -1218,6 +1119,11 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow
         DispatchMessage(&msg);
     }
 
+    stopFileWatcher(app);
+    stopFolderIndex(app);
+    stopParseWorker(app);
+    stopImageLoader(app);
     g_app = nullptr;
+    unregisterTraceProvider();
     return (int)msg.wParam;
 }
@@ -0,0 +1,71 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <utility>
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        bool copied = other.data_ && !other.mapping_;
+        mapping_ = std::exchange(other.mapping_, nullptr);
+        copy_ = std::move(other.copy_);
+        data_ = copied ? copy_.data() : other.data_;  // a short copy_ moves its bytes
+        size_ = std::exchange(other.size_, 0);
+        open_ = std::exchange(other.open_, false);
+        other.data_ = nullptr;
+        other.copy_.clear();
+    }
+    return *this;
+}
+
+bool MappedFile::open(const std::wstring& path) {
+    close();
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size{};
+    bool ok = GetFileSizeEx(file, &size) && (unsigned long long)size.QuadPart <= (size_t)-1;
+    size_t length = ok ? (size_t)size.QuadPart : 0;
+    if (ok && length <= kCopyBytes) {
+        // Small enough to copy: nothing stays open for a writer to run into
+        copy_.resize(length);
+        size_t done = 0;
+        while (ok && done < length) {
+            DWORD read = 0;
+            ok = ReadFile(file, copy_.data() + done,
+                          (DWORD)std::min<size_t>(length - done, 1u << 30), &read, nullptr) != 0;
+            if (read == 0) break;  // truncated meanwhile: keep what was there
+            done += read;
+        }
+        copy_.resize(done);
+        if (ok && done > 0) data_ = copy_.data();
+        size_ = done;
+    } else if (ok) {
+        // The mapping keeps the section alive after the handle is closed
+        mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_) data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        ok = data_ != nullptr;
+        size_ = length;
+    }
+    CloseHandle(file);
+    if (!ok) {
+        close();
+        return false;
+    }
+    open_ = true;
+    return true;
+}
+
+void MappedFile::close() {
+    if (mapping_) {
+        if (data_) UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+    }
+    mapping_ = nullptr;
+    std::string().swap(copy_);
+    data_ = nullptr;
+    size_ = 0;
+    open_ = false;
+}
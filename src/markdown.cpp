@@ -1,7 +1,6 @@
 #include "markdown.h"
+#include "mapped_file.h"
 #include <md4c.h>
-#include <fstream>
-#include <sstream>
 #include <chrono>
 #include <cstring>
 #include <stack>
@@ -9,18 +8,22 @@
 #include <unordered_map>
 #include <algorithm>
 #include <cctype>
+#include <new>
+#include <type_traits>
 
 namespace qmd {
 
 // Parser context for MD4C callbacks
 struct ParserContext {
     ElementPtr root;
+    ElementArena* arena = nullptr;
     std::stack<Element*> elementStack;
     std::string currentText;
+    std::string htmlText;              // raw HTML of the open HtmlBlock
     const char* inputStart = nullptr;  // start of markdown source for offset tracking
 
     ParserContext() {
-        root = std::make_shared<Element>(ElementType::Document);
+        root = newDocument(arena);
         elementStack.push(root.get());
     }
 
@@ -28,11 +31,10 @@ struct ParserContext {
         return elementStack.empty() ? nullptr : elementStack.top();
     }
 
-    void pushElement(ElementPtr elem) {
+    void pushElement(Element* elem) {
         if (Element* parent = current()) {
-            elem->parent = parent;
-            parent->children.push_back(elem);
-            elementStack.push(elem.get());
+            arena->append(parent, elem);
+            elementStack.push(elem);
         }
     }
 
@@ -44,14 +46,13 @@ struct ParserContext {
 
     void flushText() {
         if (!currentText.empty() && current()) {
-            // For HTML blocks, accumulate raw HTML in the element's text field
+            // For HTML blocks, accumulate raw HTML until the block closes
             if (current()->type == ElementType::HtmlBlock) {
-                current()->text += currentText;
+                htmlText += currentText;
             } else {
-                auto textElem = std::make_shared<Element>(ElementType::Text);
-                textElem->text = currentText;
-                textElem->parent = current();
-                current()->children.push_back(textElem);
+                Element* textElem = arena->make(ElementType::Text);
+                textElem->text = arena->storeText(currentText);
+                arena->append(current(), textElem);
             }
             currentText.clear();
         }
@@ -67,59 +68,59 @@ static int enterBlockCallback(MD_BLOCKTYPE type, void* detail, void* userdata) {
     auto* ctx = static_cast<ParserContext*>(userdata);
     ctx->flushText();
 
-    ElementPtr elem;
+    Element* elem = nullptr;
     switch (type) {
         case MD_BLOCK_DOC:
             // Root already exists
             return 0;
 
         case MD_BLOCK_P:
-            elem = std::make_shared<Element>(ElementType::Paragraph);
+            elem = ctx->arena->make(ElementType::Paragraph);
             break;
 
         case MD_BLOCK_H: {
             auto* h = static_cast<MD_BLOCK_H_DETAIL*>(detail);
-            elem = std::make_shared<Element>(ElementType::Heading);
+            elem = ctx->arena->make(ElementType::Heading);
             elem->level = h->level;
             break;
         }
 
         case MD_BLOCK_CODE: {
             auto* code = static_cast<MD_BLOCK_CODE_DETAIL*>(detail);
-            elem = std::make_shared<Element>(ElementType::CodeBlock);
+            elem = ctx->arena->make(ElementType::CodeBlock);
             if (code->lang.text && code->lang.size > 0) {
-                elem->language = std::string(code->lang.text, code->lang.size);
+                elem->language = ctx->arena->store(std::string_view(code->lang.text, code->lang.size));
             }
             break;
         }
 
         case MD_BLOCK_QUOTE:
-            elem = std::make_shared<Element>(ElementType::BlockQuote);
+            elem = ctx->arena->make(ElementType::BlockQuote);
             break;
 
         case MD_BLOCK_UL:
-            elem = std::make_shared<Element>(ElementType::List);
+            elem = ctx->arena->make(ElementType::List);
             elem->ordered = false;
             break;
 
         case MD_BLOCK_OL: {
             auto* ol = static_cast<MD_BLOCK_OL_DETAIL*>(detail);
-            elem = std::make_shared<Element>(ElementType::List);
+            elem = ctx->arena->make(ElementType::List);
             elem->ordered = true;
             elem->start = ol->start;
             break;
         }
 
         case MD_BLOCK_LI:
-            elem = std::make_shared<Element>(ElementType::ListItem);
+            elem = ctx->arena->make(ElementType::ListItem);
             break;
 
         case MD_BLOCK_HR:
-            elem = std::make_shared<Element>(ElementType::HorizontalRule);
+            elem = ctx->arena->make(ElementType::HorizontalRule);
             break;
 
         case MD_BLOCK_TABLE: {
-            elem = std::make_shared<Element>(ElementType::Table);
+            elem = ctx->arena->make(ElementType::Table);
             auto* table = static_cast<MD_BLOCK_TABLE_DETAIL*>(detail);
             elem->col_count = (int)table->col_count;
             break;
@@ -131,19 +132,19 @@ static int enterBlockCallback(MD_BLOCKTYPE type, void* detail, void* userdata) {
             return 0;
 
         case MD_BLOCK_TR:
-            elem = std::make_shared<Element>(ElementType::TableRow);
+            elem = ctx->arena->make(ElementType::TableRow);
             break;
 
         case MD_BLOCK_TH:
         case MD_BLOCK_TD: {
-            elem = std::make_shared<Element>(ElementType::TableCell);
+            elem = ctx->arena->make(ElementType::TableCell);
             auto* td = static_cast<MD_BLOCK_TD_DETAIL*>(detail);
             elem->align = (int)td->align;
             break;
         }
 
         case MD_BLOCK_HTML:
-            elem = std::make_shared<Element>(ElementType::HtmlBlock);
+            elem = ctx->arena->make(ElementType::HtmlBlock);
             break;
 
         default:
@@ -168,10 +169,10 @@ static int leaveBlockCallback(MD_BLOCKTYPE type, void* /*detail*/, void* userdat
         case MD_BLOCK_HTML: {
             // Parse HTML content and convert to elements
             Element* htmlBlock = ctx->current();
-            if (htmlBlock && htmlBlock->type == ElementType::HtmlBlock && !htmlBlock->text.empty()) {
-                parseHtmlIntoElements(htmlBlock->text, htmlBlock);
-                htmlBlock->text.clear(); // Clear raw HTML after parsing
+            if (htmlBlock && htmlBlock->type == ElementType::HtmlBlock && !ctx->htmlText.empty()) {
+                parseHtmlIntoElements(ctx->htmlText, htmlBlock, *ctx->arena);
             }
+            ctx->htmlText.clear();
             ctx->popElement();
             break;
         }
@@ -186,40 +187,40 @@ static int enterSpanCallback(MD_SPANTYPE type, void* detail, void* userdata) {
     auto* ctx = static_cast<ParserContext*>(userdata);
     ctx->flushText();
 
-    ElementPtr elem;
+    Element* elem = nullptr;
     switch (type) {
         case MD_SPAN_EM:
-            elem = std::make_shared<Element>(ElementType::Emphasis);
+            elem = ctx->arena->make(ElementType::Emphasis);
             break;
 
         case MD_SPAN_STRONG:
-            elem = std::make_shared<Element>(ElementType::Strong);
+            elem = ctx->arena->make(ElementType::Strong);
             break;
 
         case MD_SPAN_CODE:
-            elem = std::make_shared<Element>(ElementType::Code);
+            elem = ctx->arena->make(ElementType::Code);
             break;
 
         case MD_SPAN_A: {
             auto* a = static_cast<MD_SPAN_A_DETAIL*>(detail);
-            elem = std::make_shared<Element>(ElementType::Link);
+            elem = ctx->arena->make(ElementType::Link);
             if (a->href.text && a->href.size > 0) {
-                elem->url = std::string(a->href.text, a->href.size);
+                elem->url = ctx->arena->store(std::string_view(a->href.text, a->href.size));
             }
             if (a->title.text && a->title.size > 0) {
-                elem->title = std::string(a->title.text, a->title.size);
+                elem->title = ctx->arena->store(std::string_view(a->title.text, a->title.size));
             }
             break;
         }
 
         case MD_SPAN_IMG: {
             auto* img = static_cast<MD_SPAN_IMG_DETAIL*>(detail);
-            elem = std::make_shared<Element>(ElementType::Image);
+            elem = ctx->arena->make(ElementType::Image);
             if (img->src.text && img->src.size > 0) {
-                elem->url = std::string(img->src.text, img->src.size);
+                elem->url = ctx->arena->store(std::string_view(img->src.text, img->src.size));
             }
             if (img->title.text && img->title.size > 0) {
-                elem->title = std::string(img->title.text, img->title.size);
+                elem->title = ctx->arena->store(std::string_view(img->title.text, img->title.size));
             }
             break;
         }
@@ -269,23 +270,15 @@ static int textCallback(MD_TEXTTYPE type, const MD_CHAR* text, MD_SIZE size, voi
 
         case MD_TEXT_SOFTBR:
             ctx->flushText();
-            {
-                auto elem = std::make_shared<Element>(ElementType::SoftBreak);
-                elem->parent = ctx->current();
-                if (ctx->current()) {
-                    ctx->current()->children.push_back(elem);
-                }
+            if (ctx->current()) {
+                ctx->arena->append(ctx->current(), ctx->arena->make(ElementType::SoftBreak));
             }
             break;
 
         case MD_TEXT_BR:
             ctx->flushText();
-            {
-                auto elem = std::make_shared<Element>(ElementType::HardBreak);
-                elem->parent = ctx->current();
-                if (ctx->current()) {
-                    ctx->current()->children.push_back(elem);
-                }
+            if (ctx->current()) {
+                ctx->arena->append(ctx->current(), ctx->arena->make(ElementType::HardBreak));
             }
             break;
 
@@ -332,29 +325,29 @@ struct ExtensionMatch {
 
 // Find the first extension span at or after `from`. Delimiters are ASCII,
 // so byte scanning is UTF-8 safe.
-static bool findExtensionSpan(const std::string& text, size_t from, ExtensionMatch& match) {
+static bool findExtensionSpan(std::string_view text, size_t from, ExtensionMatch& match) {
     for (size_t i = from; i < text.size(); i++) {
         char c = text[i];
         if (c == '=' && i + 1 < text.size() && text[i + 1] == '=') {
             size_t close = text.find("==", i + 2);
-            if (close != std::string::npos && close > i + 2) {
+            if (close != std::string_view::npos && close > i + 2) {
                 match = {i, close - (i + 2), 2, ElementType::Highlight};
                 return true;
             }
         } else if (c == '~' && i + 1 < text.size() && text[i + 1] == '~') {
             size_t close = text.find("~~", i + 2);
-            if (close != std::string::npos && close > i + 2) {
+            if (close != std::string_view::npos && close > i + 2) {
                 match = {i, close - (i + 2), 2, ElementType::Strikethrough};
                 return true;
             }
             // No closing ~~: fall through to try a single-tilde subscript
             size_t single = text.find('~', i + 2);
-            if (single == std::string::npos) continue;
+            if (single == std::string_view::npos) continue;
             i++;  // retry from the second tilde as a potential single opener
             continue;
         } else if (c == '^' || c == '~') {
             size_t close = text.find(c, i + 1);
-            if (close == std::string::npos || close == i + 1) continue;
+            if (close == std::string_view::npos || close == i + 1) continue;
             // Typora rule: no whitespace inside sup/sub spans
             bool hasSpace = false;
             for (size_t j = i + 1; j < close; j++) {
@@ -370,43 +363,42 @@ static bool findExtensionSpan(const std::string& text, size_t from, ExtensionMat
     return false;
 }
 
-static ElementPtr makeTextElement(std::string text, Element* parent) {
-    auto node = std::make_shared<Element>(ElementType::Text);
-    node->text = std::move(text);
-    node->parent = parent;
+// `text` is a slice of an arena-owned view, so no copy is needed
+static Element* makeTextElement(ElementArena& arena, std::string_view text) {
+    Element* node = arena.make(ElementType::Text);
+    node->text = text;
     return node;
 }
 
-static void splitInlineExtensions(const ElementPtr& parent) {
+static void splitInlineExtensions(Element* parent, ElementArena& arena) {
     if (parent->type == ElementType::Code ||
         parent->type == ElementType::CodeBlock ||
         parent->type == ElementType::MermaidDiagram) {
         return;
     }
 
-    std::vector<ElementPtr> rebuilt;
+    std::vector<Element*> rebuilt;
     bool changed = false;
-    for (auto& child : parent->children) {
+    for (Element* child : parent->children) {
         if (child->type != ElementType::Text) {
-            splitInlineExtensions(child);
+            splitInlineExtensions(child, arena);
             rebuilt.push_back(child);
             continue;
         }
 
-        const std::string& text = child->text;
+        std::string_view text = child->text;
         size_t cursor = 0;
         ExtensionMatch m;
         bool any = false;
         while (findExtensionSpan(text, cursor, m)) {
             any = true;
             if (m.start > cursor) {
-                rebuilt.push_back(makeTextElement(text.substr(cursor, m.start - cursor), parent.get()));
+                rebuilt.push_back(makeTextElement(arena, text.substr(cursor, m.start - cursor)));
             }
-            auto span = std::make_shared<Element>(m.type);
-            span->parent = parent.get();
-            span->children.push_back(makeTextElement(
-                text.substr(m.start + m.delimLen, m.contentLen), span.get()));
-            rebuilt.push_back(std::move(span));
+            Element* span = arena.make(m.type);
+            arena.append(span, makeTextElement(
+                arena, text.substr(m.start + m.delimLen, m.contentLen)));
+            rebuilt.push_back(span);
             cursor = m.start + m.delimLen + m.contentLen + m.delimLen;
         }
         if (!any) {
@@ -415,24 +407,232 @@ static void splitInlineExtensions(const ElementPtr& parent) {
         }
         changed = true;
         if (cursor < text.size()) {
-            rebuilt.push_back(makeTextElement(text.substr(cursor), parent.get()));
+            rebuilt.push_back(makeTextElement(arena, text.substr(cursor)));
         }
     }
-    if (changed) parent->children = std::move(rebuilt);
+    if (changed) {
+        parent->children.clear();  // the old array stays in the arena
+        for (Element* child : rebuilt) arena.append(parent, child);
+    }
+}
+
+} // namespace
+
+// --- ElementArena ---
+
+static_assert(std::is_trivially_destructible<Element>::value,
+              "ElementArena frees nodes without running destructors");
+
+namespace {
+constexpr size_t kArenaBlockSize = 64 * 1024;
+}
+
+void* ElementArena::allocate(Pool& pool, size_t size, size_t align) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(pool.cursor) + align - 1) & ~(uintptr_t)(align - 1);
+    if (!pool.cursor || p + size > reinterpret_cast<uintptr_t>(pool.end)) {
+        if (size + align > kArenaBlockSize / 4) {
+            // Large request (a long code block, a huge child list): give it
+            // its own block and keep bumping in the current one
+            pool.blocks.emplace_back(new char[size + align]);
+            pool.used += size;
+            uintptr_t q = reinterpret_cast<uintptr_t>(pool.blocks.back().get());
+            q = (q + align - 1) & ~(uintptr_t)(align - 1);
+            return reinterpret_cast<void*>(q);
+        }
+        pool.blocks.emplace_back(new char[kArenaBlockSize]);
+        pool.cursor = pool.blocks.back().get();
+        pool.end = pool.cursor + kArenaBlockSize;
+        p = (reinterpret_cast<uintptr_t>(pool.cursor) + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    pool.cursor = reinterpret_cast<char*>(p + size);
+    pool.used += size;
+    return reinterpret_cast<void*>(p);
+}
+
+Element* ElementArena::make(ElementType type) {
+    return new (allocate(sizeof(Element), alignof(Element))) Element(type);
+}
+
+std::string_view ElementArena::store(std::string_view text) {
+    if (text.empty()) return {};
+    char* dst = static_cast<char*>(allocate(text.size(), 1));
+    std::memcpy(dst, text.data(), text.size());
+    return std::string_view(dst, text.size());
+}
+
+std::string_view ElementArena::storeText(std::string_view text) {
+    if (text.empty()) return {};
+    char* dst = static_cast<char*>(allocate(m_text, text.size(), 1));
+    std::memcpy(dst, text.data(), text.size());
+    return std::string_view(dst, text.size());
+}
+
+namespace {
+
+// UTF-8 to UTF-16 the way MultiByteToWideChar(CP_UTF8) does it: an invalid
+// or truncated sequence becomes U+FFFD. Never writes more units than there
+// are bytes. Returns the number of units written.
+size_t decodeUtf8(std::string_view in, wchar_t* out) {
+    size_t n = 0;
+    size_t i = 0;
+    while (i < in.size()) {
+        unsigned char c = static_cast<unsigned char>(in[i]);
+        if (c < 0x80) {
+            out[n++] = c;
+            i++;
+            continue;
+        }
+        size_t extra;
+        uint32_t cp;
+        uint32_t minimum;
+        if ((c & 0xE0) == 0xC0) { extra = 1; cp = c & 0x1F; minimum = 0x80; }
+        else if ((c & 0xF0) == 0xE0) { extra = 2; cp = c & 0x0F; minimum = 0x800; }
+        else if ((c & 0xF8) == 0xF0) { extra = 3; cp = c & 0x07; minimum = 0x10000; }
+        else {
+            out[n++] = 0xFFFD;
+            i++;
+            continue;
+        }
+        size_t used = 1;
+        while (used <= extra && i + used < in.size() &&
+               (static_cast<unsigned char>(in[i + used]) & 0xC0) == 0x80) {
+            cp = (cp << 6) | (static_cast<unsigned char>(in[i + used]) & 0x3F);
+            used++;
+        }
+        i += used;
+        if (used <= extra || cp < minimum || cp > 0x10FFFF ||
+            (cp >= 0xD800 && cp <= 0xDFFF)) {
+            out[n++] = 0xFFFD;
+        } else if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out[n++] = static_cast<wchar_t>(0xD800 + (cp >> 10));
+            out[n++] = static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+        } else {
+            out[n++] = static_cast<wchar_t>(cp);
+        }
+    }
+    return n;
 }
 
 } // namespace
 
+void ElementArena::widenText(Element* root) {
+    if (!root) return;
+    size_t bytes = 0;
+    std::vector<Element*> stack{root};
+    while (!stack.empty()) {
+        Element* elem = stack.back();
+        stack.pop_back();
+        bytes += elem->text.size();
+        for (Element* child : elem->children) stack.push_back(child);
+    }
+    if (bytes == 0) {
+        m_text = Pool();
+        return;
+    }
+
+    auto* buffer = static_cast<wchar_t*>(allocate(bytes * sizeof(wchar_t), alignof(wchar_t)));
+    stack.push_back(root);
+    while (!stack.empty()) {
+        Element* elem = stack.back();
+        stack.pop_back();
+        if (!elem->text.empty()) {
+            size_t units = decodeUtf8(elem->text, buffer);
+            elem->wtext = std::wstring_view(buffer, units);
+            elem->text = {};
+            buffer += units;
+        }
+        for (Element* child : elem->children) stack.push_back(child);
+    }
+    m_text = Pool();
+}
+
+std::string narrowText(std::wstring_view text) {
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        uint32_t cp = text[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < text.size() &&
+            text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (text[++i] - 0xDC00);
+        } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = 0xFFFD;
+        }
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+    return out;
+}
+
+void ElementArena::append(Element* parent, Element* child) {
+    ElementList& list = parent->children;
+    if (list.count == list.capacity) {
+        uint32_t capacity = list.capacity ? list.capacity * 2 : 4;
+        auto** items = static_cast<Element**>(
+            allocate(capacity * sizeof(Element*), alignof(Element*)));
+        if (list.count) std::memcpy(items, list.items, list.count * sizeof(Element*));
+        list.items = items;
+        list.capacity = capacity;
+    }
+    list.items[list.count++] = child;
+    child->parent = parent;
+}
+
+ElementPtr newDocument(ElementArena*& arena) {
+    auto owner = std::make_shared<ElementArena>();
+    arena = owner.get();
+    // Aliasing constructor: the root shares the arena's control block, so
+    // the tree lives exactly as long as some holder of the root
+    return ElementPtr(owner, owner->make(ElementType::Document));
+}
+
+namespace {
+
+// Owner of a document with another one's blocks appended: both trees,
+// and the arena the root's grown child list comes out of
+struct JoinedDocument {
+    ElementPtr base;
+    ElementPtr appended;
+    ElementArena lists;
+};
+
+} // namespace
+
+void appendDocument(ElementPtr& root, ElementPtr more) {
+    if (!more || more->children.empty()) return;
+    auto joined = std::make_shared<JoinedDocument>();
+    joined->base = root;
+    joined->appended = std::move(more);
+    for (Element* child : joined->appended->children) joined->lists.append(root.get(), child);
+    joined->appended->children.clear();
+    root = ElementPtr(joined, root.get());
+}
+
 MarkdownParser::MarkdownParser() = default;
 MarkdownParser::~MarkdownParser() = default;
 
-ParseResult MarkdownParser::parse(const std::string& markdown) {
+ParseResult MarkdownParser::parse(std::string_view markdown) {
     ParseResult result;
 
     auto startTime = std::chrono::high_resolution_clock::now();
 
+    // A mapped empty file has no data pointer; md4c still wants a string
+    const char* input = markdown.empty() ? "" : markdown.data();
     ParserContext ctx;
-    ctx.inputStart = markdown.c_str();
+    ctx.inputStart = input;
 
     MD_PARSER parser = {
         0, // abi_version
@@ -459,7 +659,7 @@ ParseResult MarkdownParser::parse(const std::string& markdown) {
         nullptr  // syntax
     };
 
-    int ret = md_parse(markdown.c_str(), static_cast<MD_SIZE>(markdown.size()), &parser, &ctx);
+    int ret = md_parse(input, static_cast<MD_SIZE>(markdown.size()), &parser, &ctx);
 
     auto endTime = std::chrono::high_resolution_clock::now();
     result.parseTimeUs = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
@@ -471,7 +671,8 @@ ParseResult MarkdownParser::parse(const std::string& markdown) {
     }
 
     ctx.flushText();
-    splitInlineExtensions(ctx.root);
+    splitInlineExtensions(ctx.root.get(), *ctx.arena);
+    ctx.arena->widenText(ctx.root.get());
     result.root = ctx.root;
     result.success = true;
     return result;
@@ -480,17 +681,20 @@ ParseResult MarkdownParser::parse(const std::string& markdown) {
 ParseResult MarkdownParser::parseFile(const std::string& path) {
     ParseResult result;
 
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
+    std::wstring widePath;
+    int wideLen = MultiByteToWideChar(CP_UTF8, 0, path.data(), (int)path.size(), nullptr, 0);
+    if (wideLen > 0) {
+        widePath.resize(wideLen);
+        MultiByteToWideChar(CP_UTF8, 0, path.data(), (int)path.size(), &widePath[0], wideLen);
+    }
+
+    MappedFile file;
+    if (!file.open(widePath)) {
         result.success = false;
         result.error = "Failed to open file: " + path;
         return result;
     }
-
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-
-    return parse(buffer.str());
+    return parse(file.view());
 }
 
 // Utility functions
@@ -527,20 +731,21 @@ std::string elementTypeToString(ElementType type) {
     }
 }
 
-void debugPrintElement(const ElementPtr& elem, int indent) {
+void debugPrintElement(const Element* elem, int indent) {
     if (!elem) return;
 
     std::string pad(indent * 2, ' ');
     printf("%s%s", pad.c_str(), elementTypeToString(elem->type).c_str());
 
-    if (!elem->text.empty()) {
-        printf(": \"%s\"", elem->text.c_str());
+    if (!elem->wtext.empty()) {
+        std::string text = narrowText(elem->wtext);
+        printf(": \"%.*s\"", (int)text.size(), text.data());
     }
     if (elem->level > 0) {
         printf(" (level=%d)", elem->level);
     }
     if (!elem->url.empty()) {
-        printf(" [url=%s]", elem->url.c_str());
+        printf(" [url=%.*s]", (int)elem->url.size(), elem->url.data());
     }
     printf("\n");
 
@@ -616,7 +821,7 @@ static HtmlTag parseTag(const std::string& tagStr) {
     return tag;
 }
 
-void parseHtmlIntoElements(const std::string& html, Element* parent) {
+void parseHtmlIntoElements(std::string_view html, Element* parent, ElementArena& arena) {
     if (!parent) return;
 
     std::stack<Element*> elementStack;
@@ -628,10 +833,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
     auto flushText = [&]() {
         std::string trimmed = trim(textBuffer);
         if (!trimmed.empty() && !elementStack.empty()) {
-            auto textElem = std::make_shared<Element>(ElementType::Text);
-            textElem->text = trimmed;
-            textElem->parent = elementStack.top();
-            elementStack.top()->children.push_back(textElem);
+            Element* textElem = arena.make(ElementType::Text);
+            textElem->text = arena.storeText(trimmed);
+            arena.append(elementStack.top(), textElem);
         }
         textBuffer.clear();
     };
@@ -640,7 +844,7 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         // Look for next tag
         size_t tagStart = html.find('<', pos);
 
-        if (tagStart == std::string::npos) {
+        if (tagStart == std::string_view::npos) {
             // No more tags, add remaining text
             textBuffer += html.substr(pos);
             break;
@@ -653,24 +857,23 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
 
         // Find end of tag
         size_t tagEnd = html.find('>', tagStart);
-        if (tagEnd == std::string::npos) {
+        if (tagEnd == std::string_view::npos) {
             // Malformed, add as text
             textBuffer += html.substr(tagStart);
             break;
         }
 
-        std::string tagStr = html.substr(tagStart, tagEnd - tagStart + 1);
+        std::string tagStr(html.substr(tagStart, tagEnd - tagStart + 1));
         HtmlTag tag = parseTag(tagStr);
 
         // Handle different tags
         if (tag.name == "ul" || tag.name == "ol") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::List);
+                Element* elem = arena.make(ElementType::List);
                 elem->ordered = (tag.name == "ol");
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -679,10 +882,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "li") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::ListItem);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::ListItem);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -691,12 +893,11 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "a") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Link);
-                elem->url = tag.href;
-                elem->title = tag.title;
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::Link);
+                elem->url = arena.store(tag.href);
+                elem->title = arena.store(tag.title);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -705,10 +906,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "strong" || tag.name == "b") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Strong);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::Strong);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -717,10 +917,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "em" || tag.name == "i") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Emphasis);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::Emphasis);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -729,10 +928,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "code") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Code);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::Code);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -741,10 +939,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "p") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Paragraph);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::Paragraph);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -754,11 +951,10 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
                  tag.name == "h4" || tag.name == "h5" || tag.name == "h6") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Heading);
+                Element* elem = arena.make(ElementType::Heading);
                 elem->level = tag.name[1] - '0';
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -766,23 +962,20 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         }
         else if (tag.name == "br") {
             flushText();
-            auto elem = std::make_shared<Element>(ElementType::HardBreak);
-            elem->parent = elementStack.top();
-            elementStack.top()->children.push_back(elem);
+            Element* elem = arena.make(ElementType::HardBreak);
+            arena.append(elementStack.top(), elem);
         }
         else if (tag.name == "hr") {
             flushText();
-            auto elem = std::make_shared<Element>(ElementType::HorizontalRule);
-            elem->parent = elementStack.top();
-            elementStack.top()->children.push_back(elem);
+            Element* elem = arena.make(ElementType::HorizontalRule);
+            arena.append(elementStack.top(), elem);
         }
         else if (tag.name == "pre") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::CodeBlock);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::CodeBlock);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -791,10 +984,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "blockquote") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::BlockQuote);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::BlockQuote);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -803,10 +995,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "ruby") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::Ruby);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::Ruby);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -815,10 +1006,9 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         else if (tag.name == "rt") {
             if (!tag.isClosing) {
                 flushText();
-                auto elem = std::make_shared<Element>(ElementType::RubyText);
-                elem->parent = elementStack.top();
-                elementStack.top()->children.push_back(elem);
-                elementStack.push(elem.get());
+                Element* elem = arena.make(ElementType::RubyText);
+                arena.append(elementStack.top(), elem);
+                elementStack.push(elem);
             } else if (elementStack.size() > 1) {
                 flushText();
                 elementStack.pop();
@@ -839,7 +1029,7 @@ void parseHtmlIntoElements(const std::string& html, Element* parent) {
         // Skip comments
         else if (tagStr.substr(0, 4) == "<!--") {
             size_t commentEnd = html.find("-->", tagStart);
-            if (commentEnd != std::string::npos) {
+            if (commentEnd != std::string_view::npos) {
                 tagEnd = commentEnd + 2;
             }
         }
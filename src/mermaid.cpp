@@ -1,4 +1,5 @@
 #include "mermaid.h"
+#include "hash.h"
 
 #include <algorithm>
 #include <cctype>
@@ -8,16 +9,18 @@
 #include <deque>
 #include <limits>
 #include <numeric>
+#include <thread>
 #include <unordered_map>
 
 namespace mermaid {
 namespace {
 
+// One mention of a node in a statement, as views into the source
 struct NodeSpec {
-    std::string id;
-    std::string label;
+    std::string_view id;
+    std::string_view encodedLabel;
     NodeShape shape = NodeShape::Rectangle;
-    std::string className;
+    std::string_view className;
     bool hasDefinition = false;
     size_t sourceOffset = 0;
 };
@@ -101,6 +104,10 @@ bool isArrowAt(std::string_view value, size_t position) {
 }
 
 std::string decodeLabel(std::string_view encoded) {
+    if (encoded.find_first_of("\\<&") == std::string_view::npos) {
+        return std::string(encoded);
+    }
+
     std::string decoded;
     decoded.reserve(encoded.size());
 
@@ -328,7 +335,7 @@ bool parseStyleList(std::string_view value, Style& style, std::string& error) {
     return true;
 }
 
-bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
+bool parseNodeSpec(std::string_view line, size_t& position, size_t lineOffset,
                    NodeSpec& spec, std::string& error) {
     skipSpaces(line, position);
     size_t idStart = position;
@@ -339,7 +346,9 @@ bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
             c == ':' || c == ';' || c == ',') {
             break;
         }
-        if (isArrowAt(line, position)) break;
+        if (c == '-' || c == '=') {
+            if (isArrowAt(line, position)) break;
+        }
         position++;
     }
 
@@ -348,25 +357,26 @@ bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
         return false;
     }
 
-    spec.id = std::string(line.substr(idStart, position - idStart));
-    spec.label = spec.id;
-    spec.sourceOffset = sourceOffset + idStart;
+    spec.id = line.substr(idStart, position - idStart);
+    spec.sourceOffset = lineOffset + idStart;
     skipSpaces(line, position);
 
     // Mermaid v11 attribute syntax (A@{ shape: ..., label: ... }) is not
     // supported — fail so the block falls back to a readable code block
     // instead of rendering the raw attributes as a diamond label
-    if (!spec.id.empty() && spec.id.back() == '@' &&
-        position < line.size() && line[position] == '{') {
+    if (spec.id.back() == '@' && position < line.size() && line[position] == '{') {
         error = "Mermaid '@{ }' attribute syntax is not supported";
         return false;
     }
 
     const Delimiter* delimiter = nullptr;
-    for (const auto& candidate : kDelimiters) {
-        if (startsWithAt(line, position, candidate.open)) {
-            delimiter = &candidate;
-            break;
+    if (position < line.size() &&
+        (line[position] == '[' || line[position] == '(' || line[position] == '{')) {
+        for (const auto& candidate : kDelimiters) {
+            if (startsWithAt(line, position, candidate.open)) {
+                delimiter = &candidate;
+                break;
+            }
         }
     }
 
@@ -376,7 +386,6 @@ bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
         position += delimiter->open.size();
         skipSpaces(line, position);
 
-        std::string_view encodedLabel;
         if (position < line.size() && (line[position] == '"' || line[position] == '\'')) {
             char quote = line[position++];
             size_t labelStart = position;
@@ -395,7 +404,7 @@ bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
                 error = "Unterminated quoted node label";
                 return false;
             }
-            encodedLabel = line.substr(labelStart, position - labelStart);
+            spec.encodedLabel = line.substr(labelStart, position - labelStart);
             position++;
             skipSpaces(line, position);
             if (!startsWithAt(line, position, delimiter->close)) {
@@ -409,10 +418,9 @@ bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
                 error = "Unterminated node label";
                 return false;
             }
-            encodedLabel = trim(line.substr(position, close - position));
+            spec.encodedLabel = trim(line.substr(position, close - position));
             position = close + delimiter->close.size();
         }
-        spec.label = decodeLabel(encodedLabel);
     }
 
     skipSpaces(line, position);
@@ -427,7 +435,7 @@ bool parseNodeSpec(std::string_view line, size_t& position, size_t sourceOffset,
             error = "Expected a class name after ':::'";
             return false;
         }
-        spec.className = std::string(line.substr(classStart, position - classStart));
+        spec.className = line.substr(classStart, position - classStart);
     }
 
     return true;
@@ -478,32 +486,96 @@ bool parseArrow(std::string_view line, size_t& position, ArrowSpec& arrow,
     return true;
 }
 
-size_t ensureNode(Diagram& diagram, std::unordered_map<std::string, size_t>& nodeIds,
-                  const NodeSpec& spec) {
-    auto existing = nodeIds.find(spec.id);
-    if (existing == nodeIds.end()) {
-        size_t index = diagram.nodes.size();
-        Node node;
-        node.id = spec.id;
-        node.label = spec.label;
-        node.shape = spec.shape;
-        node.className = spec.className;
-        node.sourceOffset = spec.sourceOffset;
-        diagram.nodes.push_back(std::move(node));
-        nodeIds.emplace(spec.id, index);
-        return index;
-    }
-
-    Node& node = diagram.nodes[existing->second];
-    if (spec.hasDefinition) {
-        node.label = spec.label;
-        node.shape = spec.shape;
-    }
-    if (!spec.className.empty()) node.className = spec.className;
-    node.sourceOffset = std::min(node.sourceOffset, spec.sourceOffset);
-    return existing->second;
+// A node as the parser accumulates it. Ids, labels and class names are
+// views into the source; the last definition wins, so labels are decoded
+// and strings built only once parsing is done (see finishNodes).
+struct NodeDraft {
+    std::string_view id;
+    std::string_view encodedLabel;
+    std::string_view className;
+    NodeShape shape = NodeShape::Rectangle;
+    bool hasDefinition = false;
+    size_t sourceOffset = 0;
+    uint64_t hash = 0;
+    Style style;
+};
+
+uint64_t hashId(std::string_view id) {
+    return hashBytes(kFnvOffset, id.data(), id.size());
 }
 
+// Interns node ids to dense indices in first-seen order: open addressing
+// with linear probing over a power-of-two slot array holding index + 1
+class NodeTable {
+public:
+    size_t intern(const NodeSpec& spec) {
+        uint64_t hash = hashId(spec.id);
+        if ((drafts_.size() + 1) * 2 > slots_.size()) grow();
+
+        size_t mask = slots_.size() - 1;
+        for (size_t slot = static_cast<size_t>(hash) & mask;; slot = (slot + 1) & mask) {
+            uint32_t entry = slots_[slot];
+            if (entry == 0) {
+                slots_[slot] = static_cast<uint32_t>(drafts_.size() + 1);
+                NodeDraft draft;
+                draft.id = spec.id;
+                draft.hash = hash;
+                draft.sourceOffset = spec.sourceOffset;
+                drafts_.push_back(draft);
+                merge(drafts_.back(), spec);
+                return drafts_.size() - 1;
+            }
+            NodeDraft& draft = drafts_[entry - 1];
+            if (draft.hash == hash && draft.id == spec.id) {
+                merge(draft, spec);
+                return entry - 1;
+            }
+        }
+    }
+
+    NodeDraft& operator[](size_t index) { return drafts_[index]; }
+    bool empty() const { return drafts_.empty(); }
+
+    void finishNodes(Diagram& diagram) const {
+        diagram.nodes.reserve(drafts_.size());
+        for (const auto& draft : drafts_) {
+            Node node;
+            node.id = std::string(draft.id);
+            node.label = draft.hasDefinition ? decodeLabel(draft.encodedLabel) : node.id;
+            node.shape = draft.shape;
+            node.className = std::string(draft.className);
+            node.style = draft.style;
+            node.sourceOffset = draft.sourceOffset;
+            diagram.nodes.push_back(std::move(node));
+        }
+    }
+
+private:
+    static void merge(NodeDraft& draft, const NodeSpec& spec) {
+        if (spec.hasDefinition) {
+            draft.hasDefinition = true;
+            draft.encodedLabel = spec.encodedLabel;
+            draft.shape = spec.shape;
+        }
+        if (!spec.className.empty()) draft.className = spec.className;
+        draft.sourceOffset = std::min(draft.sourceOffset, spec.sourceOffset);
+    }
+
+    void grow() {
+        std::vector<uint32_t> slots(std::max<size_t>(64, slots_.size() * 2), 0);
+        size_t mask = slots.size() - 1;
+        for (size_t index = 0; index < drafts_.size(); index++) {
+            size_t slot = static_cast<size_t>(drafts_[index].hash) & mask;
+            while (slots[slot] != 0) slot = (slot + 1) & mask;
+            slots[slot] = static_cast<uint32_t>(index + 1);
+        }
+        slots_ = std::move(slots);
+    }
+
+    std::vector<NodeDraft> drafts_;
+    std::vector<uint32_t> slots_;
+};
+
 bool parseDirection(std::string_view value, Direction& direction) {
     if (equalsIgnoreCase(value, "TB") || equalsIgnoreCase(value, "TD")) {
         direction = Direction::TopToBottom;
@@ -526,219 +598,577 @@ ParseResult fail(ParseResult result, size_t line, std::string message) {
     return result;
 }
 
-} // namespace
-
-ParseResult parse(std::string_view source) {
-    std::string normalized(source);
-    if (normalized.size() >= 3 &&
-        static_cast<unsigned char>(normalized[0]) == 0xEF &&
-        static_cast<unsigned char>(normalized[1]) == 0xBB &&
-        static_cast<unsigned char>(normalized[2]) == 0xBF) {
-        normalized[0] = ' ';
-        normalized[1] = ' ';
-        normalized[2] = ' ';
-    }
-
-    char quote = '\0';
-    bool escaped = false;
-    bool comment = false;
-    bool pipeLabel = false;
-    int squareDepth = 0;
-    int roundDepth = 0;
-    int curlyDepth = 0;
-    for (size_t i = 0; i < normalized.size(); i++) {
-        char& c = normalized[i];
-        if (c == '\n') {
-            comment = false;
-            pipeLabel = false;
-            continue;
+// Splits the source into statements on newlines and on semicolons outside
+// quotes, pipe labels, brackets and %% comments, in one forward pass and
+// without copying. Each top-level ';' starts a new statement line, which
+// is what errorLine has always counted.
+class StatementScanner {
+public:
+    explicit StatementScanner(std::string_view source) : source_(source) {
+        if (source_.size() >= 3 &&
+            static_cast<unsigned char>(source_[0]) == 0xEF &&
+            static_cast<unsigned char>(source_[1]) == 0xBB &&
+            static_cast<unsigned char>(source_[2]) == 0xBF) {
+            position_ = 3;
         }
-        if (comment) continue;
-        if (quote != '\0') {
-            if (c == quote && !escaped) quote = '\0';
-            if (c == '\\' && !escaped) {
-                escaped = true;
-            } else {
-                escaped = false;
+    }
+
+    // Returns false once the source is exhausted; `offset` is where the
+    // statement starts in the source
+    bool next(std::string_view& statement, size_t& offset) {
+        if (done_) return false;
+        size_t start = position_;
+        for (; position_ < source_.size(); position_++) {
+            char c = source_[position_];
+            if (c == '\n') {
+                comment_ = false;
+                pipeLabel_ = false;
+                break;
             }
-            continue;
-        }
-        if (pipeLabel) {
-            if (c == '|') pipeLabel = false;
-            continue;
-        }
-        if (c == '"' || c == '\'') {
-            quote = c;
-            escaped = false;
-            continue;
-        }
-        if (c == '%' && i + 1 < normalized.size() &&
-            normalized[i + 1] == '%' &&
-            squareDepth == 0 && roundDepth == 0 && curlyDepth == 0) {
-            comment = true;
-            continue;
+            if (comment_) continue;
+            if (quote_ != '\0') {
+                if (c == quote_ && !escaped_) quote_ = '\0';
+                escaped_ = c == '\\' && !escaped_;
+                continue;
+            }
+            if (pipeLabel_) {
+                if (c == '|') pipeLabel_ = false;
+                continue;
+            }
+            if (c == '"' || c == '\'') {
+                quote_ = c;
+                escaped_ = false;
+                continue;
+            }
+            bool topLevel = squareDepth_ == 0 && roundDepth_ == 0 && curlyDepth_ == 0;
+            if (c == '%' && topLevel && position_ + 1 < source_.size() &&
+                source_[position_ + 1] == '%') {
+                comment_ = true;
+                continue;
+            }
+            if (c == '|' && topLevel) pipeLabel_ = true;
+            else if (c == '[') squareDepth_++;
+            else if (c == ']' && squareDepth_ > 0) squareDepth_--;
+            else if (c == '(') roundDepth_++;
+            else if (c == ')' && roundDepth_ > 0) roundDepth_--;
+            else if (c == '{') curlyDepth_++;
+            else if (c == '}' && curlyDepth_ > 0) curlyDepth_--;
+            else if (c == ';' && topLevel) break;
         }
-        if (c == '|' && squareDepth == 0 && roundDepth == 0 && curlyDepth == 0) {
-            pipeLabel = true;
-        } else if (c == '[') squareDepth++;
-        else if (c == ']' && squareDepth > 0) squareDepth--;
-        else if (c == '(') roundDepth++;
-        else if (c == ')' && roundDepth > 0) roundDepth--;
-        else if (c == '{') curlyDepth++;
-        else if (c == '}' && curlyDepth > 0) curlyDepth--;
-        else if (c == ';' && squareDepth == 0 && roundDepth == 0 && curlyDepth == 0) {
-            c = '\n';
+
+        statement = source_.substr(start, position_ - start);
+        offset = start;
+        if (position_ >= source_.size()) {
+            done_ = true;
+        } else {
+            position_++;
         }
+        return true;
     }
-    source = normalized;
 
+private:
+    std::string_view source_;
+    size_t position_ = 0;
+    bool done_ = false;
+    char quote_ = '\0';
+    bool escaped_ = false;
+    bool comment_ = false;
+    bool pipeLabel_ = false;
+    int squareDepth_ = 0;
+    int roundDepth_ = 0;
+    int curlyDepth_ = 0;
+};
+
+} // namespace
+
+ParseResult parse(std::string_view source) {
     ParseResult result;
-    std::unordered_map<std::string, size_t> nodeIds;
+    NodeTable nodes;
+    StatementScanner scanner(source);
     bool foundHeader = false;
 
     size_t lineNumber = 0;
+    std::string_view line;
     size_t lineOffset = 0;
-    while (lineOffset <= source.size()) {
+    while (scanner.next(line, lineOffset)) {
         lineNumber++;
-        size_t lineEnd = source.find('\n', lineOffset);
-        if (lineEnd == std::string_view::npos) lineEnd = source.size();
 
-        std::string_view line = source.substr(lineOffset, lineEnd - lineOffset);
         if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        while (!line.empty() && isSpace(line.front())) {
+            line.remove_prefix(1);
+            lineOffset++;
+        }
         line = trim(line);
         if (!line.empty() && line.back() == ';') {
             line.remove_suffix(1);
             line = trim(line);
         }
+        if (line.empty() || startsWithAt(line, 0, "%%")) continue;
 
-        if (!line.empty() && !startsWithAt(line, 0, "%%")) {
-            size_t position = 0;
-            std::string_view keyword = readWord(line, position);
+        size_t position = 0;
+        std::string_view keyword = readWord(line, position);
 
-            if (!foundHeader) {
-                if (!equalsIgnoreCase(keyword, "flowchart") &&
-                    !equalsIgnoreCase(keyword, "graph")) {
-                    return fail(std::move(result), lineNumber,
-                                "Only Mermaid flowchart and graph diagrams are supported");
-                }
+        if (!foundHeader) {
+            if (!equalsIgnoreCase(keyword, "flowchart") &&
+                !equalsIgnoreCase(keyword, "graph")) {
+                return fail(std::move(result), lineNumber,
+                            "Only Mermaid flowchart and graph diagrams are supported");
+            }
 
-                std::string_view direction = readWord(line, position);
-                if (!direction.empty() && !parseDirection(direction, result.diagram.direction)) {
-                    return fail(std::move(result), lineNumber,
-                                "Unsupported flowchart direction");
-                }
-                foundHeader = true;
-            } else if (equalsIgnoreCase(keyword, "classDef")) {
-                std::string_view className = readWord(line, position);
-                if (className.empty()) {
-                    return fail(std::move(result), lineNumber,
-                                "Expected a class name after classDef");
-                }
-                Style style;
-                std::string error;
-                if (!parseStyleList(trim(line.substr(position)), style, error)) {
-                    return fail(std::move(result), lineNumber, std::move(error));
-                }
-                result.diagram.classStyles[std::string(className)] = style;
-            } else if (equalsIgnoreCase(keyword, "class")) {
-                std::string_view ids = readWord(line, position);
-                std::string_view className = readWord(line, position);
-                if (ids.empty() || className.empty()) {
-                    return fail(std::move(result), lineNumber,
-                                "Expected node IDs and a class name");
-                }
+            std::string_view direction = readWord(line, position);
+            if (!direction.empty() && !parseDirection(direction, result.diagram.direction)) {
+                return fail(std::move(result), lineNumber,
+                            "Unsupported flowchart direction");
+            }
+            foundHeader = true;
+        } else if (equalsIgnoreCase(keyword, "classDef")) {
+            std::string_view className = readWord(line, position);
+            if (className.empty()) {
+                return fail(std::move(result), lineNumber,
+                            "Expected a class name after classDef");
+            }
+            Style style;
+            std::string error;
+            if (!parseStyleList(trim(line.substr(position)), style, error)) {
+                return fail(std::move(result), lineNumber, std::move(error));
+            }
+            result.diagram.classStyles[std::string(className)] = style;
+        } else if (equalsIgnoreCase(keyword, "class")) {
+            std::string_view ids = readWord(line, position);
+            std::string_view className = readWord(line, position);
+            if (ids.empty() || className.empty()) {
+                return fail(std::move(result), lineNumber,
+                            "Expected node IDs and a class name");
+            }
 
-                size_t idPosition = 0;
-                while (idPosition <= ids.size()) {
-                    size_t comma = ids.find(',', idPosition);
-                    if (comma == std::string_view::npos) comma = ids.size();
-                    std::string_view id = trim(ids.substr(idPosition, comma - idPosition));
-                    if (!id.empty()) {
-                        NodeSpec spec;
-                        spec.id = std::string(id);
-                        spec.label = spec.id;
-                        spec.className = std::string(className);
-                        spec.sourceOffset = lineOffset;
-                        ensureNode(result.diagram, nodeIds, spec);
-                    }
-                    if (comma == ids.size()) break;
-                    idPosition = comma + 1;
-                }
-            } else if (equalsIgnoreCase(keyword, "style")) {
-                std::string_view id = readWord(line, position);
-                if (id.empty()) {
-                    return fail(std::move(result), lineNumber,
-                                "Expected a node ID after style");
-                }
-                Style style;
-                std::string error;
-                if (!parseStyleList(trim(line.substr(position)), style, error)) {
-                    return fail(std::move(result), lineNumber, std::move(error));
+            size_t idPosition = 0;
+            while (idPosition <= ids.size()) {
+                size_t comma = ids.find(',', idPosition);
+                if (comma == std::string_view::npos) comma = ids.size();
+                std::string_view id = trim(ids.substr(idPosition, comma - idPosition));
+                if (!id.empty()) {
+                    NodeSpec spec;
+                    spec.id = id;
+                    spec.className = className;
+                    spec.sourceOffset = lineOffset;
+                    nodes.intern(spec);
                 }
-                NodeSpec spec;
-                spec.id = std::string(id);
-                spec.label = spec.id;
-                spec.sourceOffset = lineOffset;
-                size_t nodeIndex = ensureNode(result.diagram, nodeIds, spec);
-                mergeStyle(result.diagram.nodes[nodeIndex].style, style);
-            } else if (equalsIgnoreCase(keyword, "subgraph") ||
-                       equalsIgnoreCase(keyword, "end") ||
-                       equalsIgnoreCase(keyword, "click") ||
-                       equalsIgnoreCase(keyword, "linkStyle")) {
+                if (comma == ids.size()) break;
+                idPosition = comma + 1;
+            }
+        } else if (equalsIgnoreCase(keyword, "style")) {
+            std::string_view id = readWord(line, position);
+            if (id.empty()) {
                 return fail(std::move(result), lineNumber,
-                            "This Mermaid flowchart statement is not supported");
-            } else {
-                position = 0;
-                NodeSpec currentSpec;
-                std::string error;
-                if (!parseNodeSpec(line, position, lineOffset, currentSpec, error)) {
+                            "Expected a node ID after style");
+            }
+            Style style;
+            std::string error;
+            if (!parseStyleList(trim(line.substr(position)), style, error)) {
+                return fail(std::move(result), lineNumber, std::move(error));
+            }
+            NodeSpec spec;
+            spec.id = id;
+            spec.sourceOffset = lineOffset;
+            mergeStyle(nodes[nodes.intern(spec)].style, style);
+        } else if (equalsIgnoreCase(keyword, "subgraph") ||
+                   equalsIgnoreCase(keyword, "end") ||
+                   equalsIgnoreCase(keyword, "click") ||
+                   equalsIgnoreCase(keyword, "linkStyle")) {
+            return fail(std::move(result), lineNumber,
+                        "This Mermaid flowchart statement is not supported");
+        } else {
+            position = 0;
+            NodeSpec currentSpec;
+            std::string error;
+            if (!parseNodeSpec(line, position, lineOffset, currentSpec, error)) {
+                return fail(std::move(result), lineNumber, std::move(error));
+            }
+            size_t currentNode = nodes.intern(currentSpec);
+
+            while (true) {
+                skipSpaces(line, position);
+                if (position >= line.size()) break;
+
+                ArrowSpec arrow;
+                if (!parseArrow(line, position, arrow, error)) {
                     return fail(std::move(result), lineNumber, std::move(error));
                 }
-                size_t currentNode = ensureNode(result.diagram, nodeIds, currentSpec);
-
-                while (true) {
-                    skipSpaces(line, position);
-                    if (position >= line.size()) break;
-
-                    ArrowSpec arrow;
-                    if (!parseArrow(line, position, arrow, error)) {
-                        return fail(std::move(result), lineNumber, std::move(error));
-                    }
-
-                    NodeSpec nextSpec;
-                    if (!parseNodeSpec(line, position, lineOffset, nextSpec, error)) {
-                        return fail(std::move(result), lineNumber, std::move(error));
-                    }
-                    size_t nextNode = ensureNode(result.diagram, nodeIds, nextSpec);
-                    result.diagram.edges.push_back({
-                        currentNode,
-                        nextNode,
-                        std::move(arrow.label),
-                        arrow.directed,
-                        arrow.dashed,
-                        arrow.strokeScale,
-                    });
-                    currentNode = nextNode;
+
+                NodeSpec nextSpec;
+                if (!parseNodeSpec(line, position, lineOffset, nextSpec, error)) {
+                    return fail(std::move(result), lineNumber, std::move(error));
                 }
+                size_t nextNode = nodes.intern(nextSpec);
+                result.diagram.edges.push_back({
+                    currentNode,
+                    nextNode,
+                    std::move(arrow.label),
+                    arrow.directed,
+                    arrow.dashed,
+                    arrow.strokeScale,
+                });
+                currentNode = nextNode;
             }
         }
-
-        if (lineEnd == source.size()) break;
-        lineOffset = lineEnd + 1;
     }
 
     if (!foundHeader) {
         return fail(std::move(result), 0,
                     "Only Mermaid flowchart and graph diagrams are supported");
     }
-    if (result.diagram.nodes.empty()) {
+    if (nodes.empty()) {
         return fail(std::move(result), 0, "The Mermaid flowchart has no nodes");
     }
 
+    nodes.finishNodes(result.diagram);
     result.success = true;
     return result;
 }
 
+namespace {
+
+// Diagrams with at least this many layered nodes (real plus virtual) run
+// their ordering variants on worker threads
+constexpr size_t kParallelOrderingNodes = 400;
+constexpr int kOrderingIterations = 24;
+constexpr int kOrderingStallLimit = 4;
+constexpr int kTransposePasses = 8;
+
+// The ranked graph the ordering works on. Real nodes keep their diagram
+// index and virtual nodes (one per rank a long edge crosses) follow them,
+// so every segment joins two adjacent ranks. Neighbour lists are CSR
+// arrays: up[upStart[n]..upStart[n+1]) are n's neighbours one rank above.
+struct LayerGraph {
+    size_t nodeCount = 0;
+    size_t rankCount = 0;
+    std::vector<uint32_t> rank;
+    std::vector<uint32_t> rankStart;  // rankCount + 1 offsets into an order
+    std::vector<uint32_t> upStart;
+    std::vector<uint32_t> up;
+    std::vector<uint32_t> downStart;
+    std::vector<uint32_t> down;
+};
+
+// One ordering candidate: every rank's nodes left to right, flattened into
+// a single array sliced by LayerGraph::rankStart, plus each node's index
+// within its rank
+struct Ordering {
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> position;
+    size_t crossings = 0;
+};
+
+LayerGraph buildLayerGraph(const Diagram& diagram, const std::vector<size_t>& ranks,
+                           size_t rankCount) {
+    LayerGraph graph;
+    graph.rankCount = rankCount;
+    graph.rank.reserve(ranks.size());
+    for (size_t value : ranks) graph.rank.push_back(static_cast<uint32_t>(value));
+
+    // Segments run from the upper (lower-ranked) end to the lower one,
+    // whichever way the edge points; back-edges are ordered like forward ones
+    std::vector<std::pair<uint32_t, uint32_t>> segments;
+    segments.reserve(diagram.edges.size());
+    for (const auto& edge : diagram.edges) {
+        if (edge.from >= ranks.size() || edge.to >= ranks.size()) continue;
+        uint32_t upper = static_cast<uint32_t>(edge.from);
+        uint32_t lower = static_cast<uint32_t>(edge.to);
+        if (graph.rank[upper] == graph.rank[lower]) continue;
+        if (graph.rank[upper] > graph.rank[lower]) std::swap(upper, lower);
+
+        uint32_t previous = upper;
+        for (uint32_t level = graph.rank[upper] + 1; level < graph.rank[lower]; level++) {
+            uint32_t virtualNode = static_cast<uint32_t>(graph.rank.size());
+            graph.rank.push_back(level);
+            segments.emplace_back(previous, virtualNode);
+            previous = virtualNode;
+        }
+        segments.emplace_back(previous, lower);
+    }
+    graph.nodeCount = graph.rank.size();
+
+    graph.rankStart.assign(rankCount + 1, 0);
+    for (uint32_t level : graph.rank) graph.rankStart[level + 1]++;
+    for (size_t level = 0; level < rankCount; level++) {
+        graph.rankStart[level + 1] += graph.rankStart[level];
+    }
+
+    graph.upStart.assign(graph.nodeCount + 1, 0);
+    graph.downStart.assign(graph.nodeCount + 1, 0);
+    for (const auto& segment : segments) {
+        graph.downStart[segment.first + 1]++;
+        graph.upStart[segment.second + 1]++;
+    }
+    for (size_t i = 0; i < graph.nodeCount; i++) {
+        graph.upStart[i + 1] += graph.upStart[i];
+        graph.downStart[i + 1] += graph.downStart[i];
+    }
+    graph.up.resize(segments.size());
+    graph.down.resize(segments.size());
+    std::vector<uint32_t> upFill(graph.upStart.begin(), graph.upStart.end() - 1);
+    std::vector<uint32_t> downFill(graph.downStart.begin(), graph.downStart.end() - 1);
+    for (const auto& segment : segments) {
+        graph.down[downFill[segment.first]++] = segment.second;
+        graph.up[upFill[segment.second]++] = segment.first;
+    }
+    return graph;
+}
+
+// Crossings between rank `level` and the one below it, counted as
+// inversions of the lower endpoints with a Fenwick tree (Barth, Jünger and
+// Mutzel's bilayer count) in O(segments log width)
+size_t countRankCrossings(const LayerGraph& graph, const Ordering& ordering, size_t level,
+                          std::vector<uint32_t>& scratch, std::vector<uint32_t>& tree) {
+    scratch.clear();
+    uint32_t begin = graph.rankStart[level];
+    uint32_t end = graph.rankStart[level + 1];
+    for (uint32_t slot = begin; slot < end; slot++) {
+        uint32_t node = ordering.order[slot];
+        size_t first = scratch.size();
+        for (uint32_t i = graph.downStart[node]; i < graph.downStart[node + 1]; i++) {
+            scratch.push_back(ordering.position[graph.down[i]]);
+        }
+        std::sort(scratch.begin() + static_cast<std::ptrdiff_t>(first), scratch.end());
+    }
+
+    size_t width = graph.rankStart[level + 2] - graph.rankStart[level + 1];
+    tree.assign(width + 1, 0);
+    size_t crossings = 0;
+    size_t inserted = 0;
+    for (uint32_t value : scratch) {
+        size_t notAbove = 0;
+        for (size_t i = value + 1; i > 0; i -= i & (~i + 1)) notAbove += tree[i];
+        crossings += inserted - notAbove;
+        for (size_t i = value + 1; i <= width; i += i & (~i + 1)) tree[i]++;
+        inserted++;
+    }
+    return crossings;
+}
+
+size_t countCrossings(const LayerGraph& graph, const Ordering& ordering) {
+    std::vector<uint32_t> scratch;
+    std::vector<uint32_t> tree;
+    size_t total = 0;
+    for (size_t level = 0; level + 1 < graph.rankCount; level++) {
+        total += countRankCrossings(graph, ordering, level, scratch, tree);
+    }
+    return total;
+}
+
+// Reorders one rank by the median position of each node's neighbours in
+// the adjacent fixed rank. Nodes without such neighbours keep their slot.
+void medianSweepRank(const LayerGraph& graph, Ordering& ordering, size_t level, bool downward,
+                     std::vector<float>& medians, std::vector<uint32_t>& scratch,
+                     std::vector<uint32_t>& movable) {
+    const auto& start = downward ? graph.upStart : graph.downStart;
+    const auto& neighbours = downward ? graph.up : graph.down;
+    uint32_t begin = graph.rankStart[level];
+    uint32_t end = graph.rankStart[level + 1];
+    if (end - begin < 2) return;
+
+    movable.clear();
+    for (uint32_t slot = begin; slot < end; slot++) {
+        uint32_t node = ordering.order[slot];
+        uint32_t count = start[node + 1] - start[node];
+        if (count == 0) {
+            medians[node] = -1.0f;
+            continue;
+        }
+        scratch.clear();
+        for (uint32_t i = start[node]; i < start[node + 1]; i++) {
+            scratch.push_back(ordering.position[neighbours[i]]);
+        }
+        size_t middle = count / 2;
+        std::nth_element(scratch.begin(), scratch.begin() + middle, scratch.end());
+        float median = static_cast<float>(scratch[middle]);
+        if (count % 2 == 0) {
+            uint32_t below = *std::max_element(scratch.begin(), scratch.begin() + middle);
+            median = (median + static_cast<float>(below)) * 0.5f;
+        }
+        medians[node] = median;
+        movable.push_back(node);
+    }
+
+    std::stable_sort(movable.begin(), movable.end(), [&](uint32_t left, uint32_t right) {
+        return medians[left] < medians[right];
+    });
+    size_t next = 0;
+    for (uint32_t slot = begin; slot < end; slot++) {
+        if (medians[ordering.order[slot]] < 0.0f) continue;
+        ordering.order[slot] = movable[next++];
+    }
+    for (uint32_t slot = begin; slot < end; slot++) {
+        ordering.position[ordering.order[slot]] = slot - begin;
+    }
+}
+
+// Crossings contributed by u's and v's segments on one side if u sits
+// directly left of v: pairs whose far ends are out of order
+size_t pairCrossings(const std::vector<uint32_t>& uPositions,
+                     const std::vector<uint32_t>& vPositions) {
+    size_t crossings = 0;
+    size_t j = 0;
+    for (uint32_t value : uPositions) {
+        while (j < vPositions.size() && vPositions[j] < value) j++;
+        crossings += j;
+    }
+    return crossings;
+}
+
+void gatherPositions(const std::vector<uint32_t>& start, const std::vector<uint32_t>& neighbours,
+                     const Ordering& ordering, uint32_t node, std::vector<uint32_t>& out) {
+    out.clear();
+    for (uint32_t i = start[node]; i < start[node + 1]; i++) {
+        out.push_back(ordering.position[neighbours[i]]);
+    }
+    std::sort(out.begin(), out.end());
+}
+
+// Swaps adjacent nodes wherever that removes crossings with either
+// neighbouring rank. A rank is revisited only after a swap in it or next
+// to it, which keeps passes cheap on graphs with long virtual chains.
+void transpose(const LayerGraph& graph, Ordering& ordering, std::vector<char>& dirty) {
+    std::vector<uint32_t> uUp, vUp, uDown, vDown;
+    std::fill(dirty.begin(), dirty.end(), 1);
+    for (int pass = 0; pass < kTransposePasses; pass++) {
+        bool improved = false;
+        for (size_t level = 0; level < graph.rankCount; level++) {
+            if (!dirty[level]) continue;
+            dirty[level] = 0;
+            uint32_t begin = graph.rankStart[level];
+            uint32_t end = graph.rankStart[level + 1];
+            if (end - begin < 2) continue;
+
+            bool swappedRank = false;
+            gatherPositions(graph.upStart, graph.up, ordering, ordering.order[begin], uUp);
+            gatherPositions(graph.downStart, graph.down, ordering, ordering.order[begin], uDown);
+            for (uint32_t slot = begin; slot + 1 < end; slot++) {
+                uint32_t u = ordering.order[slot];
+                uint32_t v = ordering.order[slot + 1];
+                gatherPositions(graph.upStart, graph.up, ordering, v, vUp);
+                gatherPositions(graph.downStart, graph.down, ordering, v, vDown);
+                size_t kept = pairCrossings(uUp, vUp) + pairCrossings(uDown, vDown);
+                size_t swapped = pairCrossings(vUp, uUp) + pairCrossings(vDown, uDown);
+                if (swapped < kept) {
+                    // u moves right and stays the left node of the next pair
+                    ordering.order[slot] = v;
+                    ordering.order[slot + 1] = u;
+                    ordering.position[v] = slot - begin;
+                    ordering.position[u] = slot + 1 - begin;
+                    swappedRank = true;
+                } else {
+                    std::swap(uUp, vUp);
+                    std::swap(uDown, vDown);
+                }
+            }
+            if (swappedRank) {
+                improved = true;
+                if (level > 0) dirty[level - 1] = 1;
+                dirty[level] = 1;
+                if (level + 1 < graph.rankCount) dirty[level + 1] = 1;
+            }
+        }
+        if (!improved) break;
+    }
+}
+
+// One Sugiyama ordering run: alternating up/down median sweeps, each
+// followed by transposition, keeping the best ordering seen. Variants
+// differ in their initial order and first sweep direction.
+Ordering orderVariant(const LayerGraph& graph, int variant) {
+    Ordering current;
+    current.order.resize(graph.nodeCount);
+    current.position.resize(graph.nodeCount);
+    std::vector<uint32_t> fill(graph.rankStart.begin(), graph.rankStart.end() - 1);
+    for (uint32_t node = 0; node < graph.nodeCount; node++) {
+        current.order[fill[graph.rank[node]]++] = node;
+    }
+    if (variant & 2) {
+        for (size_t level = 0; level < graph.rankCount; level++) {
+            std::reverse(current.order.begin() + graph.rankStart[level],
+                         current.order.begin() + graph.rankStart[level + 1]);
+        }
+    }
+    for (size_t level = 0; level < graph.rankCount; level++) {
+        for (uint32_t slot = graph.rankStart[level]; slot < graph.rankStart[level + 1]; slot++) {
+            current.position[current.order[slot]] = slot - graph.rankStart[level];
+        }
+    }
+    current.crossings = countCrossings(graph, current);
+
+    Ordering best = current;
+    std::vector<float> medians(graph.nodeCount, -1.0f);
+    std::vector<uint32_t> scratch;
+    std::vector<uint32_t> movable;
+    std::vector<char> dirty(graph.rankCount, 1);
+    int stalled = 0;
+    for (int iteration = 0; iteration < kOrderingIterations && best.crossings > 0; iteration++) {
+        bool downward = ((iteration + (variant & 1)) % 2) == 0;
+        if (downward) {
+            for (size_t level = 1; level < graph.rankCount; level++) {
+                medianSweepRank(graph, current, level, true, medians, scratch, movable);
+            }
+        } else {
+            for (size_t level = graph.rankCount - 1; level > 0; level--) {
+                medianSweepRank(graph, current, level - 1, false, medians, scratch, movable);
+            }
+        }
+        transpose(graph, current, dirty);
+        current.crossings = countCrossings(graph, current);
+        if (current.crossings < best.crossings) {
+            best = current;
+            stalled = 0;
+        } else if (++stalled >= kOrderingStallLimit) {
+            break;
+        }
+    }
+    return best;
+}
+
+// Runs the ordering variants (concurrently for large graphs) and returns
+// the one with the fewest crossings, lowest variant first on ties so the
+// result does not depend on the thread count
+Ordering orderRanks(const LayerGraph& graph) {
+    bool large = graph.nodeCount >= kParallelOrderingNodes;
+    int variants = large ? 4 : 2;
+    std::vector<Ordering> results(static_cast<size_t>(variants));
+
+    unsigned threads = large ? std::thread::hardware_concurrency() : 1u;
+    threads = std::clamp(threads, 1u, static_cast<unsigned>(variants));
+    if (threads > 1) {
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (unsigned worker = 1; worker < threads; worker++) {
+            workers.emplace_back([&, worker] {
+                for (int variant = static_cast<int>(worker); variant < variants;
+                     variant += static_cast<int>(threads)) {
+                    results[static_cast<size_t>(variant)] = orderVariant(graph, variant);
+                }
+            });
+        }
+        for (int variant = 0; variant < variants; variant += static_cast<int>(threads)) {
+            results[static_cast<size_t>(variant)] = orderVariant(graph, variant);
+        }
+        for (auto& worker : workers) worker.join();
+    } else {
+        for (int variant = 0; variant < variants; variant++) {
+            results[static_cast<size_t>(variant)] = orderVariant(graph, variant);
+            if (results[static_cast<size_t>(variant)].crossings == 0) break;
+        }
+    }
+
+    size_t bestIndex = 0;
+    for (size_t i = 1; i < results.size(); i++) {
+        if (!results[i].order.empty() && results[i].crossings < results[bestIndex].crossings) {
+            bestIndex = i;
+        }
+    }
+    return std::move(results[bestIndex]);
+}
+
+} // namespace
+
 Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
               float nodeGap, float rankGap) {
     Layout result;
@@ -748,15 +1178,20 @@ Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
     nodeGap = std::max(0.0f, nodeGap);
     rankGap = std::max(0.0f, rankGap);
 
-    std::vector<std::vector<size_t>> outgoing(nodeCount);
-    std::vector<std::vector<size_t>> incoming(nodeCount);
+    std::vector<uint32_t> outgoingStart(nodeCount + 1, 0);
     std::vector<size_t> indegree(nodeCount, 0);
     for (const auto& edge : diagram.edges) {
         if (edge.from >= nodeCount || edge.to >= nodeCount) continue;
-        outgoing[edge.from].push_back(edge.to);
-        incoming[edge.to].push_back(edge.from);
+        outgoingStart[edge.from + 1]++;
         indegree[edge.to]++;
     }
+    for (size_t i = 0; i < nodeCount; i++) outgoingStart[i + 1] += outgoingStart[i];
+    std::vector<uint32_t> outgoing(outgoingStart[nodeCount]);
+    std::vector<uint32_t> outgoingFill(outgoingStart.begin(), outgoingStart.end() - 1);
+    for (const auto& edge : diagram.edges) {
+        if (edge.from >= nodeCount || edge.to >= nodeCount) continue;
+        outgoing[outgoingFill[edge.from]++] = static_cast<uint32_t>(edge.to);
+    }
 
     std::deque<size_t> ready;
     for (size_t i = 0; i < nodeCount; i++) {
@@ -772,7 +1207,8 @@ Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
         processed[node] = true;
         maxRank = std::max(maxRank, rank[node]);
 
-        for (size_t target : outgoing[node]) {
+        for (uint32_t i = outgoingStart[node]; i < outgoingStart[node + 1]; i++) {
+            size_t target = outgoing[i];
             rank[target] = std::max(rank[target], rank[node] + 1);
             if (--indegree[target] == 0) ready.push_back(target);
         }
@@ -785,62 +1221,60 @@ Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
         if (!processed[i]) rank[i] = nextRank++;
     }
     for (size_t value : rank) maxRank = std::max(maxRank, value);
-
-    std::vector<std::vector<size_t>> ranks(maxRank + 1);
-    for (size_t i = 0; i < nodeCount; i++) ranks[rank[i]].push_back(i);
     result.ranks = rank;
 
-    std::vector<float> order(nodeCount, 0.0f);
-    for (size_t level = 0; level < ranks.size(); level++) {
-        if (level > 0) {
-            std::stable_sort(ranks[level].begin(), ranks[level].end(),
-                [&](size_t left, size_t right) {
-                    auto barycenter = [&](size_t node) {
-                        if (incoming[node].empty()) {
-                            return static_cast<float>(node);
-                        }
-                        float total = 0.0f;
-                        size_t count = 0;
-                        for (size_t parent : incoming[node]) {
-                            if (rank[parent] < level) {
-                                total += order[parent];
-                                count++;
-                            }
-                        }
-                        return count > 0 ? total / static_cast<float>(count)
-                                         : static_cast<float>(node);
-                    };
-                    return barycenter(left) < barycenter(right);
-                });
-        }
-        for (size_t i = 0; i < ranks[level].size(); i++) {
-            order[ranks[level][i]] = static_cast<float>(i);
+    const size_t rankCount = maxRank + 1;
+    LayerGraph graph = buildLayerGraph(diagram, rank, rankCount);
+    Ordering ordering = orderRanks(graph);
+    result.crossings = ordering.crossings;
+
+    // Drop the virtual nodes: rankOrder[rankStart[r]..rankStart[r+1]) are
+    // the real nodes of rank r, left to right
+    std::vector<uint32_t> rankOrder;
+    std::vector<uint32_t> rankStart(rankCount + 1, 0);
+    rankOrder.reserve(nodeCount);
+    for (size_t level = 0; level < rankCount; level++) {
+        for (uint32_t slot = graph.rankStart[level]; slot < graph.rankStart[level + 1]; slot++) {
+            uint32_t node = ordering.order[slot];
+            if (node < nodeCount) rankOrder.push_back(node);
         }
+        rankStart[level + 1] = static_cast<uint32_t>(rankOrder.size());
     }
+    auto rankNodes = [&](size_t level) {
+        return std::make_pair(rankOrder.begin() + rankStart[level],
+                              rankOrder.begin() + rankStart[level + 1]);
+    };
+    auto rankSize = [&](size_t level) {
+        return static_cast<size_t>(rankStart[level + 1] - rankStart[level]);
+    };
 
     result.nodes.resize(nodeCount);
     bool vertical = diagram.direction == Direction::TopToBottom ||
                     diagram.direction == Direction::BottomToTop;
 
     if (vertical) {
-        std::vector<float> rankWidths(ranks.size(), 0.0f);
-        std::vector<float> rankHeights(ranks.size(), 0.0f);
-        for (size_t level = 0; level < ranks.size(); level++) {
-            for (size_t node : ranks[level]) {
+        std::vector<float> rankWidths(rankCount, 0.0f);
+        std::vector<float> rankHeights(rankCount, 0.0f);
+        for (size_t level = 0; level < rankCount; level++) {
+            auto nodes = rankNodes(level);
+            for (auto it = nodes.first; it != nodes.second; ++it) {
+                size_t node = *it;
                 rankWidths[level] += std::max(1.0f, nodeSizes[node].width);
                 rankHeights[level] = std::max(
                     rankHeights[level], std::max(1.0f, nodeSizes[node].height));
             }
-            if (ranks[level].size() > 1) {
-                rankWidths[level] += nodeGap * static_cast<float>(ranks[level].size() - 1);
+            if (rankSize(level) > 1) {
+                rankWidths[level] += nodeGap * static_cast<float>(rankSize(level) - 1);
             }
             result.width = std::max(result.width, rankWidths[level]);
         }
 
         float y = 0.0f;
-        for (size_t level = 0; level < ranks.size(); level++) {
+        for (size_t level = 0; level < rankCount; level++) {
             float x = (result.width - rankWidths[level]) * 0.5f;
-            for (size_t node : ranks[level]) {
+            auto nodes = rankNodes(level);
+            for (auto it = nodes.first; it != nodes.second; ++it) {
+                size_t node = *it;
                 float width = std::max(1.0f, nodeSizes[node].width);
                 float height = std::max(1.0f, nodeSizes[node].height);
                 float nodeY = y + (rankHeights[level] - height) * 0.5f;
@@ -848,7 +1282,7 @@ Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
                 x += width + nodeGap;
             }
             y += rankHeights[level];
-            if (level + 1 < ranks.size()) y += rankGap;
+            if (level + 1 < rankCount) y += rankGap;
         }
         result.height = y;
 
@@ -860,24 +1294,28 @@ Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
             }
         }
     } else {
-        std::vector<float> rankWidths(ranks.size(), 0.0f);
-        std::vector<float> rankHeights(ranks.size(), 0.0f);
-        for (size_t level = 0; level < ranks.size(); level++) {
-            for (size_t node : ranks[level]) {
+        std::vector<float> rankWidths(rankCount, 0.0f);
+        std::vector<float> rankHeights(rankCount, 0.0f);
+        for (size_t level = 0; level < rankCount; level++) {
+            auto nodes = rankNodes(level);
+            for (auto it = nodes.first; it != nodes.second; ++it) {
+                size_t node = *it;
                 rankWidths[level] = std::max(
                     rankWidths[level], std::max(1.0f, nodeSizes[node].width));
                 rankHeights[level] += std::max(1.0f, nodeSizes[node].height);
             }
-            if (ranks[level].size() > 1) {
-                rankHeights[level] += nodeGap * static_cast<float>(ranks[level].size() - 1);
+            if (rankSize(level) > 1) {
+                rankHeights[level] += nodeGap * static_cast<float>(rankSize(level) - 1);
             }
             result.height = std::max(result.height, rankHeights[level]);
         }
 
         float x = 0.0f;
-        for (size_t level = 0; level < ranks.size(); level++) {
+        for (size_t level = 0; level < rankCount; level++) {
             float y = (result.height - rankHeights[level]) * 0.5f;
-            for (size_t node : ranks[level]) {
+            auto nodes = rankNodes(level);
+            for (auto it = nodes.first; it != nodes.second; ++it) {
+                size_t node = *it;
                 float width = std::max(1.0f, nodeSizes[node].width);
                 float height = std::max(1.0f, nodeSizes[node].height);
                 float nodeX = x + (rankWidths[level] - width) * 0.5f;
@@ -885,7 +1323,7 @@ Layout layout(const Diagram& diagram, const std::vector<Size>& nodeSizes,
                 y += height + nodeGap;
             }
             x += rankWidths[level];
-            if (level + 1 < ranks.size()) x += rankGap;
+            if (level + 1 < rankCount) x += rankGap;
         }
         result.width = x;
 
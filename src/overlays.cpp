@@ -71,7 +71,12 @@ void renderSearchOverlay(App& app) {
     IDWriteTextFormat* searchTextFormat = app.searchTextFormat;
     if (searchTextFormat) {
         float textX = barX + dpi(app, 42.0f);
-        float textWidth = barWidth - dpi(app, 120.0f);  // Leave room for count
+        // Mode chips sit at the right end, the match count left of them
+        float chipSize = dpi(app, 24.0f);
+        float chipGap = dpi(app, 4.0f);
+        float chipsRight = barX + barWidth - dpi(app, 10.0f);
+        float chipsLeft = chipsRight - chipSize * 2 - chipGap;
+        float textWidth = barWidth - dpi(app, 120.0f) - (chipsRight - chipsLeft);  // Leave room for count
 
         if (app.searchQuery.empty()) {
             // Placeholder text
@@ -110,25 +115,70 @@ void renderSearchOverlay(App& app) {
             }
         }
 
+        // Regex (Alt+R) and whole-word (Alt+W) toggles
+        {
+            const wchar_t* labels[2] = {L".*", L"W"};
+            bool states[2] = {app.searchRegex, app.searchWholeWord};
+            for (int i = 0; i < 2; i++) {
+                float chipX = chipsLeft + i * (chipSize + chipGap);
+                float chipY = barY + (barHeight - chipSize) / 2;
+                D2D1_ROUNDED_RECT chipRect = D2D1::RoundedRect(
+                    D2D1::RectF(chipX, chipY, chipX + chipSize, chipY + chipSize),
+                    dpi(app, 4.0f), dpi(app, 4.0f));
+                D2D1_COLOR_F labelColor = app.theme.text;
+                if (states[i]) {
+                    D2D1_COLOR_F fill = app.theme.accent;
+                    fill.a = 0.25f * anim;
+                    app.brush->SetColor(fill);
+                    app.renderTarget->FillRoundedRectangle(chipRect, app.brush);
+                    D2D1_COLOR_F border = app.theme.accent;
+                    border.a = 0.8f * anim;
+                    app.brush->SetColor(border);
+                    app.renderTarget->DrawRoundedRectangle(chipRect, app.brush, 1.0f);
+                    labelColor.a = anim;
+                } else {
+                    labelColor.a = 0.35f * anim;
+                }
+                float labelWidth = measureText(app, labels[i], searchTextFormat);
+                float labelX = chipX + (chipSize - labelWidth) / 2;
+                app.brush->SetColor(labelColor);
+                app.renderTarget->DrawText(labels[i], (UINT32)wcslen(labels[i]), searchTextFormat,
+                    D2D1::RectF(labelX, barY + dpi(app, 12.0f), chipX + chipSize, barY + barHeight),
+                    app.brush);
+            }
+        }
+
         // Match count
         if (!app.searchQuery.empty()) {
-            wchar_t countText[32];
+            wchar_t countText[48];
             size_t matchCount = app.editMode ? app.editorSearchMatches.size() : app.searchMatches.size();
             int currentIdx = app.editMode ? app.editorSearchCurrentIndex : app.searchCurrentIndex;
-            if (matchCount == 0) {
+            // Document matches stream in while layout is still running
+            bool scanning = !app.editMode && !app.layoutComplete;
+            bool badPattern = (app.searchRegex || app.searchWholeWord) && !app.searchPattern.valid();
+            if (badPattern) {
+                swprintf_s(countText, L"%.40ls", app.searchPattern.error().c_str());
+                app.brush->SetColor(D2D1::ColorF(0.9f, 0.3f, 0.3f, anim));
+            } else if (matchCount == 0 && scanning) {
+                wcscpy_s(countText, L"Searching...");
+                D2D1_COLOR_F countColor = app.theme.text;
+                countColor.a = 0.7f * anim;
+                app.brush->SetColor(countColor);
+            } else if (matchCount == 0) {
                 wcscpy_s(countText, L"No matches");
                 // Red color for no matches
                 app.brush->SetColor(D2D1::ColorF(0.9f, 0.3f, 0.3f, anim));
             } else {
-                swprintf_s(countText, L"%d of %zu", currentIdx + 1, matchCount);
+                swprintf_s(countText, scanning ? L"%d of %zu+" : L"%d of %zu",
+                           currentIdx + 1, matchCount);
                 D2D1_COLOR_F countColor = app.theme.text;
                 countColor.a = 0.7f * anim;
                 app.brush->SetColor(countColor);
             }
             float countTextWidth = measureText(app, countText, searchTextFormat);
-            float countX = barX + barWidth - countTextWidth - dpi(app, 14.0f);
+            float countX = chipsLeft - countTextWidth - dpi(app, 8.0f);
             app.renderTarget->DrawText(countText, (UINT32)wcslen(countText), searchTextFormat,
-                D2D1::RectF(countX, barY + dpi(app, 12.0f), barX + barWidth - dpi(app, 10.0f), barY + barHeight), app.brush);
+                D2D1::RectF(countX, barY + dpi(app, 12.0f), chipsLeft - dpi(app, 4.0f), barY + barHeight), app.brush);
         }
 
     }
@@ -181,22 +231,22 @@ void renderFolderBrowser(App& app) {
         // which breaks down for CJK and other wide scripts
         std::wstring displayPath = app.folderBrowserPath;
         float maxPathWidth = panelWidth - padding * 2;
+        auto textWidth = [&](const std::wstring& s) {
+            float w = 0.0f;
+            IDWriteTextLayout* layout = nullptr;
+            if (app.dwriteFactory && SUCCEEDED(app.dwriteFactory->CreateTextLayout(
+                    s.c_str(), (UINT32)s.length(), browserFormat,
+                    1000000.0f, headerHeight, &layout)) && layout) {
+                DWRITE_TEXT_METRICS metrics;
+                if (SUCCEEDED(layout->GetMetrics(&metrics))) {
+                    w = metrics.widthIncludingTrailingWhitespace;
+                }
+                layout->Release();
+            }
+            return w;
+        };
 
         if (!displayPath.empty() && app.dwriteFactory) {
-            auto textWidth = [&](const std::wstring& s) {
-                float w = 0.0f;
-                IDWriteTextLayout* layout = nullptr;
-                if (SUCCEEDED(app.dwriteFactory->CreateTextLayout(
-                        s.c_str(), (UINT32)s.length(), browserFormat,
-                        1000000.0f, headerHeight, &layout)) && layout) {
-                    DWRITE_TEXT_METRICS metrics;
-                    if (SUCCEEDED(layout->GetMetrics(&metrics))) {
-                        w = metrics.widthIncludingTrailingWhitespace;
-                    }
-                    layout->Release();
-                }
-                return w;
-            };
             if (textWidth(displayPath) > maxPathWidth) {
                 std::wstring tail = displayPath;
                 while (textWidth(L"..." + tail) > maxPathWidth) {
@@ -222,6 +272,36 @@ void renderFolderBrowser(App& app) {
 
         // Items list (with scrolling)
         float listStartY = dividerY + dpi(app, 8.0f);
+
+        // While searching: the query, and how many hits so far
+        if (!app.folderSearchQuery.empty()) {
+            float rowY = listStartY;
+            std::wstring status;
+            if (!app.folderItems.empty()) {
+                status = std::to_wstring(app.folderItems.size()) +
+                         (app.folderIndexing ? L" so far" : L" found");
+            } else {
+                status = app.folderIndexing ? L"Indexing\x2026" : L"No matches";
+            }
+            float statusW = textWidth(status);
+            D2D1_COLOR_F statusColor = app.theme.text;
+            statusColor.a = 0.5f * anim;
+            app.brush->SetColor(statusColor);
+            app.renderTarget->DrawText(status.c_str(), (UINT32)status.length(), browserFormat,
+                D2D1::RectF(panelX + panelWidth - padding - statusW, rowY + dpi(app, 4.0f),
+                            panelX + panelWidth - padding, rowY + itemHeight),
+                app.brush);
+
+            D2D1_COLOR_F queryColor = app.theme.accent;
+            queryColor.a = anim;
+            app.brush->SetColor(queryColor);
+            app.renderTarget->DrawText(app.folderSearchQuery.c_str(), (UINT32)app.folderSearchQuery.length(),
+                browserFormat,
+                D2D1::RectF(panelX + padding, rowY + dpi(app, 4.0f),
+                            panelX + panelWidth - padding - statusW - dpi(app, 8.0f), rowY + itemHeight),
+                app.brush);
+            listStartY = rowY + itemHeight + dpi(app, 4.0f);
+        }
         float listHeight = panelHeight - listStartY - padding;
         float totalItemsHeight = app.folderItems.size() * itemHeight;
 
@@ -263,7 +343,15 @@ void renderFolderBrowser(App& app) {
             float textX = itemX + dpi(app, 26.0f);
 
             // Simple folder/file indicator
-            if (item.isDirectory) {
+            if (!item.heading.empty()) {
+                // Heading inside a file (folder search hit)
+                D2D1_COLOR_F markColor = app.theme.accent;
+                markColor.a = anim;
+                app.brush->SetColor(markColor);
+                app.renderTarget->DrawText(L"#", 1, browserFormat,
+                    D2D1::RectF(iconX + dpi(app, 3.0f), itemY + dpi(app, 4.0f), textX, itemY + itemHeight),
+                    app.brush);
+            } else if (item.isDirectory) {
                 // Folder icon (simple filled rectangle with tab)
                 D2D1_COLOR_F folderColor = app.theme.isDark ? hexColor(0xE8A848) : hexColor(0xD4941A);
                 folderColor.a = anim;
@@ -291,11 +379,25 @@ void renderFolderBrowser(App& app) {
             textColor.a = anim;
             app.brush->SetColor(textColor);
 
-            app.renderTarget->DrawText(item.name.c_str(), (UINT32)item.name.length(), browserFormat,
+            std::wstring label = item.heading.empty() ? item.name
+                                                      : item.heading + L"  \x00B7  " + item.name;
+            app.renderTarget->DrawText(label.c_str(), (UINT32)label.length(), browserFormat,
                 D2D1::RectF(textX, itemY + dpi(app, 4.0f), panelX + panelWidth - padding, itemY + itemHeight),
                 app.brush);
         }
 
+        // The listing is still being read in the background
+        if (app.folderListingPending) {
+            float rowY = listStartY + app.folderItems.size() * itemHeight - app.folderBrowserScroll;
+            D2D1_COLOR_F pendingColor = app.theme.text;
+            pendingColor.a = 0.5f * anim;
+            app.brush->SetColor(pendingColor);
+            app.renderTarget->DrawText(L"Loading\x2026", 8, browserFormat,
+                D2D1::RectF(panelX + padding + dpi(app, 26.0f), rowY + dpi(app, 4.0f),
+                            panelX + panelWidth - padding, rowY + itemHeight),
+                app.brush);
+        }
+
         // Scrollbar if needed
         if (totalItemsHeight > listHeight) {
             float sbHeight = listHeight / totalItemsHeight * listHeight;
@@ -709,7 +811,7 @@ void renderHelpOverlay(App& app) {
     const HelpEntry overlayEntries[] = {
         {L"F / Ctrl+F",   L"Search"},
         {L"Enter",        L"Next search match"},
-        {L"B",            L"Toggle folder browser"},
+        {L"B",            L"Folder browser (type to search)"},
         {L"Tab",          L"Toggle table of contents"},
         {L"T",            L"Theme chooser"},
         {L"S",            L"Toggle stats"},
@@ -0,0 +1,315 @@
+#include "parse_worker.h"
+#include "document.h"
+#include "document_cache.h"
+#include "file_watcher.h"
+#include "utils.h"
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Opening a Markdown file this large parses it progressively: the first
+// chunk is swapped in as soon as it is parsed, so the first screen does
+// not wait for the rest, which follows in chunks appended to the tree.
+// md4c then only ever holds one chunk's worth of line and mark buffers.
+constexpr size_t kProgressiveMinBytes = 8 * 1024 * 1024;
+constexpr size_t kFirstChunkBytes = 256 * 1024;
+constexpr size_t kChunkBytes = 2 * 1024 * 1024;
+constexpr size_t kMaxQueuedChunks = 2;  // parsed ahead of the UI thread
+
+struct ParseJob {
+    uint64_t generation = 0;
+    ParseReason reason = ParseReason::Update;
+    qmd::MarkdownParser parser;  // copy of app.parser's options
+    std::string content;
+    MappedFile file;             // parsed in place of content when open
+    std::string path;
+    std::wstring widePath;
+    DocumentStamp stamp;         // of the file read, when there is one
+    bool useCache = false;       // an Open may load the cached tree instead
+};
+
+struct FinishedParse {
+    uint64_t generation = 0;
+    ParseReason reason = ParseReason::Update;
+    std::string path;
+    qmd::ParseResult result;  // a later chunk: blocks to append to the tree
+    DocumentStamp stamp;      // set once the tree holds the whole file
+    App::LayoutSeed seed;     // loaded from the cache with the tree
+};
+
+} // namespace
+
+// Everything here is shared with the worker thread and guarded by `mutex`.
+// There is one slot per direction: a newer request overwrites a job the
+// worker has not picked up yet, and a newer result overwrites one the UI
+// thread has not taken yet, so a burst of edits parses at most twice.
+struct App::ParseWorkerState {
+    std::mutex mutex;
+    std::condition_variable wake;      // worker: a job arrived or stopping
+    std::condition_variable finished;  // waitForParse: a result arrived
+    std::thread thread;
+    HWND hwnd = nullptr;
+    bool stopping = false;
+    bool hasJob = false;
+    ParseJob job;
+    bool hasResult = false;
+    FinishedParse result;
+    std::deque<FinishedParse> chunks;  // progressive open, after `result`
+    uint64_t pendingOpen = 0;  // UI thread only: Open not yet swapped in
+
+    // An early return from WinMain must not destroy a joinable std::thread
+    ~ParseWorkerState() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (thread.joinable()) thread.join();
+    }
+};
+
+namespace {
+
+void workerLoop(App::ParseWorkerState* state) {
+    for (;;) {
+        ParseJob job;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->wake.wait(lock, [&] { return state->stopping || state->hasJob; });
+            if (state->stopping) return;
+            job = std::move(state->job);
+            state->hasJob = false;
+        }
+
+        FinishedParse done;
+        done.generation = job.generation;
+        done.reason = job.reason;
+        std::string_view source = job.file.isOpen() ? job.file.view()
+                                                    : std::string_view(job.content);
+        // Only an open: an update swaps in the whole tree so the layout can
+        // reuse the blocks it did not change
+        DocumentChunks chunks;
+        if (job.useCache && loadDocumentCache(job.widePath, job.stamp, done.result, done.seed)) {
+            // Unchanged since it was last open: no parse at all
+        } else {
+            if (job.reason == ParseReason::Open && source.size() >= kProgressiveMinBytes &&
+                !isMermaidDocumentPath(job.path)) {
+                chunks = splitDocument(source, kFirstChunkBytes, kChunkBytes);
+            }
+            if (chunks.starts.size() > 1) {
+                done.result = parseDocumentChunk(job.parser, source, chunks, 0);
+            } else {
+                done.result = parseDocument(job.parser, source, job.path);
+            }
+        }
+        // A progressive open holds the whole file only with its last chunk
+        if (chunks.starts.size() <= 1) done.stamp = job.stamp;
+        bool parsed = done.result.success;
+        done.path = std::move(job.path);
+
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->result = std::move(done);
+            state->hasResult = true;
+        }
+        state->finished.notify_all();
+        PostMessage(state->hwnd, WM_APP_PARSE_DONE, 0, 0);
+
+        for (size_t i = 1; parsed && i < chunks.starts.size(); i++) {
+            {
+                // A newer request drops the rest of this document
+                std::unique_lock<std::mutex> lock(state->mutex);
+                state->wake.wait(lock, [&] {
+                    return state->stopping || state->hasJob ||
+                        state->chunks.size() < kMaxQueuedChunks;
+                });
+                if (state->stopping || state->hasJob) break;
+            }
+            FinishedParse more;
+            more.generation = job.generation;
+            more.reason = job.reason;
+            more.result = parseDocumentChunk(job.parser, source, chunks, i);
+            if (!more.result.success) break;
+            if (i + 1 == chunks.starts.size()) more.stamp = job.stamp;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->chunks.push_back(std::move(more));
+            }
+            PostMessage(state->hwnd, WM_APP_PARSE_DONE, 0, 0);
+        }
+        job.file.close();
+    }
+}
+
+bool swapInDocument(App& app, FinishedParse& done) {
+    if (!done.result.success) return false;
+    app.root = std::move(done.result.root);
+    app.parseTimeUs = done.result.parseTimeUs;
+
+    if (done.reason == ParseReason::Open) {
+        // The outgoing document, while its layout is still here to save
+        saveDocumentCache(app);
+        app.currentFile = std::move(done.path);
+        app.scrollY = 0;
+        app.scrollX = 0;
+        app.targetScrollY = 0;
+        app.targetScrollX = 0;
+        app.focusMermaidOnNextLayout = isMermaidDocumentPath(app.currentFile);
+        app.contentHeight = 0;
+        // A different document: nothing of the old layout may be carried
+        // over as reusable blocks
+        app.clearLayoutCache();
+        app.searchMatches.clear();
+        watchFile(app, app.currentFile);
+        updateWindowTitle(app);
+
+        // Reopened from the cache: back where it was left, at the current
+        // zoom. Heights measured in another font or at another width would
+        // only misplace the layout and the scroll position, so they go.
+        app.layoutSeed = std::move(done.seed);
+        if (app.layoutSeed.scale > 0.0f && !layoutSeedApplies(app, app.layoutSeed)) {
+            app.layoutSeed = App::LayoutSeed();
+        }
+        if (app.layoutSeed.scale > 0.0f) {
+            float scale = app.contentScale * app.appliedZoomFactor;
+            app.scrollY = app.layoutSeed.scrollY * scale / app.layoutSeed.scale;
+            app.targetScrollY = app.scrollY;
+        }
+    }
+    app.currentFileStamp = done.stamp;
+
+    app.layoutDirty = true;
+    InvalidateRect(app.hwnd, nullptr, FALSE);
+    return true;
+}
+
+// Progressive open: the next chunk's blocks go after the ones already laid
+// out, and layout picks up from there
+void appendChunk(App& app, FinishedParse& chunk) {
+    if (!app.root) return;
+    appendDocument(app.root, std::move(chunk.result.root));
+    app.parseTimeUs += chunk.result.parseTimeUs;
+    app.currentFileStamp = chunk.stamp;
+    if (app.layoutDirty) {
+        // The pending layout covers the new blocks
+    } else if (app.editMode) {
+        app.layoutDirty = true;
+    } else if (app.layoutComplete) {
+        app.layoutComplete = false;
+        app.invalidateDocumentTiles(app.layoutCursorY);
+        PostMessage(app.hwnd, WM_APP_LAYOUT_CHUNK, 0, 0);
+    }
+    InvalidateRect(app.hwnd, nullptr, FALSE);
+}
+
+} // namespace
+
+void startParseWorker(App& app) {
+    if (app.parseWorker) return;
+    app.parseWorker = std::make_shared<App::ParseWorkerState>();
+    app.parseWorker->hwnd = app.hwnd;
+    app.parseWorker->thread = std::thread(workerLoop, app.parseWorker.get());
+}
+
+void stopParseWorker(App& app) {
+    app.parseWorker.reset();  // the destructor stops and joins the thread
+}
+
+namespace {
+
+void queueParse(App& app, std::string content, MappedFile file, std::string path,
+                ParseReason reason, std::wstring widePath = {},
+                const DocumentStamp& stamp = {}) {
+    if (!app.parseWorker) startParseWorker(app);
+    auto& state = *app.parseWorker;
+    // A file-watch reload or preview of the document that is about to be
+    // replaced must not supersede the open
+    if (reason == ParseReason::Update && state.pendingOpen != 0) return;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.job.generation = ++app.parseGeneration;
+        state.job.reason = reason;
+        state.job.parser = app.parser;
+        state.job.content = std::move(content);
+        state.job.file = std::move(file);
+        state.job.path = std::move(path);
+        state.job.widePath = std::move(widePath);
+        state.job.stamp = stamp;
+        state.job.useCache = reason == ParseReason::Open && app.documentCacheEnabled &&
+                             stamp.valid();
+        state.hasJob = true;
+        if (reason == ParseReason::Open) state.pendingOpen = app.parseGeneration;
+    }
+    state.wake.notify_one();
+}
+
+} // namespace
+
+void requestParse(App& app, std::string content, std::string path, ParseReason reason) {
+    queueParse(app, std::move(content), MappedFile(), std::move(path), reason);
+}
+
+bool requestParseFile(App& app, const std::wstring& widePath, std::string path,
+                      ParseReason reason) {
+    // Stamped before reading, so a write in between only makes the stamp
+    // older than the content: a cache miss next time, never a stale hit
+    DocumentStamp stamp;
+    documentStamp(widePath, stamp);
+    MappedFile file;
+    std::string content;
+    if (!file.open(widePath)) {
+        std::ifstream in(widePath, std::ios::binary);
+        if (!in) return false;
+        content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    queueParse(app, std::move(content), std::move(file), std::move(path), reason, widePath,
+               stamp);
+    return true;
+}
+
+void applyParseResult(App& app) {
+    if (!app.parseWorker) return;
+    auto& state = *app.parseWorker;
+    FinishedParse done;
+    bool hasResult = false;
+    std::deque<FinishedParse> chunks;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        hasResult = state.hasResult;
+        if (hasResult) done = std::move(state.result);
+        state.hasResult = false;
+        chunks.swap(state.chunks);
+    }
+    if (!chunks.empty()) state.wake.notify_one();  // room to parse ahead again
+
+    if (hasResult) {
+        if (done.generation == state.pendingOpen) state.pendingOpen = 0;
+        // Superseded by a newer request while it was parsing
+        if (done.generation == app.parseGeneration) swapInDocument(app, done);
+    }
+    for (auto& chunk : chunks) {
+        if (chunk.generation == app.parseGeneration) appendChunk(app, chunk);
+    }
+}
+
+bool waitForParse(App& app) {
+    if (!app.parseWorker || app.parseGeneration == 0) return false;
+    auto& state = *app.parseWorker;
+    FinishedParse done;
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.finished.wait(lock, [&] {
+            return state.hasResult && state.result.generation == app.parseGeneration;
+        });
+        done = std::move(state.result);
+        state.hasResult = false;
+    }
+    if (done.generation == state.pendingOpen) state.pendingOpen = 0;
+    return swapInDocument(app, done);
+}
@@ -0,0 +1,94 @@
+#include "perf_trace.h"
+
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+// Enable in a capture by name (wpr/tracelog accept "*Tinta") or by this GUID
+TRACELOGGING_DEFINE_PROVIDER(g_traceProvider, "Tinta",
+    (0xe2c85d89, 0x250a, 0x5c31, 0x8a, 0x35, 0x16, 0xf1, 0xa8, 0x28, 0x73, 0xad));
+
+namespace {
+
+const char* const kPhaseNames[] = {
+    "Layout",
+    "Tokenize",
+    "Mermaid",
+    "Images",
+    "DrawDocument",
+    "DrawHighlights",
+    "DrawOverlays",
+    "Present",
+};
+static_assert(std::size(kPhaseNames) == FrameStats::kPhases, "one name per FramePhase");
+
+} // namespace
+
+void registerTraceProvider() {
+    TraceLoggingRegister(g_traceProvider);
+}
+
+void unregisterTraceProvider() {
+    TraceLoggingUnregister(g_traceProvider);
+}
+
+const char* framePhaseName(FramePhase phase) {
+    return kPhaseNames[(size_t)phase];
+}
+
+ScopedPhase::ScopedPhase(App* app, FramePhase phase) : app_(app) {
+    begin(phase);
+}
+
+void ScopedPhase::begin(FramePhase phase) {
+    phase_ = phase;
+    running_ = true;
+    TraceLoggingWrite(g_traceProvider, "Phase",
+        TraceLoggingOpcode(WINEVENT_OPCODE_START),
+        TraceLoggingString(framePhaseName(phase), "Name"));
+    start_ = Clock::now();
+}
+
+void ScopedPhase::stop() {
+    if (!running_) return;
+    running_ = false;
+    int64_t us = usElapsed(start_);
+    if (app_) app_->frameStats.phaseUs[(size_t)phase_] += us;
+    TraceLoggingWrite(g_traceProvider, "Phase",
+        TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+        TraceLoggingString(framePhaseName(phase_), "Name"),
+        TraceLoggingInt64(us, "DurationUs"));
+}
+
+void ScopedPhase::switchTo(FramePhase phase) {
+    stop();
+    begin(phase);
+}
+
+void endFrame(App& app, int64_t frameUs) {
+    auto& stats = app.frameStats;
+    std::copy(std::begin(stats.phaseUs), std::end(stats.phaseUs), stats.lastPhaseUs);
+    std::fill(std::begin(stats.phaseUs), std::end(stats.phaseUs), 0);
+    stats.frameUs[stats.frames % FrameStats::kHistory] = frameUs;
+    stats.frames++;
+    TraceLoggingWrite(g_traceProvider, "Frame",
+        TraceLoggingInt64(frameUs, "DurationUs"),
+        TraceLoggingUInt64(app.drawCalls, "DrawCalls"));
+}
+
+int64_t percentile(const int64_t* sorted, size_t count, double p) {
+    if (count == 0) return 0;
+    size_t rank = (size_t)std::ceil(p * count);
+    return sorted[std::min(count, std::max<size_t>(rank, 1)) - 1];
+}
+
+int64_t frameTimePercentileUs(const FrameStats& stats, double p) {
+    size_t count = std::min(stats.frames, FrameStats::kHistory);
+    int64_t sorted[FrameStats::kHistory];
+    std::copy(stats.frameUs, stats.frameUs + count, sorted);
+    std::sort(sorted, sorted + count);
+    return percentile(sorted, count, p);
+}
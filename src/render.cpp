@@ -1,23 +1,65 @@
 #include "render.h"
+#include "hash.h"
 #include "utils.h"
 #include "syntax.h"
 #include "search.h"
 #include "mermaid.h"
+#include "image_loader.h"
+#include "perf_trace.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cmath>
 #include <functional>
 #include <limits>
 #include <string_view>
 #include <filesystem>
-#include <urlmon.h>
-#pragma comment(lib, "urlmon.lib")
+#include <thread>
 
 namespace {
 constexpr float kHugeWidth = 100000.0f;
 constexpr float kLineBucketTolerance = 5.0f;
 
+static uint64_t hashString(uint64_t h, std::string_view s) {
+    h = hashValue(h, s.size());
+    return hashBytes(h, s.data(), s.size());
+}
+
+static uint64_t hashString(uint64_t h, std::wstring_view s) {
+    h = hashValue(h, s.size());
+    return hashBytes(h, s.data(), s.size() * sizeof(wchar_t));
+}
+
+// Hash of everything in a subtree that affects its layout. Source offsets
+// are left out on purpose: an edit shifts the offsets of every later block
+// without changing how those blocks look.
+static uint64_t hashElement(const Element* elem, uint64_t h = kFnvOffset) {
+    if (!elem) return hashValue(h, 0xFFu);
+    h = hashValue(h, static_cast<int>(elem->type));
+    h = hashString(h, elem->wtext);
+    h = hashString(h, elem->url);
+    h = hashString(h, elem->title);
+    h = hashString(h, elem->language);
+    h = hashValue(h, elem->level);
+    h = hashValue(h, elem->ordered);
+    h = hashValue(h, elem->start);
+    h = hashValue(h, elem->align);
+    h = hashValue(h, elem->col_count);
+    h = hashValue(h, elem->children.size());
+    for (const auto& child : elem->children) {
+        h = hashElement(child, h);
+    }
+    return h;
+}
+
+// Scale the layout is built at: the zoom baked into the text formats. A
+// zoom tick changes zoomFactor at once; the frames in between draw this
+// layout scaled until updateTextFormats catches up (see applyZoomDelta)
+static float layoutScale(const App& app) {
+    return app.contentScale * app.appliedZoomFactor;
+}
+
 struct LayoutInfo {
     IDWriteTextLayout* layout = nullptr;
     float width = 0.0f;
@@ -52,9 +94,11 @@ static LayoutInfo createLayout(App& app, std::wstring_view text, IDWriteTextForm
     return info;
 }
 
-static void addTextRect(App& app, const D2D1_RECT_F& rect, size_t docStart, size_t docLength) {
-    size_t idx = app.textRects.size();
-    app.textRects.push_back({rect, docStart, docLength});
+static void addTextRect(App& app, const D2D1_RECT_F& rect, size_t docStart, size_t docLength,
+                        size_t textRun) {
+    uint32_t idx = (uint32_t)app.textRects.size();
+    app.textRects.push_back({rect, (uint32_t)docStart, (uint32_t)docLength,
+                             textRun == SIZE_MAX ? UINT32_MAX : (uint32_t)textRun});
 
     if (app.lineBuckets.empty() ||
         std::abs(rect.top - app.lineBuckets.back().top) > kLineBucketTolerance) {
@@ -63,8 +107,9 @@ static void addTextRect(App& app, const D2D1_RECT_F& rect, size_t docStart, size
         bucket.bottom = rect.bottom;
         bucket.minX = rect.left;
         bucket.maxX = rect.right;
-        bucket.textRectIndices.push_back(idx);
-        app.lineBuckets.push_back(std::move(bucket));
+        bucket.firstTextRect = idx;
+        bucket.textRectCount = 1;
+        app.lineBuckets.push_back(bucket);
         return;
     }
 
@@ -72,27 +117,45 @@ static void addTextRect(App& app, const D2D1_RECT_F& rect, size_t docStart, size
     bucket.bottom = std::max(bucket.bottom, rect.bottom);
     bucket.minX = std::min(bucket.minX, rect.left);
     bucket.maxX = std::max(bucket.maxX, rect.right);
-    bucket.textRectIndices.push_back(idx);
+    bucket.textRectCount = idx + 1 - bucket.firstTextRect;
+}
+
+static uint32_t runColorIndex(App& app, const D2D1_COLOR_F& color) {
+    uint64_t key = hashBytes(kFnvOffset, &color, sizeof(color));
+    auto found = app.runColorIndex.find(key);
+    if (found != app.runColorIndex.end()) {
+        const D2D1_COLOR_F& known = app.runColors[found->second];
+        if (known.r == color.r && known.g == color.g && known.b == color.b && known.a == color.a) {
+            return found->second;
+        }
+    }
+    uint32_t index = (uint32_t)app.runColors.size();
+    app.runColors.push_back(color);
+    app.runColorIndex.emplace(key, index);  // a colliding color just goes unindexed
+    return index;
 }
 
-static void addTextRun(App& app, LayoutInfo&& info, const D2D1_POINT_2F& pos,
-                       const D2D1_RECT_F& bounds, D2D1_COLOR_F color,
-                       size_t docStart, size_t docLength, bool selectable) {
-    if (!info.layout) return;
+// Returns the run's index in layoutTextRuns, or SIZE_MAX without a layout
+static size_t addTextRun(App& app, LayoutInfo&& info, const D2D1_POINT_2F& pos,
+                         const D2D1_RECT_F& bounds, D2D1_COLOR_F color,
+                         size_t docStart, size_t docLength, bool selectable) {
+    if (!info.layout) return SIZE_MAX;
 
     App::LayoutTextRun run;
     run.layout = info.layout;
     run.pos = pos;
     run.bounds = bounds;
-    run.color = color;
-    run.docStart = docStart;
-    run.docLength = docLength;
+    run.color = runColorIndex(app, color);
+    run.docStart = (uint32_t)docStart;
+    run.docLength = (uint32_t)docLength;
     run.selectable = selectable;
+    size_t index = app.layoutTextRuns.size();
     app.layoutTextRuns.push_back(run);
 
     if (selectable) {
-        addTextRect(app, bounds, docStart, docLength);
+        addTextRect(app, bounds, docStart, docLength, index);
     }
+    return index;
 }
 
 struct LayoutSnapshot {
@@ -114,23 +177,6 @@ static LayoutSnapshot takeSnapshot(App& app) {
     };
 }
 
-static void rollbackTo(App& app, const LayoutSnapshot& s) {
-    for (size_t i = s.textRuns; i < app.layoutTextRuns.size(); i++) {
-        if (app.layoutTextRuns[i].layout) {
-            app.layoutTextRuns[i].layout->Release();
-        }
-    }
-    app.layoutTextRuns.resize(s.textRuns);
-    app.layoutRects.resize(s.rects);
-    app.layoutLines.resize(s.lines);
-    app.layoutShapes.resize(s.shapes);
-    app.layoutConnectors.resize(s.connectors);
-    app.linkRects.resize(s.links);
-    app.textRects.resize(s.textRects);
-    app.lineBuckets.resize(s.lineBuckets);
-    app.docText.resize(s.docTextLen);
-}
-
 static void shiftLayoutItems(App& app, const LayoutSnapshot& from, float dx) {
     if (dx == 0.0f) return;
     for (size_t i = from.textRuns; i < app.layoutTextRuns.size(); i++) {
@@ -185,8 +231,13 @@ static float getSpaceWidth(App& app, IDWriteTextFormat* format) {
     return measureText(app, L" ", format);
 }
 
-static void layoutElement(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth);
-static void layoutImage(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth);
+static void layoutElement(App& app, const Element* elem, float& y, float indent, float maxWidth);
+static void layoutImage(App& app, const Element* elem, float& y, float indent, float maxWidth);
+
+// View a scratch vector of siblings as an ElementList for layoutInlineContent
+static ElementList asList(std::vector<Element*>& elements) {
+    return {elements.data(), (uint32_t)elements.size(), (uint32_t)elements.size()};
+}
 
 // --- UAX#14 line-break analysis ---
 //
@@ -276,7 +327,7 @@ private:
 
 // canBreak[i] == true when a line may break before text[i]; canBreak[len]
 // is always true. Falls back to space-only breaking if analysis fails.
-void analyzeBreakOpportunities(App& app, const std::wstring& text, std::vector<bool>& canBreak) {
+void analyzeBreakOpportunities(App& app, std::wstring_view text, std::vector<bool>& canBreak) {
     canBreak.assign(text.size() + 1, false);
     if (text.empty()) return;
     canBreak[text.size()] = true;
@@ -299,7 +350,7 @@ void analyzeBreakOpportunities(App& app, const std::wstring& text, std::vector<b
 
     bool analyzed = false;
     if (app.textAnalyzer) {
-        LineBreakAnalysis analysis(text.c_str(), (UINT32)text.size());
+        LineBreakAnalysis analysis(text.data(), (UINT32)text.size());
         if (SUCCEEDED(app.textAnalyzer->AnalyzeLineBreakpoints(
                 &analysis, 0, (UINT32)text.size(), &analysis))) {
             for (size_t i = 1; i < text.size(); i++) {
@@ -317,9 +368,23 @@ void analyzeBreakOpportunities(App& app, const std::wstring& text, std::vector<b
     }
 }
 
+// UTF-16 text of an inline element's Text children: a view of the one
+// child's text when there is just one, else joined into `joined`
+std::wstring_view childText(const Element* elem, std::wstring& joined) {
+    std::wstring_view single;
+    size_t parts = 0;
+    for (const auto& child : elem->children) {
+        if (child->type != ElementType::Text) continue;
+        if (parts++ == 1) joined.assign(single);
+        if (parts == 1) single = child->wtext;
+        else joined += child->wtext;
+    }
+    return parts > 1 ? std::wstring_view(joined) : single;
+}
+
 } // namespace
 
-static void layoutInlineContent(App& app, const std::vector<ElementPtr>& elements,
+static void layoutInlineContent(App& app, const ElementList& elements,
                                 float startX, float& y, float maxWidth,
                                 IDWriteTextFormat* baseFormat, D2D1_COLOR_F baseColor,
                                 const std::string& baseLinkUrl = {}, float customLineHeight = 0.0f) {
@@ -341,7 +406,8 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
         app.linkRects.push_back(lr);
     };
 
-    for (const auto& elem : elements) {
+    for (size_t elemIndex = 0; elemIndex < elements.size(); elemIndex++) {
+        const Element* elem = elements[elemIndex];
         IDWriteTextFormat* format = baseFormat;
         D2D1_COLOR_F color = baseColor;
         std::string linkUrl = baseLinkUrl;
@@ -351,38 +417,49 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
         D2D1_COLOR_F bgColor{};
         float drawYOffset = 0.0f;
 
-        std::wstring text;
+        // Views the elements' UTF-16 text; only pieces joined from several
+        // elements are copied, into `joined`
+        std::wstring_view text;
+        std::wstring joined;
 
         switch (elem->type) {
             case ElementType::Text:
-                text = toWide(elem->text);
+            case ElementType::SoftBreak: {
+                // Plain text runs on across source line breaks: lay out the
+                // whole stretch as one piece, so a wrapped line that joins
+                // two source lines is still one drawn layout
+                size_t end = elemIndex + 1;
+                while (end < elements.size() &&
+                       (elements[end]->type == ElementType::Text ||
+                        elements[end]->type == ElementType::SoftBreak)) {
+                    end++;
+                }
+                if (end == elemIndex + 1 && elem->type == ElementType::Text) {
+                    text = elem->wtext;
+                } else {
+                    for (size_t i = elemIndex; i < end; i++) {
+                        if (elements[i]->type == ElementType::Text) joined += elements[i]->wtext;
+                        else joined += L' ';
+                    }
+                    text = joined;
+                }
+                elemIndex = end - 1;
                 break;
+            }
 
             case ElementType::Strong:
                 format = app.boldFormat;
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
+                text = childText(elem, joined);
                 break;
 
             case ElementType::Emphasis:
                 format = app.italicFormat;
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
+                text = childText(elem, joined);
                 break;
 
             case ElementType::Strikethrough:
                 hasStrike = true;
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
+                text = childText(elem, joined);
                 break;
 
             case ElementType::Highlight:
@@ -391,31 +468,19 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
                 bgColor = app.theme.isDark
                     ? D2D1::ColorF(0.98f, 0.80f, 0.25f, 0.28f)
                     : D2D1::ColorF(1.00f, 0.88f, 0.20f, 0.45f);
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
+                text = childText(elem, joined);
                 break;
 
             case ElementType::Superscript:
                 // Small text; NEAR alignment already sits it at the top of the line
                 format = app.supSubFormat ? app.supSubFormat : baseFormat;
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
+                text = childText(elem, joined);
                 break;
 
             case ElementType::Subscript:
                 format = app.supSubFormat ? app.supSubFormat : baseFormat;
                 drawYOffset = lineHeight * 0.38f;
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
+                text = childText(elem, joined);
                 break;
 
             case ElementType::Code: {
@@ -423,7 +488,7 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
                 color = app.theme.code;
                 for (const auto& child : elem->children) {
                     if (child->type == ElementType::Text) {
-                        text = toWide(child->text);
+                        text = child->wtext;
                     }
                 }
 
@@ -455,15 +520,7 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
                 color = app.theme.link;
                 linkUrl = elem->url;
                 isLink = true;
-                for (const auto& child : elem->children) {
-                    if (child->type == ElementType::Text) {
-                        text += toWide(child->text);
-                    }
-                }
-                break;
-
-            case ElementType::SoftBreak:
-                text = L" ";
+                text = childText(elem, joined);
                 break;
 
             case ElementType::HardBreak:
@@ -489,11 +546,11 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
                     if (child->type == ElementType::RubyText) {
                         for (const auto& rtChild : child->children) {
                             if (rtChild->type == ElementType::Text) {
-                                rubyText += toWide(rtChild->text);
+                                rubyText += rtChild->wtext;
                             }
                         }
                     } else if (child->type == ElementType::Text) {
-                        baseText += toWide(child->text);
+                        baseText += child->wtext;
                     }
                 }
                 if (baseText.empty()) continue;
@@ -641,13 +698,13 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
             }
             D2D1_POINT_2F segPos = D2D1::Point2F(segX, y + drawYOffset);
             D2D1_RECT_F segBounds = D2D1::RectF(segX, y, segX + segWidth, y + lineHeight);
-            addTextRun(app, std::move(info), segPos, segBounds, color,
-                       textDocStart + segStart, segEnd - segStart, false);
+            size_t segRun = addTextRun(app, std::move(info), segPos, segBounds, color,
+                                       textDocStart + segStart, segEnd - segStart, false);
             for (const auto& w : segWords) {
                 float wx = segX + widthOf(segStart, w.start);
                 D2D1_RECT_F wb = D2D1::RectF(wx, y, wx + widthOf(w.start, w.start + w.len),
                                              y + lineHeight);
-                addTextRect(app, wb, textDocStart + w.start, w.len);
+                addTextRect(app, wb, textDocStart + w.start, w.len, segRun);
             }
             segWords.clear();
         };
@@ -744,15 +801,27 @@ static void layoutInlineContent(App& app, const std::vector<ElementPtr>& element
     y += lineHeight;
 }
 
-static void layoutParagraph(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
+// The text of a heading as the TOC lists it and its anchor id is made from
+static std::wstring headingPlainText(const Element* elem) {
+    std::wstring text;
+    std::function<void(const Element*)> extract = [&](const Element* e) {
+        if (!e) return;
+        if (e->type == ElementType::Text) text += e->wtext;
+        else for (const auto& c : e->children) extract(c);
+    };
+    for (const auto& child : elem->children) extract(child);
+    return text;
+}
+
+static void layoutParagraph(App& app, const Element* elem, float& y, float indent, float maxWidth) {
     layoutInlineContent(app, elem->children, indent, y, maxWidth, app.textFormat, app.theme.text);
     app.docText += L"\n\n";
-    float scale = app.contentScale * app.zoomFactor;
+    float scale = layoutScale(app);
     y += 14 * scale;
 }
 
-static void layoutHeading(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
-    float scale = app.contentScale * app.zoomFactor;
+static void layoutHeading(App& app, const Element* elem, float& y, float indent, float maxWidth) {
+    float scale = layoutScale(app);
     int levelIndex = std::min(elem->level - 1, 5);
     IDWriteTextFormat* format = app.headingFormats[levelIndex] ? app.headingFormats[levelIndex] : app.textFormat;
 
@@ -764,18 +833,8 @@ static void layoutHeading(App& app, const ElementPtr& elem, float& y, float inde
 
     // Record heading for TOC (h1-h3 only)
     if (elem->level <= 3) {
-        std::wstring headingText;
-        std::function<void(const ElementPtr&)> extract = [&](const ElementPtr& e) {
-            if (!e) return;
-            if (e->type == ElementType::Text) headingText += toWide(e->text);
-            else for (const auto& c : e->children) extract(c);
-        };
-        for (const auto& child : elem->children) extract(child);
-
-        std::string baseId = slugifyHeading(headingText);
-        int& n = app.headingSlugCounts[baseId];
-        std::string id = (n == 0) ? baseId : (baseId + "-" + std::to_string(n));
-        n++;
+        std::wstring headingText = headingPlainText(elem);
+        std::string id = nextHeadingId(app.headingSlugCounts, headingText);
         app.headings.push_back({headingText, elem->level, y, id});
     }
 
@@ -888,15 +947,105 @@ static App::LayoutShapeType mermaidShapeType(mermaid::NodeShape shape) {
     }
 }
 
-static bool layoutMermaidDiagram(App& app, const std::string& source,
-                                 size_t sourceOffset, float& y,
-                                 float indent, float maxWidth,
-                                 D2D1_RECT_F* renderedBounds = nullptr) {
+struct MeasuredMermaidEdgeLabel {
+    std::wstring text;
+    float width = 0.0f;
+    float height = 0.0f;
+};
+
+} // namespace
+
+// Everything layoutMermaidDiagram derives from the source before it emits
+// shapes: the parse, label measurements and the graph layout. Measuring
+// 100+ labels and ranking the graph dominated every zoom tick, resize and
+// theme switch, so entries are kept across layouts (see mermaidLayoutFor).
+struct App::MermaidLayoutEntry {
+    bool valid = false;  // source failed to parse or lay out
+    mermaid::Diagram diagram;
+    std::vector<std::wstring> labels;
+    std::vector<ResolvedMermaidStyle> styles;
+    std::vector<MeasuredMermaidEdgeLabel> edgeLabels;
+    mermaid::Layout graphLayout;
+    std::shared_ptr<App::MermaidGeometry> geometry;  // built on first placement
+    uint64_t lastUse = 0;
+};
+
+// A diagram's routed connectors, shapes and labels in diagram space, plus
+// the Direct2D geometries they draw with: one path per connector, grouped
+// with the connectors that share its color, width and dash, and one
+// geometry group per node/chip style. Shared by every placement of the
+// cached layout; the geometries are factory resources, so they survive a
+// lost render target.
+struct App::MermaidGeometry {
+    struct TextItem {
+        std::wstring text;
+        D2D1_RECT_F rect{};
+        D2D1_COLOR_F color{};
+    };
+    // One draw call: fill the geometry (strokeWidth 0) or stroke it
+    struct Pass {
+        ID2D1Geometry* geometry = nullptr;
+        D2D1_COLOR_F color{};
+        float strokeWidth = 0.0f;
+        bool dashed = false;
+    };
+
+    std::vector<D2D1_RECT_F> nodeRects;
+    std::vector<TextItem> textItems;
+    std::vector<LayoutShape> shapes;
+    std::vector<LayoutConnector> connectors;
+    D2D1_RECT_F bounds{};
+    std::vector<Pass> passes;  // in draw order: connectors, arrowheads, shapes
+
+    MermaidGeometry() = default;
+    MermaidGeometry(const MermaidGeometry&) = delete;
+    MermaidGeometry& operator=(const MermaidGeometry&) = delete;
+    ~MermaidGeometry() {
+        for (auto& pass : passes) {
+            if (pass.geometry) pass.geometry->Release();
+        }
+    }
+};
+
+namespace {
+
+constexpr size_t kMermaidLayoutCacheMax = 64;
+
+static uint64_t mermaidLayoutKey(const App& app, std::string_view source, float scale) {
+    // The layout does not depend on the available width (that only centers
+    // the diagram), so resizing keeps hitting. Fonts follow the theme.
+    uint64_t h = hashString(kFnvOffset, source);
+    h = hashValue(h, scale);
+    return hashValue(h, app.currentThemeIndex);
+}
+
+static App::MermaidLayoutEntry& mermaidLayoutFor(
+        App& app, std::string_view source, float scale) {
+    uint64_t key = mermaidLayoutKey(app, source, scale);
+    uint64_t use = ++app.mermaidLayoutUse;
+    auto found = app.mermaidLayoutCache.find(key);
+    if (found != app.mermaidLayoutCache.end()) {
+        found->second->lastUse = use;
+        return *found->second;
+    }
+
+    if (app.mermaidLayoutCache.size() >= kMermaidLayoutCacheMax) {
+        auto oldest = app.mermaidLayoutCache.begin();
+        for (auto it = app.mermaidLayoutCache.begin(); it != app.mermaidLayoutCache.end(); ++it) {
+            if (it->second->lastUse < oldest->second->lastUse) oldest = it;
+        }
+        app.mermaidLayoutCache.erase(oldest);
+    }
+    auto& entry = app.mermaidLayoutCache[key];
+    entry = std::make_shared<App::MermaidLayoutEntry>();
+    entry->lastUse = use;
+    ScopedPhase phase(&app, FramePhase::Mermaid);
+
     auto parsed = mermaid::parse(source);
-    if (!parsed.success || parsed.diagram.nodes.empty()) return false;
+    if (!parsed.success || parsed.diagram.nodes.empty()) return *entry;
+    entry->diagram = std::move(parsed.diagram);
 
-    const auto& diagram = parsed.diagram;
-    float scale = app.contentScale * app.zoomFactor;
+    const auto& diagram = entry->diagram;
     float maxLabelWidth = 280.0f * scale;
     float measureHeight = 10000.0f * scale;
     float paddingX = 18.0f * scale;
@@ -904,9 +1053,9 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
     float minimumWidth = 120.0f * scale;
     float minimumHeight = 52.0f * scale;
 
-    std::vector<std::wstring> labels;
+    auto& labels = entry->labels;
+    auto& styles = entry->styles;
     std::vector<mermaid::Size> nodeSizes;
-    std::vector<ResolvedMermaidStyle> styles;
     labels.reserve(diagram.nodes.size());
     nodeSizes.reserve(diagram.nodes.size());
     styles.reserve(diagram.nodes.size());
@@ -935,17 +1084,13 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
         styles.push_back(resolveMermaidStyle(app, diagram, node, scale));
     }
 
-    struct MeasuredMermaidEdgeLabel {
-        std::wstring text;
-        float width = 0.0f;
-        float height = 0.0f;
-    };
     bool vertical = diagram.direction == mermaid::Direction::TopToBottom ||
                     diagram.direction == mermaid::Direction::BottomToTop;
     float labelPaddingX = 6.0f * scale;
     float labelPaddingY = 4.0f * scale;
     float rankGap = 78.0f * scale;
-    std::vector<MeasuredMermaidEdgeLabel> edgeLabels(diagram.edges.size());
+    auto& edgeLabels = entry->edgeLabels;
+    edgeLabels.resize(diagram.edges.size());
     for (size_t i = 0; i < diagram.edges.size(); i++) {
         if (diagram.edges[i].label.empty()) continue;
 
@@ -967,43 +1112,47 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
         rankGap = std::max(rankGap, labelExtent + 20.0f * scale);
     }
 
-    mermaid::Layout graphLayout = mermaid::layout(
+    entry->graphLayout = mermaid::layout(
         diagram, nodeSizes, 32.0f * scale, rankGap);
-    if (graphLayout.nodes.size() != diagram.nodes.size()) return false;
+    entry->valid = entry->graphLayout.nodes.size() == diagram.nodes.size();
+    return *entry;
+}
 
-    float baseX = indent;
-    if (graphLayout.width < maxWidth) {
-        baseX += (maxWidth - graphLayout.width) * 0.5f;
-    }
-    float baseY = y + 10.0f * scale;
-    float diagramLeft = baseX;
-    float diagramTop = baseY;
-    float diagramRight = baseX + graphLayout.width;
-    float diagramBottom = baseY + graphLayout.height;
+// Routes the connectors, places the edge label chips and node shapes and
+// collects the labels of a cached diagram, all in diagram space
+static std::shared_ptr<App::MermaidGeometry> buildMermaidGeometry(
+        App& app, const App::MermaidLayoutEntry& cached, float scale) {
+    auto geometry = std::make_shared<App::MermaidGeometry>();
+    const auto& diagram = cached.diagram;
+    const auto& labels = cached.labels;
+    const auto& styles = cached.styles;
+    const auto& edgeLabels = cached.edgeLabels;
+    const auto& graphLayout = cached.graphLayout;
+    float paddingX = 18.0f * scale;
+    float paddingY = 12.0f * scale;
+    bool vertical = diagram.direction == mermaid::Direction::TopToBottom ||
+                    diagram.direction == mermaid::Direction::BottomToTop;
+    float labelPaddingX = 6.0f * scale;
+    float labelPaddingY = 4.0f * scale;
 
-    std::vector<D2D1_RECT_F> nodeRects;
+    float diagramLeft = 0.0f;
+    float diagramTop = 0.0f;
+    float diagramRight = graphLayout.width;
+    float diagramBottom = graphLayout.height;
+
+    auto& nodeRects = geometry->nodeRects;
     nodeRects.reserve(graphLayout.nodes.size());
     for (const auto& rect : graphLayout.nodes) {
-        nodeRects.push_back(D2D1::RectF(
-            baseX + rect.left,
-            baseY + rect.top,
-            baseX + rect.right,
-            baseY + rect.bottom));
+        nodeRects.push_back(D2D1::RectF(rect.left, rect.top, rect.right, rect.bottom));
     }
 
-    struct MermaidTextItem {
-        std::wstring text;
-        D2D1_RECT_F rect{};
-        D2D1_COLOR_F color{};
-    };
-    std::vector<MermaidTextItem> textItems;
+    auto& textItems = geometry->textItems;
     textItems.reserve(diagram.nodes.size() + diagram.edges.size());
 
     D2D1_COLOR_F connectorColor = app.theme.text;
     connectorColor.a = app.theme.isDark ? 0.7f : 0.6f;
 
-    app.layoutConnectors.reserve(
-        app.layoutConnectors.size() + diagram.edges.size());
+    geometry->connectors.reserve(diagram.edges.size());
     size_t exteriorLane = 0;
     std::vector<D2D1_RECT_F> placedLabelRects;
     placedLabelRects.reserve(diagram.edges.size());
@@ -1144,11 +1293,11 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
         diagramTop = std::min(diagramTop, connector.bounds.top);
         diagramRight = std::max(diagramRight, connector.bounds.right);
         diagramBottom = std::max(diagramBottom, connector.bounds.bottom);
-        app.layoutConnectors.push_back(std::move(connector));
+        geometry->connectors.push_back(std::move(connector));
 
         if (!edge.label.empty()) {
             const auto& edgeLabel = edgeLabels[edgeIndex];
-            const auto& points = app.layoutConnectors.back().points;
+            const auto& points = geometry->connectors.back().points;
             size_t middle = points.size() / 2;
             const auto& middleStart = points[middle - 1];
             const auto& middleEnd = points[middle];
@@ -1191,7 +1340,7 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
             // edges look disconnected and labels look like floating text
             D2D1_COLOR_F chipStroke = connectorColor;
             chipStroke.a *= 0.6f;
-            app.layoutShapes.push_back({
+            geometry->shapes.push_back({
                 App::LayoutShapeType::RoundedRectangle,
                 labelRect,
                 app.theme.codeBackground,
@@ -1212,13 +1361,13 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
         }
     }
 
-    app.layoutShapes.reserve(app.layoutShapes.size() + diagram.nodes.size());
+    geometry->shapes.reserve(geometry->shapes.size() + diagram.nodes.size());
     for (size_t i = 0; i < diagram.nodes.size(); i++) {
         const auto& node = diagram.nodes[i];
         const auto& rect = nodeRects[i];
         const auto& style = styles[i];
 
-        app.layoutShapes.push_back({
+        geometry->shapes.push_back({
             mermaidShapeType(node.shape),
             rect,
             style.fill,
@@ -1242,43 +1391,304 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
             rect.right - insetX,
             rect.bottom - insetY);
         textItems.push_back({labels[i], textRect, style.text});
-
-        if (sourceOffset != SIZE_MAX) {
-            size_t anchorOffset = sourceOffset + node.sourceOffset;
-            if (app.scrollAnchors.empty() ||
-                app.scrollAnchors.back().sourceOffset < anchorOffset) {
-                app.scrollAnchors.push_back({anchorOffset, rect.top});
-            }
-        }
     }
 
     std::stable_sort(
         textItems.begin(), textItems.end(),
-        [](const MermaidTextItem& left, const MermaidTextItem& right) {
+        [](const App::MermaidGeometry::TextItem& left,
+           const App::MermaidGeometry::TextItem& right) {
             if (std::abs(left.rect.top - right.rect.top) > kLineBucketTolerance) {
                 return left.rect.top < right.rect.top;
             }
             return left.rect.left < right.rect.left;
         });
-    for (const auto& item : textItems) {
+    geometry->bounds = D2D1::RectF(diagramLeft, diagramTop, diagramRight, diagramBottom);
+    return geometry;
+}
+
+// Ends of the two arrowhead wings at a directed connector's tip. False
+// when the last segment is too short to give the arrow a direction.
+static bool connectorArrowWings(const App::LayoutConnector& connector,
+                                D2D1_POINT_2F& left, D2D1_POINT_2F& right) {
+    if (connector.points.size() < 2) return false;
+    const auto& tip = connector.points.back();
+    const auto& previous = connector.points[connector.points.size() - 2];
+    float dx = tip.x - previous.x;
+    float dy = tip.y - previous.y;
+    float length = std::sqrt(dx * dx + dy * dy);
+    if (length <= 0.001f) return false;
+    dx /= length;
+    dy /= length;
+    float wing = connector.arrowSize * 0.5f;
+    left = D2D1::Point2F(
+        tip.x - dx * connector.arrowSize + dy * wing,
+        tip.y - dy * connector.arrowSize - dx * wing);
+    right = D2D1::Point2F(
+        tip.x - dx * connector.arrowSize - dy * wing,
+        tip.y - dy * connector.arrowSize + dx * wing);
+    return true;
+}
+
+static bool sameColor(const D2D1_COLOR_F& a, const D2D1_COLOR_F& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+// Open path of the given open figures (each a polyline)
+static ID2D1PathGeometry* createPolylinePath(
+        ID2D1Factory* factory,
+        const std::vector<std::vector<D2D1_POINT_2F>>& figures) {
+    ID2D1PathGeometry* path = nullptr;
+    if (FAILED(factory->CreatePathGeometry(&path)) || !path) return nullptr;
+    ID2D1GeometrySink* sink = nullptr;
+    if (FAILED(path->Open(&sink)) || !sink) {
+        path->Release();
+        return nullptr;
+    }
+    for (const auto& points : figures) {
+        if (points.size() < 2) continue;
+        sink->BeginFigure(points[0], D2D1_FIGURE_BEGIN_HOLLOW);
+        sink->AddLines(points.data() + 1, (UINT32)(points.size() - 1));
+        sink->EndFigure(D2D1_FIGURE_END_OPEN);
+    }
+    HRESULT hr = sink->Close();
+    sink->Release();
+    if (FAILED(hr)) {
+        path->Release();
+        return nullptr;
+    }
+    return path;
+}
+
+// Outline of a node or label chip where it sits in diagram space
+static ID2D1Geometry* createShapeGeometry(ID2D1Factory* factory,
+                                          const App::LayoutShape& shape) {
+    const auto& rect = shape.rect;
+    float width = rect.right - rect.left;
+    float height = rect.bottom - rect.top;
+    switch (shape.type) {
+        case App::LayoutShapeType::Rectangle: {
+            ID2D1RectangleGeometry* geometry = nullptr;
+            factory->CreateRectangleGeometry(rect, &geometry);
+            return geometry;
+        }
+        case App::LayoutShapeType::RoundedRectangle:
+        case App::LayoutShapeType::Stadium: {
+            float radius = shape.type == App::LayoutShapeType::Stadium
+                ? height * 0.5f
+                : shape.radius;
+            ID2D1RoundedRectangleGeometry* geometry = nullptr;
+            factory->CreateRoundedRectangleGeometry(
+                D2D1::RoundedRect(rect, radius, radius), &geometry);
+            return geometry;
+        }
+        case App::LayoutShapeType::Ellipse: {
+            ID2D1EllipseGeometry* geometry = nullptr;
+            factory->CreateEllipseGeometry(
+                D2D1::Ellipse(
+                    D2D1::Point2F(rect.left + width * 0.5f, rect.top + height * 0.5f),
+                    width * 0.5f, height * 0.5f),
+                &geometry);
+            return geometry;
+        }
+        case App::LayoutShapeType::Diamond:
+        case App::LayoutShapeType::Hexagon:
+            break;
+    }
+
+    float inset = width * 0.18f;
+    std::vector<D2D1_POINT_2F> points;
+    if (shape.type == App::LayoutShapeType::Diamond) {
+        points = {
+            D2D1::Point2F(rect.left + width * 0.5f, rect.top),
+            D2D1::Point2F(rect.right, rect.top + height * 0.5f),
+            D2D1::Point2F(rect.left + width * 0.5f, rect.bottom),
+            D2D1::Point2F(rect.left, rect.top + height * 0.5f),
+        };
+    } else {
+        points = {
+            D2D1::Point2F(rect.left + inset, rect.top),
+            D2D1::Point2F(rect.right - inset, rect.top),
+            D2D1::Point2F(rect.right, rect.top + height * 0.5f),
+            D2D1::Point2F(rect.right - inset, rect.bottom),
+            D2D1::Point2F(rect.left + inset, rect.bottom),
+            D2D1::Point2F(rect.left, rect.top + height * 0.5f),
+        };
+    }
+    ID2D1PathGeometry* path = nullptr;
+    if (FAILED(factory->CreatePathGeometry(&path)) || !path) return nullptr;
+    ID2D1GeometrySink* sink = nullptr;
+    if (FAILED(path->Open(&sink)) || !sink) {
+        path->Release();
+        return nullptr;
+    }
+    sink->BeginFigure(points[0], D2D1_FIGURE_BEGIN_FILLED);
+    sink->AddLines(points.data() + 1, (UINT32)(points.size() - 1));
+    sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+    sink->Close();
+    sink->Release();
+    return path;
+}
+
+// One geometry group over `parts`, which it takes ownership of
+static ID2D1Geometry* groupGeometries(ID2D1Factory* factory,
+                                      std::vector<ID2D1Geometry*>& parts) {
+    ID2D1GeometryGroup* group = nullptr;
+    if (!parts.empty()) {
+        factory->CreateGeometryGroup(
+            D2D1_FILL_MODE_WINDING, parts.data(), (UINT32)parts.size(), &group);
+    }
+    for (auto* part : parts) part->Release();  // the group holds its own references
+    parts.clear();
+    return group;
+}
+
+// Batch the diagram's connectors and shapes into draw passes. Connectors
+// get one path each, grouped by color, width and dash; arrowheads go into
+// one undashed path per color and width; shapes are grouped by fill,
+// stroke and stroke width, each group filled then stroked. Batches keep
+// the order their first member was emitted in.
+static void buildMermaidPasses(App& app, App::MermaidGeometry& geometry) {
+    using Pass = App::MermaidGeometry::Pass;
+    ID2D1Factory* factory = app.d2dFactory;
+    if (!factory) return;
+
+    auto batchFor = [](std::vector<Pass>& batches, const Pass& key) {
+        for (size_t i = 0; i < batches.size(); i++) {
+            if (sameColor(batches[i].color, key.color) &&
+                batches[i].strokeWidth == key.strokeWidth &&
+                batches[i].dashed == key.dashed) {
+                return i;
+            }
+        }
+        batches.push_back(key);
+        return batches.size() - 1;
+    };
+
+    std::vector<Pass> lineBatches, arrowBatches;
+    std::vector<std::vector<ID2D1Geometry*>> lineParts;
+    std::vector<std::vector<std::vector<D2D1_POINT_2F>>> arrowFigures;
+    for (const auto& connector : geometry.connectors) {
+        if (connector.points.size() < 2) continue;
+        size_t batch = batchFor(
+            lineBatches, {nullptr, connector.color, connector.stroke, connector.dashed});
+        if (batch == lineParts.size()) lineParts.emplace_back();
+        if (auto* path = createPolylinePath(factory, {connector.points})) {
+            lineParts[batch].push_back(path);
+        }
+
+        D2D1_POINT_2F left, right;
+        if (!connector.directed || !connectorArrowWings(connector, left, right)) continue;
+        batch = batchFor(arrowBatches, {nullptr, connector.color, connector.stroke, false});
+        if (batch == arrowFigures.size()) arrowFigures.emplace_back();
+        const auto& tip = connector.points.back();
+        arrowFigures[batch].push_back({tip, left});
+        arrowFigures[batch].push_back({tip, right});
+    }
+    for (size_t i = 0; i < lineBatches.size(); i++) {
+        lineBatches[i].geometry = groupGeometries(factory, lineParts[i]);
+        if (lineBatches[i].geometry) geometry.passes.push_back(lineBatches[i]);
+    }
+    for (size_t i = 0; i < arrowBatches.size(); i++) {
+        arrowBatches[i].geometry = createPolylinePath(factory, arrowFigures[i]);
+        if (arrowBatches[i].geometry) geometry.passes.push_back(arrowBatches[i]);
+    }
+
+    struct ShapeBatch {
+        D2D1_COLOR_F fill{};
+        D2D1_COLOR_F stroke{};
+        float strokeWidth = 0.0f;
+        std::vector<ID2D1Geometry*> parts;
+    };
+    std::vector<ShapeBatch> shapeBatches;
+    for (const auto& shape : geometry.shapes) {
+        bool filled = shape.fill.a > 0.0f;
+        bool stroked = shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f;
+        if (!filled && !stroked) continue;
+        ID2D1Geometry* part = createShapeGeometry(factory, shape);
+        if (!part) continue;
+        auto found = std::find_if(
+            shapeBatches.begin(), shapeBatches.end(), [&](const ShapeBatch& batch) {
+                return sameColor(batch.fill, shape.fill) &&
+                       sameColor(batch.stroke, shape.stroke) &&
+                       batch.strokeWidth == shape.strokeWidth;
+            });
+        if (found == shapeBatches.end()) {
+            shapeBatches.push_back({shape.fill, shape.stroke, shape.strokeWidth, {}});
+            found = shapeBatches.end() - 1;
+        }
+        found->parts.push_back(part);
+    }
+    for (auto& batch : shapeBatches) {
+        ID2D1Geometry* group = groupGeometries(factory, batch.parts);
+        if (!group) continue;
+        bool filled = batch.fill.a > 0.0f;
+        bool stroked = batch.stroke.a > 0.0f && batch.strokeWidth > 0.0f;
+        if (filled) geometry.passes.push_back({group, batch.fill, 0.0f, false});
+        if (stroked) {
+            if (filled) group->AddRef();  // each pass releases its reference
+            geometry.passes.push_back({group, batch.stroke, batch.strokeWidth, false});
+        }
+    }
+}
+
+static bool layoutMermaidDiagram(App& app, std::string_view source,
+                                 size_t sourceOffset, float& y,
+                                 float indent, float maxWidth,
+                                 D2D1_RECT_F* renderedBounds = nullptr) {
+    float scale = layoutScale(app);
+    auto& cached = mermaidLayoutFor(app, source, scale);
+    if (!cached.valid) return false;
+    if (!cached.geometry) {
+        cached.geometry = buildMermaidGeometry(app, cached, scale);
+        buildMermaidPasses(app, *cached.geometry);
+    }
+
+    const auto& diagram = cached.diagram;
+    const auto& graphLayout = cached.graphLayout;
+    const auto& geometry = *cached.geometry;
+    float baseX = indent;
+    if (graphLayout.width < maxWidth) {
+        baseX += (maxWidth - graphLayout.width) * 0.5f;
+    }
+    float baseY = y + 10.0f * scale;
+    auto place = [&](const D2D1_RECT_F& rect) {
+        return D2D1::RectF(rect.left + baseX, rect.top + baseY,
+                           rect.right + baseX, rect.bottom + baseY);
+    };
+
+    D2D1_RECT_F bounds = place(geometry.bounds);
+    app.layoutDiagrams.push_back({bounds, D2D1::Point2F(baseX, baseY), cached.geometry});
+
+    if (sourceOffset != SIZE_MAX) {
+        for (size_t i = 0; i < diagram.nodes.size(); i++) {
+            size_t anchorOffset = sourceOffset + diagram.nodes[i].sourceOffset;
+            if (app.scrollAnchors.empty() ||
+                app.scrollAnchors.back().sourceOffset < anchorOffset) {
+                app.scrollAnchors.push_back({anchorOffset, geometry.nodeRects[i].top + baseY});
+            }
+        }
+    }
+
+    for (const auto& item : geometry.textItems) {
+        D2D1_RECT_F rect = place(item.rect);
         LayoutInfo textLayout = createWrappedLayout(
             app, item.text, app.textFormat,
-            item.rect.right - item.rect.left,
-            item.rect.bottom - item.rect.top);
+            rect.right - rect.left,
+            rect.bottom - rect.top);
         size_t docStart = app.docText.size();
         app.docText += item.text;
         addTextRun(
             app, std::move(textLayout),
-            D2D1::Point2F(item.rect.left, item.rect.top),
-            item.rect, item.color, docStart, item.text.size(), true);
+            D2D1::Point2F(rect.left, rect.top),
+            rect, item.color, docStart, item.text.size(), true);
         app.docText += L"\n";
     }
     app.docText += L"\n";
 
     app.contentWidth = std::max(
         app.contentWidth,
-        diagramRight + 40.0f * scale);
-    if (app.focusMermaidOnNextLayout && !nodeRects.empty()) {
+        bounds.right + 40.0f * scale);
+    if (app.focusMermaidOnNextLayout && !geometry.nodeRects.empty()) {
         std::vector<bool> hasIncoming(diagram.nodes.size(), false);
         for (const auto& edge : diagram.edges) {
             if (edge.to < hasIncoming.size()) hasIncoming[edge.to] = true;
@@ -1291,7 +1701,8 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
             }
         }
 
-        float rootCenter = (nodeRects[rootIndex].left + nodeRects[rootIndex].right) * 0.5f;
+        D2D1_RECT_F root = place(geometry.nodeRects[rootIndex]);
+        float rootCenter = (root.left + root.right) * 0.5f;
         float viewportWidth = documentViewportWidth(app);
         float maxScroll = std::max(0.0f, app.contentWidth - viewportWidth);
         float focusedScroll = rootCenter - viewportWidth * 0.5f;
@@ -1299,32 +1710,83 @@ static bool layoutMermaidDiagram(App& app, const std::string& source,
         app.targetScrollX = app.scrollX;
         app.focusMermaidOnNextLayout = false;
     }
-    if (renderedBounds) {
-        *renderedBounds =
-            D2D1::RectF(diagramLeft, diagramTop, diagramRight, diagramBottom);
-    }
-    y = diagramBottom + 24.0f * scale;
+    if (renderedBounds) *renderedBounds = bounds;
+    y = bounds.bottom + 24.0f * scale;
     return true;
 }
 
-static void layoutCodeBlock(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
-    std::string code;
+} // namespace
+
+// Tokenizing is a per-character scan with a keyword lookup per identifier;
+// a code block's tokens only depend on its source and language, so they
+// are kept across zoom, resize, theme and edit relayouts
+struct App::CodeTokenEntry {
+    CodeTokens tokens;
+    uint64_t lastUse = 0;
+};
+
+namespace {
+
+constexpr size_t kCodeTokenCacheMax = 1024;
+
+static const CodeTokens& codeTokensFor(App& app, std::wstring_view code, int language) {
+    uint64_t key = hashValue(kFnvOffset, language);
+    key = hashValue(key, code.size());
+    key = hashBytes(key, code.data(), code.size() * sizeof(wchar_t));
+    uint64_t use = ++app.codeTokenUse;
+    auto found = app.codeTokenCache.find(key);
+    if (found != app.codeTokenCache.end()) {
+        found->second->lastUse = use;
+        return found->second->tokens;
+    }
+
+    if (app.codeTokenCache.size() >= kCodeTokenCacheMax) {
+        auto oldest = app.codeTokenCache.begin();
+        for (auto it = app.codeTokenCache.begin(); it != app.codeTokenCache.end(); ++it) {
+            if (it->second->lastUse < oldest->second->lastUse) oldest = it;
+        }
+        app.codeTokenCache.erase(oldest);
+    }
+    auto& entry = app.codeTokenCache[key];
+    entry = std::make_shared<App::CodeTokenEntry>();
+    entry->lastUse = use;
+    ScopedPhase phase(&app, FramePhase::Tokenize);
+    entry->tokens = tokenizeCode(code, language);
+    return entry->tokens;
+}
+
+// Brush for a syntax color, created on first use for the current render
+// target; null without one, which leaves that range in the run color
+static ID2D1SolidColorBrush* codeBrushFor(App& app, const D2D1_COLOR_F& color) {
+    for (const auto& b : app.codeBrushes) {
+        if (sameColor(b.color, color)) return b.brush;
+    }
+    if (!app.renderTarget) return nullptr;
+    ID2D1SolidColorBrush* brush = nullptr;
+    if (FAILED(app.renderTarget->CreateSolidColorBrush(color, &brush))) return nullptr;
+    app.codeBrushes.push_back({color, brush});
+    return brush;
+}
+
+static void layoutCodeBlock(App& app, const Element* elem, float& y, float indent, float maxWidth) {
+    std::wstring wcode;
     for (const auto& child : elem->children) {
         if (child->type == ElementType::Text) {
-            code += child->text;
+            wcode += child->wtext;
         }
     }
 
-    std::string languageName = elem->language;
+    std::string languageName(elem->language);
     std::transform(
         languageName.begin(), languageName.end(), languageName.begin(),
         [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
     if (languageName == "mermaid") {
+        std::string code = narrowText(wcode);
         D2D1_RECT_F renderedBounds{};
         if (layoutMermaidDiagram(
                 app, code, elem->sourceOffset, y, indent, maxWidth,
                 &renderedBounds)) {
-            app.codeBlocks.push_back({renderedBounds, toWide(code)});
+            app.codeBlocks.push_back({renderedBounds, wcode});
             return;
         }
     }
@@ -1332,12 +1794,12 @@ static void layoutCodeBlock(App& app, const ElementPtr& elem, float& y, float in
     std::wstring langHint = toWide(elem->language);
     int language = detectLanguage(langHint);
 
-    float scale = app.contentScale * app.zoomFactor;
+    float scale = layoutScale(app);
     float lineHeight = 20.0f * scale;
     float padding = 12.0f * scale;
 
     int lineCount = 1;
-    for (char c : code) if (c == '\n') lineCount++;
+    for (wchar_t c : wcode) if (c == L'\n') lineCount++;
 
     app.docText += L"\n";
 
@@ -1346,87 +1808,70 @@ static void layoutCodeBlock(App& app, const ElementPtr& elem, float& y, float in
     app.layoutRects.push_back({D2D1::RectF(indent, y, indent + maxWidth, y + blockHeight),
                                app.theme.codeBackground});
 
-    std::wstring wcode = toWide(code);
-
     // Track code block for copy button
     app.codeBlocks.push_back({
         D2D1::RectF(indent, y, indent + maxWidth, y + blockHeight),
         wcode
     });
     float textY = y + padding;
-    bool inBlockComment = false;
+    const CodeTokens* tokens = language > 0 ? &codeTokensFor(app, wcode, language) : nullptr;
     size_t codeDocStart = app.docText.size();
     size_t lineStart = 0;
+    size_t lineIndex = 0;
     float maxLineWidth = 0.0f;
 
     while (lineStart <= wcode.length()) {
         size_t lineEnd = wcode.find(L'\n', lineStart);
         if (lineEnd == std::wstring::npos) lineEnd = wcode.length();
 
-        std::wstring wline = wcode.substr(lineStart, lineEnd - lineStart);
-        if (!wline.empty() && wline.back() == L'\r') wline.pop_back();
+        std::wstring_view wline(wcode.data() + lineStart, lineEnd - lineStart);
+        if (!wline.empty() && wline.back() == L'\r') wline.remove_suffix(1);
 
         size_t lineDocStart = codeDocStart + lineStart;
-        float lineWidth = 0.0f;
-
-        if (language > 0) {
-            std::vector<SyntaxToken> tokens = tokenizeLine(wline, language, inBlockComment);
-            float tokenX = indent + padding;
 
-            // Merge consecutive same-color tokens into one layout — a line
-            // typically collapses to a handful of color runs instead of one
-            // IDWriteTextLayout per token.
-            size_t ti = 0;
-            while (ti < tokens.size()) {
-                if (tokens[ti].text.empty()) { ti++; continue; }
-
-                D2D1_COLOR_F runColor = getTokenColor(app.theme, tokens[ti].tokenType);
-                std::wstring_view runText = tokens[ti].text;
+        // One layout per line in the plain code color; every other token
+        // color is a drawing-effect brush over its range, so a highlighted
+        // line still costs one layout and one draw call
+        LayoutInfo info = createLayout(app, wline, app.codeFormat, lineHeight, app.codeTypography);
+        if (tokens && info.layout) {
+            const auto& spans = tokens->spans;
+            size_t ti = tokens->lineSpans[lineIndex];
+            size_t lineSpanEnd = tokens->lineSpans[lineIndex + 1];
+            while (ti < lineSpanEnd) {
+                D2D1_COLOR_F runColor = getTokenColor(app.theme, spans[ti].tokenType);
+                size_t runStart = spans[ti].start;
+                size_t runEnd = runStart + spans[ti].length;
                 size_t tj = ti + 1;
-                while (tj < tokens.size()) {
-                    const auto& next = tokens[tj];
-                    if (next.text.empty()) { tj++; continue; }
-                    D2D1_COLOR_F c = getTokenColor(app.theme, next.tokenType);
-                    bool sameColor = c.r == runColor.r && c.g == runColor.g &&
-                                     c.b == runColor.b && c.a == runColor.a;
-                    // Tokens are views into wline; only merge physically
-                    // adjacent ones so the combined view stays valid
-                    bool adjacent = next.text.data() == runText.data() + runText.size();
-                    if (!sameColor || !adjacent) break;
-                    runText = std::wstring_view(runText.data(), runText.size() + next.text.size());
+                while (tj < lineSpanEnd && spans[tj].start == runEnd &&
+                       sameColor(getTokenColor(app.theme, spans[tj].tokenType), runColor)) {
+                    runEnd = spans[tj].start + spans[tj].length;
                     tj++;
                 }
-
-                LayoutInfo info = createLayout(app, runText, app.codeFormat, lineHeight, app.codeTypography);
-                float runWidth = info.width;
-
-                D2D1_POINT_2F pos = D2D1::Point2F(tokenX, textY);
-                D2D1_RECT_F bounds = D2D1::RectF(tokenX, textY, tokenX + runWidth, textY + lineHeight);
-                addTextRun(app, std::move(info), pos, bounds, runColor,
-                           lineDocStart, 0, false);
-
-                tokenX += runWidth;
-                lineWidth += runWidth;
+                ID2D1SolidColorBrush* brush = sameColor(runColor, app.theme.code)
+                    ? nullptr : codeBrushFor(app, runColor);
+                if (brush) {
+                    info.layout->SetDrawingEffect(brush,
+                        {(UINT32)(runStart - lineStart), (UINT32)(runEnd - runStart)});
+                }
                 ti = tj;
             }
-        } else {
-            LayoutInfo info = createLayout(app, wline, app.codeFormat, lineHeight, app.codeTypography);
-            lineWidth = info.width;
-            D2D1_POINT_2F pos = D2D1::Point2F(indent + padding, textY);
-            D2D1_RECT_F bounds = D2D1::RectF(indent + padding, textY,
-                                             indent + padding + lineWidth, textY + lineHeight);
-            addTextRun(app, std::move(info), pos, bounds, app.theme.code,
-                       lineDocStart, wline.length(), false);
         }
+        float lineWidth = info.width;
+        D2D1_POINT_2F pos = D2D1::Point2F(indent + padding, textY);
+        D2D1_RECT_F bounds = D2D1::RectF(indent + padding, textY,
+                                         indent + padding + lineWidth, textY + lineHeight);
+        size_t lineRun = addTextRun(app, std::move(info), pos, bounds, app.theme.code,
+                                    lineDocStart, wline.length(), false);
 
         if (!wline.empty()) {
             D2D1_RECT_F lineBounds = D2D1::RectF(indent + padding, textY,
                 indent + padding + lineWidth, textY + lineHeight);
-            addTextRect(app, lineBounds, lineDocStart, wline.length());
+            addTextRect(app, lineBounds, lineDocStart, wline.length(), lineRun);
         }
 
         maxLineWidth = std::max(maxLineWidth, lineWidth);
         textY += lineHeight;
+        lineIndex++;
         if (lineEnd == wcode.length()) break;
         lineStart = lineEnd + 1;
     }
@@ -1445,8 +1890,8 @@ static void layoutCodeBlock(App& app, const ElementPtr& elem, float& y, float in
     y += blockHeight + 14 * scale;
 }
 
-static void layoutBlockquote(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
-    float scale = app.contentScale * app.zoomFactor;
+static void layoutBlockquote(App& app, const Element* elem, float& y, float indent, float maxWidth) {
+    float scale = layoutScale(app);
     float quoteIndent = 20.0f * scale;
     float startY = y;
 
@@ -1458,8 +1903,8 @@ static void layoutBlockquote(App& app, const ElementPtr& elem, float& y, float i
                                app.theme.blockquoteBorder});
 }
 
-static void layoutList(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
-    float scale = app.contentScale * app.zoomFactor;
+static void layoutList(App& app, const Element* elem, float& y, float indent, float maxWidth) {
+    float scale = layoutScale(app);
     float listIndent = 24.0f * scale;
     int itemNum = elem->start;
 
@@ -1487,7 +1932,7 @@ static void layoutList(App& app, const ElementPtr& elem, float& y, float indent,
 
         float itemStartY = y;
         if (hasBlockChildren) {
-            std::vector<ElementPtr> inlineElements, blockElements;
+            std::vector<Element*> inlineElements, blockElements;
             for (const auto& itemChild : child->children) {
                 if (itemChild->type == ElementType::Paragraph ||
                     itemChild->type == ElementType::List ||
@@ -1500,7 +1945,7 @@ static void layoutList(App& app, const ElementPtr& elem, float& y, float indent,
             }
 
             if (!inlineElements.empty()) {
-                layoutInlineContent(app, inlineElements, indent + listIndent, y,
+                layoutInlineContent(app, asList(inlineElements), indent + listIndent, y,
                     maxWidth - listIndent, app.textFormat, app.theme.text);
             }
 
@@ -1521,108 +1966,62 @@ static void layoutList(App& app, const ElementPtr& elem, float& y, float indent,
     y += 8 * scale;
 }
 
-static App::ImageEntry& getOrLoadImage(App& app, const std::string& src) {
+// Cached entry for src, queueing a background load on first use. The entry
+// stays pending until the loader posts WM_APP_IMAGE_READY.
+static App::ImageEntry& getOrLoadImage(App& app, const std::string& src,
+                                       float maxWidth, float maxHeight) {
     auto it = app.imageCache.find(src);
     if (it != app.imageCache.end()) return it->second;
 
-    App::ImageEntry entry;
-    entry.failed = true;  // assume failure
-
-    if (!app.wicFactory || !app.renderTarget) {
-        app.imageCache[src] = entry;
-        return app.imageCache[src];
+    auto& entry = app.imageCache[src];
+    if (!app.renderTarget) {
+        entry.failed = true;
+        return entry;
     }
 
-    std::wstring widePath;
-
-    // Check if URL
-    bool isUrl = (src.rfind("http://", 0) == 0 || src.rfind("https://", 0) == 0);
-    if (isUrl) {
-        // Download to temp file
-        wchar_t tempPath[MAX_PATH] = {};
-        std::wstring wideSrc = toWide(src);
-        HRESULT hr = URLDownloadToCacheFileW(nullptr, wideSrc.c_str(), tempPath, MAX_PATH, 0, nullptr);
-        if (FAILED(hr)) {
-            app.imageCache[src] = entry;
-            return app.imageCache[src];
-        }
-        widePath = tempPath;
+    entry.isUrl = (src.rfind("http://", 0) == 0 || src.rfind("https://", 0) == 0);
+    if (entry.isUrl || app.currentFile.empty()) {
+        entry.path = toWide(src);
     } else {
         // Resolve relative to current file's directory
-        std::wstring wsrc = toWide(src);
-        if (!app.currentFile.empty()) {
-            std::filesystem::path basePath(app.currentFile);
-            std::filesystem::path imgPath = basePath.parent_path() / src;
-            widePath = imgPath.wstring();
-        } else {
-            widePath = wsrc;
-        }
-    }
-
-    // Load via WIC
-    IWICBitmapDecoder* decoder = nullptr;
-    HRESULT hr = app.wicFactory->CreateDecoderFromFilename(widePath.c_str(), nullptr,
-        GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
-    if (FAILED(hr) || !decoder) {
-        app.imageCache[src] = entry;
-        return app.imageCache[src];
-    }
-
-    IWICBitmapFrameDecode* frame = nullptr;
-    hr = decoder->GetFrame(0, &frame);
-    if (FAILED(hr) || !frame) {
-        decoder->Release();
-        app.imageCache[src] = entry;
-        return app.imageCache[src];
-    }
-
-    IWICFormatConverter* converter = nullptr;
-    hr = app.wicFactory->CreateFormatConverter(&converter);
-    if (FAILED(hr) || !converter) {
-        frame->Release();
-        decoder->Release();
-        app.imageCache[src] = entry;
-        return app.imageCache[src];
-    }
-
-    hr = converter->Initialize(frame, GUID_WICPixelFormat32bppPBGRA,
-        WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom);
-    if (FAILED(hr)) {
-        converter->Release();
-        frame->Release();
-        decoder->Release();
-        app.imageCache[src] = entry;
-        return app.imageCache[src];
+        std::filesystem::path basePath(app.currentFile);
+        entry.path = (basePath.parent_path() / src).wstring();
     }
-
-    ID2D1Bitmap* bitmap = nullptr;
-    hr = app.renderTarget->CreateBitmapFromWicBitmap(converter, nullptr, &bitmap);
-    converter->Release();
-    frame->Release();
-    decoder->Release();
-
-    if (SUCCEEDED(hr) && bitmap) {
-        D2D1_SIZE_F size = bitmap->GetSize();
-        entry.bitmap = bitmap;
-        entry.width = (int)size.width;
-        entry.height = (int)size.height;
-        entry.failed = false;
-    }
-
-    app.imageCache[src] = entry;
-    return app.imageCache[src];
+    requestImage(app, src, maxWidth, maxHeight);
+    return entry;
 }
 
-static void layoutImage(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
-    auto& entry = getOrLoadImage(app, elem->url);
+static void layoutImage(App& app, const Element* elem, float& y, float indent, float maxWidth) {
+    float scale = layoutScale(app);
+    float maxHeight = 600.0f * scale;
+    std::string src(elem->url);
+    auto& entry = getOrLoadImage(app, src, maxWidth, maxHeight);
+    entry.lastUse = ++app.imageUseClock;
+
+    // Fit within maxWidth and the height cap, never upscaling
+    float fit = imageFitScale(entry.width, entry.height, maxWidth, maxHeight);
+    float displayW = entry.width * fit;
+    float displayH = entry.height * fit;
+
+    // Once the header is decoded, reserve the final box so the block does
+    // not move again when the pixels arrive
+    if (entry.pending) app.layoutBlockProvisional = true;
+    bool sizeKnown = entry.width > 0 && entry.height > 0;
+    if (entry.pending && sizeKnown && !entry.bitmap) {
+        D2D1_COLOR_F color = app.theme.text;
+        color.a = 0.06f;
+        app.layoutRects.push_back({D2D1::RectF(indent, y, indent + displayW, y + displayH), color});
+        y += displayH + 12 * scale;
+        return;
+    }
 
     if (entry.failed || !entry.bitmap) {
         // Render alt text as placeholder
         std::wstring altText = L"[image";
         std::wstring alt;
-        std::function<void(const ElementPtr&)> extract = [&](const ElementPtr& e) {
+        std::function<void(const Element*)> extract = [&](const Element* e) {
             if (!e) return;
-            if (e->type == ElementType::Text) alt += toWide(e->text);
+            if (e->type == ElementType::Text) alt += e->wtext;
             else for (const auto& c : e->children) extract(c);
         };
         for (const auto& c : elem->children) extract(c);
@@ -1645,20 +2044,12 @@ static void layoutImage(App& app, const ElementPtr& elem, float& y, float indent
         return;
     }
 
-    float scale = app.contentScale * app.zoomFactor;
-    float imgW = (float)entry.width;
-    float imgH = (float)entry.height;
-
-    // Scale to fit within maxWidth, never upscale
-    float displayScale = std::min(1.0f, maxWidth / imgW);
-    float displayW = imgW * displayScale;
-    float displayH = imgH * displayScale;
-
-    // Cap max height
-    float maxH = 600.0f * scale;
-    if (displayH > maxH) {
-        displayH = maxH;
-        displayW = displayH * (imgW / imgH);
+    // The bitmap was decoded for a smaller box (lower zoom, narrower window):
+    // decode again at the new size and stretch the current one meanwhile
+    if (!entry.pending && entry.pixelWidth < entry.width &&
+        displayW > entry.pixelWidth + 1.0f) {
+        requestImage(app, src, maxWidth, maxHeight);
+        app.layoutBlockProvisional = true;
     }
 
     app.layoutBitmaps.push_back({entry.bitmap,
@@ -1667,68 +2058,233 @@ static void layoutImage(App& app, const ElementPtr& elem, float& y, float indent
     y += displayH + 12 * scale;
 }
 
-static void layoutTable(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
-    float scale = app.contentScale * app.zoomFactor;
-    float cellPadding = 8.0f * scale;
-    float fontSize = app.textFormat->GetFontSize();
-    float lineHeight = fontSize * 1.7f;
-    float minColWidth = 40.0f * scale;
+constexpr size_t kTableCellWidthsMax = 1u << 18;
+constexpr size_t kParallelCellMeasure = 256;  // uncached cells worth extra threads
+constexpr unsigned kMaxMeasureThreads = 8;
+
+// Widen colWidths to every cell's natural (unwrapped) width. Cached widths
+// are reused; the rest are measured on worker threads when there are
+// enough of them. The DirectWrite factory is the shared one, which is
+// thread-safe, and text formats are immutable, so workers create and
+// measure their own layouts.
+static void measureTableColumns(App& app, const std::vector<const Element*>& rows,
+                                std::vector<float>& colWidths, float lineHeight,
+                                float extra) {
+    struct Job {
+        const Element* cell;
+        size_t column;
+        bool header;
+        uint64_t key;
+        float width;
+    };
+    std::vector<Job> jobs;
+    float scale = layoutScale(app);
+    for (size_t r = 0; r < rows.size(); r++) {
+        const auto& cells = rows[r]->children;
+        for (size_t c = 0; c < cells.size() && c < colWidths.size(); c++) {
+            uint64_t key = hashElement(cells[c]);
+            key = hashValue(key, r == 0);
+            key = hashValue(key, scale);
+            key = hashValue(key, app.currentThemeIndex);
+            auto it = app.tableCellWidths.find(key);
+            if (it != app.tableCellWidths.end()) {
+                colWidths[c] = std::max(colWidths[c], it->second + extra);
+            } else {
+                jobs.push_back({cells[c], c, r == 0, key, 0.0f});
+            }
+        }
+    }
+    if (jobs.empty()) return;
 
-    // Collect rows
-    std::vector<Element*> rows;
-    for (const auto& child : elem->children) {
-        if (child->type == ElementType::TableRow) {
-            rows.push_back(child.get());
+    auto measure = [&](Job& job) {
+        std::wstring text;
+        std::function<void(const Element*)> extract = [&](const Element* e) {
+            if (!e) return;
+            if (e->type == ElementType::Text) text += e->wtext;
+            else for (const auto& ch : e->children) extract(ch);
+        };
+        for (const auto& ch : job.cell->children) extract(ch);
+
+        IDWriteTextFormat* fmt = job.header ? app.boldFormat : app.textFormat;
+        if (text.empty() || !fmt) return;
+        IDWriteTextLayout* layout = nullptr;
+        app.dwriteFactory->CreateTextLayout(text.data(), (UINT32)text.length(),
+            fmt, kHugeWidth, lineHeight, &layout);
+        if (layout) {
+            DWRITE_TEXT_METRICS metrics{};
+            layout->GetMetrics(&metrics);
+            job.width = metrics.widthIncludingTrailingWhitespace;
+            layout->Release();
         }
+    };
+
+    unsigned threads = jobs.size() >= kParallelCellMeasure
+        ? std::clamp(std::thread::hardware_concurrency(), 1u, kMaxMeasureThreads)
+        : 1u;
+    if (threads > 1) {
+        std::atomic<size_t> next{0};
+        auto work = [&] {
+            for (size_t i = next++; i < jobs.size(); i = next++) measure(jobs[i]);
+        };
+        std::vector<std::thread> workers;
+        workers.reserve(threads - 1);
+        for (unsigned t = 1; t < threads; t++) workers.emplace_back(work);
+        work();
+        for (auto& worker : workers) worker.join();
+    } else {
+        for (auto& job : jobs) measure(job);
     }
-    if (rows.empty()) return;
 
-    // Determine column count
-    int colCount = elem->col_count;
-    if (colCount <= 0 && !rows.empty()) {
-        colCount = (int)rows[0]->children.size();
+    if (app.tableCellWidths.size() + jobs.size() > kTableCellWidthsMax) {
+        app.tableCellWidths.clear();
     }
-    if (colCount <= 0) return;
+    for (const auto& job : jobs) {
+        app.tableCellWidths[job.key] = job.width;
+        colWidths[job.column] = std::max(colWidths[job.column], job.width + extra);
+    }
+}
 
-    // Pass 1: Measure natural widths using plain text extraction (cheap, approximate)
-    std::vector<float> colWidths(colCount, minColWidth);
-    std::vector<float> rowHeights(rows.size(), lineHeight + cellPadding * 2);
-    std::vector<std::vector<int>> cellAligns(rows.size(), std::vector<int>(colCount, 0));
+// Whether the table being laid out has used up the current slice
+static bool tableSliceOver(const App& app, float y) {
+    const auto& slice = app.tableSlice;
+    if (slice.stopY >= 0.0f && y > slice.stopY) return true;
+    return slice.budgetUs > 0 && usElapsed(slice.start) > slice.budgetUs;
+}
 
-    for (size_t r = 0; r < rows.size(); r++) {
-        const auto& row = rows[r];
-        for (size_t c = 0; c < row->children.size() && c < (size_t)colCount; c++) {
+// Lay out rows from t.nextRow on, each cell once at its final column
+// width, the row as tall as its tallest cell. A top-level table stops
+// between rows once the slice is over (after at least one row). Returns
+// true when the table is finished.
+static bool layoutTableRows(App& app, App::TableLayout& t, float& y) {
+    float scale = layoutScale(app);
+    float cellPadding = 8.0f * scale;
+    float lineHeight = app.textFormat->GetFontSize() * 1.7f;
+    D2D1_COLOR_F borderColor = app.theme.blockquoteBorder;
+    float borderStroke = 1.0f * scale;
+    bool pausable = t.table && t.table == app.tableSlice.pausable;
+
+    float sliceTop = y;
+    size_t firstRow = t.nextRow;
+    std::vector<float> rowTops;
+    while (t.nextRow < t.rows.size()) {
+        if (pausable && t.nextRow > firstRow && tableSliceOver(app, y)) break;
+        size_t r = t.nextRow;
+        bool isHeader = (r == 0);
+        const auto& row = t.rows[r];
+        IDWriteTextFormat* fmt = isHeader ? app.boldFormat : app.textFormat;
+        D2D1_COLOR_F textColor = isHeader ? app.theme.heading : app.theme.text;
+        rowTops.push_back(y);
+
+        // Header row background, or a subtle one on alternating rows. Its
+        // bottom is known once the cells are laid out.
+        size_t background = SIZE_MAX;
+        if (isHeader || r % 2 == 0) {
+            D2D1_COLOR_F bg = app.theme.codeBackground;
+            bg.a = isHeader ? 0.5f : 0.15f;
+            background = app.layoutRects.size();
+            app.layoutRects.push_back({D2D1::RectF(t.indent, y, t.indent + t.totalWidth, y), bg});
+        }
+
+        float rowBottom = y + lineHeight + cellPadding * 2;
+        float cellX = t.indent;
+        for (size_t c = 0; c < row->children.size() && c < t.colWidths.size(); c++) {
             const auto& cell = row->children[c];
-            cellAligns[r][c] = cell->align;
-
-            // Extract plain text for width estimation
-            std::wstring text;
-            std::function<void(const ElementPtr&)> extract = [&](const ElementPtr& e) {
-                if (!e) return;
-                if (e->type == ElementType::Text) text += toWide(e->text);
-                else for (const auto& ch : e->children) extract(ch);
-            };
-            for (const auto& ch : cell->children) extract(ch);
-
-            // Measure natural width
-            bool isHeader = (r == 0);
-            IDWriteTextFormat* fmt = isHeader ? app.boldFormat : app.textFormat;
-            float textWidth = 0;
-            if (!text.empty() && fmt) {
-                IDWriteTextLayout* layout = nullptr;
-                app.dwriteFactory->CreateTextLayout(text.data(), (UINT32)text.length(),
-                    fmt, kHugeWidth, lineHeight, &layout);
-                if (layout) {
-                    DWRITE_TEXT_METRICS metrics{};
-                    layout->GetMetrics(&metrics);
-                    textWidth = metrics.widthIncludingTrailingWhitespace;
-                    layout->Release();
+            if (!cell->children.empty()) {
+                float cellW = t.colWidths[c] - cellPadding * 2;
+                float textX = cellX + cellPadding;
+                float textY = y + cellPadding;
+
+                int align = cell->align;
+                LayoutSnapshot cellSnap = takeSnapshot(app);
+
+                layoutInlineContent(app, cell->children, textX, textY, cellW,
+                                    fmt, textColor, {}, lineHeight);
+                rowBottom = std::max(rowBottom, textY + cellPadding);
+
+                // Apply center/right alignment by shifting all new items
+                if (align == 2 || align == 3) {
+                    float maxRight = 0.0f;
+                    for (size_t i = cellSnap.textRuns; i < app.layoutTextRuns.size(); i++) {
+                        maxRight = std::max(maxRight, app.layoutTextRuns[i].bounds.right);
+                    }
+                    float contentW = maxRight - textX;
+                    float dx = 0.0f;
+                    if (align == 2) { // center
+                        dx = (cellW - contentW) / 2.0f;
+                    } else { // right
+                        dx = cellW - contentW;
+                    }
+                    if (dx > 0.0f) {
+                        shiftLayoutItems(app, cellSnap, dx);
+                    }
                 }
             }
-            float needed = textWidth + cellPadding * 2 + 6.0f * scale;
-            if (needed > colWidths[c]) colWidths[c] = needed;
+
+            cellX += t.colWidths[c];
         }
+        if (background != SIZE_MAX) app.layoutRects[background].rect.bottom = rowBottom;
+        app.docText += L"\n";
+        y = rowBottom;
+        t.nextRow++;
+    }
+    bool finished = t.nextRow >= t.rows.size();
+
+    // Grid lines of the rows laid out in this slice: horizontal above each
+    // row (thicker after the header) and below the last, vertical down the
+    // slice
+    for (size_t i = 0; i < rowTops.size(); i++) {
+        float stroke = (firstRow + i == 1) ? borderStroke * 2 : borderStroke;
+        app.layoutLines.push_back({D2D1::Point2F(t.indent, rowTops[i]),
+                                   D2D1::Point2F(t.indent + t.totalWidth, rowTops[i]),
+                                   borderColor, stroke});
+    }
+    if (finished) {
+        float stroke = (t.rows.size() == 1) ? borderStroke * 2 : borderStroke;
+        app.layoutLines.push_back({D2D1::Point2F(t.indent, y),
+                                   D2D1::Point2F(t.indent + t.totalWidth, y),
+                                   borderColor, stroke});
+    }
+    float vx = t.indent;
+    for (size_t c = 0; c <= t.colWidths.size(); c++) {
+        app.layoutLines.push_back({D2D1::Point2F(vx, sliceTop),
+                                   D2D1::Point2F(vx, y),
+                                   borderColor, borderStroke});
+        if (c < t.colWidths.size()) vx += t.colWidths[c];
+    }
+
+    if (!finished) return false;
+    app.docText += L"\n";
+    y += 14 * scale;
+    return true;
+}
+
+static void layoutTable(App& app, const Element* elem, float& y, float indent, float maxWidth) {
+    float scale = layoutScale(app);
+    float cellPadding = 8.0f * scale;
+    float fontSize = app.textFormat->GetFontSize();
+    float lineHeight = fontSize * 1.7f;
+    float minColWidth = 40.0f * scale;
+
+    App::TableLayout t;
+    for (const auto& child : elem->children) {
+        if (child->type == ElementType::TableRow) {
+            t.rows.push_back(child);
+        }
+    }
+    if (t.rows.empty()) return;
+
+    // Determine column count
+    int colCount = elem->col_count;
+    if (colCount <= 0) {
+        colCount = (int)t.rows[0]->children.size();
     }
+    if (colCount <= 0) return;
+
+    // Natural widths from each cell's plain text (cheap, approximate)
+    auto& colWidths = t.colWidths;
+    colWidths.assign(colCount, minColWidth);
+    measureTableColumns(app, t.rows, colWidths, lineHeight,
+                        cellPadding * 2 + 6.0f * scale);
 
     // Distribute widths like a browser's auto table layout: columns whose
     // natural width is under their fair share keep it untouched; only the
@@ -1780,123 +2336,15 @@ static void layoutTable(App& app, const ElementPtr& elem, float& y, float indent
         app.contentWidth = std::max(app.contentWidth, indent + totalWidth);
     }
 
-    // Pass 1b: Measure row heights via layoutInlineContent with snapshot-rollback
-    for (size_t r = 0; r < rows.size(); r++) {
-        float maxRowH = lineHeight + cellPadding * 2;
-        bool isHeader = (r == 0);
-        IDWriteTextFormat* fmt = isHeader ? app.boldFormat : app.textFormat;
-        D2D1_COLOR_F textColor = isHeader ? app.theme.heading : app.theme.text;
-        const auto& row = rows[r];
-
-        for (size_t c = 0; c < row->children.size() && c < (size_t)colCount; c++) {
-            const auto& cell = row->children[c];
-            if (cell->children.empty()) continue;
-
-            float cellW = colWidths[c] - cellPadding * 2;
-            LayoutSnapshot snap = takeSnapshot(app);
-            float cellY = 0.0f;
-            layoutInlineContent(app, cell->children, 0.0f, cellY, cellW,
-                                fmt, textColor, {}, lineHeight);
-            rollbackTo(app, snap);
-
-            float h = cellY + cellPadding * 2;
-            if (h > maxRowH) maxRowH = h;
-        }
-        rowHeights[r] = maxRowH;
-    }
-
-    // Pass 2: Render cells via layoutInlineContent (produces real text runs, links, etc.)
-    float tableStartY = y;
-    D2D1_COLOR_F borderColor = app.theme.blockquoteBorder;
-    float borderStroke = 1.0f * scale;
-
-    for (size_t r = 0; r < rows.size(); r++) {
-        float cellX = indent;
-        bool isHeader = (r == 0);
-        const auto& row = rows[r];
-
-        // Header row background
-        if (isHeader) {
-            D2D1_COLOR_F headerBg = app.theme.codeBackground;
-            headerBg.a = 0.5f;
-            app.layoutRects.push_back({D2D1::RectF(indent, y, indent + totalWidth, y + rowHeights[r]), headerBg});
-        } else if (r % 2 == 0) {
-            // Subtle alternating row background
-            D2D1_COLOR_F altBg = app.theme.codeBackground;
-            altBg.a = 0.15f;
-            app.layoutRects.push_back({D2D1::RectF(indent, y, indent + totalWidth, y + rowHeights[r]), altBg});
-        }
-
-        for (size_t c = 0; c < row->children.size() && c < (size_t)colCount; c++) {
-            const auto& cell = row->children[c];
-            IDWriteTextFormat* fmt = isHeader ? app.boldFormat : app.textFormat;
-            D2D1_COLOR_F textColor = isHeader ? app.theme.heading : app.theme.text;
-
-            if (!cell->children.empty()) {
-                float cellW = colWidths[c] - cellPadding * 2;
-                float textX = cellX + cellPadding;
-                float textY = y + cellPadding;
-
-                int align = cellAligns[r][c];
-                LayoutSnapshot cellSnap = takeSnapshot(app);
-
-                layoutInlineContent(app, cell->children, textX, textY, cellW,
-                                    fmt, textColor, {}, lineHeight);
-
-                // Apply center/right alignment by shifting all new items
-                if (align == 2 || align == 3) {
-                    float maxRight = 0.0f;
-                    for (size_t i = cellSnap.textRuns; i < app.layoutTextRuns.size(); i++) {
-                        maxRight = std::max(maxRight, app.layoutTextRuns[i].bounds.right);
-                    }
-                    float contentW = maxRight - textX;
-                    float dx = 0.0f;
-                    if (align == 2) { // center
-                        dx = (cellW - contentW) / 2.0f;
-                    } else { // right
-                        dx = cellW - contentW;
-                    }
-                    if (dx > 0.0f) {
-                        shiftLayoutItems(app, cellSnap, dx);
-                    }
-                }
-            }
-
-            cellX += colWidths[c];
-        }
-        app.docText += L"\n";
-        y += rowHeights[r];
-    }
-
-    // Grid lines: horizontal
-    for (size_t r = 0; r <= rows.size(); r++) {
-        float lineY = tableStartY;
-        for (size_t i = 0; i < r; i++) lineY += rowHeights[i];
-        float stroke = (r == 1) ? borderStroke * 2 : borderStroke; // thicker after header
-        app.layoutLines.push_back({D2D1::Point2F(indent, lineY),
-                                   D2D1::Point2F(indent + totalWidth, lineY),
-                                   borderColor, stroke});
-    }
-
-    // Grid lines: vertical
-    {
-        float tableEndY = tableStartY;
-        for (size_t r = 0; r < rows.size(); r++) tableEndY += rowHeights[r];
-        float vx = indent;
-        for (int c = 0; c <= colCount; c++) {
-            app.layoutLines.push_back({D2D1::Point2F(vx, tableStartY),
-                                       D2D1::Point2F(vx, tableEndY),
-                                       borderColor, borderStroke});
-            if (c < colCount) vx += colWidths[c];
-        }
-    }
-
-    app.docText += L"\n";
-    y += 14 * scale;
+    t.table = elem;
+    t.indent = indent;
+    t.totalWidth = totalWidth;
+    t.top = y;
+    if (!layoutTableRows(app, t, y)) app.pendingTable = std::move(t);
 }
 
 static void layoutHorizontalRule(App& app, float& y, float indent, float maxWidth) {
-    float scale = app.contentScale * app.zoomFactor;
+    float scale = layoutScale(app);
     y += 16 * scale;
     app.layoutLines.push_back({D2D1::Point2F(indent, y),
                                D2D1::Point2F(indent + maxWidth, y),
@@ -1904,7 +2352,7 @@ static void layoutHorizontalRule(App& app, float& y, float indent, float maxWidt
     y += 16 * scale;
 }
 
-static void layoutElement(App& app, const ElementPtr& elem, float& y, float indent, float maxWidth) {
+static void layoutElement(App& app, const Element* elem, float& y, float indent, float maxWidth) {
     if (!elem) return;
 
     switch (elem->type) {
@@ -1919,15 +2367,18 @@ static void layoutElement(App& app, const ElementPtr& elem, float& y, float inde
             break;
         case ElementType::MermaidDiagram:
             if (!layoutMermaidDiagram(
-                    app, elem->text, elem->sourceOffset, y, indent, maxWidth)) {
+                    app, narrowText(elem->wtext), elem->sourceOffset, y, indent, maxWidth)) {
                 app.focusMermaidOnNextLayout = false;
-                auto fallback = std::make_shared<Element>(ElementType::CodeBlock);
-                auto text = std::make_shared<Element>(ElementType::Text);
-                text->text = elem->text;
-                text->parent = fallback.get();
-                fallback->children.push_back(std::move(text));
-                fallback->sourceOffset = elem->sourceOffset;
-                layoutCodeBlock(app, fallback, y, indent, maxWidth);
+                // Show the source as a plain code block; the stand-in nodes
+                // only need to outlive this call
+                Element fallback(ElementType::CodeBlock);
+                Element text(ElementType::Text);
+                text.wtext = elem->wtext;
+                text.parent = &fallback;
+                Element* fallbackChildren[] = {&text};
+                fallback.children = {fallbackChildren, 1, 1};
+                fallback.sourceOffset = elem->sourceOffset;
+                layoutCodeBlock(app, &fallback, y, indent, maxWidth);
             }
             break;
         case ElementType::BlockQuote:
@@ -1946,13 +2397,13 @@ static void layoutElement(App& app, const ElementPtr& elem, float& y, float inde
             // HtmlBlock can contain both block elements (Paragraph, List, etc.)
             // and inline elements (Text, Ruby, Link, etc.). Collect consecutive
             // inline children and render them through layoutInlineContent.
-            std::vector<ElementPtr> inlineBuffer;
+            std::vector<Element*> inlineBuffer;
             auto flushInline = [&]() {
                 if (!inlineBuffer.empty()) {
-                    layoutInlineContent(app, inlineBuffer, indent, y, maxWidth,
+                    layoutInlineContent(app, asList(inlineBuffer), indent, y, maxWidth,
                                         app.textFormat, app.theme.text);
                     app.docText += L"\n\n";
-                    float s = app.contentScale * app.zoomFactor;
+                    float s = layoutScale(app);
                     y += 14 * s;
                     inlineBuffer.clear();
                 }
@@ -1985,7 +2436,7 @@ static void layoutElement(App& app, const ElementPtr& elem, float& y, float inde
 }
 
 // Find first valid sourceOffset in an element subtree
-static size_t findFirstSourceOffset(const ElementPtr& elem) {
+static size_t findFirstSourceOffset(const Element* elem) {
     if (!elem) return SIZE_MAX;
     if (elem->sourceOffset != SIZE_MAX) return elem->sourceOffset;
     for (const auto& child : elem->children) {
@@ -1996,7 +2447,7 @@ static size_t findFirstSourceOffset(const ElementPtr& elem) {
 }
 
 // Count total elements in AST for vector pre-allocation
-static size_t countElements(const ElementPtr& elem) {
+static size_t countElements(const Element* elem) {
     if (!elem) return 0;
     size_t count = 1;
     for (const auto& child : elem->children) {
@@ -2009,21 +2460,347 @@ static size_t countElements(const ElementPtr& elem) {
 
 namespace {
 
+// Everything outside the document that block layout depends on. A resize,
+// zoom or theme switch changes it and forces a full relayout.
+static uint64_t layoutParamsKey(const App& app) {
+    uint64_t h = kFnvOffset;
+    h = hashValue(h, documentViewportWidth(app));
+    h = hashValue(h, app.contentScale);
+    h = hashValue(h, app.appliedZoomFactor);
+    h = hashValue(h, app.currentThemeIndex);
+    return h;
+}
+
+// Current size of every layout vector, i.e. where the next block starts
+static App::LayoutBlock blockStartHere(const App& app) {
+    App::LayoutBlock b;
+    b.textRuns = app.layoutTextRuns.size();
+    b.rects = app.layoutRects.size();
+    b.lines = app.layoutLines.size();
+    b.shapes = app.layoutShapes.size();
+    b.connectors = app.layoutConnectors.size();
+    b.diagrams = app.layoutDiagrams.size();
+    b.bitmaps = app.layoutBitmaps.size();
+    b.links = app.linkRects.size();
+    b.codeBlocks = app.codeBlocks.size();
+    b.textRects = app.textRects.size();
+    b.lineBuckets = app.lineBuckets.size();
+    b.headings = app.headings.size();
+    b.anchors = app.scrollAnchors.size();
+    b.docText = app.docText.size();
+    return b;
+}
+
+// Add the items emitted since `from` to the per-vector tile indices
+static void indexLayoutItems(App& app, const App::LayoutBlock& from) {
+    for (size_t i = from.textRuns; i < app.layoutTextRuns.size(); i++) {
+        const auto& r = app.layoutTextRuns[i].bounds;
+        app.textRunTiles.add(i, r.top, r.bottom);
+    }
+    for (size_t i = from.rects; i < app.layoutRects.size(); i++) {
+        const auto& r = app.layoutRects[i].rect;
+        app.rectTiles.add(i, r.top, r.bottom);
+    }
+    for (size_t i = from.lines; i < app.layoutLines.size(); i++) {
+        const auto& l = app.layoutLines[i];
+        app.lineTiles.add(i, l.p1.y, l.p2.y);
+    }
+    for (size_t i = from.shapes; i < app.layoutShapes.size(); i++) {
+        const auto& r = app.layoutShapes[i].rect;
+        app.shapeTiles.add(i, r.top, r.bottom);
+    }
+    for (size_t i = from.connectors; i < app.layoutConnectors.size(); i++) {
+        const auto& r = app.layoutConnectors[i].bounds;
+        app.connectorTiles.add(i, r.top, r.bottom);
+    }
+    for (size_t i = from.diagrams; i < app.layoutDiagrams.size(); i++) {
+        const auto& r = app.layoutDiagrams[i].bounds;
+        app.diagramTiles.add(i, r.top, r.bottom);
+    }
+    for (size_t i = from.bitmaps; i < app.layoutBitmaps.size(); i++) {
+        const auto& r = app.layoutBitmaps[i].destRect;
+        app.bitmapTiles.add(i, r.top, r.bottom);
+    }
+    for (size_t i = from.textRects; i < app.textRects.size(); i++) {
+        const auto& r = app.textRects[i].rect;
+        app.textRectTiles.add(i, r.top, r.bottom);
+    }
+}
+
+template <typename T>
+static void moveTail(std::vector<T>& from, size_t start, std::vector<T>& to) {
+    if (start >= from.size()) return;
+    to.assign(std::make_move_iterator(from.begin() + start),
+              std::make_move_iterator(from.end()));
+    from.resize(start);
+}
+
+// Drop the layout of blocks [keep, end). Items of blocks [tailStart, end)
+// are moved into app.layoutReuse instead of being released, so layoutStep
+// can splice them back in after the changed blocks.
+static void truncateBlocks(App& app, size_t keep, size_t tailStart) {
+    auto& blocks = app.layoutBlocks;
+    auto& reuse = app.layoutReuse;
+    bool dropMiddle = keep < blocks.size();
+    App::LayoutBlock keepStart = dropMiddle ? blocks[keep] : App::LayoutBlock{};
+    float resumeY = dropMiddle ? keepStart.top : app.layoutCursorY;
+
+    if (tailStart < blocks.size()) {
+        const App::LayoutBlock t = blocks[tailStart];
+        reuse.bottom = app.layoutCursorY;
+        moveTail(app.layoutTextRuns, t.textRuns, reuse.textRuns);
+        moveTail(app.layoutRects, t.rects, reuse.rects);
+        moveTail(app.layoutLines, t.lines, reuse.lines);
+        moveTail(app.layoutShapes, t.shapes, reuse.shapes);
+        moveTail(app.layoutConnectors, t.connectors, reuse.connectors);
+        moveTail(app.layoutDiagrams, t.diagrams, reuse.diagrams);
+        moveTail(app.layoutBitmaps, t.bitmaps, reuse.bitmaps);
+        moveTail(app.linkRects, t.links, reuse.links);
+        moveTail(app.codeBlocks, t.codeBlocks, reuse.codeBlocks);
+        moveTail(app.textRects, t.textRects, reuse.textRects);
+        moveTail(app.lineBuckets, t.lineBuckets, reuse.lineBuckets);
+        moveTail(app.headings, t.headings, reuse.headings);
+        moveTail(app.scrollAnchors, t.anchors, reuse.anchors);
+        reuse.docText = app.docText.substr(t.docText);
+        app.docText.resize(t.docText);
+        moveTail(blocks, tailStart, reuse.blocks);
+    }
+
+    if (dropMiddle) {
+        for (size_t i = keepStart.textRuns; i < app.layoutTextRuns.size(); i++) {
+            if (app.layoutTextRuns[i].layout) {
+                app.layoutTextRuns[i].layout->Release();
+            }
+        }
+        app.layoutTextRuns.resize(keepStart.textRuns);
+        app.layoutRects.resize(keepStart.rects);
+        app.layoutLines.resize(keepStart.lines);
+        app.layoutShapes.resize(keepStart.shapes);
+        app.layoutConnectors.resize(keepStart.connectors);
+        app.layoutDiagrams.resize(keepStart.diagrams);
+        app.layoutBitmaps.resize(keepStart.bitmaps);
+        app.linkRects.resize(keepStart.links);
+        app.codeBlocks.resize(keepStart.codeBlocks);
+        app.textRects.resize(keepStart.textRects);
+        app.lineBuckets.resize(keepStart.lineBuckets);
+        app.headings.resize(keepStart.headings);
+        app.scrollAnchors.resize(keepStart.anchors);
+        app.docText.resize(keepStart.docText);
+        blocks.resize(keep);
+    }
+    app.layoutCursorY = resumeY;
+
+    // Tile ranges may point past the truncated vectors; rebuild over what's left
+    app.clearTileIndex();
+    indexLayoutItems(app, App::LayoutBlock{});
+
+    // Duplicate-heading slug numbering continues from the kept headings
+    app.headingSlugCounts.clear();
+    for (const auto& h : app.headings) {
+        app.headingSlugCounts[slugifyHeading(h.text)]++;
+    }
+}
+
+// Diff the new top-level blocks against the records of the previous layout:
+// a leading run must match in hash and source offset, a trailing run in
+// hash only (its offsets moved by the edit). A block laid out around a
+// pending image placeholder never counts as unchanged. Returns true when
+// anything was kept, leaving layoutNextBlock at the first block that needs
+// laying out.
+static bool reuseUnchangedBlocks(App& app, uint64_t paramsKey) {
+    const auto& children = app.root->children;
+    const auto& old = app.layoutBlocks;
+    if (!app.layoutComplete || old.empty() || children.empty() ||
+        paramsKey != app.layoutBlocksKey || app.focusMermaidOnNextLayout) {
+        return false;
+    }
+
+    size_t limit = std::min(old.size(), children.size());
+    size_t prefix = 0;
+    while (prefix < limit &&
+           !old[prefix].provisional &&
+           old[prefix].sourceOffset == findFirstSourceOffset(children[prefix]) &&
+           old[prefix].hash == hashElement(children[prefix])) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < limit - prefix &&
+           !old[old.size() - 1 - suffix].provisional &&
+           old[old.size() - 1 - suffix].hash ==
+               hashElement(children[children.size() - 1 - suffix])) {
+        suffix++;
+    }
+    if (prefix == 0 && suffix == 0) return false;
+
+    // Tiles above the first changed block still show what will be drawn
+    app.invalidateDocumentTiles(prefix < old.size() ? old[prefix].top : app.layoutCursorY);
+    app.clearReusedLayout();
+    float contentRight = documentViewportWidth(app);
+    for (size_t i = 0; i < old.size(); i++) {
+        if (i < prefix || i >= old.size() - suffix) {
+            contentRight = std::max(contentRight, old[i].contentRight);
+        }
+    }
+    truncateBlocks(app, prefix, old.size() - suffix);
+    if (suffix > 0) app.layoutReuse.firstNewBlock = children.size() - suffix;
+
+    // Search results in the kept prefix stay valid
+    truncateSearch(app, app.docText.size());
+    app.contentWidth = contentRight;
+    app.layoutNextBlock = prefix;
+    return true;
+}
+
+// Append the stashed tail blocks at y, shifting their geometry and docText
+// positions by where they now start, and their source offsets by the edit
+static void spliceReusedBlocks(App& app, float& y) {
+    auto& reuse = app.layoutReuse;
+    const auto& children = app.root->children;
+    if (reuse.blocks.empty()) {
+        app.clearReusedLayout();
+        return;
+    }
+
+    const App::LayoutBlock first = reuse.blocks.front();
+    const App::LayoutBlock base = blockStartHere(app);
+    float dy = y - first.top;
+    auto shiftRect = [dy](D2D1_RECT_F& r) { r.top += dy; r.bottom += dy; };
+    auto shiftDoc = [&](uint32_t pos) { return (uint32_t)(pos - first.docText + base.docText); };
+
+    for (auto& r : reuse.textRuns) {
+        r.pos.y += dy;
+        shiftRect(r.bounds);
+        r.docStart = shiftDoc(r.docStart);
+        app.layoutTextRuns.push_back(r);
+    }
+    reuse.textRuns.clear();  // the layouts are owned by layoutTextRuns again
+    for (auto& r : reuse.rects) {
+        shiftRect(r.rect);
+        app.layoutRects.push_back(r);
+    }
+    for (auto& l : reuse.lines) {
+        l.p1.y += dy;
+        l.p2.y += dy;
+        app.layoutLines.push_back(l);
+    }
+    for (auto& shape : reuse.shapes) {
+        shiftRect(shape.rect);
+        app.layoutShapes.push_back(shape);
+    }
+    for (auto& connector : reuse.connectors) {
+        shiftRect(connector.bounds);
+        for (auto& point : connector.points) point.y += dy;
+        app.layoutConnectors.push_back(std::move(connector));
+    }
+    for (auto& diagram : reuse.diagrams) {
+        shiftRect(diagram.bounds);
+        diagram.origin.y += dy;
+        app.layoutDiagrams.push_back(std::move(diagram));
+    }
+    for (auto& b : reuse.bitmaps) {
+        shiftRect(b.destRect);
+        app.layoutBitmaps.push_back(b);
+    }
+    for (auto& l : reuse.links) {
+        shiftRect(l.bounds);
+        app.linkRects.push_back(std::move(l));
+    }
+    for (auto& cb : reuse.codeBlocks) {
+        shiftRect(cb.bounds);
+        app.codeBlocks.push_back(std::move(cb));
+    }
+    for (auto& tr : reuse.textRects) {
+        shiftRect(tr.rect);
+        tr.docStart = shiftDoc(tr.docStart);
+        if (tr.textRun != UINT32_MAX) {
+            tr.textRun = (uint32_t)(tr.textRun - first.textRuns + base.textRuns);
+        }
+        app.textRects.push_back(tr);
+    }
+    for (auto& bucket : reuse.lineBuckets) {
+        bucket.top += dy;
+        bucket.bottom += dy;
+        bucket.firstTextRect = (uint32_t)(bucket.firstTextRect - first.textRects + base.textRects);
+        app.lineBuckets.push_back(bucket);
+    }
+    for (auto& h : reuse.headings) {
+        h.y += dy;
+        h.id = nextHeadingId(app.headingSlugCounts, h.text);
+        app.headings.push_back(std::move(h));
+    }
+    app.docText += reuse.docText;
+    indexLayoutItems(app, base);
+
+    // Rebase the block records onto the live vectors; scroll anchors move
+    // with their block's source offset
+    size_t newIndex = reuse.firstNewBlock;
+    for (size_t i = 0; i < reuse.blocks.size(); i++, newIndex++) {
+        App::LayoutBlock b = reuse.blocks[i];
+        size_t anchorEnd = (i + 1 < reuse.blocks.size())
+            ? reuse.blocks[i + 1].anchors
+            : first.anchors + reuse.anchors.size();
+        size_t newOffset = findFirstSourceOffset(children[newIndex]);
+        for (size_t a = b.anchors; a < anchorEnd; a++) {
+            auto anchor = reuse.anchors[a - first.anchors];
+            if (b.sourceOffset != SIZE_MAX && newOffset != SIZE_MAX) {
+                anchor.sourceOffset = anchor.sourceOffset - b.sourceOffset + newOffset;
+            }
+            anchor.renderedY += dy;
+            app.scrollAnchors.push_back(anchor);
+        }
+
+        b.sourceOffset = newOffset;
+        b.top += dy;
+        b.bottom += dy;
+        b.textRuns = b.textRuns - first.textRuns + base.textRuns;
+        b.rects = b.rects - first.rects + base.rects;
+        b.lines = b.lines - first.lines + base.lines;
+        b.shapes = b.shapes - first.shapes + base.shapes;
+        b.connectors = b.connectors - first.connectors + base.connectors;
+        b.diagrams = b.diagrams - first.diagrams + base.diagrams;
+        b.bitmaps = b.bitmaps - first.bitmaps + base.bitmaps;
+        b.links = b.links - first.links + base.links;
+        b.codeBlocks = b.codeBlocks - first.codeBlocks + base.codeBlocks;
+        b.textRects = b.textRects - first.textRects + base.textRects;
+        b.lineBuckets = b.lineBuckets - first.lineBuckets + base.lineBuckets;
+        b.headings = b.headings - first.headings + base.headings;
+        b.anchors = b.anchors - first.anchors + base.anchors;
+        b.docText = b.docText - first.docText + base.docText;
+        app.layoutBlocks.push_back(b);
+    }
+
+    y = reuse.bottom + dy;
+    app.layoutNextBlock = reuse.firstNewBlock + reuse.blocks.size();
+    app.clearReusedLayout();
+}
+
 // Reset layout state and prepare for laying out blocks. Returns false when
 // there is nothing to lay out (no document).
 bool layoutBegin(App& app) {
-    app.clearLayoutCache();
     app.layoutTimeUs = 0;
+    app.layoutHeightsBelow.clear();
 
     if (!app.root) {
+        app.clearLayoutCache();
         app.contentHeight = 0;
         app.contentWidth = app.width;
         app.layoutComplete = true;
         return false;
     }
 
+    // Reparse of the same document (edit, file-watch reload): keep the
+    // blocks that did not change and lay out only the rest
+    uint64_t paramsKey = layoutParamsKey(app);
+    if (reuseUnchangedBlocks(app, paramsKey)) {
+        app.layoutComplete = false;
+        return true;
+    }
+
+    app.clearLayoutCache();
+    truncateSearch(app, 0);
+
     // Pre-allocate vectors based on estimated element count
-    size_t elemCount = countElements(app.root);
+    size_t elemCount = countElements(app.root.get());
     app.layoutTextRuns.reserve(elemCount * 2);
     app.layoutRects.reserve(elemCount);
     app.layoutLines.reserve(elemCount);
@@ -2033,8 +2810,9 @@ bool layoutBegin(App& app) {
     app.textRects.reserve(elemCount * 2);
     app.lineBuckets.reserve(elemCount);
     app.docText.reserve(elemCount * 20);  // ~20 chars per element average
+    app.layoutBlocks.reserve(app.root->children.size());
 
-    float scale = app.contentScale * app.zoomFactor;
+    float scale = layoutScale(app);
 
     float layoutWidth = documentViewportWidth(app);
 
@@ -2043,45 +2821,361 @@ bool layoutBegin(App& app) {
     app.layoutCursorY = 20.0f * scale;
     app.layoutNextBlock = 0;
     app.layoutComplete = false;
+    app.layoutBlocksKey = paramsKey;
+    app.layoutBlocksScale = scale;
     app.contentWidth = layoutWidth;
     app.scrollAnchors.clear();
     return true;
 }
 
-// Lay out top-level blocks until targetY is passed (targetY < 0: no limit) or
-// budgetUs is exhausted (budgetUs <= 0: no limit). Returns true when all
-// blocks are done.
-bool layoutStep(App& app, float targetY, int64_t budgetUs) {
+// Lay out top-level blocks from layoutNextBlock up to endBlock, until
+// targetY is passed (targetY < 0: no limit) or budgetUs is exhausted
+// (budgetUs <= 0: no limit)
+static void layoutBlocksUntil(App& app, size_t endBlock, float targetY, int64_t budgetUs) {
     auto t0 = Clock::now();
     const auto& children = app.root->children;
+    endBlock = std::min(endBlock, children.size());
     float y = app.layoutCursorY;
+    float baseWidth = documentViewportWidth(app);
 
-    while (app.layoutNextBlock < children.size()) {
+    while (app.layoutNextBlock < endBlock) {
+        if (app.layoutNextBlock == app.layoutReuse.firstNewBlock) {
+            spliceReusedBlocks(app, y);
+            break;
+        }
         if (targetY >= 0.0f && y > targetY) break;
         if (budgetUs > 0 && usElapsed(t0) > budgetUs) break;
 
         const auto& child = children[app.layoutNextBlock];
-        // Record scroll anchor from source offset
-        size_t offset = findFirstSourceOffset(child);
-        if (offset != SIZE_MAX) {
-            app.scrollAnchors.push_back({offset, y});
+        const App::LayoutBlock slice = blockStartHere(app);
+        // A top-level table may stop between rows when this slice is over
+        // (not while viewport-first blocks wait to be spliced in)
+        app.tableSlice = {
+            app.layoutAside.pending ? nullptr : child, targetY, budgetUs, t0};
+        float widthSoFar = app.contentWidth;
+        App::LayoutBlock block;
+        if (app.pendingTable.table == child) {
+            // A table paused in the previous slice: carry on from its next row
+            block = app.pendingTableBlock;
+            app.contentWidth = block.contentRight;
+            app.layoutBlockProvisional = block.provisional;
+            if (layoutTableRows(app, app.pendingTable, y)) app.pendingTable = App::TableLayout{};
+        } else {
+            block = slice;
+            block.hash = hashElement(child);
+            block.top = y;
+            // Record scroll anchor from source offset
+            size_t offset = findFirstSourceOffset(child);
+            block.sourceOffset = offset;
+            if (offset != SIZE_MAX) {
+                app.scrollAnchors.push_back({offset, y});
+            }
+            // Measure this block's own horizontal extent so a later partial
+            // relayout can recompute contentWidth without it
+            app.contentWidth = baseWidth;
+            app.layoutBlockProvisional = false;
+            layoutElement(app, child, y, app.layoutIndent, app.layoutMaxWidth);
         }
-        layoutElement(app, child, y, app.layoutIndent, app.layoutMaxWidth);
+        app.tableSlice = App::TableSlice{};
+        block.provisional = app.layoutBlockProvisional;
+        block.bottom = y;
+        block.contentRight = app.contentWidth;
+        app.contentWidth = std::max(widthSoFar, block.contentRight);
+        indexLayoutItems(app, slice);
+        if (app.pendingTable.table == child) {
+            app.pendingTableBlock = block;
+            break;
+        }
+        app.layoutBlocks.push_back(block);
         app.layoutNextBlock++;
     }
 
     app.layoutCursorY = y;
-    // Partial content height grows as layout fills in (keeps scrollbar sane)
-    float scale = app.contentScale * app.zoomFactor;
-    app.contentHeight = y + 40.0f * scale;
-    return app.layoutNextBlock >= children.size();
+}
+
+// Lay out top-level blocks until targetY is passed (targetY < 0: no limit) or
+// budgetUs is exhausted (budgetUs <= 0: no limit). Returns true when all
+// blocks are done.
+bool layoutStep(App& app, float targetY, int64_t budgetUs) {
+    layoutBlocksUntil(app, SIZE_MAX, targetY, budgetUs);
+    // Partial content height grows as layout fills in (keeps scrollbar sane).
+    // The rows of a paused table count at the average height so far, and
+    // after a viewport-first layout the blocks below at their estimate.
+    float scale = layoutScale(app);
+    float pendingRows = 0.0f;
+    const auto& table = app.pendingTable;
+    if (table.table && table.nextRow > 0) {
+        float average = (app.layoutCursorY - table.top) / (float)table.nextRow;
+        pendingRows = average * (float)(table.rows.size() - table.nextRow);
+    }
+    float below = 0.0f;
+    const auto& heightsBelow = app.layoutHeightsBelow;
+    if (!heightsBelow.empty()) {
+        size_t next = app.layoutNextBlock + (table.table ? 1 : 0);
+        below = heightsBelow[std::min(next, heightsBelow.size() - 1)];
+    }
+    app.contentHeight = app.layoutCursorY + pendingRows + below + 40.0f * scale;
+    advanceSearch(app);
+    return app.layoutNextBlock >= app.root->children.size();
 }
 
 void layoutFinish(App& app) {
-    // Defer toLower to when search actually needs it (lazy rebuild)
-    app.docTextLower.clear();
-    mapSearchMatchesToLayout(app);
     app.layoutComplete = true;
+    // Measured now: the cached heights have nothing left to estimate
+    app.layoutSeed = App::LayoutSeed();
+    app.layoutHeightsBelow = {};
+    // The end of the text is final now: settle regex matches held back there
+    advanceSearch(app);
+    mapSearchMatchesToLayout(app);
+}
+
+// --- Laying out from the middle of the document ---
+
+// Heights of the blocks of the layout about to be replaced, or of a
+// document reopened from the cache, by content hash, scaled when the zoom
+// changed. A different width or theme makes them estimates rather than
+// measurements, which is all they are used as.
+struct BlockHeights {
+    std::unordered_map<uint64_t, float> byHash;
+    float ratio = 1.0f;
+};
+
+static BlockHeights previousBlockHeights(const App& app) {
+    BlockHeights heights;
+    float scale = layoutScale(app);
+    if (app.layoutBlocksScale > 0.0f) heights.ratio = scale / app.layoutBlocksScale;
+    for (const auto* blocks : {&app.layoutBlocks, &app.layoutAside.layout.blocks}) {
+        for (const auto& b : *blocks) heights.byHash.emplace(b.hash, b.bottom - b.top);
+    }
+    // A document reopened from the cache: its heights were saved at their
+    // own scale, stored here so that the common ratio rescales them right
+    const auto& seed = app.layoutSeed;
+    if (seed.scale > 0.0f && heights.ratio > 0.0f) {
+        float seedRatio = scale / seed.scale / heights.ratio;
+        for (const auto& [hash, height] : seed.blockHeights) {
+            heights.byHash.emplace(hash, height * seedRatio);
+        }
+    }
+    return heights;
+}
+
+struct TextAmount {
+    size_t chars = 0;
+    size_t lineBreaks = 0;
+    size_t paragraphs = 0;  // paragraphs, list items, rows: each starts a line
+    size_t images = 0;
+};
+
+static void measureTextAmount(const Element* elem, TextAmount& amount) {
+    if (!elem) return;
+    amount.chars += elem->wtext.size();
+    switch (elem->type) {
+        case ElementType::Paragraph:
+        case ElementType::Heading:
+        case ElementType::ListItem:
+        case ElementType::TableRow:
+        case ElementType::CodeBlock:
+            amount.paragraphs++;
+            break;
+        case ElementType::HardBreak:
+            amount.lineBreaks++;
+            break;
+        case ElementType::Image:
+            amount.images++;
+            break;
+        default:
+            break;
+    }
+    if (elem->type == ElementType::Text && elem->parent &&
+        elem->parent->type == ElementType::CodeBlock) {
+        amount.lineBreaks += std::count(elem->wtext.begin(), elem->wtext.end(), L'\n');
+    }
+    for (const auto& child : elem->children) measureTextAmount(child, amount);
+}
+
+// How tall a block will probably be before it is laid out: as tall as the
+// same block was last time, else a guess from how much text it holds at
+// the body font's line height and average glyph width
+static float estimateBlockHeight(const App& app, const Element* elem,
+                                 const BlockHeights& heights) {
+    auto it = heights.byHash.find(hashElement(elem));
+    if (it != heights.byHash.end()) return it->second * heights.ratio;
+
+    float scale = layoutScale(app);
+    if (elem->type == ElementType::HorizontalRule) return 32.0f * scale;
+    if (elem->type == ElementType::MermaidDiagram) return 320.0f * scale;
+
+    TextAmount amount;
+    measureTextAmount(elem, amount);
+    float lineHeight = 24.0f * scale;
+    if (elem->type == ElementType::CodeBlock) {
+        return (float)(amount.lineBreaks + 1) * 20.0f * scale + 40.0f * scale;
+    }
+    float charsPerLine = std::max(1.0f, app.layoutMaxWidth / (8.0f * scale));
+    float lines = std::ceil((float)amount.chars / charsPerLine) + (float)amount.lineBreaks;
+    lines = std::max(lines, (float)std::max<size_t>(amount.paragraphs, 1));
+    if (elem->type == ElementType::Heading) lines *= 1.5f;
+    return lines * lineHeight + (float)amount.paragraphs * 14.0f * scale +
+           (float)amount.images * 200.0f * scale;
+}
+
+// Visit the TOC headings of a subtree in the order layoutHeading records
+// them, numbering their ids with the same counter. Stops when visit
+// returns true and returns whether it did.
+template <typename Visit>
+static bool visitHeadingIds(const Element* elem, std::unordered_map<std::string, int>& counts,
+                            Visit&& visit) {
+    if (!elem) return false;
+    if (elem->type == ElementType::Heading) {
+        return elem->level <= 3 && visit(nextHeadingId(counts, headingPlainText(elem)));
+    }
+    for (const auto& child : elem->children) {
+        if (visitHeadingIds(child, counts, visit)) return true;
+    }
+    return false;
+}
+
+// Lay out from block `first`, placed at its estimated top, through
+// targetY, leaving the blocks above to layoutAboveViewport and giving the
+// scrollbar an estimate of the blocks below. Returns false without doing
+// anything when the block is so close to the top that laying out
+// everything above it first costs little anyway.
+static bool layoutViewportBlocks(App& app, size_t first, float top, float targetY,
+                                 const BlockHeights& heights) {
+    if (first == 0 || top < (float)app.height) return false;
+    const auto& children = app.root->children;
+
+    auto& aside = app.layoutAside;
+    aside.pending = true;
+    aside.nextBlock = 0;
+    aside.endBlock = first;
+    aside.cursorY = app.layoutCursorY;
+
+    // Duplicate headings in the viewport blocks are numbered after the
+    // ones above them, as they will be once those are laid out
+    for (size_t i = 0; i < first; i++) {
+        visitHeadingIds(children[i], app.headingSlugCounts, [](const std::string&) { return false; });
+    }
+
+    app.layoutNextBlock = first;
+    app.layoutCursorY = top;
+    layoutBlocksUntil(app, SIZE_MAX, targetY, -1);
+
+    // Kept for layoutStep until the blocks below are laid out in turn
+    auto& below = app.layoutHeightsBelow;
+    below.assign(children.size() + 1, 0.0f);
+    for (size_t i = children.size(); i-- > app.layoutNextBlock;) {
+        below[i] = below[i + 1] + estimateBlockHeight(app, children[i], heights);
+    }
+    float scale = layoutScale(app);
+    app.contentHeight = app.layoutCursorY + below[app.layoutNextBlock] + 40.0f * scale;
+    return true;
+}
+
+// The viewport blocks under the current scroll position, estimated from
+// the top margin down
+static bool layoutFromScrollPosition(App& app, const BlockHeights& heights) {
+    const auto& children = app.root->children;
+    std::vector<float> estimates(children.size());
+    float total = app.layoutCursorY;
+    for (size_t i = 0; i < children.size(); i++) {
+        estimates[i] = estimateBlockHeight(app, children[i], heights);
+        total += estimates[i];
+    }
+    // Estimated shorter than the old scroll position: show its end
+    float maxScroll = std::max(0.0f, total - (float)app.height);
+    if (app.scrollY > maxScroll) {
+        app.scrollY = maxScroll;
+        app.targetScrollY = std::min(app.targetScrollY, maxScroll);
+    }
+
+    float top = app.layoutCursorY;
+    size_t first = 0;
+    for (; first + 1 < children.size(); first++) {
+        if (top + estimates[first] > app.scrollY) break;
+        top += estimates[first];
+    }
+    return layoutViewportBlocks(app, first, top, app.scrollY + (float)app.height * 2.0f, heights);
+}
+
+// Swap the live layout with the blocks being laid out above the viewport
+// blocks. Layout code only ever appends to the live vectors, so between
+// two swaps it lays out the blocks above without disturbing what is drawn.
+static void swapLayoutAside(App& app) {
+    auto& aside = app.layoutAside;
+    auto& l = aside.layout;
+    std::swap(app.layoutTextRuns, l.textRuns);
+    std::swap(app.layoutRects, l.rects);
+    std::swap(app.layoutLines, l.lines);
+    std::swap(app.layoutShapes, l.shapes);
+    std::swap(app.layoutConnectors, l.connectors);
+    std::swap(app.layoutDiagrams, l.diagrams);
+    std::swap(app.layoutBitmaps, l.bitmaps);
+    std::swap(app.linkRects, l.links);
+    std::swap(app.codeBlocks, l.codeBlocks);
+    std::swap(app.textRects, l.textRects);
+    std::swap(app.lineBuckets, l.lineBuckets);
+    std::swap(app.headings, l.headings);
+    std::swap(app.scrollAnchors, l.anchors);
+    std::swap(app.docText, l.docText);
+    std::swap(app.layoutBlocks, l.blocks);
+    std::swap(app.textRunTiles, aside.textRunTiles);
+    std::swap(app.rectTiles, aside.rectTiles);
+    std::swap(app.lineTiles, aside.lineTiles);
+    std::swap(app.shapeTiles, aside.shapeTiles);
+    std::swap(app.connectorTiles, aside.connectorTiles);
+    std::swap(app.diagramTiles, aside.diagramTiles);
+    std::swap(app.bitmapTiles, aside.bitmapTiles);
+    std::swap(app.textRectTiles, aside.textRectTiles);
+    std::swap(app.headingSlugCounts, aside.headingSlugCounts);
+    std::swap(app.layoutNextBlock, aside.nextBlock);
+    std::swap(app.layoutCursorY, aside.cursorY);
+}
+
+// Lay out the blocks above the viewport blocks for at most budgetUs. Once
+// they reach them, splice the viewport blocks in after them and move the
+// scroll position by however far their estimated top was off, so what is
+// on screen does not jump. Returns true once spliced.
+static bool layoutAboveViewport(App& app, int64_t budgetUs) {
+    auto& aside = app.layoutAside;
+    swapLayoutAside(app);
+    layoutBlocksUntil(app, aside.endBlock, -1.0f, budgetUs);
+    if (app.layoutNextBlock < aside.endBlock) {
+        swapLayoutAside(app);
+        return false;
+    }
+
+    // The viewport blocks are the aside now; hand them to the splice that
+    // also reattaches unchanged blocks after an edit
+    app.clearReusedLayout();
+    auto& reuse = app.layoutReuse;
+    reuse = std::move(aside.layout);
+    reuse.firstNewBlock = aside.endBlock;
+    reuse.bottom = aside.cursorY;
+    app.layoutAside = App::LayoutAside{};  // its tiles index the moved items; the splice reindexes
+
+    float y = app.layoutCursorY;
+    float dy = reuse.blocks.empty() ? 0.0f : y - reuse.blocks.front().top;
+    spliceReusedBlocks(app, y);
+    app.layoutCursorY = y;
+    app.scrollY = std::max(0.0f, app.scrollY + dy);
+    app.targetScrollY = std::max(0.0f, app.targetScrollY + dy);
+    app.contentHeight += dy;
+    // Matches so far were found in the viewport blocks' text alone, at
+    // offsets that all moved: search the whole text again
+    truncateSearch(app, 0);
+    return true;
+}
+
+// One slice of background layout: the blocks above viewport-first blocks
+// come first, then whatever is left below. Returns true when all are done.
+static bool layoutSlice(App& app, int64_t budgetUs) {
+    if (app.layoutAside.pending) {
+        if (!layoutAboveViewport(app, budgetUs)) return false;
+        // The budget went to the blocks above; the rest is for the next slice
+        if (budgetUs > 0) return false;
+    }
+    return layoutStep(app, -1.0f, budgetUs);
 }
 
 } // namespace
@@ -2098,12 +3192,23 @@ void layoutDocument(App& app) {
 
 void layoutDocumentViewportFirst(App& app) {
     auto t0 = Clock::now();
+    // Far enough down that laying out everything above the viewport would
+    // hold up the first frame: keep the outgoing layout's block heights to
+    // estimate where the viewport blocks start
+    bool deep = app.scrollY > (float)app.height * 2.0f;
+    BlockHeights heights;
+    if (deep) heights = previousBlockHeights(app);
     if (layoutBegin(app)) {
-        // Lay out through two viewports past the current scroll so the first
-        // frame presents immediately; the rest continues in chunks.
-        float targetY = app.scrollY + (float)app.height * 2.0f;
-        if (layoutStep(app, targetY, -1)) {
-            layoutFinish(app);
+        bool fresh = app.layoutNextBlock == 0 && app.layoutReuse.blocks.empty();
+        if (deep && fresh && layoutFromScrollPosition(app, heights)) {
+            // The blocks above fill in from WM_APP_LAYOUT_CHUNK
+        } else {
+            // Lay out through two viewports past the current scroll so the
+            // first frame presents immediately; the rest continues in chunks.
+            float targetY = app.scrollY + (float)app.height * 2.0f;
+            if (layoutStep(app, targetY, -1)) {
+                layoutFinish(app);
+            }
         }
     }
     app.layoutDirty = false;
@@ -2113,7 +3218,7 @@ void layoutDocumentViewportFirst(App& app) {
 bool layoutDocumentContinue(App& app, int64_t budgetUs) {
     if (app.layoutComplete) return true;
     auto t0 = Clock::now();
-    bool done = layoutStep(app, -1.0f, budgetUs);
+    bool done = layoutSlice(app, budgetUs);
     if (done) layoutFinish(app);
     app.layoutTimeUs += (size_t)usElapsed(t0);
     return done;
@@ -2126,8 +3231,365 @@ void ensureLayoutComplete(App& app) {
     }
     if (!app.layoutComplete) {
         auto t0 = Clock::now();
-        layoutStep(app, -1.0f, -1);
+        layoutSlice(app, -1);
         layoutFinish(app);
         app.layoutTimeUs += (size_t)usElapsed(t0);
     }
 }
+
+bool layoutFromHeading(App& app, const std::string& id) {
+    if (!app.root || app.layoutDirty || app.layoutComplete) return false;
+    const auto& children = app.root->children;
+
+    std::unordered_map<std::string, int> counts;
+    size_t block = 0;
+    for (; block < children.size(); block++) {
+        if (visitHeadingIds(children[block], counts,
+                            [&](const std::string& headingId) { return headingId == id; })) {
+            break;
+        }
+    }
+    if (block == children.size()) return false;
+
+    auto t0 = Clock::now();
+    BlockHeights heights = previousBlockHeights(app);
+    float scale = layoutScale(app);
+    float top = 20.0f * scale;  // layoutBegin's top margin
+    for (size_t i = 0; i < block; i++) top += estimateBlockHeight(app, children[i], heights);
+    if (block == 0 || top < (float)app.height) return false;
+
+    // Not yet laid out, so nothing of the current layout is given up that
+    // is not redone in the same background slices
+    if (!layoutBegin(app)) return false;
+    layoutViewportBlocks(app, block, top, top + (float)app.height * 2.0f, heights);
+    app.layoutTimeUs += (size_t)usElapsed(t0);
+    return true;
+}
+
+// --- Drawing ---
+
+namespace {
+
+// Path geometry of a diamond or hexagon of the given size at the origin.
+// Mermaid nodes mostly come in a handful of sizes, so the geometry is built
+// once per size instead of per shape per frame.
+static ID2D1PathGeometry* shapeGeometryFor(App& app, App::LayoutShapeType type,
+                                           float width, float height) {
+    // Sizes to 1/16 DIP: type in the top byte, 28 bits each for the sizes
+    auto quantize = [](float v) {
+        return (uint64_t)std::max(0.0f, std::min(v * 16.0f + 0.5f, 268435455.0f));
+    };
+    uint64_t key = ((uint64_t)type << 56) | (quantize(width) << 28) | quantize(height);
+    auto it = app.shapeGeometries.find(key);
+    if (it != app.shapeGeometries.end()) return it->second;
+    if (app.shapeGeometries.size() >= 1024) app.releaseShapeGeometries();
+
+    D2D1_POINT_2F diamond[] = {
+        D2D1::Point2F(width * 0.5f, 0.0f),
+        D2D1::Point2F(width, height * 0.5f),
+        D2D1::Point2F(width * 0.5f, height),
+        D2D1::Point2F(0.0f, height * 0.5f),
+    };
+    float inset = width * 0.18f;
+    D2D1_POINT_2F hexagon[] = {
+        D2D1::Point2F(inset, 0.0f),
+        D2D1::Point2F(width - inset, 0.0f),
+        D2D1::Point2F(width, height * 0.5f),
+        D2D1::Point2F(width - inset, height),
+        D2D1::Point2F(inset, height),
+        D2D1::Point2F(0.0f, height * 0.5f),
+    };
+    bool isDiamond = type == App::LayoutShapeType::Diamond;
+    const D2D1_POINT_2F* points = isDiamond ? diamond : hexagon;
+    UINT32 count = isDiamond ? 4 : 6;
+
+    ID2D1PathGeometry* geometry = nullptr;
+    if (FAILED(app.d2dFactory->CreatePathGeometry(&geometry)) || !geometry) return nullptr;
+    ID2D1GeometrySink* sink = nullptr;
+    if (FAILED(geometry->Open(&sink)) || !sink) {
+        geometry->Release();
+        return nullptr;
+    }
+    sink->BeginFigure(points[0], D2D1_FIGURE_BEGIN_FILLED);
+    sink->AddLines(points + 1, count - 1);
+    sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+    sink->Close();
+    sink->Release();
+    app.shapeGeometries[key] = geometry;
+    return geometry;
+}
+
+// Dash pattern for dashed connectors, created once (a factory resource)
+static ID2D1StrokeStyle* dashedStrokeStyleFor(App& app) {
+    if (!app.dashedStrokeStyle) {
+        D2D1_STROKE_STYLE_PROPERTIES properties = {
+            D2D1_CAP_STYLE_FLAT,
+            D2D1_CAP_STYLE_FLAT,
+            D2D1_CAP_STYLE_FLAT,
+            D2D1_LINE_JOIN_MITER,
+            10.0f,
+            D2D1_DASH_STYLE_DASH,
+            0.0f,
+        };
+        app.d2dFactory->CreateStrokeStyle(
+            properties, nullptr, 0, &app.dashedStrokeStyle);
+    }
+    return app.dashedStrokeStyle;
+}
+
+} // namespace
+
+void drawDocumentLayer(App& app, ID2D1RenderTarget* target, ID2D1DeviceContext* dc,
+                              float scrollX, float scrollY, const D2D1_RECT_F& view) {
+    const float viewportTop = view.top;
+    const float viewportBottom = view.bottom;
+    const float viewportLeft = view.left;
+    const float viewportRight = view.right;
+    const float cullMargin = 100.0f;
+
+    // The tile indices narrow each pass to the items near the viewport;
+    // the per-item checks below still do the exact culling
+    const auto rectRange = app.rectTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+    const auto connectorRange = app.connectorTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+    const auto shapeRange = app.shapeTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+    const auto diagramRange = app.diagramTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+    const auto bitmapRange = app.bitmapTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+    const auto textRunRange = app.textRunTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+    const auto lineRange = app.lineTiles.query(
+        viewportTop - cullMargin, viewportBottom + cullMargin);
+
+    for (size_t i = rectRange.first; i < rectRange.second; i++) {
+        const auto& rect = app.layoutRects[i];
+        if (rect.rect.bottom < viewportTop - cullMargin ||
+            rect.rect.top > viewportBottom + cullMargin) {
+            continue;
+        }
+        if (rect.rect.right < viewportLeft - cullMargin ||
+            rect.rect.left > viewportRight + cullMargin) {
+            continue;
+        }
+        app.brush->SetColor(rect.color);
+        target->FillRectangle(
+            D2D1::RectF(rect.rect.left - scrollX, rect.rect.top - scrollY,
+                       rect.rect.right - scrollX, rect.rect.bottom - scrollY),
+            app.brush);
+        app.drawCalls++;
+    }
+
+    for (size_t c = connectorRange.first; c < connectorRange.second; c++) {
+        const auto& connector = app.layoutConnectors[c];
+        if (connector.bounds.bottom < viewportTop - cullMargin ||
+            connector.bounds.top > viewportBottom + cullMargin ||
+            connector.bounds.right < viewportLeft - cullMargin ||
+            connector.bounds.left > viewportRight + cullMargin ||
+            connector.points.size() < 2) {
+            continue;
+        }
+
+        app.brush->SetColor(connector.color);
+        for (size_t i = 1; i < connector.points.size(); i++) {
+            const auto& from = connector.points[i - 1];
+            const auto& to = connector.points[i];
+            target->DrawLine(
+                D2D1::Point2F(from.x - scrollX, from.y - scrollY),
+                D2D1::Point2F(to.x - scrollX, to.y - scrollY),
+                app.brush, connector.stroke,
+                connector.dashed ? dashedStrokeStyleFor(app) : nullptr);
+            app.drawCalls++;
+        }
+
+        D2D1_POINT_2F left, right;
+        if (connector.directed && connectorArrowWings(connector, left, right)) {
+            const auto& tip = connector.points.back();
+            D2D1_POINT_2F screenTip =
+                D2D1::Point2F(tip.x - scrollX, tip.y - scrollY);
+            target->DrawLine(
+                screenTip,
+                D2D1::Point2F(left.x - scrollX, left.y - scrollY),
+                app.brush, connector.stroke);
+            target->DrawLine(
+                screenTip,
+                D2D1::Point2F(right.x - scrollX, right.y - scrollY),
+                app.brush, connector.stroke);
+            app.drawCalls += 2;
+        }
+    }
+
+    D2D1_MATRIX_3X2_F baseTransform;
+    target->GetTransform(&baseTransform);
+    for (size_t i = shapeRange.first; i < shapeRange.second; i++) {
+        const auto& shape = app.layoutShapes[i];
+        if (shape.rect.bottom < viewportTop - cullMargin ||
+            shape.rect.top > viewportBottom + cullMargin ||
+            shape.rect.right < viewportLeft - cullMargin ||
+            shape.rect.left > viewportRight + cullMargin) {
+            continue;
+        }
+
+        D2D1_RECT_F rect = D2D1::RectF(
+            shape.rect.left - scrollX,
+            shape.rect.top - scrollY,
+            shape.rect.right - scrollX,
+            shape.rect.bottom - scrollY);
+
+        if (shape.type == App::LayoutShapeType::Diamond ||
+            shape.type == App::LayoutShapeType::Hexagon) {
+            ID2D1PathGeometry* geometry = shapeGeometryFor(
+                app, shape.type, rect.right - rect.left, rect.bottom - rect.top);
+            if (!geometry) continue;
+            // Built at the origin: move it to the shape for the two draws
+            target->SetTransform(
+                D2D1::Matrix3x2F::Translation(rect.left, rect.top) * baseTransform);
+            if (shape.fill.a > 0.0f) {
+                app.brush->SetColor(shape.fill);
+                target->FillGeometry(geometry, app.brush);
+                app.drawCalls++;
+            }
+            if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
+                app.brush->SetColor(shape.stroke);
+                target->DrawGeometry(geometry, app.brush, shape.strokeWidth);
+                app.drawCalls++;
+            }
+            target->SetTransform(baseTransform);
+            continue;
+        }
+
+        app.brush->SetColor(shape.fill);
+        if (shape.type == App::LayoutShapeType::Ellipse) {
+            D2D1_ELLIPSE ellipse = D2D1::Ellipse(
+                D2D1::Point2F(
+                    (rect.left + rect.right) * 0.5f,
+                    (rect.top + rect.bottom) * 0.5f),
+                (rect.right - rect.left) * 0.5f,
+                (rect.bottom - rect.top) * 0.5f);
+            if (shape.fill.a > 0.0f) {
+                target->FillEllipse(ellipse, app.brush);
+                app.drawCalls++;
+            }
+            if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
+                app.brush->SetColor(shape.stroke);
+                target->DrawEllipse(
+                    ellipse, app.brush, shape.strokeWidth);
+                app.drawCalls++;
+            }
+            continue;
+        }
+
+        if (shape.type == App::LayoutShapeType::RoundedRectangle ||
+            shape.type == App::LayoutShapeType::Stadium) {
+            float radius = shape.type == App::LayoutShapeType::Stadium
+                ? (rect.bottom - rect.top) * 0.5f
+                : shape.radius;
+            D2D1_ROUNDED_RECT rounded = D2D1::RoundedRect(rect, radius, radius);
+            if (shape.fill.a > 0.0f) {
+                target->FillRoundedRectangle(rounded, app.brush);
+                app.drawCalls++;
+            }
+            if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
+                app.brush->SetColor(shape.stroke);
+                target->DrawRoundedRectangle(
+                    rounded, app.brush, shape.strokeWidth);
+                app.drawCalls++;
+            }
+            continue;
+        }
+
+        if (shape.fill.a > 0.0f) {
+            target->FillRectangle(rect, app.brush);
+            app.drawCalls++;
+        }
+        if (shape.stroke.a > 0.0f && shape.strokeWidth > 0.0f) {
+            app.brush->SetColor(shape.stroke);
+            target->DrawRectangle(
+                rect, app.brush, shape.strokeWidth);
+            app.drawCalls++;
+        }
+    }
+
+    // Mermaid diagrams: each pass fills or strokes a whole batch of shapes
+    // or connectors, placed with a translation
+    for (size_t i = diagramRange.first; i < diagramRange.second; i++) {
+        const auto& diagram = app.layoutDiagrams[i];
+        if (diagram.bounds.bottom < viewportTop - cullMargin ||
+            diagram.bounds.top > viewportBottom + cullMargin ||
+            diagram.bounds.right < viewportLeft - cullMargin ||
+            diagram.bounds.left > viewportRight + cullMargin ||
+            !diagram.geometry) {
+            continue;
+        }
+        target->SetTransform(
+            D2D1::Matrix3x2F::Translation(
+                diagram.origin.x - scrollX, diagram.origin.y - scrollY) *
+            baseTransform);
+        for (const auto& pass : diagram.geometry->passes) {
+            app.brush->SetColor(pass.color);
+            if (pass.strokeWidth > 0.0f) {
+                target->DrawGeometry(
+                    pass.geometry, app.brush, pass.strokeWidth,
+                    pass.dashed ? dashedStrokeStyleFor(app) : nullptr);
+            } else {
+                target->FillGeometry(pass.geometry, app.brush);
+            }
+            app.drawCalls++;
+        }
+        target->SetTransform(baseTransform);
+    }
+
+    // Render images (bitmaps)
+    for (size_t i = bitmapRange.first; i < bitmapRange.second; i++) {
+        const auto& bmp = app.layoutBitmaps[i];
+        if (!bmp.bitmap) continue;
+        if (bmp.destRect.bottom < viewportTop - cullMargin ||
+            bmp.destRect.top > viewportBottom + cullMargin) continue;
+        if (bmp.destRect.right < viewportLeft - cullMargin ||
+            bmp.destRect.left > viewportRight + cullMargin) continue;
+        target->DrawBitmap(bmp.bitmap,
+            D2D1::RectF(bmp.destRect.left - scrollX,
+                         bmp.destRect.top - scrollY,
+                         bmp.destRect.right - scrollX,
+                         bmp.destRect.bottom - scrollY));
+        app.drawCalls++;
+    }
+
+    for (size_t i = textRunRange.first; i < textRunRange.second; i++) {
+        const auto& run = app.layoutTextRuns[i];
+        if (run.bounds.bottom < viewportTop - cullMargin ||
+            run.bounds.top > viewportBottom + cullMargin) {
+            continue;
+        }
+        if (run.bounds.right < viewportLeft - cullMargin ||
+            run.bounds.left > viewportRight + cullMargin) {
+            continue;
+        }
+        app.brush->SetColor(app.runColors[run.color]);
+        D2D1_POINT_2F drawPos = D2D1::Point2F(run.pos.x - scrollX, run.pos.y - scrollY);
+        if (dc) {
+            dc->DrawTextLayout(drawPos, run.layout, app.brush,
+                D2D1_DRAW_TEXT_OPTIONS_ENABLE_COLOR_FONT);
+        } else {
+            target->DrawTextLayout(drawPos, run.layout, app.brush);
+        }
+        app.drawCalls++;
+    }
+
+    for (size_t i = lineRange.first; i < lineRange.second; i++) {
+        const auto& line = app.layoutLines[i];
+        float minY = std::min(line.p1.y, line.p2.y);
+        float maxY = std::max(line.p1.y, line.p2.y);
+        if (maxY < viewportTop - cullMargin || minY > viewportBottom + cullMargin) {
+            continue;
+        }
+        app.brush->SetColor(line.color);
+        target->DrawLine(
+            D2D1::Point2F(line.p1.x - scrollX, line.p1.y - scrollY),
+            D2D1::Point2F(line.p2.x - scrollX, line.p2.y - scrollY),
+            app.brush, line.stroke);
+        app.drawCalls++;
+    }
+}
@@ -1,117 +1,299 @@
 #include "search.h"
 #include "utils.h"
 #include "render.h"
+#include "text_search.h"
 
 #include <algorithm>
+#include <cwchar>
 #include <limits>
 
 namespace {
 constexpr size_t kNoTextRect = std::numeric_limits<size_t>::max();
-}
-
-void performSearch(App& app) {
-    app.searchMatches.clear();
-    app.searchCurrentIndex = 0;
-    app.searchMatchCursor = 0;
 
-    if (app.searchQuery.empty() || !app.root) return;
+// Fold the docText layout has appended since the last call. Layout only
+// ever appends (or truncates through truncateSearch), so each character is
+// lowercased once per layout instead of once per keystroke.
+void foldDocText(App& app) {
+    if (app.docTextLower.size() > app.docText.size()) app.docTextLower.clear();
+    size_t from = app.docTextLower.size();
+    app.docTextLower.resize(app.docText.size());
+    for (size_t i = from; i < app.docText.size(); i++) {
+        app.docTextLower[i] = (wchar_t)towlower(app.docText[i]);
+    }
+}
 
-    // docText and textRects must cover the whole document before searching
-    ensureLayoutComplete(app);
+// Record every occurrence of searchQueryLower that starts at or after
+// searchScanPos and fits in the folded text. Occurrences may overlap: a
+// longer query then only has to recheck these instead of the whole text.
+void scanFoldedText(App& app) {
+    const std::wstring& text = app.docTextLower;
+    const std::wstring& query = app.searchQueryLower;
+    if (query.empty() || text.size() < query.size()) return;
 
-    // Use layout-built document text when available
-    if (app.docText.empty()) {
-        extractText(app.root, app.docText);
-    }
-    if (app.docText.empty()) return;
-    if (app.docTextLower.empty()) {
-        app.docTextLower = toLower(app.docText);
+    size_t scanEnd = text.size() - query.size() + 1;
+    size_t pos = app.searchScanPos;
+    while (pos < scanEnd) {
+        pos = findChar(text.data(), pos, scanEnd, query[0]);
+        if (pos >= scanEnd) break;
+        if (wmemcmp(text.data() + pos + 1, query.data() + 1, query.size() - 1) == 0) {
+            app.searchCandidates.push_back(pos);
+        }
+        pos++;
     }
+    app.searchScanPos = std::max(app.searchScanPos, scanEnd);
+}
 
-    std::wstring queryLower = toLower(app.searchQuery);
-    const std::wstring& textLower = app.docTextLower;
-
-    // Estimate match count to avoid repeated vector reallocation
-    app.searchMatches.reserve(64);
+void pushMatch(App& app, size_t start, size_t length) {
+    App::SearchMatch match;
+    match.textRectIndex = kNoTextRect;
+    match.startPos = start;
+    match.length = length;
+    match.highlightRect = D2D1::RectF(0, 0, 0, 0);
+    app.searchMatches.push_back(match);
+}
 
-    size_t pos = 0;
-    while ((pos = textLower.find(queryLower, pos)) != std::wstring::npos) {
-        App::SearchMatch match;
-        match.textRectIndex = kNoTextRect;
-        match.startPos = pos;
-        match.length = app.searchQuery.length();
-        match.highlightRect = D2D1::RectF(0, 0, 0, 0);
-        app.searchMatches.push_back(match);
-        pos += app.searchQuery.length();
+// Matches are the non-overlapping occurrences, taken left to right
+void appendMatches(App& app, size_t firstCandidate) {
+    size_t length = app.searchQueryLower.size();
+    size_t lastEnd = app.searchMatches.empty()
+        ? 0 : app.searchMatches.back().startPos + app.searchMatches.back().length;
+    for (size_t i = firstCandidate; i < app.searchCandidates.size(); i++) {
+        size_t pos = app.searchCandidates[i];
+        if (pos < lastEnd) continue;
+        pushMatch(app, pos, length);
+        lastEnd = pos + length;
     }
+}
 
-    mapSearchMatchesToLayout(app);
+// Proportional estimate of [start, end) within a text rect: good enough to
+// scroll to, and the fallback when a rect has no layout to hit-test
+D2D1_RECT_F estimateFragment(const App::TextRect& tr, size_t start, size_t end) {
+    float charWidth = (tr.rect.right - tr.rect.left) / static_cast<float>(tr.docLength);
+    float startX = tr.rect.left + static_cast<float>(start - tr.docStart) * charWidth;
+    float endX = startX + static_cast<float>(end - start) * charWidth;
+    return D2D1::RectF(startX, tr.rect.top, endX, tr.rect.bottom);
 }
 
-void mapSearchMatchesToLayout(App& app) {
-    for (auto& match : app.searchMatches) {
+// Map matches [firstMatch, end) onto textRects. textRects follow document
+// order, so each match binary-searches forward from the previous one's rect
+// instead of walking every rect in between.
+void mapSearchMatchesFrom(App& app, size_t firstMatch) {
+    if (firstMatch == 0) app.searchHighlightRects.clear();
+    for (size_t i = firstMatch; i < app.searchMatches.size(); i++) {
+        auto& match = app.searchMatches[i];
         match.textRectIndex = kNoTextRect;
         match.highlightRect = D2D1::RectF(0, 0, 0, 0);
+        match.exact = false;
     }
-    if (app.searchMatches.empty()) return;
+    if (firstMatch >= app.searchMatches.size()) return;
     if (app.textRects.empty()) return;
 
-    size_t matchIndex = 0;
-    for (size_t textRectIndex = 0; textRectIndex < app.textRects.size();
-         textRectIndex++) {
-        const auto& tr = app.textRects[textRectIndex];
-        size_t rectStart = tr.docStart;
-        size_t rectEnd = rectStart + tr.docLength;
-        if (rectEnd <= rectStart) continue;
-
-        while (matchIndex < app.searchMatches.size()) {
-            const auto& m = app.searchMatches[matchIndex];
-            size_t mEnd = m.startPos + m.length;
-            if (mEnd <= rectStart) {
-                matchIndex++;
-                continue;
+    const auto& rects = app.textRects;
+    auto endsBefore = [](const App::TextRect& tr, size_t pos) {
+        return tr.docStart + tr.docLength <= pos;
+    };
+    size_t rectIndex = 0;
+    for (size_t i = firstMatch; i < app.searchMatches.size(); i++) {
+        auto& m = app.searchMatches[i];
+        size_t mEnd = m.startPos + m.length;
+        rectIndex = (size_t)(std::lower_bound(rects.begin() + rectIndex, rects.end(),
+                                              m.startPos, endsBefore) - rects.begin());
+        for (size_t r = rectIndex; r < rects.size() && rects[r].docStart < mEnd; r++) {
+            const auto& tr = rects[r];
+            size_t overlapStart = std::max((size_t)tr.docStart, m.startPos);
+            size_t overlapEnd = std::min((size_t)tr.docStart + tr.docLength, mEnd);
+            if (overlapStart >= overlapEnd) continue;
+
+            D2D1_RECT_F fragment = estimateFragment(tr, overlapStart, overlapEnd);
+            if (m.textRectIndex == kNoTextRect) {
+                m.textRectIndex = r;
+                m.highlightRect = fragment;
+            } else {
+                m.highlightRect.left = std::min(m.highlightRect.left, fragment.left);
+                m.highlightRect.top = std::min(m.highlightRect.top, fragment.top);
+                m.highlightRect.right = std::max(m.highlightRect.right, fragment.right);
+                m.highlightRect.bottom = std::max(m.highlightRect.bottom, fragment.bottom);
             }
-            break;
         }
+    }
+}
 
-        size_t mi = matchIndex;
-        while (mi < app.searchMatches.size()) {
-            auto& m = app.searchMatches[mi];
-            if (m.startPos >= rectEnd) break;
-
-            size_t mEnd = m.startPos + m.length;
-            size_t overlapStart = std::max(rectStart, m.startPos);
-            size_t overlapEnd = std::min(rectEnd, mEnd);
-            if (overlapStart < overlapEnd) {
-                float totalWidth = tr.rect.right - tr.rect.left;
-                float charWidth = totalWidth / static_cast<float>(tr.docLength);
-                float startX =
-                    tr.rect.left + static_cast<float>(overlapStart - rectStart) * charWidth;
-                float endX =
-                    startX + static_cast<float>(overlapEnd - overlapStart) * charWidth;
-                D2D1_RECT_F fragment =
-                    D2D1::RectF(startX, tr.rect.top, endX, tr.rect.bottom);
-
-                if (m.textRectIndex == kNoTextRect) {
-                    m.textRectIndex = textRectIndex;
-                    m.highlightRect = fragment;
-                } else {
-                    m.highlightRect.left = std::min(m.highlightRect.left, fragment.left);
-                    m.highlightRect.top = std::min(m.highlightRect.top, fragment.top);
-                    m.highlightRect.right = std::max(m.highlightRect.right, fragment.right);
-                    m.highlightRect.bottom = std::max(m.highlightRect.bottom, fragment.bottom);
-                }
-            }
+// Hit-test [start, end) against the layout that draws the rect. Rows come
+// from the rect when the range stays on one line and from DirectWrite when
+// the run wraps.
+bool hitTestFragments(App& app, const App::TextRect& tr, size_t start, size_t end) {
+    if (tr.textRun >= app.layoutTextRuns.size()) return false;
+    const auto& run = app.layoutTextRuns[tr.textRun];
+    if (!run.layout || start < run.docStart || end > run.docStart + run.docLength) return false;
 
-            if (mEnd <= rectEnd) {
-                mi++;
-            } else {
-                break;
+    DWRITE_HIT_TEST_METRICS metrics[4];
+    UINT32 count = 0;
+    if (FAILED(run.layout->HitTestTextRange((UINT32)(start - run.docStart), (UINT32)(end - start),
+                                            run.pos.x, run.pos.y, metrics, 4, &count)) ||
+        count == 0) {
+        return false;
+    }
+    for (UINT32 i = 0; i < count; i++) {
+        float top = count == 1 ? tr.rect.top : metrics[i].top;
+        float bottom = count == 1 ? tr.rect.bottom : metrics[i].top + metrics[i].height;
+        app.searchHighlightRects.push_back(D2D1::RectF(
+            metrics[i].left, top, metrics[i].left + metrics[i].width, bottom));
+    }
+    return true;
+}
+
+// Regex and whole-word queries run the compiled pattern over the folded
+// text from searchScanPos. Until layout is complete the pattern may hold
+// back a match that more text could still extend; searchScanPos is then
+// where it resumes.
+void scanWithPattern(App& app) {
+    const std::wstring& text = app.docTextLower;
+    std::vector<SearchPattern::Match> found;
+    app.searchScanPos = app.searchPattern.find(text.data(), text.size(), app.searchScanPos,
+                                               app.layoutComplete, found);
+    for (const auto& match : found) pushMatch(app, match.start, match.length);
+}
+
+bool usesPattern(const App& app) {
+    return app.searchRegex || app.searchWholeWord;
+}
+
+void resetSearchState(App& app) {
+    app.searchMatches.clear();
+    app.searchCandidates.clear();
+    app.searchQueryLower.clear();
+    app.searchPattern.clear();
+    app.searchScanPos = 0;
+    app.searchScrollPending = false;
+}
+
+} // namespace
+
+void performSearch(App& app) {
+    app.searchCurrentIndex = 0;
+    app.searchMatchCursor = 0;
+
+    std::wstring queryLower = toLower(app.searchQuery);
+    if (queryLower.empty() || !app.root) {
+        resetSearchState(app);
+        return;
+    }
+
+    // Search whatever layout has produced so far; advanceSearch picks up
+    // the rest as layout continues, so a large document never blocks here
+    foldDocText(app);
+    if (usesPattern(app)) {
+        // Compiled once per query; an invalid regex leaves no pattern and
+        // the overlay shows its error
+        resetSearchState(app);
+        if (!app.searchPattern.compile(queryLower, app.searchRegex, app.searchWholeWord)) return;
+        scanWithPattern(app);
+        mapSearchMatchesFrom(app, 0);
+        app.searchScrollPending = app.searchMatches.empty() && !app.layoutComplete;
+        return;
+    }
+    app.searchPattern.clear();
+
+    const std::wstring& prev = app.searchQueryLower;
+    bool narrowing = !prev.empty() && queryLower.size() > prev.size() &&
+                     queryLower.compare(0, prev.size(), prev) == 0;
+    if (narrowing) {
+        // Every occurrence of the longer query is one of the shorter query:
+        // recheck those and only scan text the old scan had not reached
+        const std::wstring& text = app.docTextLower;
+        size_t scanEnd = text.size() >= queryLower.size() ? text.size() - queryLower.size() + 1 : 0;
+        auto& candidates = app.searchCandidates;
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](size_t pos) {
+            return pos >= scanEnd ||
+                   text.compare(pos, queryLower.size(), queryLower) != 0;
+        }), candidates.end());
+        app.searchScanPos = std::min(app.searchScanPos, scanEnd);
+    } else {
+        app.searchCandidates.clear();
+        app.searchScanPos = 0;
+    }
+    app.searchQueryLower = std::move(queryLower);
+
+    scanFoldedText(app);
+    app.searchMatches.clear();
+    appendMatches(app, 0);
+    mapSearchMatchesFrom(app, 0);
+    app.searchScrollPending = app.searchMatches.empty() && !app.layoutComplete;
+}
+
+void advanceSearch(App& app) {
+    if (app.editMode || app.searchQuery.empty()) return;
+
+    size_t firstMatch = app.searchMatches.size();
+    if (app.searchPattern.valid()) {
+        foldDocText(app);
+        scanWithPattern(app);
+        if (app.searchMatches.size() == firstMatch) return;
+    } else {
+        if (app.searchQueryLower.empty()) return;
+        foldDocText(app);
+        size_t firstCandidate = app.searchCandidates.size();
+        scanFoldedText(app);
+        if (app.searchCandidates.size() == firstCandidate) return;
+        appendMatches(app, firstCandidate);
+    }
+    mapSearchMatchesFrom(app, firstMatch);
+    if (app.searchScrollPending && !app.searchMatches.empty()) {
+        app.searchScrollPending = false;
+        scrollToCurrentMatch(app);
+    }
+}
+
+void truncateSearch(App& app, size_t validChars) {
+    if (app.docTextLower.size() > validChars) app.docTextLower.resize(validChars);
+    if (app.searchPattern.valid()) {
+        // How far past its end a regex match looked is not recorded, so any
+        // of them may depend on the dropped text: rescan from the top
+        app.searchMatches.clear();
+        app.searchScanPos = 0;
+        app.searchCurrentIndex = 0;
+        return;
+    }
+    if (app.searchQueryLower.empty()) return;
+
+    size_t length = app.searchQueryLower.size();
+    auto& candidates = app.searchCandidates;
+    candidates.erase(std::find_if(candidates.begin(), candidates.end(), [&](size_t pos) {
+        return pos + length > validChars;
+    }), candidates.end());
+    auto& matches = app.searchMatches;
+    matches.erase(std::find_if(matches.begin(), matches.end(), [&](const App::SearchMatch& m) {
+        return m.startPos + m.length > validChars;
+    }), matches.end());
+    app.searchScanPos = std::min(app.searchScanPos,
+                                 validChars >= length ? validChars - length + 1 : 0);
+    if (app.searchCurrentIndex >= (int)matches.size()) app.searchCurrentIndex = 0;
+}
+
+void mapSearchMatchesToLayout(App& app) {
+    mapSearchMatchesFrom(app, 0);
+}
+
+std::pair<const D2D1_RECT_F*, size_t> searchHighlightFragments(App& app, size_t matchIndex) {
+    auto& m = app.searchMatches[matchIndex];
+    if (!m.exact) {
+        size_t first = app.searchHighlightRects.size();
+        size_t mEnd = m.startPos + m.length;
+        const auto& rects = app.textRects;
+        for (size_t r = m.textRectIndex; r < rects.size() && rects[r].docStart < mEnd; r++) {
+            const auto& tr = rects[r];
+            size_t overlapStart = std::max((size_t)tr.docStart, m.startPos);
+            size_t overlapEnd = std::min((size_t)tr.docStart + tr.docLength, mEnd);
+            if (overlapStart >= overlapEnd) continue;
+            if (!hitTestFragments(app, tr, overlapStart, overlapEnd)) {
+                app.searchHighlightRects.push_back(estimateFragment(tr, overlapStart, overlapEnd));
             }
         }
-
-        matchIndex = mi;
+        m.exact = true;
+        m.exactFirst = (uint32_t)first;
+        m.exactCount = (uint32_t)(app.searchHighlightRects.size() - first);
     }
+    return {app.searchHighlightRects.data() + m.exactFirst, m.exactCount};
 }
 
 void scrollToCurrentMatch(App& app) {
@@ -38,6 +38,9 @@ void saveSettings(const Settings& settings) {
     file << "hasAskedFileAssociation=" << (settings.hasAskedFileAssociation ? 1 : 0) << "\n";
     file << "editorShowPreview=" << (settings.editorShowPreview ? 1 : 0) << "\n";
     file << "editorWordWrap=" << (settings.editorWordWrap ? 1 : 0) << "\n";
+    file << "imageCacheMB=" << settings.imageCacheMB << "\n";
+    file << "documentTiles=" << (settings.documentTiles ? 1 : 0) << "\n";
+    file << "documentCache=" << (settings.documentCache ? 1 : 0) << "\n";
 }
 
 Settings loadSettings() {
@@ -82,6 +85,13 @@ Settings loadSettings() {
             settings.editorShowPreview = (value == "1");
         } else if (key == "editorWordWrap") {
             settings.editorWordWrap = (value == "1");
+        } else if (key == "imageCacheMB") {
+            int mb = std::stoi(value);
+            if (mb >= 16 && mb <= 4096) settings.imageCacheMB = mb;
+        } else if (key == "documentTiles") {
+            settings.documentTiles = (value == "1");
+        } else if (key == "documentCache") {
+            settings.documentCache = (value == "1");
         }
     }
     return settings;
@@ -1,6 +1,39 @@
 #include "syntax.h"
 
-const std::unordered_set<std::wstring> CPP_KEYWORDS = {
+namespace {
+
+constexpr size_t keywordSlots(size_t count) {
+    size_t slots = 1;
+    while (slots < count * 2) slots *= 2;
+    return slots;
+}
+
+// Hash every word into a power-of-two table at least twice its size with
+// linear probing; runs at compile time, so the tables are plain data
+template <size_t N>
+constexpr std::array<std::wstring_view, keywordSlots(N)> makeKeywordTable(
+        const std::wstring_view (&words)[N]) {
+    constexpr size_t mask = keywordSlots(N) - 1;
+    std::array<std::wstring_view, keywordSlots(N)> slots{};
+    for (size_t w = 0; w < N; w++) {
+        size_t i = keywordHash(words[w]) & mask;
+        while (!slots[i].empty() && slots[i] != words[w]) i = (i + 1) & mask;
+        slots[i] = words[w];
+    }
+    return slots;
+}
+
+} // namespace
+
+bool KeywordSet::contains(std::wstring_view word) const {
+    if (word.empty()) return false;
+    for (size_t i = keywordHash(word) & mask_;; i = (i + 1) & mask_) {
+        if (slots_[i].empty()) return false;
+        if (slots_[i] == word) return true;
+    }
+}
+
+constexpr auto CPP_KEYWORDS_TABLE = makeKeywordTable({
     L"if", L"else", L"for", L"while", L"do", L"switch", L"case", L"break", L"continue",
     L"return", L"goto", L"default", L"void", L"int", L"char", L"float", L"double", L"bool",
     L"long", L"short", L"unsigned", L"signed", L"const", L"static", L"extern", L"volatile",
@@ -11,9 +44,10 @@ const std::unordered_set<std::wstring> CPP_KEYWORDS = {
     L"using", L"operator", L"sizeof", L"alignof", L"decltype", L"noexcept", L"static_assert",
     L"friend", L"concept", L"requires", L"co_await", L"co_return", L"co_yield",
     L"#include", L"#define", L"#ifdef", L"#ifndef", L"#endif", L"#if", L"#else", L"#pragma"
-};
+});
+const KeywordSet CPP_KEYWORDS(CPP_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> CPP_TYPES = {
+constexpr auto CPP_TYPES_TABLE = makeKeywordTable({
     L"size_t", L"int8_t", L"int16_t", L"int32_t", L"int64_t",
     L"uint8_t", L"uint16_t", L"uint32_t", L"uint64_t",
     L"string", L"wstring", L"vector", L"map", L"set", L"unordered_map", L"unordered_set",
@@ -21,55 +55,62 @@ const std::unordered_set<std::wstring> CPP_TYPES = {
     L"HRESULT", L"HWND", L"HINSTANCE", L"LPARAM", L"WPARAM", L"LRESULT", L"BOOL",
     L"DWORD", L"WORD", L"BYTE", L"UINT", L"INT", L"LONG", L"ULONG", L"FLOAT",
     L"IDWriteFactory", L"ID2D1Factory", L"ID2D1RenderTarget", L"IDWriteTextFormat"
-};
+});
+const KeywordSet CPP_TYPES(CPP_TYPES_TABLE);
 
-const std::unordered_set<std::wstring> PYTHON_KEYWORDS = {
+constexpr auto PYTHON_KEYWORDS_TABLE = makeKeywordTable({
     L"if", L"elif", L"else", L"for", L"while", L"break", L"continue", L"pass", L"return",
     L"def", L"class", L"import", L"from", L"as", L"try", L"except", L"finally", L"raise",
     L"with", L"yield", L"lambda", L"global", L"nonlocal", L"assert", L"del", L"in", L"is",
     L"not", L"and", L"or", L"True", L"False", L"None", L"async", L"await", L"match", L"case"
-};
+});
+const KeywordSet PYTHON_KEYWORDS(PYTHON_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> JS_KEYWORDS = {
+constexpr auto JS_KEYWORDS_TABLE = makeKeywordTable({
     L"if", L"else", L"for", L"while", L"do", L"switch", L"case", L"break", L"continue",
     L"return", L"function", L"var", L"let", L"const", L"class", L"extends", L"new", L"this",
     L"super", L"try", L"catch", L"finally", L"throw", L"async", L"await", L"yield",
     L"import", L"export", L"default", L"from", L"as", L"of", L"in", L"typeof", L"instanceof",
     L"true", L"false", L"null", L"undefined", L"NaN", L"Infinity", L"void", L"delete",
     L"debugger", L"with", L"static", L"get", L"set", L"=>"
-};
+});
+const KeywordSet JS_KEYWORDS(JS_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> RUST_KEYWORDS = {
+constexpr auto RUST_KEYWORDS_TABLE = makeKeywordTable({
     L"if", L"else", L"match", L"for", L"while", L"loop", L"break", L"continue", L"return",
     L"fn", L"let", L"mut", L"const", L"static", L"struct", L"enum", L"trait", L"impl",
     L"pub", L"mod", L"use", L"crate", L"super", L"self", L"Self", L"where", L"as", L"in",
     L"type", L"unsafe", L"async", L"await", L"move", L"ref", L"dyn", L"box", L"extern",
     L"true", L"false", L"Some", L"None", L"Ok", L"Err"
-};
+});
+const KeywordSet RUST_KEYWORDS(RUST_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> GO_KEYWORDS = {
+constexpr auto GO_KEYWORDS_TABLE = makeKeywordTable({
     L"if", L"else", L"for", L"range", L"switch", L"case", L"break", L"continue", L"return",
     L"func", L"var", L"const", L"type", L"struct", L"interface", L"map", L"chan",
     L"package", L"import", L"go", L"defer", L"select", L"default", L"fallthrough", L"goto",
     L"true", L"false", L"nil", L"iota", L"make", L"new", L"append", L"len", L"cap", L"copy"
-};
+});
+const KeywordSet GO_KEYWORDS(GO_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> BASH_KEYWORDS = {
+constexpr auto BASH_KEYWORDS_TABLE = makeKeywordTable({
     L"if", L"then", L"else", L"elif", L"fi", L"for", L"in", L"do", L"done",
     L"while", L"until", L"case", L"esac", L"function", L"return", L"local",
     L"export", L"source", L"alias", L"unalias", L"set", L"unset",
     L"readonly", L"shift", L"exit", L"break", L"continue",
     L"echo", L"printf", L"read", L"eval", L"exec", L"trap",
     L"cd", L"pwd", L"test", L"true", L"false"
-};
+});
+const KeywordSet BASH_KEYWORDS(BASH_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> CSHARP_CONTROL_FLOW = {
+constexpr auto CSHARP_CONTROL_FLOW_TABLE = makeKeywordTable({
     L"if", L"else", L"for", L"foreach", L"while", L"do", L"switch", L"case", L"break",
     L"continue", L"return", L"goto", L"default", L"throw", L"try", L"catch", L"finally",
     L"yield", L"when"
-};
+});
+const KeywordSet CSHARP_CONTROL_FLOW(CSHARP_CONTROL_FLOW_TABLE);
 
-const std::unordered_set<std::wstring> CSHARP_KEYWORDS = {
+constexpr auto CSHARP_KEYWORDS_TABLE = makeKeywordTable({
     // Control flow
     L"if", L"else", L"for", L"foreach", L"while", L"do", L"switch", L"case", L"break",
     L"continue", L"return", L"goto", L"default", L"throw", L"try", L"catch", L"finally",
@@ -97,9 +138,10 @@ const std::unordered_set<std::wstring> CSHARP_KEYWORDS = {
     // Preprocessor
     L"#if", L"#else", L"#elif", L"#endif", L"#define", L"#undef",
     L"#region", L"#endregion", L"#pragma", L"#nullable", L"#warning", L"#error"
-};
+});
+const KeywordSet CSHARP_KEYWORDS(CSHARP_KEYWORDS_TABLE);
 
-const std::unordered_set<std::wstring> CSHARP_TYPES = {
+constexpr auto CSHARP_TYPES_TABLE = makeKeywordTable({
     // System types
     L"String", L"Int32", L"Int64", L"Int16", L"Boolean", L"Double", L"Single",
     L"Decimal", L"Object", L"Byte", L"SByte", L"Char", L"UInt32", L"UInt64",
@@ -129,7 +171,8 @@ const std::unordered_set<std::wstring> CSHARP_TYPES = {
     // ASP.NET common
     L"ILogger", L"IConfiguration", L"IServiceCollection", L"IApplicationBuilder",
     L"IHostBuilder", L"IWebHostBuilder"
-};
+});
+const KeywordSet CSHARP_TYPES(CSHARP_TYPES_TABLE);
 
 int detectLanguage(const std::wstring& lang) {
     std::wstring lower = lang;
@@ -151,7 +194,7 @@ int detectLanguage(const std::wstring& lang) {
     return 0;  // Unknown
 }
 
-const std::unordered_set<std::wstring>* getKeywordsForLanguage(int lang) {
+const KeywordSet* getKeywordsForLanguage(int lang) {
     switch (lang) {
         case 1: return &CPP_KEYWORDS;
         case 2: return &PYTHON_KEYWORDS;
@@ -164,16 +207,16 @@ const std::unordered_set<std::wstring>* getKeywordsForLanguage(int lang) {
     }
 }
 
-std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bool& inBlockComment) {
+std::vector<SyntaxToken> tokenizeLine(std::wstring_view line, int language, bool& inBlockComment) {
     std::vector<SyntaxToken> tokens;
-    const std::unordered_set<std::wstring>* keywords = getKeywordsForLanguage(language);
+    const KeywordSet* keywords = getKeywordsForLanguage(language);
 
     size_t i = 0;
     while (i < line.length()) {
         // Handle block comment continuation
         if (inBlockComment) {
             size_t endComment = line.find(L"*/", i);
-            if (endComment != std::wstring::npos) {
+            if (endComment != std::wstring_view::npos) {
                 tokens.push_back({std::wstring_view(line.data() + i, endComment + 2 - i),
                                   SyntaxTokenType::Comment});
                 i = endComment + 2;
@@ -208,7 +251,7 @@ std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bo
             // Block comment start
             if (line[i] == L'/' && line[i+1] == L'*') {
                 size_t endComment = line.find(L"*/", i + 2);
-                if (endComment != std::wstring::npos) {
+                if (endComment != std::wstring_view::npos) {
                     tokens.push_back({std::wstring_view(line.data() + i, endComment + 2 - i),
                                       SyntaxTokenType::Comment});
                     i = endComment + 2;
@@ -311,8 +354,7 @@ std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bo
         if (iswalpha(c) || c == L'_') {
             size_t start = i;
             while (i < line.length() && (iswalnum(line[i]) || line[i] == L'_')) i++;
-            std::wstring word = line.substr(start, i - start);
-            std::wstring_view view(line.data() + start, i - start);
+            std::wstring_view word(line.data() + start, i - start);
 
             // Check if it's a function call (followed by parenthesis)
             size_t next = i;
@@ -320,21 +362,21 @@ std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bo
             bool isFunction = (next < line.length() && line[next] == L'(');
 
             // Check if keyword (C# separates control flow from other keywords)
-            if (language == 7 && CSHARP_CONTROL_FLOW.count(word)) {
-                tokens.push_back({view, SyntaxTokenType::ControlFlow});
-            } else if (keywords && keywords->count(word)) {
-                tokens.push_back({view, SyntaxTokenType::Keyword});
-            } else if (language == 1 && CPP_TYPES.count(word)) {
-                tokens.push_back({view, SyntaxTokenType::TypeName});
-            } else if (language == 7 && CSHARP_TYPES.count(word)) {
-                tokens.push_back({view, SyntaxTokenType::TypeName});
+            if (language == 7 && CSHARP_CONTROL_FLOW.contains(word)) {
+                tokens.push_back({word, SyntaxTokenType::ControlFlow});
+            } else if (keywords && keywords->contains(word)) {
+                tokens.push_back({word, SyntaxTokenType::Keyword});
+            } else if (language == 1 && CPP_TYPES.contains(word)) {
+                tokens.push_back({word, SyntaxTokenType::TypeName});
+            } else if (language == 7 && CSHARP_TYPES.contains(word)) {
+                tokens.push_back({word, SyntaxTokenType::TypeName});
             } else if (isFunction) {
-                tokens.push_back({view, SyntaxTokenType::Function});
+                tokens.push_back({word, SyntaxTokenType::Function});
             } else if (language == 7 && iswupper(word[0]) && word.length() > 1) {
                 // C# PascalCase heuristic: uppercase-starting identifiers are likely types
-                tokens.push_back({view, SyntaxTokenType::TypeName});
+                tokens.push_back({word, SyntaxTokenType::TypeName});
             } else {
-                tokens.push_back({view, SyntaxTokenType::Plain});
+                tokens.push_back({word, SyntaxTokenType::Plain});
             }
             continue;
         }
@@ -344,9 +386,8 @@ std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bo
             size_t start = i;
             i++;
             while (i < line.length() && (iswalnum(line[i]) || line[i] == L'_')) i++;
-            std::wstring directive = line.substr(start, i - start);
             std::wstring_view view(line.data() + start, i - start);
-            if (keywords && keywords->count(directive)) {
+            if (keywords && keywords->contains(view)) {
                 tokens.push_back({view, SyntaxTokenType::Keyword});
             } else {
                 tokens.push_back({view, SyntaxTokenType::Plain});
@@ -362,6 +403,29 @@ std::vector<SyntaxToken> tokenizeLine(const std::wstring& line, int language, bo
     return tokens;
 }
 
+CodeTokens tokenizeCode(std::wstring_view code, int language) {
+    CodeTokens out;
+    bool inBlockComment = false;
+    size_t lineStart = 0;
+    while (lineStart <= code.length()) {
+        size_t lineEnd = code.find(L'\n', lineStart);
+        if (lineEnd == std::wstring_view::npos) lineEnd = code.length();
+        std::wstring_view line = code.substr(lineStart, lineEnd - lineStart);
+        if (!line.empty() && line.back() == L'\r') line.remove_suffix(1);
+
+        out.lineSpans.push_back((uint32_t)out.spans.size());
+        for (const auto& token : tokenizeLine(line, language, inBlockComment)) {
+            if (token.text.empty()) continue;
+            out.spans.push_back({(uint32_t)(token.text.data() - code.data()),
+                                 (uint32_t)token.text.size(), token.tokenType});
+        }
+        if (lineEnd == code.length()) break;
+        lineStart = lineEnd + 1;
+    }
+    out.lineSpans.push_back((uint32_t)out.spans.size());
+    return out;
+}
+
 D2D1_COLOR_F getTokenColor(const D2DTheme& theme, SyntaxTokenType ttype) {
     switch (ttype) {
         case SyntaxTokenType::Keyword:  return theme.syntaxKeyword;
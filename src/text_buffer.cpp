@@ -0,0 +1,407 @@
+#include "text_buffer.h"
+
+namespace {
+
+void appendNewlines(std::vector<size_t>& out, std::wstring_view text, size_t base) {
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == L'\n') out.push_back(base + i);
+    }
+}
+
+} // namespace
+
+TextBuffer::TextBuffer() = default;
+
+void TextBuffer::assign(std::wstring text) {
+    clear();
+    original_ = std::move(text);
+    appendNewlines(originalNewlines_, original_, 0);
+    if (!original_.empty()) root_ = makeNode(false, 0, original_.size());
+}
+
+void TextBuffer::clear() {
+    original_.clear();
+    added_.clear();
+    originalNewlines_.clear();
+    addedNewlines_.clear();
+    nodes_.clear();
+    freeNodes_.clear();
+    root_ = kNil;
+    lastInsert_ = kNil;
+    lastInsertEnd_ = 0;
+}
+
+size_t TextBuffer::countNewlines(bool added, size_t start, size_t end) const {
+    const auto& offsets = added ? addedNewlines_ : originalNewlines_;
+    auto first = std::lower_bound(offsets.begin(), offsets.end(), start);
+    auto last = std::lower_bound(first, offsets.end(), end);
+    return (size_t)(last - first);
+}
+
+uint32_t TextBuffer::makeNode(bool added, size_t start, size_t length) {
+    // xorshift: priorities only need to be spread out for the treap to stay
+    // balanced in expectation
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+
+    Node n;
+    n.priority = seed_;
+    n.added = added;
+    n.start = start;
+    n.length = length;
+    n.newlines = countNewlines(added, start, start + length);
+    n.subLength = length;
+    n.subNewlines = n.newlines;
+
+    if (!freeNodes_.empty()) {
+        uint32_t index = freeNodes_.back();
+        freeNodes_.pop_back();
+        nodes_[index] = n;
+        return index;
+    }
+    nodes_.push_back(n);
+    return (uint32_t)(nodes_.size() - 1);
+}
+
+void TextBuffer::freeSubtree(uint32_t node) {
+    std::vector<uint32_t> stack;
+    if (node != kNil) stack.push_back(node);
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        if (nodes_[index].left != kNil) stack.push_back(nodes_[index].left);
+        if (nodes_[index].right != kNil) stack.push_back(nodes_[index].right);
+        freeNodes_.push_back(index);
+    }
+}
+
+void TextBuffer::update(uint32_t node) {
+    Node& n = nodes_[node];
+    n.subLength = n.length;
+    n.subNewlines = n.newlines;
+    if (n.left != kNil) {
+        n.subLength += nodes_[n.left].subLength;
+        n.subNewlines += nodes_[n.left].subNewlines;
+    }
+    if (n.right != kNil) {
+        n.subLength += nodes_[n.right].subLength;
+        n.subNewlines += nodes_[n.right].subNewlines;
+    }
+}
+
+// Characters before `pos` go to `left`, the rest to `right`. A piece that
+// straddles `pos` is cut in two; makeNode may grow nodes_, so no Node
+// references are held across it.
+void TextBuffer::split(uint32_t node, size_t pos, uint32_t& left, uint32_t& right) {
+    if (node == kNil) {
+        left = right = kNil;
+        return;
+    }
+    uint32_t childLeft = nodes_[node].left;
+    uint32_t childRight = nodes_[node].right;
+    size_t leftLength = childLeft == kNil ? 0 : nodes_[childLeft].subLength;
+    size_t pieceLength = nodes_[node].length;
+
+    if (pos <= leftLength) {
+        uint32_t rest = kNil;
+        split(childLeft, pos, left, rest);
+        nodes_[node].left = rest;
+        update(node);
+        right = node;
+    } else if (pos >= leftLength + pieceLength) {
+        uint32_t rest = kNil;
+        split(childRight, pos - leftLength - pieceLength, rest, right);
+        nodes_[node].right = rest;
+        update(node);
+        left = node;
+    } else {
+        size_t offset = pos - leftLength;
+        bool added = nodes_[node].added;
+        size_t start = nodes_[node].start;
+        uint32_t tail = makeNode(added, start + offset, pieceLength - offset);
+        // The tail roots the old right subtree, so it inherits the priority
+        // that already satisfied the heap order there
+        nodes_[tail].priority = nodes_[node].priority;
+        nodes_[tail].right = childRight;
+        update(tail);
+
+        nodes_[node].length = offset;
+        nodes_[node].newlines = countNewlines(added, start, start + offset);
+        nodes_[node].right = kNil;
+        update(node);
+        left = node;
+        right = tail;
+    }
+}
+
+uint32_t TextBuffer::merge(uint32_t left, uint32_t right) {
+    if (left == kNil) return right;
+    if (right == kNil) return left;
+    if (nodes_[left].priority > nodes_[right].priority) {
+        uint32_t merged = merge(nodes_[left].right, right);
+        nodes_[left].right = merged;
+        update(left);
+        return left;
+    }
+    uint32_t merged = merge(left, nodes_[right].left);
+    nodes_[right].left = merged;
+    update(right);
+    return right;
+}
+
+// Typing appends at the end of the previous insert: grow that piece in
+// place instead of adding a piece per keystroke
+bool TextBuffer::growLastInsert(size_t pos, std::wstring_view text) {
+    if (lastInsert_ == kNil || pos != lastInsertEnd_ || pos == 0) return false;
+    const Node& last = nodes_[lastInsert_];
+    if (!last.added || last.start + last.length != added_.size()) return false;
+
+    // Path to the piece holding pos - 1, which must be the last insert
+    std::vector<uint32_t> path;
+    uint32_t node = root_;
+    size_t offset = pos - 1;
+    while (node != kNil) {
+        path.push_back(node);
+        const Node& n = nodes_[node];
+        size_t leftLength = n.left == kNil ? 0 : nodes_[n.left].subLength;
+        if (offset < leftLength) {
+            node = n.left;
+        } else if (offset < leftLength + n.length) {
+            break;
+        } else {
+            offset -= leftLength + n.length;
+            node = n.right;
+        }
+    }
+    if (node != lastInsert_) return false;
+
+    size_t lines = 0;
+    for (wchar_t c : text) lines += (c == L'\n');
+    appendNewlines(addedNewlines_, text, added_.size());
+    added_.append(text);
+    nodes_[node].length += text.size();
+    nodes_[node].newlines += lines;
+    for (uint32_t index : path) {
+        nodes_[index].subLength += text.size();
+        nodes_[index].subNewlines += lines;
+    }
+    lastInsertEnd_ += text.size();
+    return true;
+}
+
+TextBuffer::Span TextBuffer::insert(size_t pos, std::wstring_view text) {
+    size_t start = added_.size();
+    if (text.empty()) return {true, start, 0};
+    pos = std::min(pos, size());
+    if (growLastInsert(pos, text)) return {true, start, text.size()};
+
+    appendNewlines(addedNewlines_, text, start);
+    added_.append(text);
+    uint32_t piece = makeNode(true, start, text.size());
+
+    uint32_t left = kNil, right = kNil;
+    split(root_, pos, left, right);
+    root_ = merge(merge(left, piece), right);
+    lastInsert_ = piece;
+    lastInsertEnd_ = pos + text.size();
+    return {true, start, text.size()};
+}
+
+void TextBuffer::erase(size_t pos, size_t len) {
+    size_t total = size();
+    if (pos >= total || len == 0) return;
+    len = std::min(len, total - pos);
+
+    uint32_t left = kNil, rest = kNil, middle = kNil, right = kNil;
+    split(root_, pos, left, rest);
+    split(rest, len, middle, right);
+    freeSubtree(middle);
+    root_ = merge(left, right);
+    lastInsert_ = kNil;
+}
+
+void TextBuffer::compactAdded(Span* keep, size_t count) {
+    // Runs of added_ still named, sorted and merged, with where each moves
+    struct Run {
+        size_t begin, end, to;
+    };
+    std::vector<Run> runs;
+    std::vector<uint32_t> pieces;
+    std::vector<uint32_t> stack;
+    if (root_ != kNil) stack.push_back(root_);
+    while (!stack.empty()) {
+        const Node& n = nodes_[stack.back()];
+        if (n.added && n.length > 0) {
+            pieces.push_back(stack.back());
+            runs.push_back({n.start, n.start + n.length, 0});
+        }
+        stack.pop_back();
+        if (n.left != kNil) stack.push_back(n.left);
+        if (n.right != kNil) stack.push_back(n.right);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (keep[i].added && keep[i].length > 0) {
+            runs.push_back({keep[i].start, keep[i].start + keep[i].length, 0});
+        }
+    }
+    std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.begin < b.begin; });
+    size_t merged = 0;
+    for (const Run& run : runs) {
+        if (merged > 0 && run.begin <= runs[merged - 1].end) {
+            runs[merged - 1].end = std::max(runs[merged - 1].end, run.end);
+        } else {
+            runs[merged++] = run;
+        }
+    }
+    runs.resize(merged);
+
+    size_t total = 0;
+    for (const Run& run : runs) total += run.end - run.begin;
+    std::wstring compacted;
+    compacted.reserve(total);
+    for (Run& run : runs) {
+        run.to = compacted.size();
+        compacted.append(added_, run.begin, run.end - run.begin);
+    }
+    auto moved = [&](size_t start) {
+        auto next = std::upper_bound(runs.begin(), runs.end(), start,
+                                     [](size_t s, const Run& run) { return s < run.begin; });
+        const Run& run = *(next - 1);
+        return run.to + (start - run.begin);
+    };
+    for (uint32_t node : pieces) nodes_[node].start = moved(nodes_[node].start);
+    for (size_t i = 0; i < count; i++) {
+        if (keep[i].added && keep[i].length > 0) keep[i].start = moved(keep[i].start);
+    }
+
+    added_ = std::move(compacted);
+    std::vector<size_t>().swap(addedNewlines_);
+    appendNewlines(addedNewlines_, added_, 0);
+    lastInsert_ = kNil;
+}
+
+void TextBuffer::collectSpans(uint32_t node, size_t base, size_t from, size_t to,
+                              std::vector<Span>& out) const {
+    while (node != kNil && base < to) {
+        const Node& n = nodes_[node];
+        size_t leftLength = n.left == kNil ? 0 : nodes_[n.left].subLength;
+        if (from < base + leftLength) collectSpans(n.left, base, from, to, out);
+        size_t pieceBegin = base + leftLength;
+        size_t pieceEnd = pieceBegin + n.length;
+        size_t lo = std::max(from, pieceBegin);
+        size_t hi = std::min(to, pieceEnd);
+        if (lo < hi) out.push_back({n.added, n.start + (lo - pieceBegin), hi - lo});
+        if (to <= pieceEnd) return;
+        base = pieceEnd;
+        node = n.right;
+    }
+}
+
+void TextBuffer::spans(size_t pos, size_t len, std::vector<Span>& out) const {
+    if (len == 0 || pos >= size()) return;
+    collectSpans(root_, 0, pos, pos + std::min(len, size() - pos), out);
+}
+
+// The spans become pieces of their own, built into a treap before the one
+// split and two merges that splice them in
+void TextBuffer::insertSpans(size_t pos, const Span* spans, size_t count) {
+    uint32_t middle = kNil;
+    for (size_t i = 0; i < count; i++) {
+        const Span& s = spans[i];
+        const std::wstring& buffer = s.added ? added_ : original_;
+        if (s.length == 0 || s.start + s.length > buffer.size()) continue;
+        middle = merge(middle, makeNode(s.added, s.start, s.length));
+    }
+    if (middle == kNil) return;
+
+    pos = std::min(pos, size());
+    uint32_t left = kNil, right = kNil;
+    split(root_, pos, left, right);
+    root_ = merge(merge(left, middle), right);
+    lastInsert_ = kNil;
+}
+
+wchar_t TextBuffer::operator[](size_t pos) const {
+    uint32_t node = root_;
+    while (node != kNil) {
+        const Node& n = nodes_[node];
+        size_t leftLength = n.left == kNil ? 0 : nodes_[n.left].subLength;
+        if (pos < leftLength) {
+            node = n.left;
+        } else if (pos < leftLength + n.length) {
+            return bufferOf(n)[n.start + pos - leftLength];
+        } else {
+            pos -= leftLength + n.length;
+            node = n.right;
+        }
+    }
+    return L'\0';
+}
+
+std::wstring TextBuffer::substr(size_t pos, size_t len) const {
+    std::wstring out;
+    if (pos >= size()) return out;
+    out.reserve(std::min(len, size() - pos));
+    forEachChunk(pos, len, [&](const wchar_t* data, size_t count) {
+        out.append(data, count);
+    });
+    return out;
+}
+
+size_t TextBuffer::lineCount() const {
+    return 1 + (root_ == kNil ? 0 : nodes_[root_].subNewlines);
+}
+
+size_t TextBuffer::lineStart(size_t line) const {
+    if (line == 0) return 0;
+    if (line >= lineCount()) return size();
+
+    // Find the line-th newline; the line starts right after it
+    size_t k = line;
+    size_t base = 0;
+    uint32_t node = root_;
+    while (node != kNil) {
+        const Node& n = nodes_[node];
+        size_t leftLines = n.left == kNil ? 0 : nodes_[n.left].subNewlines;
+        size_t leftLength = n.left == kNil ? 0 : nodes_[n.left].subLength;
+        if (k <= leftLines) {
+            node = n.left;
+            continue;
+        }
+        k -= leftLines;
+        base += leftLength;
+        if (k <= n.newlines) {
+            const auto& offsets = newlinesOf(n);
+            auto first = std::lower_bound(offsets.begin(), offsets.end(), n.start);
+            return base + (first[k - 1] - n.start) + 1;
+        }
+        k -= n.newlines;
+        base += n.length;
+        node = n.right;
+    }
+    return size();
+}
+
+size_t TextBuffer::lineFromPos(size_t pos) const {
+    size_t line = 0;
+    uint32_t node = root_;
+    while (node != kNil) {
+        const Node& n = nodes_[node];
+        size_t leftLength = n.left == kNil ? 0 : nodes_[n.left].subLength;
+        size_t leftLines = n.left == kNil ? 0 : nodes_[n.left].subNewlines;
+        if (pos < leftLength) {
+            node = n.left;
+            continue;
+        }
+        line += leftLines;
+        pos -= leftLength;
+        if (pos < n.length) {
+            return line + countNewlines(n.added, n.start, n.start + pos);
+        }
+        line += n.newlines;
+        pos -= n.length;
+        node = n.right;
+    }
+    return line;
+}
@@ -0,0 +1,663 @@
+#include "text_search.h"
+
+#include <algorithm>
+#include <climits>
+#include <cwctype>
+#include <limits>
+
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)) && WCHAR_MAX <= 0xFFFF
+#include <emmintrin.h>
+#define TINTA_SEARCH_SSE2 1
+#endif
+
+namespace {
+
+constexpr size_t kNoPos = std::numeric_limits<size_t>::max();
+constexpr int kUnbounded = -1;
+constexpr int kMaxRepeat = 1000;
+// {n,m} copies its operand, so cap the program rather than the pattern
+constexpr size_t kMaxProgram = 20000;
+
+bool isSpaceChar(wchar_t c) {
+    return c == L' ' || c == L'\t' || c == L'\n' || c == L'\r' || c == L'\f' ||
+           c == L'\v' || iswspace(c);
+}
+
+bool isDigitChar(wchar_t c) {
+    return c >= L'0' && c <= L'9';
+}
+
+} // namespace
+
+size_t findChar(const wchar_t* text, size_t from, size_t end, wchar_t c) {
+    size_t i = from;
+#ifdef TINTA_SEARCH_SSE2
+    const __m128i needle = _mm_set1_epi16((short)c);
+    for (; i + 8 <= end; i += 8) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, needle));
+        if (mask != 0) {
+            unsigned bits = (unsigned)mask;
+            unsigned byte = 0;
+            while (!(bits & 1u)) { bits >>= 1; byte++; }
+            return i + byte / 2;
+        }
+    }
+#endif
+    for (; i < end; i++) {
+        if (text[i] == c) return i;
+    }
+    return end;
+}
+
+bool isSearchWordChar(wchar_t c) {
+    return c == L'_' || iswalnum(c);
+}
+
+// --- Character classes ---
+
+bool SearchPattern::CharClass::contains(wchar_t c) const {
+    for (const auto& range : ranges) {
+        if (c >= range.first && c <= range.second) return true;
+    }
+    if ((sets & Word) && isSearchWordChar(c)) return true;
+    if ((sets & NotWord) && !isSearchWordChar(c)) return true;
+    if ((sets & Digit) && isDigitChar(c)) return true;
+    if ((sets & NotDigit) && !isDigitChar(c)) return true;
+    if ((sets & Space) && isSpaceChar(c)) return true;
+    if ((sets & NotSpace) && !isSpaceChar(c)) return true;
+    return false;
+}
+
+// The text is folded, so a class written in uppercase has to be tried
+// against the uppercase form too. A negated class only matches when no
+// case of the character is in it.
+bool SearchPattern::CharClass::matches(wchar_t c) const {
+    bool in = contains(c);
+    if (!in) {
+        wchar_t upper = (wchar_t)towupper(c);
+        in = upper != c && contains(upper);
+    }
+    return in != negated;
+}
+
+// --- Parser: query -> syntax tree -> program ---
+
+class SearchPattern::Parser {
+public:
+    Parser(SearchPattern& pattern, std::wstring_view query)
+        : pattern_(pattern), query_(query) {}
+
+    bool parseRegex() {
+        root_ = parseAlternation();
+        if (failed()) return false;
+        if (pos_ < query_.size()) return fail(L"Unmatched )");
+        return true;
+    }
+
+    void parseLiteral() {
+        root_ = add(Node::Concat);
+        for (wchar_t c : query_) {
+            // charNode may grow nodes_, so take the reference after it
+            int node = charNode(c);
+            nodes_[root_].children.push_back(node);
+        }
+    }
+
+    bool emitProgram(bool wholeWord) {
+        auto& program = pattern_.program_;
+        if (wholeWord) program.push_back({Op::Assert, 0, (uint32_t)Assertion::NotWordBefore, 0});
+        if (!emit(root_)) return false;
+        if (wholeWord) program.push_back({Op::Assert, 0, (uint32_t)Assertion::NotWordAfter, 0});
+        program.push_back({Op::Match, 0, 0, 0});
+        return true;
+    }
+
+    const std::wstring& error() const { return error_; }
+
+private:
+    struct Node {
+        enum Kind { Empty, Char, Any, Class, Assert, Concat, Alternate, Repeat } kind = Empty;
+        wchar_t c = 0;
+        uint32_t value = 0;  // class index or Assertion
+        int min = 0;
+        int max = 0;
+        std::vector<int> children;
+    };
+    using Kind = Node::Kind;
+
+    int add(Kind kind) {
+        nodes_.emplace_back();
+        nodes_.back().kind = kind;
+        return (int)nodes_.size() - 1;
+    }
+
+    bool failed() const { return !error_.empty(); }
+
+    bool fail(const wchar_t* message) {
+        if (error_.empty()) error_ = message;
+        return false;
+    }
+
+    bool atEnd() const { return pos_ >= query_.size(); }
+    wchar_t peek() const { return query_[pos_]; }
+
+    int parseAlternation() {
+        int first = parseConcat();
+        if (atEnd() || peek() != L'|') return first;
+        int alt = add(Node::Alternate);
+        nodes_[alt].children.push_back(first);
+        while (!failed() && !atEnd() && peek() == L'|') {
+            pos_++;
+            int next = parseConcat();
+            nodes_[alt].children.push_back(next);
+        }
+        return alt;
+    }
+
+    int parseConcat() {
+        int concat = add(Node::Concat);
+        while (!failed() && !atEnd() && peek() != L'|' && peek() != L')') {
+            int item = parseRepeat();
+            if (failed()) break;
+            nodes_[concat].children.push_back(item);
+        }
+        return concat;
+    }
+
+    // {n}, {n,} or {n,m}; anything else leaves pos_ alone and the brace is
+    // taken literally
+    bool parseBraces(int& min, int& max) {
+        size_t p = pos_ + 1;
+        auto number = [&](int& out) {
+            size_t begin = p;
+            long value = 0;
+            while (p < query_.size() && isDigitChar(query_[p])) {
+                value = std::min<long>(value * 10 + (query_[p] - L'0'), kMaxRepeat + 1);
+                p++;
+            }
+            out = (int)value;
+            return p > begin;
+        };
+        if (!number(min)) return false;
+        max = min;
+        if (p < query_.size() && query_[p] == L',') {
+            p++;
+            if (!number(max)) max = kUnbounded;
+        }
+        if (p >= query_.size() || query_[p] != L'}') return false;
+        pos_ = p + 1;
+        return true;
+    }
+
+    int parseRepeat() {
+        int atom = parseAtom();
+        while (!failed() && !atEnd()) {
+            int min = 0, max = 0;
+            wchar_t c = peek();
+            if (c == L'*') { min = 0; max = kUnbounded; pos_++; }
+            else if (c == L'+') { min = 1; max = kUnbounded; pos_++; }
+            else if (c == L'?') { min = 0; max = 1; pos_++; }
+            else if (c == L'{' && parseBraces(min, max)) {}
+            else break;
+
+            if (min > kMaxRepeat || max > kMaxRepeat) {
+                fail(L"Repeat count too large");
+                break;
+            }
+            if (max != kUnbounded && max < min) {
+                fail(L"Invalid repeat range");
+                break;
+            }
+            // Lazy suffix: matches are leftmost-longest either way
+            if (!atEnd() && peek() == L'?') pos_++;
+
+            Kind kind = nodes_[atom].kind;
+            if (kind == Node::Assert || kind == Node::Empty) {
+                fail(L"Nothing to repeat");
+                break;
+            }
+            int repeat = add(Node::Repeat);
+            nodes_[repeat].min = min;
+            nodes_[repeat].max = max;
+            nodes_[repeat].children.push_back(atom);
+            atom = repeat;
+        }
+        return atom;
+    }
+
+    int classNode(CharClass cls) {
+        pattern_.classes_.push_back(std::move(cls));
+        int node = add(Node::Class);
+        nodes_[node].value = (uint32_t)(pattern_.classes_.size() - 1);
+        return node;
+    }
+
+    int charNode(wchar_t c) {
+        int node = add(Node::Char);
+        nodes_[node].c = (wchar_t)towlower(c);
+        return node;
+    }
+
+    int assertNode(Assertion assertion) {
+        int node = add(Node::Assert);
+        nodes_[node].value = (uint32_t)assertion;
+        return node;
+    }
+
+    // \w \d \s and their negations, shared by atoms and [...] members
+    static uint8_t shorthandSet(wchar_t c) {
+        switch (c) {
+            case L'w': return CharClass::Word;
+            case L'W': return CharClass::NotWord;
+            case L'd': return CharClass::Digit;
+            case L'D': return CharClass::NotDigit;
+            case L's': return CharClass::Space;
+            case L'S': return CharClass::NotSpace;
+        }
+        return 0;
+    }
+
+    // Escaped literal after a backslash; false for an unknown letter escape
+    bool escapedChar(wchar_t c, wchar_t& out) {
+        switch (c) {
+            case L'n': out = L'\n'; return true;
+            case L't': out = L'\t'; return true;
+            case L'r': out = L'\r'; return true;
+            case L'f': out = L'\f'; return true;
+            case L'v': out = L'\v'; return true;
+        }
+        if (iswalnum(c)) return false;
+        out = c;
+        return true;
+    }
+
+    int parseAtom() {
+        wchar_t c = peek();
+        pos_++;
+        switch (c) {
+            case L'(': {
+                if (pos_ < query_.size() && peek() == L'?') {
+                    if (pos_ + 1 < query_.size() && query_[pos_ + 1] == L':') {
+                        pos_ += 2;
+                    } else {
+                        fail(L"Unsupported group");
+                        return add(Node::Empty);
+                    }
+                }
+                int inner = parseAlternation();
+                if (failed()) return inner;
+                if (atEnd() || peek() != L')') {
+                    fail(L"Missing )");
+                    return inner;
+                }
+                pos_++;
+                return inner;
+            }
+            case L'[':
+                return parseClass();
+            case L'.':
+                return add(Node::Any);
+            case L'^':
+                return assertNode(Assertion::LineStart);
+            case L'$':
+                return assertNode(Assertion::LineEnd);
+            case L'*':
+            case L'+':
+            case L'?':
+                fail(L"Nothing to repeat");
+                return add(Node::Empty);
+            case L'\\': {
+                if (atEnd()) {
+                    fail(L"Trailing backslash");
+                    return add(Node::Empty);
+                }
+                wchar_t e = peek();
+                pos_++;
+                if (e == L'b') return assertNode(Assertion::WordBoundary);
+                if (e == L'B') return assertNode(Assertion::NotWordBoundary);
+                if (uint8_t set = shorthandSet(e)) {
+                    CharClass cls;
+                    cls.sets = set;
+                    return classNode(std::move(cls));
+                }
+                wchar_t literal = 0;
+                if (!escapedChar(e, literal)) {
+                    fail(L"Unknown escape");
+                    return add(Node::Empty);
+                }
+                return charNode(literal);
+            }
+        }
+        return charNode(c);
+    }
+
+    int parseClass() {
+        CharClass cls;
+        if (!atEnd() && peek() == L'^') {
+            cls.negated = true;
+            pos_++;
+        }
+        bool first = true;
+        while (!atEnd() && (peek() != L']' || first)) {
+            first = false;
+            wchar_t lo = peek();
+            pos_++;
+            if (lo == L'\\') {
+                if (atEnd()) break;
+                wchar_t e = peek();
+                pos_++;
+                if (uint8_t set = shorthandSet(e)) {
+                    cls.sets |= set;
+                    continue;
+                }
+                if (!escapedChar(e, lo)) {
+                    fail(L"Unknown escape");
+                    return add(Node::Empty);
+                }
+            }
+            wchar_t hi = lo;
+            if (pos_ + 1 < query_.size() && peek() == L'-' && query_[pos_ + 1] != L']') {
+                pos_++;
+                hi = peek();
+                pos_++;
+                if (hi == L'\\') {
+                    if (atEnd() || !escapedChar(peek(), hi)) {
+                        fail(L"Invalid class range");
+                        return add(Node::Empty);
+                    }
+                    pos_++;
+                }
+                if (hi < lo) {
+                    fail(L"Invalid class range");
+                    return add(Node::Empty);
+                }
+            }
+            cls.ranges.push_back({lo, hi});
+        }
+        if (atEnd()) {
+            fail(L"Missing ]");
+            return add(Node::Empty);
+        }
+        pos_++;
+        return classNode(std::move(cls));
+    }
+
+    uint32_t here() const { return (uint32_t)pattern_.program_.size(); }
+
+    bool push(Inst inst) {
+        if (pattern_.program_.size() >= kMaxProgram) return fail(L"Pattern too large");
+        pattern_.program_.push_back(inst);
+        return true;
+    }
+
+    bool emit(int index) {
+        const Node& node = nodes_[index];
+        auto& program = pattern_.program_;
+        switch (node.kind) {
+            case Node::Empty:
+                return true;
+            case Node::Char:
+                return push({Op::Char, node.c, 0, 0});
+            case Node::Any:
+                return push({Op::Any, 0, 0, 0});
+            case Node::Class:
+                return push({Op::Class, 0, node.value, 0});
+            case Node::Assert:
+                return push({Op::Assert, 0, node.value, 0});
+            case Node::Concat:
+                for (int child : node.children) {
+                    if (!emit(child)) return false;
+                }
+                return true;
+            case Node::Alternate: {
+                // split L1, next; L1: a; jump end; next: split L2, ... ; last
+                std::vector<uint32_t> jumps;
+                for (size_t i = 0; i + 1 < node.children.size(); i++) {
+                    uint32_t split = here();
+                    if (!push({Op::Split, 0, split + 1, 0})) return false;
+                    if (!emit(node.children[i])) return false;
+                    jumps.push_back(here());
+                    if (!push({Op::Jump, 0, 0, 0})) return false;
+                    program[split].y = here();
+                }
+                if (!emit(node.children.back())) return false;
+                for (uint32_t jump : jumps) program[jump].x = here();
+                return true;
+            }
+            case Node::Repeat: {
+                int child = node.children[0];
+                for (int i = 0; i < node.min; i++) {
+                    if (!emit(child)) return false;
+                }
+                if (node.max == kUnbounded) {
+                    uint32_t loop = here();
+                    if (!push({Op::Split, 0, loop + 1, 0})) return false;
+                    if (!emit(child)) return false;
+                    if (!push({Op::Jump, 0, loop, 0})) return false;
+                    program[loop].y = here();
+                    return true;
+                }
+                std::vector<uint32_t> splits;
+                for (int i = node.min; i < node.max; i++) {
+                    splits.push_back(here());
+                    if (!push({Op::Split, 0, here() + 1, 0})) return false;
+                    if (!emit(child)) return false;
+                }
+                for (uint32_t split : splits) program[split].y = here();
+                return true;
+            }
+        }
+        return true;
+    }
+
+    SearchPattern& pattern_;
+    std::wstring_view query_;
+    size_t pos_ = 0;
+    std::vector<Node> nodes_;
+    int root_ = -1;
+    std::wstring error_;
+};
+
+// --- Compilation ---
+
+void SearchPattern::clear() {
+    program_.clear();
+    classes_.clear();
+    firstChar_ = 0;
+    error_.clear();
+}
+
+bool SearchPattern::compile(std::wstring_view query, bool regex, bool wholeWord) {
+    clear();
+    if (query.empty()) return false;
+
+    Parser parser(*this, query);
+    bool ok = true;
+    if (regex) {
+        ok = parser.parseRegex();
+    } else {
+        parser.parseLiteral();
+    }
+    if (ok) ok = parser.emitProgram(wholeWord);
+    if (!ok) {
+        error_ = parser.error();
+        program_.clear();
+        classes_.clear();
+        return false;
+    }
+
+    // Prefilter: when every path has to consume one particular character
+    // first, idle stretches of text are skipped with findChar
+    uint32_t pc = 0;
+    for (size_t guard = 0; guard < program_.size(); guard++) {
+        const Inst& inst = program_[pc];
+        if (inst.op == Op::Jump) {
+            pc = inst.x;
+        } else if (inst.op == Op::Assert) {
+            pc++;
+        } else {
+            if (inst.op == Op::Char) firstChar_ = inst.c;
+            break;
+        }
+    }
+    return true;
+}
+
+// --- Matching ---
+
+struct SearchPattern::Scan {
+    const wchar_t* text;
+    size_t size;
+    bool final;
+    std::vector<Thread> current;
+    std::vector<Thread> next;
+    std::vector<uint32_t> stamps;  // stamps[pc] == stamp: pc is on the list being built
+    uint32_t stamp = 0;
+    std::vector<uint32_t> stack;
+    size_t bestStart = kNoPos;
+    size_t bestEnd = 0;
+    size_t blockedStart = kNoPos;  // a thread waiting on text past size
+};
+
+bool SearchPattern::step(const Inst& inst, wchar_t c) const {
+    switch (inst.op) {
+        case Op::Char: return inst.c == c;
+        case Op::Any: return c != L'\n';
+        case Op::Class: return classes_[inst.x].matches(c);
+        default: return false;
+    }
+}
+
+// Follow the empty transitions from pc at text position pos and add every
+// consuming instruction reached to list. A pc already on the list belongs
+// to a thread that started no later, so this one is dropped there.
+void SearchPattern::addThread(Scan& scan, std::vector<Thread>& list, uint32_t pc,
+                              size_t start, size_t pos) const {
+    bool knowNext = pos < scan.size || scan.final;
+    wchar_t prev = pos > 0 ? scan.text[pos - 1] : 0;
+    wchar_t next = pos < scan.size ? scan.text[pos] : 0;
+    bool prevWord = pos > 0 && isSearchWordChar(prev);
+    bool nextWord = pos < scan.size && isSearchWordChar(next);
+
+    scan.stack.clear();
+    scan.stack.push_back(pc);
+    while (!scan.stack.empty()) {
+        uint32_t at = scan.stack.back();
+        scan.stack.pop_back();
+        if (scan.stamps[at] == scan.stamp) continue;
+        scan.stamps[at] = scan.stamp;
+
+        const Inst& inst = program_[at];
+        switch (inst.op) {
+            case Op::Jump:
+                scan.stack.push_back(inst.x);
+                break;
+            case Op::Split:
+                scan.stack.push_back(inst.y);
+                scan.stack.push_back(inst.x);
+                break;
+            case Op::Assert: {
+                auto assertion = (Assertion)inst.x;
+                bool holds = false;
+                if (assertion == Assertion::LineStart) {
+                    holds = pos == 0 || prev == L'\n';
+                } else if (assertion == Assertion::NotWordBefore) {
+                    holds = !prevWord;
+                } else if (!knowNext) {
+                    // Depends on text that has not arrived yet
+                    scan.blockedStart = std::min(scan.blockedStart, start);
+                    break;
+                } else if (assertion == Assertion::LineEnd) {
+                    holds = pos >= scan.size || next == L'\n';
+                } else if (assertion == Assertion::WordBoundary) {
+                    holds = prevWord != nextWord;
+                } else if (assertion == Assertion::NotWordBoundary) {
+                    holds = prevWord == nextWord;
+                } else if (assertion == Assertion::NotWordAfter) {
+                    holds = !nextWord;
+                }
+                if (holds) scan.stack.push_back(at + 1);
+                break;
+            }
+            case Op::Match:
+                // Leftmost wins, then longest; empty matches are never useful
+                // to highlight
+                if (pos > start &&
+                    (scan.bestStart == kNoPos || start < scan.bestStart ||
+                     (start == scan.bestStart && pos > scan.bestEnd))) {
+                    scan.bestStart = start;
+                    scan.bestEnd = pos;
+                }
+                break;
+            default:
+                list.push_back({at, start});
+                break;
+        }
+    }
+}
+
+size_t SearchPattern::find(const wchar_t* text, size_t size, size_t from, bool final,
+                           std::vector<Match>& out) const {
+    if (program_.empty() || from >= size) return std::max(from, size);
+
+    Scan scan;
+    scan.text = text;
+    scan.size = size;
+    scan.final = final;
+    scan.stamps.assign(program_.size(), 0);
+    scan.stamp = 1;
+
+    size_t pos = from;
+    for (;;) {
+        // Threads on scan.current are sorted by start, so a new attempt at
+        // pos goes last: it only gets the pcs no earlier start reached
+        if (scan.bestStart == kNoPos) {
+            if (scan.current.empty() && firstChar_ != 0) {
+                size_t skip = findChar(text, pos, size, firstChar_);
+                if (skip != pos) {
+                    pos = skip;
+                    scan.stamp++;
+                }
+            }
+            addThread(scan, scan.current, 0, pos, pos);
+        }
+
+        if (scan.current.empty()) {
+            if (scan.bestStart != kNoPos) {
+                if (!final && scan.blockedStart <= scan.bestStart) return scan.blockedStart;
+                out.push_back({scan.bestStart, scan.bestEnd - scan.bestStart});
+                pos = scan.bestEnd;
+                scan.bestStart = kNoPos;
+                scan.blockedStart = kNoPos;
+                scan.stamp++;
+                continue;
+            }
+            if (pos >= size) return final ? size : std::min(scan.blockedStart, size);
+            pos++;
+            scan.stamp++;
+            continue;
+        }
+
+        if (pos >= size) {
+            if (!final) {
+                size_t resume = std::min(scan.current.front().start, scan.blockedStart);
+                return std::min(resume, scan.bestStart);
+            }
+            scan.current.clear();
+            continue;
+        }
+
+        wchar_t c = text[pos];
+        scan.next.clear();
+        scan.stamp++;
+        for (const Thread& thread : scan.current) {
+            if (scan.bestStart != kNoPos && thread.start > scan.bestStart) continue;
+            if (step(program_[thread.pc], c)) {
+                addThread(scan, scan.next, thread.pc + 1, thread.start, pos + 1);
+            }
+        }
+        scan.current.swap(scan.next);
+        pos++;
+    }
+}
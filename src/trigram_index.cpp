@@ -0,0 +1,361 @@
+#include "trigram_index.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <iterator>
+
+namespace {
+
+// Bulk removals (a deleted directory, a re-rooted crawl) leave dead ids in
+// the posting lists; past this many, and more dead than live, rebuild them
+constexpr size_t kCompactDead = 1024;
+constexpr uint32_t kNoId = UINT32_MAX;
+
+std::wstring_view trimmed(std::wstring_view s) {
+    size_t first = 0;
+    while (first < s.size() && (s[first] == L' ' || s[first] == L'\t')) first++;
+    size_t last = s.size();
+    while (last > first && (s[last - 1] == L' ' || s[last - 1] == L'\t')) last--;
+    return s.substr(first, last - first);
+}
+
+// List items and block quotes do not turn into setext headings when the
+// next line is a run of '-' or '='
+bool startsContainer(std::wstring_view line) {
+    if (line.empty()) return false;
+    wchar_t c = line[0];
+    if (c == L'>') return true;
+    if ((c == L'-' || c == L'*' || c == L'+') && (line.size() == 1 || line[1] == L' ')) return true;
+    size_t digits = 0;
+    while (digits < line.size() && line[digits] >= L'0' && line[digits] <= L'9') digits++;
+    return digits > 0 && digits < line.size() && (line[digits] == L'.' || line[digits] == L')');
+}
+
+// Heading text as the TOC shows it: emphasis and code markers dropped,
+// links and images reduced to their text
+std::wstring plainHeading(std::wstring_view s) {
+    std::wstring out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        wchar_t c = s[i];
+        if (c == L'*' || c == L'`' || c == L'[') continue;
+        if (c == L'!' && i + 1 < s.size() && s[i + 1] == L'[') continue;
+        if (c == L']' && i + 1 < s.size() && s[i + 1] == L'(') {
+            size_t close = s.find(L')', i + 2);
+            if (close != std::wstring_view::npos) {
+                i = close;
+                continue;
+            }
+        }
+        out += c;
+    }
+    return out;
+}
+
+void addHeading(std::vector<TrigramIndex::Heading>& out, std::wstring_view title, int level) {
+    TrigramIndex::Heading heading;
+    heading.text = plainHeading(title);
+    if (heading.text.empty()) return;
+    heading.folded = heading.text;
+    TrigramIndex::fold(heading.folded);
+    heading.level = level;
+    out.push_back(std::move(heading));
+}
+
+size_t bodySize(const TrigramIndex::Entry& entry) {
+    return entry.folded.size() * sizeof(wchar_t);
+}
+
+uint64_t trigramKey(const wchar_t* p) {
+    return ((uint64_t)(uint16_t)p[0] << 32) | ((uint64_t)(uint16_t)p[1] << 16) |
+           (uint64_t)(uint16_t)p[2];
+}
+
+} // namespace
+
+void TrigramIndex::fold(std::wstring& text) {
+    for (wchar_t& c : text) c = (wchar_t)towlower(c);
+}
+
+std::vector<TrigramIndex::Heading> TrigramIndex::scanHeadings(std::wstring_view text) {
+    std::vector<Heading> out;
+    wchar_t fence = 0;
+    size_t fenceLength = 0;
+    std::wstring_view paragraph;  // previous line, when a rule below it makes it a heading
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(L'\n', pos);
+        if (end == std::wstring_view::npos) end = text.size();
+        std::wstring_view line = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (!line.empty() && line.back() == L'\r') line.remove_suffix(1);
+
+        size_t indent = 0;
+        while (indent < line.size() && line[indent] == L' ') indent++;
+        bool code = indent >= 4;
+        std::wstring_view body = line.substr(indent);
+
+        if (!code && body.size() >= 3 && (body[0] == L'`' || body[0] == L'~')) {
+            size_t run = 0;
+            while (run < body.size() && body[run] == body[0]) run++;
+            if (run >= 3) {
+                if (!fence) {
+                    fence = body[0];
+                    fenceLength = run;
+                } else if (body[0] == fence && run >= fenceLength &&
+                           trimmed(body.substr(run)).empty()) {
+                    fence = 0;
+                }
+                paragraph = {};
+                continue;
+            }
+        }
+        if (fence) continue;
+
+        if (!code && !body.empty() && body[0] == L'#') {
+            size_t level = 0;
+            while (level < body.size() && body[level] == L'#') level++;
+            if (level <= 6 && (level == body.size() || body[level] == L' ' || body[level] == L'\t')) {
+                std::wstring_view title = trimmed(body.substr(level));
+                size_t closing = title.size();
+                while (closing > 0 && title[closing - 1] == L'#') closing--;
+                if (closing == 0 || title[closing - 1] == L' ' || title[closing - 1] == L'\t') {
+                    title = trimmed(title.substr(0, closing));
+                }
+                addHeading(out, title, (int)level);
+                paragraph = {};
+                continue;
+            }
+        }
+
+        std::wstring_view rest = trimmed(body);
+        if (!code && !paragraph.empty() && !rest.empty() && (rest[0] == L'=' || rest[0] == L'-') &&
+            rest.find_first_not_of(rest[0]) == std::wstring_view::npos) {
+            addHeading(out, paragraph, rest[0] == L'=' ? 1 : 2);
+            paragraph = {};
+            continue;
+        }
+
+        paragraph = (rest.empty() || code || startsContainer(body)) ? std::wstring_view() : rest;
+    }
+    return out;
+}
+
+std::vector<uint64_t> TrigramIndex::trigramsOf(std::wstring_view folded) {
+    std::vector<uint64_t> out;
+    if (folded.size() < 3) return out;
+    out.reserve(folded.size() - 2);
+    for (size_t i = 0; i + 3 <= folded.size(); i++) out.push_back(trigramKey(folded.data() + i));
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+TrigramIndex::Entry TrigramIndex::prepare(std::wstring path, std::wstring_view content,
+                                          bool withBody) {
+    Entry entry;
+    entry.foldedPath = path;
+    fold(entry.foldedPath);
+    entry.path = std::move(path);
+    entry.headings = scanHeadings(content);
+    if (withBody) {
+        entry.folded.assign(content);
+        fold(entry.folded);
+    }
+    entry.trigrams = trigramsOf(entry);
+    return entry;
+}
+
+// The path and headings are posted too, so their matches survive the
+// narrowing when the body is not kept
+std::vector<uint64_t> TrigramIndex::trigramsOf(const Entry& entry) {
+    std::vector<uint64_t> text = trigramsOf(entry.folded);
+    std::vector<uint64_t> extra = trigramsOf(entry.foldedPath);
+    for (const Heading& h : entry.headings) {
+        std::vector<uint64_t> more = trigramsOf(h.folded);
+        extra.insert(extra.end(), more.begin(), more.end());
+    }
+    std::sort(extra.begin(), extra.end());
+    extra.erase(std::unique(extra.begin(), extra.end()), extra.end());
+
+    std::vector<uint64_t> out;
+    out.reserve(text.size() + extra.size());
+    std::set_union(text.begin(), text.end(), extra.begin(), extra.end(), std::back_inserter(out));
+    return out;
+}
+
+void TrigramIndex::post(uint32_t id, const std::vector<uint64_t>& trigrams) {
+    for (uint64_t t : trigrams) postings_[t].push_back(id);
+}
+
+void TrigramIndex::add(Entry entry) {
+    remove(entry.path);
+    uint32_t id = (uint32_t)docs_.size();
+    post(id, entry.trigrams);
+    entry.trigrams = {};
+    byPath_[entry.foldedPath] = id;
+    if (!entry.folded.empty()) {
+        bodies_.push_back(id);
+        bodyBytes_ += bodySize(entry);
+    }
+    docs_.push_back({std::move(entry), true});
+    evictBodies();
+}
+
+// Drop the oldest bodies until the rest fit. The postings stay: a candidate
+// without a body just fails the text check.
+void TrigramIndex::evictBodies() {
+    while (bodyBytes_ > maxBodyBytes_ && !bodies_.empty()) {
+        Doc& doc = docs_[bodies_.front()];
+        bodies_.pop_front();
+        if (!doc.live || doc.entry.folded.empty()) continue;
+        bodyBytes_ -= bodySize(doc.entry);
+        std::wstring().swap(doc.entry.folded);
+    }
+}
+
+void TrigramIndex::remove(std::wstring_view path) {
+    std::wstring key(path);
+    fold(key);
+    auto it = byPath_.find(key);
+    if (it == byPath_.end()) return;
+    Doc& doc = docs_[it->second];
+    bodyBytes_ -= bodySize(doc.entry);
+    doc.live = false;
+    doc.entry = {};
+    byPath_.erase(it);
+    dead_++;
+    if (dead_ > kCompactDead && dead_ > byPath_.size()) compact();
+}
+
+void TrigramIndex::removeUnder(std::wstring_view directory) {
+    std::wstring prefix(directory);
+    fold(prefix);
+    if (!prefix.empty()) prefix += L'\\';
+    std::vector<std::wstring> paths;
+    for (const auto& [key, id] : byPath_) {
+        if (key.compare(0, prefix.size(), prefix) == 0) paths.push_back(key);
+    }
+    for (const auto& path : paths) remove(path);
+}
+
+void TrigramIndex::clear() {
+    docs_.clear();
+    byPath_.clear();
+    postings_.clear();
+    dead_ = 0;
+    bodies_.clear();
+    bodyBytes_ = 0;
+}
+
+// Renumber the live documents densely and post them again; the trigrams
+// were dropped after add, so they are recomputed from the entry
+void TrigramIndex::compact() {
+    std::vector<Doc> live;
+    live.reserve(byPath_.size());
+    std::vector<uint32_t> renumbered(docs_.size(), kNoId);
+    for (uint32_t id = 0; id < docs_.size(); id++) {
+        if (!docs_[id].live) continue;
+        renumbered[id] = (uint32_t)live.size();
+        live.push_back(std::move(docs_[id]));
+    }
+    docs_ = std::move(live);
+    std::deque<uint32_t> bodies;
+    for (uint32_t id : bodies_) {
+        if (renumbered[id] != kNoId && !docs_[renumbered[id]].entry.folded.empty()) {
+            bodies.push_back(renumbered[id]);
+        }
+    }
+    bodies_.swap(bodies);
+    byPath_.clear();
+    postings_.clear();
+    dead_ = 0;
+    for (uint32_t id = 0; id < docs_.size(); id++) {
+        const Entry& entry = docs_[id].entry;
+        byPath_[entry.foldedPath] = id;
+        post(id, trigramsOf(entry));
+    }
+}
+
+std::vector<TrigramIndex::Hit> TrigramIndex::search(std::wstring_view query, std::wstring_view scope,
+                                                   size_t limit) const {
+    std::vector<Hit> hits;
+    std::wstring q(query);
+    fold(q);
+    if (q.empty() || limit == 0) return hits;
+    std::wstring prefix(scope);
+    fold(prefix);
+    if (!prefix.empty()) prefix += L'\\';
+
+    std::vector<uint32_t> candidates;
+    bool narrowed = q.size() >= 3;
+    if (narrowed) {
+        std::vector<const std::vector<uint32_t>*> lists;
+        for (uint64_t t : trigramsOf(q)) {
+            auto it = postings_.find(t);
+            if (it == postings_.end()) return hits;
+            lists.push_back(&it->second);
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](const auto* a, const auto* b) { return a->size() < b->size(); });
+        candidates = *lists[0];
+        std::vector<uint32_t> next;
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            next.clear();
+            std::set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(),
+                                  lists[i]->end(), std::back_inserter(next));
+            candidates.swap(next);
+        }
+    } else {
+        candidates.resize(docs_.size());
+        for (uint32_t id = 0; id < docs_.size(); id++) candidates[id] = id;
+    }
+
+    struct Found {
+        const Entry* entry;
+        const Heading* heading;
+    };
+    std::vector<Found> names, headings, bodies;
+    for (uint32_t id : candidates) {
+        const Doc& doc = docs_[id];
+        if (!doc.live) continue;
+        const Entry& e = doc.entry;
+        if (e.foldedPath.compare(0, prefix.size(), prefix) != 0) continue;
+        bool matched = false;
+        if (std::wstring_view(e.foldedPath).substr(prefix.size()).find(q) != std::wstring_view::npos) {
+            names.push_back({&e, nullptr});
+            matched = true;
+        }
+        for (const Heading& h : e.headings) {
+            if (h.folded.find(q) != std::wstring::npos) {
+                headings.push_back({&e, &h});
+                matched = true;
+            }
+        }
+        if (!matched && narrowed && e.folded.find(q) != std::wstring::npos) {
+            bodies.push_back({&e, nullptr});
+        }
+    }
+
+    auto byPath = [](const Found& a, const Found& b) {
+        return a.entry->foldedPath < b.entry->foldedPath;
+    };
+    auto emit = [&](std::vector<Found>& group, HitKind kind) {
+        std::stable_sort(group.begin(), group.end(), byPath);
+        for (const Found& f : group) {
+            if (hits.size() >= limit) return;
+            Hit hit{kind, f.entry->path.substr(prefix.size()), {}, 0, {}};
+            if (f.heading) {
+                hit.heading = f.heading->text;
+                hit.level = f.heading->level;
+                hit.anchor = f.heading->anchor;
+            }
+            hits.push_back(std::move(hit));
+        }
+    };
+    emit(names, HitKind::Name);
+    emit(headings, HitKind::Heading);
+    emit(bodies, HitKind::Body);
+    return hits;
+}
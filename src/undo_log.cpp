@@ -0,0 +1,127 @@
+#include "undo_log.h"
+
+bool UndoLog::joinsGroup(const Edit& last, Kind kind, size_t position, size_t length,
+                         uint64_t timeMs) const {
+    if (!last.burst || last.kind != kind) return false;
+    if (timeMs < last.time || timeMs - last.time > kBurstMs) return false;
+    if (kind == Kind::Insert) return position == last.position + last.length;
+    // Backspace walks left from the last delete, Delete stays put
+    return position + length == last.position || position == last.position;
+}
+
+void UndoLog::record(Kind kind, size_t position, const TextBuffer::Span* spans, size_t count,
+                     size_t cursorBefore, size_t cursorAfter, uint64_t timeMs, bool burst) {
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) length += spans[i].length;
+    if (length == 0) return;
+
+    // A new edit forgets what was undone
+    if (applied_ < edits_.size()) {
+        addedChars_ -= addedChars(edits_[applied_].firstSpan, spans_.size());
+        spans_.resize(edits_[applied_].firstSpan);
+        edits_.resize(applied_);
+    }
+
+    bool joins = burst && !edits_.empty() &&
+                 joinsGroup(edits_.back(), kind, position, length, timeMs);
+    if (joins) {
+        Edit& last = edits_.back();
+        TextBuffer::Span& tail = spans_.back();
+        bool extends = last.spanCount > 0 && tail.added == spans[0].added &&
+                       tail.start + tail.length == spans[0].start;
+
+        // Typing appends to the add buffer right after the previous insert
+        if (kind == Kind::Insert && count == 1 && extends) {
+            tail.length += length;
+            if (tail.added) addedChars_ += length;
+            last.length += length;
+            last.cursorAfter = cursorAfter;
+            last.time = timeMs;
+            return;
+        }
+        // Forward deletes remove the text that followed the last one
+        if (kind == Kind::Delete && position == last.position) {
+            size_t first = 0;
+            if (extends) {
+                tail.length += spans[0].length;
+                first = 1;
+            }
+            spans_.insert(spans_.end(), spans + first, spans + count);
+            addedChars_ += addedChars(spans_.size() - (count - first), spans_.size());
+            if (extends && tail.added) addedChars_ += spans[0].length;
+            last.spanCount += count - first;
+            last.length += length;
+            last.cursorAfter = cursorAfter;
+            last.time = timeMs;
+            trim();
+            return;
+        }
+    }
+
+    Edit edit;
+    edit.kind = kind;
+    edit.groupStart = !joins;
+    edit.burst = burst;
+    edit.position = position;
+    edit.length = length;
+    edit.firstSpan = spans_.size();
+    edit.spanCount = count;
+    edit.cursorBefore = cursorBefore;
+    edit.cursorAfter = cursorAfter;
+    edit.time = timeMs;
+    spans_.insert(spans_.end(), spans, spans + count);
+    addedChars_ += addedChars(edit.firstSpan, spans_.size());
+    edits_.push_back(edit);
+    applied_ = edits_.size();
+    trim();
+}
+
+void UndoLog::clear() {
+    edits_ = {};
+    spans_ = {};
+    applied_ = 0;
+    addedChars_ = 0;
+}
+
+size_t UndoLog::addedChars(size_t first, size_t last) const {
+    size_t chars = 0;
+    for (size_t i = first; i < last; i++) {
+        if (spans_[i].added) chars += spans_[i].length;
+    }
+    return chars;
+}
+
+// The document length stands in for the add-buffer text its pieces name:
+// it can only overstate it, which at worst compacts a little later
+void UndoLog::releaseText(TextBuffer& text) {
+    size_t named = text.size() + addedChars_;
+    if (text.addedSize() < kMinReleaseChars || text.addedSize() / 2 <= named) return;
+    text.compactAdded(spans_.data(), spans_.size());
+}
+
+// Drop whole groups from the front until a quarter of the cap is free, so
+// the arrays are shifted once per quarter rather than on every edit. The
+// newest group always stays, however large the text it names.
+void UndoLog::trim() {
+    if (bytes() <= maxBytes_) return;
+    size_t target = maxBytes_ - maxBytes_ / 4;
+    size_t drop = 0;
+    size_t droppedChars = 0;
+    for (size_t i = 1; i < edits_.size(); i++) {
+        if (!edits_[i].groupStart) continue;
+        droppedChars += addedChars(edits_[drop].firstSpan, edits_[i].firstSpan);
+        drop = i;
+        size_t rest = (edits_.size() - i) * sizeof(Edit) +
+                      (spans_.size() - edits_[i].firstSpan) * sizeof(TextBuffer::Span) +
+                      (addedChars_ - droppedChars) * sizeof(wchar_t);
+        if (rest <= target) break;
+    }
+    if (drop == 0) return;
+
+    size_t firstSpan = edits_[drop].firstSpan;
+    addedChars_ -= droppedChars;
+    edits_.erase(edits_.begin(), edits_.begin() + drop);
+    spans_.erase(spans_.begin(), spans_.begin() + firstSpan);
+    for (Edit& edit : edits_) edit.firstSpan -= firstSpan;
+    applied_ -= drop;
+}
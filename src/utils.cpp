@@ -5,11 +5,11 @@
 #include <shellapi.h>
 #include <algorithm>
 
-std::wstring toWide(const std::string& str) {
+std::wstring toWide(std::string_view str) {
     if (str.empty()) return L"";
-    int len = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(), nullptr, 0);
+    int len = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.length(), nullptr, 0);
     std::wstring result(len, 0);
-    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(), &result[0], len);
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.length(), &result[0], len);
     return result;
 }
 
@@ -77,7 +77,7 @@ const App::TextRect* findTextRectAt(const App& app, int x, int y) {
     const auto* line = findLineBucketAt(app, (float)y);
     if (!line) return nullptr;
 
-    for (size_t idx : line->textRectIndices) {
+    for (size_t idx = line->firstTextRect; idx < line->firstTextRect + line->textRectCount; idx++) {
         const auto& tr = app.textRects[idx];
         if (x >= tr.rect.left && x <= tr.rect.right &&
             y >= tr.rect.top && y <= tr.rect.bottom) {
@@ -190,6 +190,14 @@ std::string slugifyHeading(const std::wstring& text) {
     return out;
 }
 
+std::string nextHeadingId(std::unordered_map<std::string, int>& counts, const std::wstring& text) {
+    std::string baseId = slugifyHeading(text);
+    int& n = counts[baseId];
+    std::string id = (n == 0) ? baseId : (baseId + "-" + std::to_string(n));
+    n++;
+    return id;
+}
+
 void scrollToHeadingY(App& app, float headingY) {
     float targetY = headingY - 20.0f;
     float maxScroll = std::max(0.0f, app.contentHeight - app.height);
@@ -203,7 +211,8 @@ void scrollToHeadingY(App& app, float headingY) {
 bool scrollToHeadingId(App& app, const std::string& id) {
     // Headings populate during the viewport-first background layout; an
     // early click on an anchor into a not-yet-laid-out section would miss.
-    // Finish the layout synchronously before declaring the target absent.
+    // Lay out from that heading first, or failing that finish the layout
+    // synchronously, before declaring the target absent.
     for (int attempt = 0; attempt < 2; attempt++) {
         for (const auto& h : app.headings) {
             if (h.id == id) {
@@ -212,6 +221,7 @@ bool scrollToHeadingId(App& app, const std::string& id) {
             }
         }
         if (app.layoutComplete && !app.layoutDirty) break;
+        if (attempt == 0 && layoutFromHeading(app, id)) continue;
         ensureLayoutComplete(app);
     }
     return false;
@@ -246,12 +256,12 @@ void copyToClipboard(HWND hwnd, const std::wstring& text) {
     CloseClipboard();
 }
 
-void extractText(const ElementPtr& elem, std::wstring& out) {
+void extractText(const Element* elem, std::wstring& out) {
     if (!elem) return;
 
     switch (elem->type) {
         case ElementType::Text:
-            out += toWide(elem->text);
+            out += elem->wtext;
             break;
         case ElementType::SoftBreak:
             out += L" ";
@@ -271,14 +281,14 @@ void extractText(const ElementPtr& elem, std::wstring& out) {
             out += L"\n";
             for (const auto& child : elem->children) {
                 if (child->type == ElementType::Text) {
-                    out += toWide(child->text);
+                    out += child->wtext;
                 }
             }
             out += L"\n\n";
             break;
         }
         case ElementType::MermaidDiagram:
-            out += toWide(elem->text);
+            out += elem->wtext;
             if (!out.empty() && out.back() != L'\n') out += L"\n";
             break;
         case ElementType::Ruby:
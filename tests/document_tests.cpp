@@ -46,24 +46,26 @@ int main() {
             if (child->type == qmd::ElementType::Highlight) {
                 highlights++;
                 check(!child->children.empty() &&
-                      child->children[0]->text == "mark \xe4\xb8\xad\xe6\x96\x87",
-                      "highlight content preserved incl. CJK");
+                      child->children[0]->wtext == L"mark \u4e2d\u6587",
+                      "highlight text is widened to UTF-16 once at parse time");
+                check(!child->children.empty() && child->children[0]->text.empty(),
+                      "the UTF-8 copy is released once widened");
             }
             if (child->type == qmd::ElementType::Superscript) {
                 sups++;
-                check(!child->children.empty() && child->children[0]->text == "2",
+                check(!child->children.empty() && child->children[0]->wtext == L"2",
                       "superscript content preserved");
             }
             if (child->type == qmd::ElementType::Subscript) subs++;
             if (child->type == qmd::ElementType::Strikethrough) {
                 strikes++;
-                check(!child->children.empty() && child->children[0]->text == "gone",
+                check(!child->children.empty() && child->children[0]->wtext == L"gone",
                       "strikethrough content preserved");
             }
             if (child->type == qmd::ElementType::Code) {
                 codeIntact++;
                 check(!child->children.empty() &&
-                      child->children[0]->text == "==not this==",
+                      child->children[0]->wtext == L"==not this==",
                       "code spans are not transformed");
             }
         }
@@ -74,12 +76,117 @@ int main() {
         check(codeIntact == 1, "inline code untouched");
     }
 
+    // Invalid UTF-8 widens to U+FFFD; astral code points to surrogate pairs
+    auto wide = parseDocument(parser, "a\xff b \xf0\x9f\x98\x80\n", "notes.md");
+    check(wide.success && !wide.root->children.empty() &&
+          !wide.root->children[0]->children.empty() &&
+          wide.root->children[0]->children[0]->wtext == L"a\ufffd b \xd83d\xde00",
+          "element text widens invalid bytes and astral code points");
+    check(qmd::narrowText(L"a\u4e2d\xd83d\xde00") == "a\xe4\xb8\xad\xf0\x9f\x98\x80",
+          "widened text narrows back to the same UTF-8");
+
     auto markdown = parseDocument(parser, "# Heading\n", "notes.md");
     check(markdown.success, "Markdown document still parses");
     check(markdown.root && !markdown.root->children.empty() &&
           markdown.root->children[0]->type == qmd::ElementType::Heading,
           ".md content keeps Markdown parsing");
 
+    // The tree owns its text: it outlives the source buffer, and dropping
+    // the last root reference releases the whole arena
+    std::weak_ptr<qmd::Element> weakRoot;
+    {
+        std::string source = "Para with `code` and [a link](https://example.com)\n";
+        auto owned = parseDocument(parser, source, "notes.md");
+        source.assign(source.size(), 'x');
+        weakRoot = owned.root;
+        check(owned.success && owned.root->children.size() == 1,
+              "arena tree has one paragraph");
+        if (owned.success && owned.root->children.size() == 1) {
+            const qmd::Element* para = owned.root->children[0];
+            check(para->parent == owned.root.get(), "parent links point into the arena");
+            bool sawLink = false;
+            for (const qmd::Element* child : para->children) {
+                check(child->parent == para, "child parent link is set");
+                if (child->type == qmd::ElementType::Link) {
+                    sawLink = child->url == "https://example.com" &&
+                              !child->children.empty() &&
+                              child->children[0]->wtext == L"a link";
+                }
+            }
+            check(sawLink, "link url and text survive the source buffer");
+        }
+    }
+    check(weakRoot.expired(), "dropping the root frees the tree");
+
+    // Progressive open: chunks hold whole top-level blocks, parse on their
+    // own with offsets into the whole source, and append to one tree
+    {
+        std::string source =
+            "# One\n\nfirst para\n\n```\ncode\n\nmore\n```\n\n- item\n\n  continued\n\n"
+            "second [link][ref]\n\n[ref]: https://example.com\n";
+        DocumentChunks chunks = splitDocument(source, 0, 0);
+        check(chunks.starts.size() == 5, "every safe blank line starts a chunk");
+        check(chunks.linkDefinitions == "[ref]: https://example.com\n",
+              "link definitions are collected");
+        bool safe = true;
+        for (size_t start : chunks.starts) {
+            std::string_view rest = std::string_view(source).substr(start);
+            safe = safe && rest.rfind("more", 0) != 0 && rest.rfind("  continued", 0) != 0;
+        }
+        check(safe, "no chunk starts inside a fence or a list item");
+        check(splitDocument(source, source.size(), 0).starts.size() == 1,
+              "nothing is cut before firstBytes");
+
+        size_t linkChunk = 3;
+        auto link = parseDocumentChunk(parser, source, chunks, linkChunk);
+        check(link.success && link.root->children.size() == 1, "a chunk parses on its own");
+        if (link.success && link.root->children.size() == 1) {
+            const qmd::Element* para = link.root->children[0];
+            check(para->sourceOffset == source.find("second"),
+                  "chunk offsets are relative to the whole source");
+            bool resolved = false;
+            for (const qmd::Element* child : para->children) {
+                resolved = resolved || (child->type == qmd::ElementType::Link &&
+                                        child->url == "https://example.com");
+            }
+            check(resolved, "a reference defined in a later chunk resolves");
+        }
+
+        // A fence left open at the end keeps the definitions out of its code
+        std::string open = "[ref]: https://example.com\n\ntext\n\n```\ncode\n";
+        DocumentChunks openChunks = splitDocument(open, 0, 0);
+        check(openChunks.unclosedBlockEnd == "```", "the unclosed fence is recorded");
+        auto tail = parseDocumentChunk(parser, open, openChunks, openChunks.starts.size() - 1);
+        auto whole = parser.parse(open);
+        check(tail.success && whole.success, "unclosed fence parses");
+        if (tail.success && whole.success && !tail.root->children.empty()) {
+            auto codeOf = [](const qmd::Element* block) {
+                std::wstring code;
+                for (const qmd::Element* child : block->children) code += child->wtext;
+                return code;
+            };
+            const qmd::Element* code = tail.root->children.back();
+            check(code->type == qmd::ElementType::CodeBlock &&
+                  codeOf(code) == codeOf(whole.root->children.back()),
+                  "an unclosed trailing fence holds the same code as in one pass");
+        }
+
+        auto first = parseDocumentChunk(parser, source, chunks, 0);
+        check(first.success, "first chunk parses");
+        if (first.success && link.success) {
+            const qmd::Element* node = first.root.get();
+            std::weak_ptr<qmd::Element> weakLink = link.root;
+            qmd::appendDocument(first.root, std::move(link.root));
+            check(first.root.get() == node, "appending keeps the root node");
+            check(first.root->children.size() == 2 &&
+                  first.root->children[1]->parent == node,
+                  "appended blocks become children of the root");
+            check(!weakLink.expired(), "the root keeps appended blocks alive");
+            first.root.reset();
+            check(weakLink.expired(), "dropping the root frees appended blocks");
+        }
+    }
+
     if (failures != 0) {
         std::cerr << failures << " test(s) failed\n";
         return 1;
@@ -1,5 +1,7 @@
 #include "mermaid.h"
 
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <iterator>
@@ -209,6 +211,151 @@ A --> D
     }
 }
 
+// Small deterministic LCG so the generated graphs are the same on every run
+struct Lcg {
+    uint32_t state;
+    uint32_t next(uint32_t bound) {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) % bound;
+    }
+};
+
+mermaid::Diagram generatedDiagram(size_t nodeCount) {
+    mermaid::Diagram diagram;
+    diagram.nodes.resize(nodeCount);
+    for (size_t i = 0; i < nodeCount; i++) diagram.nodes[i].id = "N" + std::to_string(i);
+    return diagram;
+}
+
+bool ranksDoNotOverlap(const mermaid::Layout& layout) {
+    for (size_t i = 0; i < layout.nodes.size(); i++) {
+        for (size_t j = i + 1; j < layout.nodes.size(); j++) {
+            if (layout.ranks[i] != layout.ranks[j]) continue;
+            const auto& a = layout.nodes[i];
+            const auto& b = layout.nodes[j];
+            if (a.left < b.right && b.left < a.right) return false;
+        }
+    }
+    return true;
+}
+
+double layoutMilliseconds(const mermaid::Diagram& diagram, mermaid::Layout& layout) {
+    std::vector<mermaid::Size> sizes(diagram.nodes.size(), {100.0f, 40.0f});
+    auto start = std::chrono::steady_clock::now();
+    layout = mermaid::layout(diagram, sizes, 20.0f, 60.0f);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+void testLargeTreeOrdering() {
+    // Every child has one parent, so sorting each rank by its parents'
+    // order removes all crossings however the ids were numbered
+    const size_t nodeCount = 1000;
+    auto diagram = generatedDiagram(nodeCount);
+    Lcg random{7};
+    for (size_t child = 1; child < nodeCount; child++) {
+        mermaid::Edge edge;
+        edge.from = random.next(static_cast<uint32_t>(child));
+        edge.to = child;
+        diagram.edges.push_back(edge);
+    }
+
+    mermaid::Layout layout;
+    double ms = layoutMilliseconds(diagram, layout);
+    std::cout << "layout: 1000-node tree in " << ms << " ms\n";
+    check(layout.nodes.size() == nodeCount, "1k-node tree lays out every node");
+    check(layout.crossings == 0, "1k-node tree is ordered without crossings");
+    check(ranksDoNotOverlap(layout), "1k-node tree ranks do not overlap");
+}
+
+void testLargeDagOrdering() {
+    // Dependency-graph shape: edges mostly span a few ranks and need
+    // virtual nodes, with some back-edges from cycles
+    const size_t nodeCount = 1000;
+    auto diagram = generatedDiagram(nodeCount);
+    Lcg random{42};
+    for (size_t i = 0; i < 2500; i++) {
+        size_t from = random.next(static_cast<uint32_t>(nodeCount - 1));
+        size_t span = 1 + random.next(24);
+        size_t to = std::min(nodeCount - 1, from + span);
+        if (random.next(20) == 0) std::swap(from, to);
+        mermaid::Edge edge;
+        edge.from = from;
+        edge.to = to;
+        diagram.edges.push_back(edge);
+    }
+
+    mermaid::Layout layout;
+    double ms = layoutMilliseconds(diagram, layout);
+    std::cout << "layout: 1000-node, 2500-edge graph in " << ms << " ms, "
+              << layout.crossings << " crossings\n";
+    check(layout.nodes.size() == nodeCount, "1k-node graph lays out every node");
+    check(ranksDoNotOverlap(layout), "1k-node graph ranks do not overlap");
+    check(ms < 10000.0, "1k-node graph lays out in well under ten seconds");
+
+    // The winning variant must not depend on how many threads ran
+    mermaid::Layout again;
+    layoutMilliseconds(diagram, again);
+    check(again.crossings == layout.crossings, "large graph ordering is deterministic");
+}
+
+void testOrderingRemovesSimpleCrossing() {
+    // A->D and B->C drawn in index order cross once; ordering untangles it
+    auto result = mermaid::parse("flowchart TB\nA --> D\nB --> C\nA --> X\nB --> X\n");
+    check(result.success, "crossing fixture parses");
+    if (!result.success) return;
+    std::vector<mermaid::Size> sizes(result.diagram.nodes.size(), {100.0f, 40.0f});
+    auto layout = mermaid::layout(result.diagram, sizes, 20.0f, 60.0f);
+    check(layout.crossings == 0, "median sweeps and transposition remove the crossing");
+}
+
+void testErrorLines() {
+    auto missingClose = mermaid::parse("flowchart TB\nA --> B\nB --> C[unterminated\n");
+    check(!missingClose.success, "unterminated label is rejected");
+    check(missingClose.errorLine == 3, "unterminated label reports its line");
+
+    // Top-level semicolons start a new statement line
+    auto semicolons = mermaid::parse("flowchart LR; A --> B; B --> C; subgraph X\n");
+    check(!semicolons.success, "subgraph statement is rejected");
+    check(semicolons.errorLine == 4, "semicolon statements count as lines");
+}
+
+void testRedefinitionKeepsLastLabel() {
+    auto result = mermaid::parse(
+        "flowchart TB\nA[\"First &amp; one\"] --> B\nA[\"Second &amp; final\"]\nB --> A\n");
+    check(result.success, "redefined node parses");
+    if (!result.success) return;
+    check(result.diagram.nodes.size() == 2, "redefined node is interned once");
+    const auto* a = findNode(result.diagram, "A");
+    const auto* b = findNode(result.diagram, "B");
+    check(a && a->label == "Second & final", "last node definition wins and is decoded");
+    check(b && b->label == "B", "undefined node is labelled with its id");
+    check(a && a->sourceOffset == 13, "node offset points at its first mention");
+}
+
+void testLargeGraphParse() {
+    // Generated dependency graphs reach tens of thousands of edges
+    const size_t nodeCount = 5000;
+    const size_t edgeCount = 40000;
+    std::string source = "flowchart LR\n";
+    Lcg random{3};
+    for (size_t i = 0; i < edgeCount; i++) {
+        size_t from = random.next(static_cast<uint32_t>(nodeCount));
+        size_t to = random.next(static_cast<uint32_t>(nodeCount));
+        source += "mod_" + std::to_string(from) + "[\"module " + std::to_string(from) +
+                  "\"] --> mod_" + std::to_string(to) + "\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = mermaid::parse(source);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "parse: " << edgeCount << "-edge graph in "
+              << std::chrono::duration<double, std::milli>(elapsed).count() << " ms\n";
+    check(result.success, "40k-edge graph parses");
+    check(result.diagram.edges.size() == edgeCount, "40k-edge graph keeps every edge");
+    check(result.diagram.nodes.size() <= nodeCount, "40k-edge graph interns repeated ids");
+}
+
 } // namespace
 
 int main(int argc, char** argv) {
@@ -221,6 +368,12 @@ int main(int argc, char** argv) {
     testBackslashNLineBreak();
     testAttributeSyntaxRejected();
     testLayoutExposesRanks();
+    testOrderingRemovesSimpleCrossing();
+    testLargeTreeOrdering();
+    testLargeDagOrdering();
+    testErrorLines();
+    testRedefinitionKeepsLastLabel();
+    testLargeGraphParse();
     testFiles(argc, argv);
 
     if (failures != 0) {
@@ -0,0 +1,109 @@
+#include "text_buffer.h"
+
+#include <iostream>
+#include <random>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* message) {
+    if (condition) return;
+    std::cerr << "FAIL: " << message << '\n';
+    failures++;
+}
+
+// Compare every query against a plain std::wstring holding the same text
+bool matches(const TextBuffer& buffer, const std::wstring& expected) {
+    if (buffer.size() != expected.size()) return false;
+    if (buffer.str() != expected) return false;
+
+    std::vector<size_t> starts = {0};
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i] == L'\n') starts.push_back(i + 1);
+    }
+    if (buffer.lineCount() != starts.size()) return false;
+    for (size_t line = 0; line < starts.size(); line++) {
+        if (buffer.lineStart(line) != starts[line]) return false;
+    }
+    size_t line = 0;
+    for (size_t pos = 0; pos <= expected.size(); pos++) {
+        while (line + 1 < starts.size() && starts[line + 1] <= pos) line++;
+        if (buffer.lineFromPos(pos) != line) return false;
+        if (pos < expected.size() && buffer[pos] != expected[pos]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main() {
+    TextBuffer buffer;
+    check(buffer.empty() && buffer.lineCount() == 1, "empty buffer has one line");
+    check(buffer.lineStart(0) == 0 && buffer.lineFromPos(0) == 0, "empty buffer line index");
+
+    std::wstring expected = L"# Title\n\nfirst line\nsecond line";
+    buffer.assign(expected);
+    check(matches(buffer, expected), "assign keeps text and line index");
+
+    buffer.insert(8, L"inserted\n");
+    expected.insert(8, L"inserted\n");
+    check(matches(buffer, expected), "insert in the middle of a piece");
+
+    buffer.erase(2, 10);
+    expected.erase(2, 10);
+    check(matches(buffer, expected), "erase across piece boundaries");
+
+    check(buffer.substr(3, 4) == expected.substr(3, 4), "substr spans pieces");
+
+    // Typing at the same spot grows one piece instead of adding one per key
+    buffer.assign(L"ab\ncd");
+    size_t before = buffer.pieceCount();
+    buffer.insert(3, L"x");
+    size_t afterFirst = buffer.pieceCount();
+    size_t caret = 4;
+    for (wchar_t c : std::wstring(L"yz\nw")) {
+        buffer.insert(caret++, std::wstring(1, c));
+    }
+    check(afterFirst == before + 2, "first insert splits the original piece");
+    check(buffer.pieceCount() == afterFirst, "consecutive typing reuses the insert piece");
+    check(matches(buffer, L"ab\nxyz\nwcd"), "grown insert piece keeps the line index");
+
+    // Random edits against the reference
+    std::mt19937 rng(1234);
+    const std::wstring alphabet = L"abc \n\xD55C";
+    buffer.assign(L"line one\nline two\n");
+    expected = L"line one\nline two\n";
+    bool allMatch = true;
+    for (int step = 0; step < 2000 && allMatch; step++) {
+        if (expected.empty() || rng() % 3 != 0) {
+            size_t pos = rng() % (expected.size() + 1);
+            std::wstring text;
+            size_t len = 1 + rng() % 6;
+            for (size_t i = 0; i < len; i++) text += alphabet[rng() % alphabet.size()];
+            buffer.insert(pos, text);
+            expected.insert(pos, text);
+        } else {
+            size_t pos = rng() % expected.size();
+            size_t len = 1 + rng() % 8;
+            buffer.erase(pos, len);
+            expected.erase(pos, len);
+        }
+        if (step % 50 == 0) allMatch = matches(buffer, expected);
+    }
+    check(allMatch && matches(buffer, expected), "random inserts and erases match std::wstring");
+
+    size_t chunkTotal = 0;
+    buffer.forEachChunk(3, 40, [&](const wchar_t*, size_t len) { chunkTotal += len; });
+    check(chunkTotal == std::min<size_t>(40, expected.size() - 3), "chunks cover the requested range");
+
+    buffer.clear();
+    check(buffer.empty() && buffer.lineCount() == 1, "clear empties the buffer");
+
+    if (failures != 0) {
+        std::cerr << failures << " test(s) failed\n";
+        return 1;
+    }
+    std::cout << "All text buffer tests passed\n";
+    return 0;
+}
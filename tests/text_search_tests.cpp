@@ -0,0 +1,151 @@
+#include "text_search.h"
+
+#include <iostream>
+#include <random>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* message) {
+    if (condition) return;
+    std::cerr << "FAIL: " << message << '\n';
+    failures++;
+}
+
+using Matches = std::vector<SearchPattern::Match>;
+
+Matches findAll(const SearchPattern& pattern, const std::wstring& text) {
+    Matches out;
+    pattern.find(text.data(), text.size(), 0, true, out);
+    return out;
+}
+
+Matches regexMatches(const wchar_t* query, const std::wstring& text, bool wholeWord = false) {
+    SearchPattern pattern;
+    if (!pattern.compile(query, true, wholeWord)) return {};
+    return findAll(pattern, text);
+}
+
+bool same(const Matches& a, const Matches& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].start != b[i].start || a[i].length != b[i].length) return false;
+    }
+    return true;
+}
+
+// Non-overlapping occurrences, left to right, as the literal search bar
+// has always reported them
+Matches literalReference(const std::wstring& text, const std::wstring& query, bool wholeWord) {
+    Matches out;
+    size_t pos = 0;
+    while ((pos = text.find(query, pos)) != std::wstring::npos) {
+        bool before = pos > 0 && isSearchWordChar(text[pos - 1]);
+        size_t end = pos + query.size();
+        bool after = end < text.size() && isSearchWordChar(text[end]);
+        if (wholeWord && (before || after)) {
+            pos++;
+            continue;
+        }
+        out.push_back({pos, query.size()});
+        pos = end;
+    }
+    return out;
+}
+
+// Feed the text in pieces the way layout appends docText and resume where
+// each call asks to
+Matches streamed(const SearchPattern& pattern, const std::wstring& text, std::mt19937& rng) {
+    Matches out;
+    size_t available = 0;
+    size_t resume = 0;
+    while (available < text.size()) {
+        available = std::min(text.size(), available + 1 + rng() % 7);
+        bool final = available == text.size();
+        resume = pattern.find(text.data(), available, resume, final, out);
+    }
+    return out;
+}
+
+} // namespace
+
+int main() {
+    const std::wstring text = L"foo bar foobar\nbar_foo foo2 (foo)\nfood";
+
+    check(same(regexMatches(L"foo", text), literalReference(text, L"foo", false)),
+          "regex literal matches every occurrence");
+    check(same(regexMatches(L"\\bfoo\\b", text), Matches{{0, 3}, {29, 3}}),
+          "\\b excludes foobar, bar_foo, foo2 and food");
+    check(same(regexMatches(L"foo", text, true), Matches{{0, 3}, {29, 3}}),
+          "whole-word mode matches \\bfoo\\b");
+    check(regexMatches(L"foo\\d", text).size() == 1, "\\d matches the digit");
+    check(same(regexMatches(L"^bar", text), Matches{{15, 3}}), "^ anchors at line starts");
+    check(same(regexMatches(L"\\)$", text), Matches{{32, 1}}), "$ anchors at line ends");
+    check(same(regexMatches(L"ba[rz]|fo{2}d", text),
+               Matches{{4, 3}, {11, 3}, {15, 3}, {34, 4}}),
+          "alternation, classes and counted repeats");
+    check(same(regexMatches(L"b.*r", L"bar bar\nbar"), Matches{{0, 7}, {8, 3}}),
+          "leftmost-longest and '.' stops at newlines");
+    check(same(regexMatches(L"a|ab", L"abab"), Matches{{0, 2}, {2, 2}}),
+          "alternatives prefer the longer match");
+    check(same(regexMatches(L"[A-Z]+", L"abc 12"), Matches{{0, 3}}),
+          "classes accept the uppercase form of folded text");
+    check(same(regexMatches(L"[^A-Z ]+", L"abc 12"), Matches{{4, 2}}),
+          "negated classes reject every case");
+    check(regexMatches(L"x*", L"abc").empty(), "empty matches are not reported");
+    check(same(regexMatches(L"(?:ab){2,3}", L"abababababab"), Matches{{0, 6}, {6, 6}}),
+          "bounded repeats of groups");
+    check(same(regexMatches(L"\\s\\w+\\.", L"see x.y and end."), Matches{{3, 3}, {11, 5}}),
+          "shorthand classes and escaped dots");
+
+    SearchPattern pattern;
+    check(!pattern.compile(L"(foo", true, false) && !pattern.error().empty(), "missing ) fails");
+    check(!pattern.compile(L"foo)", true, false), "unmatched ) fails");
+    check(!pattern.compile(L"[abc", true, false), "missing ] fails");
+    check(!pattern.compile(L"*a", true, false), "nothing to repeat fails");
+    check(!pattern.compile(L"a{5,2}", true, false), "inverted range fails");
+    check(!pattern.compile(L"a\\", true, false), "trailing backslash fails");
+    check(pattern.compile(L"(a+)+$", true, false), "nested repeats compile");
+    // Exponential for a backtracking matcher, linear here
+    std::wstring many(20000, L'a');
+    many += L'b';
+    check(findAll(pattern, many).empty(), "pathological pattern finishes without a match");
+    check(pattern.compile(L"a{2}{", true, false) &&
+          same(findAll(pattern, L"aa{"), Matches{{0, 3}}), "a brace that is no repeat is literal");
+
+    // Literal and whole-word queries against a reference, whole and streamed
+    std::mt19937 rng(99);
+    const std::wstring alphabet = L"ab _\n.";
+    bool literalOk = true;
+    bool streamOk = true;
+    for (int round = 0; round < 300 && literalOk && streamOk; round++) {
+        std::wstring sample;
+        size_t length = 20 + rng() % 200;
+        for (size_t i = 0; i < length; i++) sample += alphabet[rng() % alphabet.size()];
+        std::wstring query;
+        size_t queryLength = 1 + rng() % 3;
+        for (size_t i = 0; i < queryLength; i++) query += alphabet[rng() % 3];
+        bool wholeWord = rng() % 2 == 0;
+
+        SearchPattern literal;
+        literal.compile(query, false, wholeWord);
+        Matches expected = literalReference(sample, query, wholeWord);
+        literalOk = same(findAll(literal, sample), expected);
+        streamOk = same(streamed(literal, sample, rng), expected);
+
+        const wchar_t* regexes[] = {L"a+b", L"\\bab*\\b", L"(a|b)+$", L"^b.a?", L"[ ._]+"};
+        SearchPattern regex;
+        regex.compile(regexes[round % 5], true, false);
+        streamOk = streamOk && same(streamed(regex, sample, rng), findAll(regex, sample));
+    }
+    check(literalOk, "literal and whole-word matches agree with the reference");
+    check(streamOk, "streamed scans report the same matches as one pass");
+
+    if (failures != 0) {
+        std::cerr << failures << " test(s) failed\n";
+        return 1;
+    }
+    std::cout << "All text search tests passed\n";
+    return 0;
+}
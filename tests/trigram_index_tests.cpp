@@ -0,0 +1,135 @@
+#include "trigram_index.h"
+
+#include <iostream>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* message) {
+    if (condition) return;
+    std::cerr << "FAIL: " << message << '\n';
+    failures++;
+}
+
+using Kind = TrigramIndex::HitKind;
+
+bool has(const std::vector<TrigramIndex::Hit>& hits, Kind kind, const wchar_t* path,
+         const wchar_t* heading = L"") {
+    for (const auto& hit : hits) {
+        if (hit.kind == kind && hit.path == path && hit.heading == heading) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main() {
+    // Headings: ATX with closing #s, setext, inline markup, fenced code
+    auto headings = TrigramIndex::scanHeadings(
+        L"# Getting **Started** #\n"
+        L"text\n\n"
+        L"Install Guide\n"
+        L"=============\n\n"
+        L"```\n# not a heading\n```\n"
+        L"- item\n---\n"
+        L"### See [the docs](https://example.com)\n"
+        L"#hashtag\n");
+    check(headings.size() == 3, "three headings outside code, lists and hashtags");
+    if (headings.size() == 3) {
+        check(headings[0].text == L"Getting Started" && headings[0].level == 1,
+              "ATX heading loses markup and the closing sequence");
+        check(headings[1].text == L"Install Guide" && headings[1].level == 1,
+              "setext heading takes the line above the rule");
+        check(headings[2].text == L"See the docs" && headings[2].level == 3,
+              "link text stays, its target goes");
+    }
+
+    TrigramIndex index;
+    index.add(TrigramIndex::prepare(L"readme.md", L"# Overview\nWelcome to Tinta.\n"));
+    index.add(TrigramIndex::prepare(L"guides\\install.md",
+        L"# Installation\n## Windows Setup\nRun the installer.\n"));
+    index.add(TrigramIndex::prepare(L"guides\\usage.md",
+        L"# Usage\nOpen a folder and press B to browse.\n"));
+    index.add(TrigramIndex::prepare(L"notes\\\x4e2d\x6587.md", L"# \x6807\x9898\n\x5185\x5bb9\n"));
+    check(index.size() == 4, "four documents indexed");
+
+    auto install = index.search(L"INSTALL", L"", 10);
+    check(has(install, Kind::Name, L"guides\\install.md"), "name match is case-insensitive");
+    check(has(install, Kind::Heading, L"guides\\install.md", L"Installation"),
+          "heading match names the heading");
+    check(!install.empty() && install[0].kind == Kind::Name, "name matches come first");
+
+    auto body = index.search(L"browse", L"", 10);
+    check(body.size() == 1 && has(body, Kind::Body, L"guides\\usage.md"),
+          "body-only match is reported once per file");
+
+    check(index.search(L"welcome to tinta!", L"", 10).empty(),
+          "every trigram present is not enough: the text is verified");
+    check(index.search(L"zzz", L"", 10).empty(), "an unknown trigram matches nothing");
+
+    auto scoped = index.search(L"us", L"guides", 10);
+    check(scoped.size() == 2 && has(scoped, Kind::Name, L"usage.md") &&
+          has(scoped, Kind::Heading, L"usage.md", L"Usage"),
+          "short queries match names and headings within the scope, relative to it");
+    check(index.search(L"guides", L"guides", 10).empty(),
+          "the scope itself is not part of the matched name");
+
+    auto cjk = index.search(L"\x6807\x9898", L"", 10);
+    check(has(cjk, Kind::Heading, L"notes\\\x4e2d\x6587.md", L"\x6807\x9898"),
+          "CJK headings match");
+
+    check(index.search(L"e", L"", 2).size() == 2, "the limit caps hits");
+
+    // A document kept without its body is found by name and headings only
+    index.add(TrigramIndex::prepare(L"big.md", L"# Huge Heading\nunindexed body\n", false));
+    check(has(index.search(L"huge", L"", 10), Kind::Heading, L"big.md", L"Huge Heading"),
+          "headings of a document without its body are found");
+    check(index.search(L"unindexed", L"", 10).empty(), "its body is not");
+    index.remove(L"big.md");
+
+    // Re-adding a path replaces it; removing a directory drops its files
+    index.add(TrigramIndex::prepare(L"README.md", L"# Overview\nReplaced.\n"));
+    check(index.size() == 4, "same path in another case replaces the document");
+    check(index.search(L"welcome", L"", 10).empty(), "replaced text is gone");
+    check(!index.search(L"replaced", L"", 10).empty(), "new text is found");
+    index.removeUnder(L"guides");
+    check(index.size() == 2, "removing a directory drops the files below it");
+    check(index.search(L"install", L"", 10).empty(), "removed files are not found");
+
+    // Many removals compact the posting lists without losing live documents
+    for (int i = 0; i < 3000; i++) {
+        index.add(TrigramIndex::prepare(L"bulk\\" + std::to_wstring(i) + L".md", L"bulk text"));
+    }
+    index.removeUnder(L"bulk");
+    check(index.size() == 2, "bulk files removed");
+    check(!index.search(L"replaced", L"", 10).empty(), "live documents survive compaction");
+    check(index.search(L"bulk", L"", 10).empty(), "compacted documents stay removed");
+
+    // The folded text stays within its budget; the oldest bodies go first
+    {
+        std::wstring body(1000, L'x');
+        TrigramIndex small(10 * body.size() * sizeof(wchar_t));
+        for (int i = 0; i < 30; i++) {
+            std::wstring text = L"# Title " + std::to_wstring(i) + L"\nword" +
+                                std::to_wstring(i) + L"z " + body;
+            small.add(TrigramIndex::prepare(L"doc" + std::to_wstring(i) + L".md", text));
+            check(small.bodyBytes() <= 10 * body.size() * sizeof(wchar_t),
+                  "bodies stay within the budget");
+        }
+        check(small.size() == 30, "evicting a body keeps the document");
+        check(!small.search(L"word29z", L"", 10).empty(), "the newest body is searchable");
+        check(small.search(L"word0z", L"", 10).empty(), "the oldest body was dropped");
+        check(has(small.search(L"title 0", L"", 10), Kind::Heading, L"doc0.md", L"Title 0"),
+              "a document without its body is still found by heading");
+        small.add(TrigramIndex::prepare(L"doc0.md", L"word0z"));
+        check(!small.search(L"word0z", L"", 10).empty(), "reading a document again restores it");
+    }
+
+    if (failures != 0) {
+        std::cerr << failures << " test(s) failed\n";
+        return 1;
+    }
+    std::cout << "All trigram index tests passed\n";
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include "undo_log.h"
+
+#include <iostream>
+#include <random>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* message) {
+    if (condition) return;
+    std::cerr << "FAIL: " << message << '\n';
+    failures++;
+}
+
+using Kind = UndoLog::Kind;
+
+// A buffer and its history, edited the way the editor does
+struct Doc {
+    TextBuffer text;
+    UndoLog log;
+    uint64_t now = 0;
+
+    explicit Doc(size_t maxBytes = 8u << 20) : log(maxBytes) {}
+
+    void type(size_t pos, const std::wstring& s, bool burst = true) {
+        TextBuffer::Span span = text.insert(pos, s);
+        log.record(Kind::Insert, pos, &span, 1, pos, pos + s.size(), now, burst);
+        log.releaseText(text);
+    }
+
+    void erase(size_t pos, size_t len, bool burst = true) {
+        std::vector<TextBuffer::Span> spans;
+        text.spans(pos, len, spans);
+        log.record(Kind::Delete, pos, spans.data(), spans.size(), pos + len, pos, now, burst);
+        text.erase(pos, len);
+    }
+
+    bool undo() {
+        return log.undo([&](const UndoLog::Edit& e, const TextBuffer::Span* spans) {
+            if (e.kind == Kind::Insert) text.erase(e.position, e.length);
+            else text.insertSpans(e.position, spans, e.spanCount);
+        });
+    }
+
+    bool redo() {
+        return log.redo([&](const UndoLog::Edit& e, const TextBuffer::Span* spans) {
+            if (e.kind == Kind::Insert) text.insertSpans(e.position, spans, e.spanCount);
+            else text.erase(e.position, e.length);
+        });
+    }
+};
+
+} // namespace
+
+int main() {
+    // Spans name the text without copying it and splice it back in
+    {
+        TextBuffer buffer;
+        buffer.assign(L"hello world");
+        buffer.insert(5, L",");
+        std::vector<TextBuffer::Span> spans;
+        buffer.spans(3, 6, spans);
+        check(spans.size() == 3, "a range across three pieces has three spans");
+        buffer.erase(3, 6);
+        check(buffer.str() == L"helrld", "erased");
+        buffer.insertSpans(3, spans.data(), spans.size());
+        check(buffer.str() == L"hello, world", "spans restore the erased text");
+        check(buffer.lineCount() == 1, "line index follows");
+    }
+
+    // A typing burst merges into one edit over one span
+    {
+        Doc doc;
+        doc.text.assign(L"ab");
+        for (wchar_t c : std::wstring(L"xyz")) {
+            doc.type(1 + doc.text.size() - 2, std::wstring(1, c));
+            doc.now += 100;
+        }
+        check(doc.text.str() == L"axyzb", "typed");
+        check(doc.log.editCount() == 1 && doc.log.spanCount() == 1,
+              "consecutive keystrokes extend one span");
+        check(doc.undo() && doc.text.str() == L"ab", "one undo removes the burst");
+        check(!doc.undo(), "nothing left to undo");
+        check(doc.redo() && doc.text.str() == L"axyzb", "redo puts the burst back");
+    }
+
+    // A pause, a non-keystroke edit or a jump starts a new group
+    {
+        Doc doc;
+        doc.type(0, L"a");
+        doc.now += 2000;
+        doc.type(1, L"b");
+        doc.type(2, L"pasted", false);
+        doc.type(0, L"c");
+        check(doc.text.str() == L"cabpasted", "typed");
+        check(doc.undo() && doc.text.str() == L"abpasted", "jump undone alone");
+        check(doc.undo() && doc.text.str() == L"ab", "paste undone alone");
+        check(doc.undo() && doc.text.str() == L"a", "keystroke after the pause undone alone");
+        check(doc.undo() && doc.text.str().empty(), "first keystroke undone");
+    }
+
+    // Backspace runs group as separate edits; forward deletes merge spans
+    {
+        Doc doc;
+        doc.text.assign(L"0123456789");
+        doc.erase(7, 1);
+        doc.erase(6, 1);
+        doc.erase(5, 1);
+        check(doc.text.str() == L"0123489", "backspaced");
+        check(doc.log.editCount() == 3, "backspaces are one edit each");
+        doc.now += 2000;
+        doc.erase(1, 1);
+        doc.erase(1, 1);
+        check(doc.text.str() == L"03489", "deleted forward");
+        check(doc.log.editCount() == 4 && doc.log.spanCount() == 4,
+              "forward deletes of adjacent original text share a span");
+        check(doc.undo() && doc.text.str() == L"0123489", "forward deletes undone together");
+        check(doc.undo() && doc.text.str() == L"0123456789", "backspace run undone together");
+        check(doc.redo() && doc.text.str() == L"0123489", "backspace run redone");
+    }
+
+    // A new edit after undo drops the redo history
+    {
+        Doc doc;
+        doc.type(0, L"one", false);
+        doc.type(3, L"two", false);
+        doc.undo();
+        doc.type(3, L"three", false);
+        check(doc.log.editCount() == 2 && !doc.log.canRedo(), "redo history truncated");
+        check(doc.text.str() == L"onethree", "new edit applied");
+    }
+
+    // The byte cap drops the oldest groups and keeps the newest
+    {
+        size_t cap = 100 * (sizeof(UndoLog::Edit) + sizeof(TextBuffer::Span));
+        Doc doc(cap);
+        for (int i = 0; i < 1000; i++) doc.type(doc.text.size(), L"x", false);
+        check(doc.log.bytes() <= cap, "history stays under the cap");
+        check(doc.log.editCount() >= 50, "at most a quarter of the cap is freed at once");
+        size_t undone = 0;
+        while (doc.undo()) undone++;
+        check(undone == doc.log.editCount(), "every kept group undoes");
+        check(doc.text.size() == 1000 - undone, "the oldest edits are no longer undoable");
+
+        Doc pasted(64 * 1024);
+        for (int i = 0; i < 10; i++) pasted.type(pasted.text.size(), std::wstring(4096, L'x'), false);
+        check(pasted.log.bytes() <= 64 * 1024 && pasted.log.editCount() < 10,
+              "the text of pastes counts against the cap");
+    }
+
+    // Large text counts against the cap, and pastes that were undone and
+    // replaced are released from the add buffer
+    {
+        Doc doc(16u << 20);
+        doc.text.assign(L"0123456789");
+        doc.type(2, L"xy", false);
+        doc.erase(5, 2);
+        std::wstring edited = doc.text.str();
+        size_t pasteChars = UndoLog::kMinReleaseChars;
+        for (int i = 0; i < 12; i++) {
+            doc.type(4, std::wstring(pasteChars, (wchar_t)(L'a' + i)), false);
+            check(doc.log.bytes() <= (16u << 20), "pasted text counts against the cap");
+            check(doc.undo() && doc.text.str() == edited, "paste undone");
+        }
+        check(doc.text.addedSize() <= 5 * pasteChars, "undone pastes do not pile up");
+        check(doc.redo() && doc.text.size() == edited.size() + pasteChars &&
+              doc.text[4] == L'l' && doc.text[4 + pasteChars - 1] == L'l',
+              "the last paste redoes from the compacted buffer");
+        check(doc.undo() && doc.text.str() == edited, "and undoes again");
+        while (doc.undo()) {}
+        check(doc.text.str() == L"0123456789", "older edits survive compaction");
+    }
+
+    // Random edits, then undone and redone all the way
+    {
+        std::mt19937 rng(7);
+        Doc doc;
+        doc.text.assign(L"The quick brown fox\njumps over\nthe lazy dog\n");
+        std::wstring original = doc.text.str();
+        for (int i = 0; i < 400; i++) {
+            doc.now += rng() % 3 == 0 ? 1500 : 50;
+            size_t size = doc.text.size();
+            if (size > 0 && rng() % 2) {
+                size_t pos = rng() % size;
+                doc.erase(pos, 1 + rng() % std::min<size_t>(size - pos, 8), rng() % 2);
+            } else {
+                std::wstring s(1 + rng() % 4, (wchar_t)(L'a' + rng() % 26));
+                if (rng() % 5 == 0) s += L'\n';
+                doc.type(size == 0 ? 0 : rng() % (size + 1), s, rng() % 2);
+            }
+        }
+        std::wstring final = doc.text.str();
+        while (doc.undo()) {}
+        check(doc.text.str() == original, "undoing everything restores the original");
+        while (doc.redo()) {}
+        check(doc.text.str() == final, "redoing everything restores the final text");
+    }
+
+    if (failures != 0) {
+        std::cerr << failures << " test(s) failed\n";
+        return 1;
+    }
+    std::cout << "All undo log tests passed\n";
+    return 0;
+}